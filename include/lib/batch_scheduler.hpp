@@ -0,0 +1,55 @@
+#ifndef BATCH_SCHEDULER_HPP
+#define BATCH_SCHEDULER_HPP
+
+#include "lib/burn_station.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Runs a manifest of burn jobs in one process (MI --batch). Jobs are planned
+// up front, started longest first to keep the makespan short, kept to one at
+// a time per device, and capped per USB root hub so sticks sharing a hub do
+// not slow each other down.
+namespace BatchScheduler {
+
+    // Where a device's writes compete for bandwidth: a USB root hub, the
+    // filesystem holding an image, or the device alone
+    struct Link {
+        std::string key;            // "usb2", "fs:2049", "/dev/nvme0n1"
+        double bandwidthMBps;       // Usable bandwidth of the shared link, 0 if unshared
+    };
+
+    Link linkOf(const std::string& device);
+
+    struct Job {
+        size_t index;                               // Position in the manifest
+        BurnStation::JobSpec spec;
+        std::string deviceKey;
+        Link link;
+        double deviceMBps;
+        double estimatedSeconds;
+        uint64_t bytesWritten;                      // Of the planned strategy
+        std::string strategy;
+        std::shared_ptr<BurnStation::Source> source;
+    };
+
+    // TOML ([[job]] tables, top-level keys are defaults for every job) or
+    // JSON ({"defaults": {...}, "jobs": [...]} or a bare array), chosen by
+    // extension; keys: iso, device, persistence, fs, table, fast, size
+    std::vector<BurnStation::JobSpec> readManifest(const std::string& path);
+
+    // Analyzes each distinct ISO once and estimates every job
+    std::vector<Job> plan(const std::vector<BurnStation::JobSpec>& specs,
+                          BurnStation::SourceTable& sources);
+
+    // Jobs one link may run at once
+    unsigned linkCapacity(const Link& link, double deviceMBps);
+
+    void printPlan(const std::vector<Job>& jobs);
+
+    // Runs every job; true when all of them succeeded
+    bool run(std::vector<Job>& jobs);
+}
+
+#endif // BATCH_SCHEDULER_HPP
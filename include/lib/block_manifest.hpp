@@ -0,0 +1,64 @@
+#ifndef BLOCK_MANIFEST_HPP
+#define BLOCK_MANIFEST_HPP
+
+#include "utils/sha256.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace BlockManifest {
+
+    // Leaves cover 1 MiB of device data each
+    const uint32_t CHUNK_SIZE = 1024 * 1024;
+
+    // Last MiB of the device stays clear for the backup GPT
+    const uint64_t TAIL_RESERVE = 1024 * 1024;
+
+    const int MAX_EXTENTS = 16;
+
+    struct Extent {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    #pragma pack(push, 1)
+    struct ManifestHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkSize;
+        uint64_t deviceSize;
+        uint64_t treeOffset;
+        uint64_t nodeCount;
+        uint32_t leafCount;
+        uint32_t extentCount;
+        Extent extents[MAX_EXTENTS];
+        uint8_t rootHash[32];
+        uint64_t createdAt;
+        uint8_t headerHash[32];
+    };
+    #pragma pack(pop)
+
+    struct VerifyReport {
+        bool manifestFound;
+        bool intact;
+        uint64_t bytesChecked;
+        std::vector<Extent> corrupted;
+    };
+
+    std::vector<Hash::Digest> hashExtents(int fd, const std::vector<Extent>& extents,
+                                          uint32_t chunkSize, const std::string& label);
+    std::vector<Hash::Digest> buildTree(const std::vector<Hash::Digest>& leaves);
+
+    std::vector<Extent> coveredExtents(const std::string& device, bool rawImage,
+                                       uint64_t isoSize);
+    // expected: optional per-chunk digests of the source (from the ISO index)
+    // that the written blocks are checked against while sealing
+    bool sealDevice(const std::string& device, const std::vector<Extent>& extents,
+                    const std::vector<Hash::Digest>& expected = {});
+    VerifyReport verifyDevice(const std::string& device);
+    // Clears the manifest header, for contents changed after sealing that
+    // cannot be sealed again; true when there was one
+    bool dropManifest(const std::string& device);
+}
+
+#endif // BLOCK_MANIFEST_HPP
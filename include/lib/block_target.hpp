@@ -0,0 +1,68 @@
+#ifndef BLOCK_TARGET_HPP
+#define BLOCK_TARGET_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "lib/write_plan.hpp"
+
+// Output targets are either block devices or plain image files. Image files
+// have no partition nodes, so partitions are addressed by byte offset.
+namespace BlockTarget {
+    
+    struct Partition {
+        int number;             // 1-based MBR slot
+        uint8_t type;
+        bool bootable;
+        uint64_t offset;
+        uint64_t length;
+    };
+    
+    bool isImageFile(const std::string& path);
+    
+    // Creates (or resizes) a sparse image file; no blocks are allocated
+    bool createImage(const std::string& path, uint64_t size);
+    
+    // Accepts a byte count with an optional K/M/G/T suffix (powers of 1024);
+    // returns 0 on malformed input
+    uint64_t parseSize(const std::string& text);
+    
+    uint64_t querySize(int fd);
+    uint64_t querySize(const std::string& path);
+    
+    // Data extents of the first size bytes of fd (SEEK_DATA/SEEK_HOLE);
+    // everything else is a hole. Without hole support the whole range is
+    // reported as data.
+    std::vector<Pipeline::Extent> mapData(int fd, uint64_t size);
+    
+    // True when the range of an image file is one hole and so reads as
+    // zeros already; always false for block devices
+    bool isHole(int fd, uint64_t offset, uint64_t length);
+    
+    // Zeros a range: holes are punched in image files, block devices use
+    // BLKZEROOUT; both fall back to writing zeros
+    void zeroRange(int fd, const std::string& path, uint64_t offset, uint64_t length);
+    
+    // Same without the fallback: false when zeroing would mean writing the
+    // zeros from here. keepAllocated zeroes file blocks in place rather than
+    // punching them out, for files whose space was reserved up front.
+    bool tryZeroRange(int fd, uint64_t offset, uint64_t length, bool keepAllocated = false);
+    
+    // Shares the source blocks with the target (FICLONERANGE) instead of
+    // copying them. Only works between files on one reflink-capable
+    // filesystem (btrfs, XFS) with block-aligned offsets; false otherwise.
+    bool cloneRange(int inputFd, uint64_t inputOffset, int outputFd, uint64_t outputOffset,
+                    uint64_t length);
+    
+    // Reflinks what it can, then uses copy_file_range, falling back to a
+    // read/write loop when the kernel or filesystem cannot do either.
+    // Returns how many bytes were reflinked.
+    uint64_t copyRange(int inputFd, uint64_t inputOffset, int outputFd, uint64_t outputOffset,
+                       uint64_t length);
+    
+    // Primary MBR partitions, read from the target itself
+    std::vector<Partition> readPartitions(const std::string& path);
+    bool findPartition(const std::string& path, int number, Partition& partition);
+}
+
+#endif // BLOCK_TARGET_HPP
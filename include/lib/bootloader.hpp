@@ -5,6 +5,10 @@
 #include <vector>
 #include <cstdint>
 
+namespace BootStructures {
+    class PartitionTable;
+}
+
 namespace Bootloader {
     
     enum class BootType {
@@ -17,14 +21,17 @@ namespace Bootloader {
     class BootloaderInstaller {
     private:
         std::string device;
-        std::string mountPoint;
         BootType bootType;
+        bool writeMBR;
         
     public:
-        BootloaderInstaller(const std::string& dev, BootType type = BootType::AUTO);
-        ~BootloaderInstaller();
+        // With mbr = false the boot code is left to a partition table commit
+        // that already staged it (see stageBootCode)
+        BootloaderInstaller(const std::string& dev, BootType type = BootType::AUTO, 
+                            bool mbr = true);
         
         bool detectBootType(const std::string& isoPath);
+        BootType getBootType() const { return bootType; }
         bool installSyslinux();
         bool installGrub();
         bool copyBootFiles(const std::string& isoPath);
@@ -34,10 +41,20 @@ namespace Bootloader {
     private:
         bool installMBR();
         bool writeSyslinuxMBR();
-        std::vector<uint8_t> getSyslinuxMBRCode();
+        bool writeConfig(const std::string& path, const std::string& contents);
+        
+    public:
+        static std::vector<uint8_t> getSyslinuxMBRCode();
     };
     
-    bool installBootloader(const std::string& device, const std::string& isoPath);
+    // Stages the MBR boot code the ISO needs into a pending partition table,
+    // so it reaches the disk with the partition entries in one commit
+    bool stageBootCode(BootStructures::PartitionTable& table, const std::string& isoPath);
+    
+    // Configuration files go through the FAT writer on partition 1; nothing
+    // is mounted. A partition 1 that is not FAT32 is skipped.
+    bool installBootloader(const std::string& device, const std::string& isoPath, 
+                           bool writeMBR = true);
 }
 
 #endif // BOOTLOADER_HPP
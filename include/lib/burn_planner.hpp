@@ -0,0 +1,63 @@
+#ifndef BURN_PLANNER_HPP
+#define BURN_PLANNER_HPP
+
+#include "lib/iso_analyzer.hpp"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Picks the burn strategy by estimated wall time instead of by structure
+// flags alone: every strategy that yields a bootable result is costed from
+// the ISO's composition and the target's throughput, and the cheapest wins.
+namespace BurnPlanner {
+
+    // What the ISO is made of, from the sidecar index or the directory tree
+    struct Composition {
+        uint64_t isoBytes;
+        uint64_t fileBytes;
+        uint64_t fileCount;
+        uint64_t directoryCount;
+        uint64_t smallFiles;        // Below 64 KiB
+        uint64_t largestFile;
+        uint64_t zeroBytes;         // Known zero ranges of the image
+        bool zeroKnown;             // From the index or the file's holes
+    };
+
+    struct DeviceProfile {
+        std::string kind;           // "image file", "USB flash", ...
+        double sequentialMBps;      // Large writes
+        double smallWriteIOPS;      // 4 KiB writes scattered over the device
+        bool imageFile;             // Zeros become holes, no partition nodes to wait for
+    };
+
+    struct Estimate {
+        ISOAnalyzer::BurnStrategy strategy;
+        bool valid;
+        std::string reason;         // Why it is not valid
+        uint64_t bytesWritten;
+        uint64_t smallWrites;
+        double seconds;
+    };
+
+    struct Plan {
+        ISOAnalyzer::BurnStrategy strategy;
+        Composition composition;
+        DeviceProfile device;
+        std::vector<Estimate> estimates;    // One per strategy
+    };
+
+    Composition analyzeComposition(const std::string& isoPath);
+
+    // From sysfs for block devices; MYISO_DEVICE_PROFILE="<MB/s>:<IOPS>"
+    // overrides it with measured figures
+    DeviceProfile profileDevice(const std::string& device);
+
+    Plan plan(const ISOAnalyzer::ISOStructure& structure, const Composition& composition,
+              const DeviceProfile& device, bool persistence);
+    Plan plan(const std::string& isoPath, const std::string& device,
+              const ISOAnalyzer::ISOStructure& structure, bool persistence);
+
+    std::string strategyName(ISOAnalyzer::BurnStrategy strategy);
+}
+
+#endif // BURN_PLANNER_HPP
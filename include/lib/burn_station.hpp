@@ -0,0 +1,144 @@
+#ifndef BURN_STATION_HPP
+#define BURN_STATION_HPP
+
+#include "lib/iso_analyzer.hpp"
+#include "lib/burn_planner.hpp"
+#include "lib/mbr_gpt.hpp"
+#include "lib/source_stager.hpp"
+#include "utils/mpmc_queue.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+// Long-running burn service (MI --daemon). Jobs arrive as text commands on a
+// Unix socket, go through a lock-free queue to a pool of workers, and run one
+// at a time per device; every client gets JSON-line events back.
+//
+// Protocol, one command per line (quote paths with spaces):
+//   burn <iso> <device> [-p <MB>] [-f <fs>] [-t mbr|gpt] [-m] [--size <size>]
+//   status                 one "job" event per known job, a "cache" event
+//                          with the source cache's hit counts, then "end"
+//   watch [<job>]          stream events of one job, or of all jobs
+//   shutdown               finish running jobs, cancel queued ones, exit
+namespace BurnStation {
+
+    const std::string DEFAULT_SOCKET = "/run/myiso.sock";
+
+    struct JobSpec {
+        std::string isoPath;
+        std::string device;
+        size_t persistenceSizeMB = 0;
+        std::string persistenceFS = "ext4";
+        BootStructures::TableType tableType = BootStructures::TableType::MBR;
+        bool fastMode = false;
+        uint64_t imageSize = 0;         // --size: create or resize an image target
+    };
+
+    // Parses the arguments of a "burn" command (or a CLI-style job line);
+    // false with a reason on bad input
+    bool parseJob(const std::vector<std::string>& args, JobSpec& spec, std::string& error);
+
+    // Splits a command line on blanks; double quotes group, backslash escapes
+    std::vector<std::string> tokenize(const std::string& line);
+
+    // Analysis shared by every job burning the same ISO (path, size and
+    // mtime); the open descriptor keeps the ISO's pages cached between jobs
+    struct Source {
+        std::string isoPath;            // For a URL, its staged copy
+        SourceStager::Handle staged;    // Set for URLs only
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        int fd = -1;
+        ISOAnalyzer::ISOStructure structure;
+        BurnPlanner::Composition composition;
+        std::mutex mutex;
+        bool analyzed = false;
+
+        ~Source();
+    };
+
+    class SourceTable {
+    private:
+        std::mutex mutex;
+        std::map<std::string, std::shared_ptr<Source>> sources;
+
+    public:
+        // Analyzes the ISO on first use; later callers wait for that and
+        // share the result
+        std::shared_ptr<Source> acquire(const std::string& isoPath);
+    };
+
+    // Runs one job to completion on the calling thread; observer gets the
+    // pipeline's progress.
+    bool runJob(const JobSpec& spec, Source& source,
+                const std::function<void(const std::string&, size_t, size_t)>& observer);
+
+    enum class JobState {
+        QUEUED,
+        RUNNING,
+        DONE,
+        FAILED,
+        CANCELLED
+    };
+
+    std::string stateName(JobState state);
+
+    class Station {
+    private:
+        struct Client;
+        struct Job;
+
+        std::string socketPath;
+        unsigned workerCount;
+        int listenFd;
+        int stopPipe[2];
+
+        MPMCQueue<std::shared_ptr<Job>> queue;
+        std::mutex wakeMutex;
+        std::condition_variable wake;
+        std::atomic<bool> stopping;
+
+        // Jobs waiting for a device another worker is burning
+        std::mutex laneMutex;
+        std::set<std::string> busyDevices;
+        std::map<std::string, std::deque<std::shared_ptr<Job>>> lanes;
+
+        std::mutex jobMutex;
+        std::map<uint64_t, std::shared_ptr<Job>> jobs;
+        uint64_t nextJob;
+
+        std::mutex clientMutex;
+        std::vector<std::shared_ptr<Client>> clients;
+        std::vector<std::thread> clientThreads;         // Parallel to clients
+
+        SourceTable sources;
+
+        void workerLoop();
+        void execute(std::shared_ptr<Job> job);
+        void finish(Job& job, JobState state, const std::string& error = "");
+        void publish(const Job& job, const std::string& line);
+        void serve(std::shared_ptr<Client> client);
+        void command(Client& client, const std::vector<std::string>& args);
+        void reapClients();
+
+    public:
+        explicit Station(const std::string& socket = DEFAULT_SOCKET, unsigned workers = 0);
+        ~Station();
+        Station(const Station&) = delete;
+        Station& operator=(const Station&) = delete;
+
+        // Binds the socket and serves until "shutdown", SIGINT or SIGTERM
+        int run();
+    };
+}
+
+#endif // BURN_STATION_HPP
@@ -3,12 +3,27 @@
 
 #include <string>
 #include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "lib/task_graph.hpp"
 
 namespace DeviceHandler {
+    // Cleared at both ends of a device: MBR/GPT, filesystem signatures and
+    // the backup GPT
+    const uint64_t WIPE_SIZE = 10 * 1024 * 1024;
+    
+
     bool validateDevice(const std::string& device);
     bool isDeviceMounted(const std::string& device);
     bool unmountDevice(const std::string& device);
     bool wipeDevice(const std::string& device);
+    bool wipeRange(const std::string& device, uint64_t offset, uint64_t length);
+    void rereadPartitions(const std::string& device);
+    
+    // Adds the wipe of both device ends as trimmable writes, followed by a
+    // partition table re-read; returns the re-read task
+    Pipeline::TaskId planWipe(Pipeline::TaskGraph& graph, const std::string& device,
+                              const std::vector<Pipeline::TaskId>& after = {});
     size_t getDeviceSize(const std::string& device);
     bool createPartitionTable(const std::string& device);
     std::string createPartition(const std::string& device, size_t sizeInMB);
@@ -0,0 +1,33 @@
+#ifndef ESP_IMAGE_HPP
+#define ESP_IMAGE_HPP
+
+#include "lib/iso9660.hpp"
+#include <string>
+#include <cstdint>
+
+// The EFI System Partition is built from the FAT image that UEFI ISOs carry
+// as their El Torito EFI entry (efiboot.img): the image is copied block for
+// block into the partition instead of formatting one and copying files.
+namespace ESPImage {
+
+    struct BootImage {
+        uint64_t offset;        // Byte offset in the ISO
+        uint64_t size;          // Bytes covered by the image's filesystem
+        std::string path;       // ISO path when the image is also a file
+    };
+
+    // Finds the EFI boot entry and checks that it holds a FAT boot sector;
+    // false when the ISO has none
+    bool locate(const std::string& isoPath, const ISO9660::Image& image, BootImage& boot);
+    bool locate(const std::string& isoPath, BootImage& boot);
+
+    // Image size rounded up to the 1 MiB partition alignment
+    uint64_t partitionSize(const BootImage& boot);
+
+    // Copies the image to offset and grows its FAT volume over the rest of
+    // the partition, as far as the image's allocation tables reach
+    bool write(const std::string& isoPath, const BootImage& boot,
+               const std::string& device, uint64_t offset, uint64_t length);
+}
+
+#endif // ESP_IMAGE_HPP
@@ -0,0 +1,153 @@
+#ifndef FAT_WRITER_HPP
+#define FAT_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <array>
+#include <cstdint>
+
+namespace FatWriter {
+
+    // Byte range of file data in a source descriptor
+    struct SourceExtent {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // Entry of an existing volume, as read by Volume::load()
+    struct FileInfo {
+        std::string path;               // As stored (long name where present)
+        bool isDirectory;
+        uint32_t cluster;
+        uint64_t size;
+        uint16_t date;                  // FAT write date/time
+        uint16_t time;
+        std::string parent;             // Key of the parent directory
+        size_t entryStart;              // Byte range of its entries in the parent
+        size_t entryEnd;
+    };
+
+    // Populates a FAT32 volume without mounting it. On a fresh volume files
+    // get contiguous cluster runs after the root directory; after load()
+    // the existing tree is kept and free runs are found in the FAT.
+    // Directories and both FATs are written by commit(); clusters freed by
+    // remove() are only reused after it, so the data of an uncommitted
+    // change never overwrites what the on-disk tree still points to.
+    class Volume {
+    private:
+        struct Directory {
+            uint32_t firstCluster;
+            std::vector<uint8_t> entries;       // Raw 32-byte entries
+            std::set<std::string> shortNames;
+        };
+
+        std::string device;
+        uint64_t baseOffset;
+        int deviceFd;
+
+        uint32_t bytesPerSector;
+        uint32_t clusterSize;
+        uint32_t reservedSectors;
+        uint32_t numFATs;
+        uint32_t fatSectors;
+        uint32_t rootCluster;
+        uint32_t fsInfoSector;
+        uint64_t dataOffset;
+
+        std::vector<uint32_t> fat;
+        uint32_t nextFree;                      // No free cluster below this
+        std::vector<uint32_t> releasing;        // Freed chains, zeroed by commit()
+        std::map<std::string, Directory> directories;  // Keyed by upper-case path
+        std::map<std::string, FileInfo> existing;      // Same keys, from load()
+
+        uint64_t clusterOffset(uint32_t cluster) const;
+        uint32_t sequenceNext;                  // Run handed out by beginSequence()
+        uint32_t sequenceEnd;
+
+        uint64_t findRun(uint64_t count, uint64_t alignment) const;
+        uint32_t allocate(uint64_t bytes);
+        void release(uint32_t first);
+        std::vector<uint32_t> chain(uint32_t first) const;
+        std::vector<SourceExtent> ranges(uint32_t first, uint64_t size) const;
+        Directory& parentOf(const std::string& path, std::string& name);
+        void addEntry(Directory& dir, const std::string& name, uint8_t attributes,
+                      uint32_t cluster, uint32_t size, int64_t mtime);
+        std::string makeShortName(Directory& dir, const std::string& name,
+                                  uint8_t& caseFlags, bool& needsLong);
+        void loadDirectory(const std::string& key, const std::string& path, uint32_t cluster);
+
+    public:
+        explicit Volume(const std::string& dev, uint64_t offset = 0);
+        ~Volume();
+        Volume(const Volume&) = delete;
+        Volume& operator=(const Volume&) = delete;
+
+        // Reads the boot sector; throws FilesystemError if it is not FAT32
+        void open();
+
+        // Reads the FAT and the whole directory tree of a populated volume
+        void load();
+        const std::map<std::string, FileInfo>& files() const;
+
+        // Frees the clusters of a loaded file or directory (recursively) and
+        // drops its entries; the clusters become free at commit()
+        void remove(const std::string& path);
+
+        // Parents must already exist; paths are '/'-separated
+        void makeDirectory(const std::string& path, int64_t mtime = 0);
+        void addFile(const std::string& path, int sourceFd,
+                     const std::vector<SourceExtent>& extents, uint64_t size,
+                     int64_t mtime = 0);
+        void addFile(const std::string& path, const std::string& contents,
+                     int64_t mtime = 0);
+
+        // Allocates one contiguous cluster run without writing it and
+        // returns its byte offset on the device; the caller fills it
+        uint64_t reserveFile(const std::string& path, uint64_t size, int64_t mtime = 0);
+
+        // Files of the given sizes, added next and in that order, are laid
+        // back to back in one free run starting at an aligned device offset.
+        // False (and normal allocation) when no such run is left.
+        bool beginSequence(const std::vector<uint64_t>& sizes, uint64_t alignment);
+        void endSequence();
+
+        // SHA-256 of a loaded file's data
+        std::array<uint8_t, 32> hashFile(const FileInfo& file) const;
+
+        // Writes directories, FATs and FSInfo
+        void commit();
+
+        uint64_t freeBytes() const;
+        uint32_t clusterBytes() const;
+    };
+
+    struct SyncStats {
+        uint64_t copiedFiles = 0;
+        uint64_t copiedBytes = 0;
+        uint64_t removed = 0;
+        uint64_t unchanged = 0;
+    };
+
+    // FAT timestamps have two-second resolution and are local time
+    bool sameTimestamp(const FileInfo& file, int64_t mtime);
+
+    // Bytes a size-and-timestamp sync of the ISO would allocate on a loaded
+    // volume, in whole clusters. Space freed by the sync does not count,
+    // since it is only released at commit().
+    uint64_t syncBytes(const std::string& isoPath, const Volume& volume);
+
+    // Brings a loaded volume in line with an ISO: copies new or changed files
+    // (size and timestamp, or content hash with compareHash) and removes
+    // entries the ISO no longer has. The caller commits.
+    SyncStats syncISO(const std::string& isoPath, Volume& volume, bool compareHash = false);
+
+    // Copies the whole directory tree of an ISO into the volume, reading the
+    // ISO directly (no loop device or mount). Directories come first, then
+    // the boot-critical files in boot read order as one aligned sequence,
+    // then everything else.
+    uint64_t copyISO(const std::string& isoPath, Volume& volume);
+}
+
+#endif // FAT_WRITER_HPP
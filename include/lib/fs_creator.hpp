@@ -3,6 +3,9 @@
 
 #include <string>
 #include <cstdint>
+#include <vector>
+#include <map>
+#include "lib/write_plan.hpp"
 
 namespace FilesystemCreator {
     
@@ -10,6 +13,8 @@ namespace FilesystemCreator {
     private:
         std::string device;
         int deviceFd;
+        uint64_t baseOffset;        // Volume start within device
+        uint64_t volumeLength;      // 0: up to the end of the device
         uint64_t sectorCount;
         
         #pragma pack(push, 1)
@@ -57,11 +62,20 @@ namespace FilesystemCreator {
         #pragma pack(pop)
         
     public:
-        explicit FAT32Creator(const std::string& dev);
+        explicit FAT32Creator(const std::string& dev, uint64_t offset = 0, uint64_t length = 0);
         ~FAT32Creator();
         
         bool create(const std::string& label = "MyISO");
         
+        // Byte ranges create() writes on a volume of the given size,
+        // relative to the start of the volume
+        static std::vector<Pipeline::Extent> footprint(uint64_t volumeBytes);
+        
+        // Layout create() gives a volume of the given sector count; data
+        // clusters are 4 KiB
+        static uint32_t fatSectorsFor(uint64_t sectors);
+        static uint32_t reservedSectorsFor(uint64_t sectors);
+        
     private:
         bool writeBootSector(const std::string& label);
         bool writeFSInfo();
@@ -69,12 +83,34 @@ namespace FilesystemCreator {
         bool initializeRootDirectory();
     };
     
+    // File or directory written into a fresh filesystem at format time
+    struct SeedEntry {
+        std::string path;           // '/'-separated, parents listed first
+        std::string contents;
+        bool isDirectory;
+        uint16_t mode;              // Permission bits only
+    };
+    
+    // Minimal ext4 (extents, uninit_bg, sparse_super, 4 KiB blocks) with a
+    // root directory, lost+found, a journal and any seeded entries. Only metadata is written:
+    // inode tables are left for the kernel to initialize lazily, and the
+    // journal is zeroed with cheap zeroing only.
     class EXT4Creator {
     private:
         std::string device;
         int deviceFd;
+        uint64_t baseOffset;        // Volume start within device
+        uint64_t volumeLength;      // 0: up to the end of the device
         uint64_t blockCount;
         
+        uint32_t groupCount;
+        uint32_t inodesPerGroup;
+        uint32_t inodeTableBlocks;
+        uint32_t gdtBlocks;
+        uint32_t nextInode;
+        uint32_t createdAt;
+        uint8_t uuid[16];
+        
         #pragma pack(push, 1)
         struct Ext4SuperBlock {
             uint32_t s_inodes_count;
@@ -110,20 +146,122 @@ namespace FilesystemCreator {
             uint32_t s_feature_ro_compat;
             uint8_t s_uuid[16];
             char s_volume_name[16];
-            uint8_t padding[924];
+            char s_last_mounted[64];
+            uint32_t s_algorithm_usage_bitmap;
+            uint8_t s_prealloc_blocks;
+            uint8_t s_prealloc_dir_blocks;
+            uint16_t s_reserved_gdt_blocks;
+            uint8_t s_journal_uuid[16];
+            uint32_t s_journal_inum;
+            uint32_t s_journal_dev;
+            uint32_t s_last_orphan;
+            uint32_t s_hash_seed[4];
+            uint8_t s_def_hash_version;
+            uint8_t s_jnl_backup_type;
+            uint16_t s_desc_size;
+            uint32_t s_default_mount_opts;
+            uint32_t s_first_meta_bg;
+            uint32_t s_mkfs_time;
+            uint32_t s_jnl_blocks[17];
+            uint32_t s_blocks_count_hi;
+            uint32_t s_r_blocks_count_hi;
+            uint32_t s_free_blocks_count_hi;
+            uint16_t s_min_extra_isize;
+            uint16_t s_want_extra_isize;
+            uint32_t s_flags;
+            uint8_t padding[668];
+        };
+        
+        struct Ext4GroupDesc {
+            uint32_t bg_block_bitmap;
+            uint32_t bg_inode_bitmap;
+            uint32_t bg_inode_table;
+            uint16_t bg_free_blocks_count;
+            uint16_t bg_free_inodes_count;
+            uint16_t bg_used_dirs_count;
+            uint16_t bg_flags;
+            uint32_t bg_exclude_bitmap;
+            uint16_t bg_block_bitmap_csum;
+            uint16_t bg_inode_bitmap_csum;
+            uint16_t bg_itable_unused;
+            uint16_t bg_checksum;
+        };
+        
+        struct Ext4Inode {
+            uint16_t i_mode;
+            uint16_t i_uid;
+            uint32_t i_size_lo;
+            uint32_t i_atime;
+            uint32_t i_ctime;
+            uint32_t i_mtime;
+            uint32_t i_dtime;
+            uint16_t i_gid;
+            uint16_t i_links_count;
+            uint32_t i_blocks_lo;
+            uint32_t i_flags;
+            uint32_t i_osd1;
+            uint32_t i_block[15];
+            uint32_t i_generation;
+            uint32_t i_file_acl_lo;
+            uint32_t i_size_high;
+            uint32_t i_obso_faddr;
+            uint8_t i_osd2[12];
+            uint16_t i_extra_isize;
+            uint16_t i_checksum_hi;
+            uint32_t i_ctime_extra;
+            uint32_t i_mtime_extra;
+            uint32_t i_atime_extra;
+            uint32_t i_crtime;
+            uint32_t i_crtime_extra;
+            uint32_t i_version_hi;
+            uint32_t i_projid;
+            uint8_t padding[96];
         };
         #pragma pack(pop)
         
+        struct DirEntry {
+            uint32_t inode;
+            uint8_t fileType;
+            std::string name;
+        };
+        
+        std::vector<Ext4GroupDesc> groups;
+        std::vector<std::vector<uint8_t>> blockBitmaps;
+        std::map<uint32_t, Ext4Inode> inodes;
+        std::map<uint32_t, std::vector<DirEntry>> directories;
+        std::map<std::string, uint32_t> directoryPaths;
+        std::vector<SeedEntry> seeds;
+        
     public:
-        explicit EXT4Creator(const std::string& dev);
+        explicit EXT4Creator(const std::string& dev, uint64_t offset = 0, uint64_t length = 0);
         ~EXT4Creator();
         
+        // Queued until create(); small files only (one inline extent tree)
+        void addDirectory(const std::string& path, uint16_t mode = 0755);
+        void addFile(const std::string& path, const std::string& contents, uint16_t mode = 0644);
+        
         bool create(const std::string& label = "persistence");
         
+        // uninit_bg descriptor checksum; seeded from the filesystem UUID,
+        // so descriptors must be rechecksummed when the UUID changes
+        static uint16_t groupChecksum(const uint8_t* uuid, uint32_t group, const void* desc);
+        
     private:
+        void computeLayout();
+        bool hasSuperBlockBackup(uint32_t group) const;
+        uint32_t groupBlocks(uint32_t group) const;
+        void markUsed(uint64_t block, uint64_t count);
+        uint32_t allocateBlocks(uint32_t count);
+        Ext4Inode& newInode(uint32_t number, uint16_t mode, uint16_t links);
+        void setExtents(Ext4Inode& inode, uint32_t start, uint32_t count);
+        
         bool writeSuperBlock(const std::string& label);
         bool createBlockGroups();
         bool createRootInode();
+        bool writeSeeds();
+        bool createJournal();
+        bool writeDirectories();
+        bool writeInodes();
         void generateUUID(uint8_t* uuid);
     };
     
@@ -131,6 +269,8 @@ namespace FilesystemCreator {
     private:
         std::string device;
         int deviceFd;
+        uint64_t baseOffset;        // Volume start within device
+        uint64_t volumeLength;      // 0: up to the end of the device
         uint64_t sectorCount;
         
         #pragma pack(push, 1)
@@ -165,7 +305,7 @@ namespace FilesystemCreator {
         #pragma pack(pop)
         
     public:
-        explicit NTFSCreator(const std::string& dev);
+        explicit NTFSCreator(const std::string& dev, uint64_t offset = 0, uint64_t length = 0);
         ~NTFSCreator();
         
         bool create(const std::string& label = "MyISO");
@@ -175,8 +315,13 @@ namespace FilesystemCreator {
         bool initializeMFT();
     };
     
+    // Writes are left in the page cache so several partitions can be
+    // formatted concurrently; callers sync the whole device once at the end.
+    // With an offset the volume lives inside device (an image file) instead
+    // of being the whole of it. Seed entries are only supported on ext4.
     bool createFilesystem(const std::string& device, const std::string& fsType, 
-                         const std::string& label = "");
+                         const std::string& label = "", uint64_t offset = 0,
+                         uint64_t length = 0, const std::vector<SeedEntry>& seed = {});
 }
 
 #endif // FS_CREATOR_HPP
@@ -0,0 +1,43 @@
+#ifndef GOLDEN_IMAGE_HPP
+#define GOLDEN_IMAGE_HPP
+
+#include "lib/smart_burner.hpp"
+#include <string>
+#include <cstdint>
+
+namespace GoldenImage {
+    
+    // Used unless MYISO_CACHE_DIR is set
+    const std::string DEFAULT_CACHE_DIR = "/var/cache/myiso";
+    
+    std::string cacheDir();
+    
+    // Hex digest of everything that shapes the image: the ISO identity
+    // (size, mtime, head hash), strategy and persistence. The layout does
+    // not depend on the device, so one image serves every size of stick.
+    std::string cacheKey(const SmartBurner::BurnConfig& config);
+    
+    // Raw and hybrid strategies already are a straight copy of the ISO
+    bool isBakeable(const SmartBurner::BurnConfig& config);
+    
+    // Runs the full pipeline once against a sparse scratch file of
+    // workspaceSize bytes, cuts it at the end of the last partition and
+    // leaves the result at imagePath
+    bool bake(const SmartBurner::BurnConfig& config, const std::string& imagePath, 
+              uint64_t workspaceSize);
+    
+    // Copies only the allocated extents of the image; the wiped head and
+    // tail of the device are always written so stale tables cannot survive.
+    // Image targets on the cache's filesystem get reflinks where possible.
+    // Returns the number of allocated bytes transferred.
+    uint64_t copyAllocated(const std::string& imagePath, const std::string& device);
+    
+    // Gives the device a fresh MBR disk signature and fresh FAT32/NTFS
+    // volume serials and ext4 UUIDs; returns how many were replaced
+    int stampIdentifiers(const std::string& device);
+    
+    // Bakes the image if it is not cached yet, then copies, stamps and seals
+    bool burn(const SmartBurner::BurnConfig& config);
+}
+
+#endif // GOLDEN_IMAGE_HPP
@@ -0,0 +1,84 @@
+#ifndef HTTP_SOURCE_HPP
+#define HTTP_SOURCE_HPP
+
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+// A minimal HTTP/1.1 client for ISOs given as URLs: one keep-alive
+// connection per read stream, byte-range GETs, redirects followed on the
+// first request. Every range is pinned to the version first seen through
+// If-Match (or If-Unmodified-Since), so a file replaced on the server fails
+// the burn instead of mixing two images. A "#sha256=<hex>" fragment names
+// the digest the image must have.
+namespace HttpSource {
+
+    struct Resource {
+        std::string url;            // After redirects, without the fragment
+        std::string name;           // Last path component
+        uint64_t size = 0;
+        bool ranges = false;        // The server answers range requests
+        std::string etag;
+        std::string lastModified;
+        std::string sha256;         // Expected digest, lowercase hex
+    };
+
+    // http:// or https:// (the latter is refused when connecting)
+    bool isUrl(const std::string& path);
+
+    class Connection {
+    private:
+        std::string url;            // Current URL, without the fragment
+        std::string fragment;
+        std::string host;
+        std::string port;
+        std::string target;
+        int fd;
+        std::string inbox;          // Bytes received past the last header
+        bool changed;
+
+        struct Response {
+            int status = 0;
+            uint64_t length = 0;
+            bool hasLength = false;
+            bool close = false;
+            std::string location;
+            std::string contentRange;
+            std::string etag;
+            std::string lastModified;
+        };
+
+        void setURL(const std::string& url);
+        void connectServer();
+        void disconnect();
+        Response request(const std::string& headers);
+        void receive(uint8_t* buffer, size_t length);
+        void discard(const Response& response);
+
+    public:
+        explicit Connection(const std::string& url);
+        ~Connection();
+
+        Connection(const Connection&) = delete;
+        Connection& operator=(const Connection&) = delete;
+
+        // Identifies the resource and reads up to headBytes from its start
+        // into head, in the same request
+        Resource probe(uint64_t headBytes, std::string& head);
+
+        // Exactly [offset, offset + length) of the version probed
+        void read(const Resource& resource, uint64_t offset, uint64_t length, uint8_t* buffer);
+
+        // The last read failed because the server has another version now,
+        // which no retry can fix
+        bool sourceChanged() const { return changed; }
+
+        // The whole body in order, for servers without range support;
+        // the sink returns false to stop early
+        void readAll(const Resource& resource,
+                     const std::function<bool(const uint8_t*, size_t)>& sink);
+    };
+}
+
+#endif // HTTP_SOURCE_HPP
@@ -0,0 +1,56 @@
+#ifndef ISO9660_HPP
+#define ISO9660_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace ISO9660 {
+
+    const uint32_t SECTOR_SIZE = 2048;
+
+    enum class BootPlatform : uint8_t {
+        X86 = 0x00,
+        POWERPC = 0x01,
+        MAC = 0x02,
+        EFI = 0xEF
+    };
+
+    struct Extent {
+        uint32_t lba;
+        uint64_t length;
+    };
+
+    struct Entry {
+        std::string path;
+        bool isDirectory;
+        uint64_t size;
+        int64_t mtime;
+        std::vector<Extent> extents;
+    };
+
+    struct BootEntry {
+        uint8_t platform;
+        bool bootable;
+        uint8_t mediaType;
+        uint16_t sectorCount;   // 512-byte virtual sectors, 0/1 means "whole image"
+        uint32_t loadRBA;
+    };
+
+    struct Image {
+        uint32_t volumeBlocks;
+        std::string volumeId;
+        uint32_t bootCatalogLBA;
+        bool rockRidge;
+        std::vector<Entry> entries;         // Pre-order, parents before children
+        std::vector<BootEntry> bootEntries;
+    };
+
+    bool readImage(const std::string& isoPath, Image& image);
+    bool readImage(int fd, Image& image);
+
+    const Entry* findEntry(const Image& image, const std::string& path);
+    const Entry* findByLBA(const Image& image, uint32_t lba);
+}
+
+#endif // ISO9660_HPP
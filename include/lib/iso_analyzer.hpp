@@ -1,6 +1,8 @@
 #ifndef ISO_ANALYZER_HPP
 #define ISO_ANALYZER_HPP
 
+#include "lib/iso9660.hpp"
+#include "lib/esp_image.hpp"
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -28,6 +30,7 @@ namespace ISOAnalyzer {
         std::vector<PartitionInfo> embeddedPartitions;
         std::string bootType;
         std::vector<std::string> bootFiles;
+        ESPImage::BootImage efiImage;   // size 0 when there is no El Torito EFI image
     };
     
     class SmartAnalyzer {
@@ -37,12 +40,18 @@ namespace ISOAnalyzer {
                                                bool withPersistence);
         static std::string getRecommendedStrategy(const ISOStructure& structure);
         
+        // Boot-critical files plus the live root images, in the order a
+        // boot reads them: loaders, their configs, kernel, initrd, squashfs
+        static std::vector<const ISO9660::Entry*> bootReadOrder(const ISO9660::Image& image);
+        
     private:
         static bool checkElTorito(const std::string& isoPath);
         static bool checkUEFI(const std::string& isoPath);
         static bool checkHybridISO(const std::string& isoPath);
         static std::vector<PartitionInfo> extractEmbeddedPartitions(const std::string& isoPath);
         static std::vector<std::string> findBootFiles(const std::string& isoPath);
+        static bool checkUEFI(const ISO9660::Image& image);
+        static std::vector<std::string> findBootFiles(const ISO9660::Image& image);
     };
     
     enum class BurnStrategy {
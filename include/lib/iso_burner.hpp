@@ -2,6 +2,7 @@
 #define ISO_BURNER_HPP
 
 #include <string>
+#include <cstdint>
 
 namespace ISOBurner {
     enum class BurnMode {
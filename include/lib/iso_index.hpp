@@ -0,0 +1,102 @@
+#ifndef ISO_INDEX_HPP
+#define ISO_INDEX_HPP
+
+#include "lib/iso9660.hpp"
+#include "utils/sha256.hpp"
+#include <string>
+#include <memory>
+#include <cstdint>
+
+namespace ISOIndex {
+
+    #pragma pack(push, 1)
+    struct IndexKey {
+        uint64_t size;
+        int64_t mtimeSec;
+        int64_t mtimeNsec;
+        uint8_t headHash[32];      // SHA-256 of the first 64 KiB
+    };
+
+    struct IndexHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkSize;
+        IndexKey key;
+        uint64_t chunkCount;
+        uint64_t zeroChunks;
+        uint64_t hashesOffset;     // chunkCount x 32 byte digests
+        uint64_t zeroMapOffset;    // one bit per chunk
+        uint64_t fileCount;
+        uint64_t filesOffset;
+        uint64_t extentCount;
+        uint64_t extentsOffset;
+        uint64_t bootCount;
+        uint64_t bootOffset;
+        uint64_t stringsSize;
+        uint64_t stringsOffset;
+        uint32_t volumeBlocks;
+        uint32_t bootCatalogLBA;
+        uint32_t rockRidge;
+        uint32_t volumeIdLength;   // Volume ID is stored at strings[0]
+        uint64_t totalSize;
+    };
+
+    struct FileRecord {
+        uint32_t pathOffset;
+        uint32_t pathLength;
+        uint32_t isDirectory;
+        uint32_t extentCount;
+        uint64_t firstExtent;
+        uint64_t size;
+        int64_t mtime;
+    };
+
+    struct ExtentRecord {
+        uint32_t lba;
+        uint32_t reserved;
+        uint64_t length;
+    };
+
+    struct BootRecord {
+        uint8_t platform;
+        uint8_t bootable;
+        uint8_t mediaType;
+        uint8_t reserved;
+        uint16_t sectorCount;
+        uint16_t reserved2;
+        uint32_t loadRBA;
+    };
+    #pragma pack(pop)
+
+    // Read-only view of a sidecar index, mapped straight from disk
+    class Index {
+    private:
+        void* mapping;
+        size_t mappingSize;
+        const IndexHeader* header;
+
+        Index(void* map, size_t size);
+
+    public:
+        ~Index();
+        Index(const Index&) = delete;
+        Index& operator=(const Index&) = delete;
+
+        static std::unique_ptr<Index> open(const std::string& isoPath);
+
+        uint32_t chunkSize() const;
+        uint64_t chunkCount() const;
+        uint64_t zeroChunks() const;
+        uint64_t isoSize() const;
+        Hash::Digest chunkHash(uint64_t chunk) const;
+        bool isZeroChunk(uint64_t chunk) const;
+
+        ISO9660::Image image() const;
+    };
+
+    std::string sidecarPath(const std::string& isoPath);
+    bool computeKey(const std::string& isoPath, IndexKey& key);
+    bool build(const std::string& isoPath);
+}
+
+#endif // ISO_INDEX_HPP
@@ -75,6 +75,12 @@ namespace BootStructures {
         uint64_t deviceSectors;
         TableType tableType;
         
+        // Sector 0 is built up in memory and written once by commit()
+        MBR stagedMBR;
+        bool mbrLoaded;
+        bool mbrDirty;
+        uint32_t stagedUpdates;
+        
     public:
         PartitionTable(const std::string& dev, TableType type = TableType::MBR);
         ~PartitionTable();
@@ -91,6 +97,7 @@ namespace BootStructures {
         bool commit();
         
     private:
+        void loadMBR();
         void calculateCHS(uint32_t lba, uint8_t* chs);
         uint32_t calculateCRC32(const void* data, size_t length);
         void generateGUID(uint8_t* guid);
@@ -0,0 +1,50 @@
+#ifndef PARTITION_SIZING_HPP
+#define PARTITION_SIZING_HPP
+
+#include "lib/iso9660.hpp"
+#include <string>
+#include <cstdint>
+
+// Sizes partitions from what will actually be written to them: the
+// extracted ISO tree is counted cluster by cluster, with its directory
+// entries and allocation tables, for the filesystem that will hold it.
+namespace PartitionSizing {
+
+    // Gap ahead of partition 1 and the GPT backup at the end; the
+    // partitions themselves are sized exactly
+    const uint64_t TABLE_OVERHEAD_MB = 2;
+
+    enum class Layout {
+        FAT32,
+        EXFAT
+    };
+
+    struct Footprint {
+        uint32_t clusterSize;
+        uint64_t fileClusters;
+        uint64_t directoryClusters;
+        uint64_t systemClusters;    // exFAT allocation bitmap and up-case table
+        uint64_t spareClusters;     // Boot configs written after the copy, and
+                                    // the FAT32 boot file alignment gap
+        uint64_t metadataBytes;     // Boot region and FATs ahead of the data
+        uint64_t bytes;             // Partition size, 1 MiB aligned
+    };
+
+    // FAT32 as FAT32Creator formats it (4 KiB clusters), never below the
+    // FAT32 minimum cluster count. extraFileBytes counts one more file in
+    // the root, such as a persistence file written next to the tree.
+    Footprint fat32(const ISO9660::Image& image, uint64_t extraFileBytes = 0);
+
+    // clusterSize 0 picks the exFAT default for the resulting volume size
+    Footprint exfat(const ISO9660::Image& image, uint32_t clusterSize = 0,
+                    uint64_t extraFileBytes = 0);
+
+    // Reads the tree from the sidecar index when there is one
+    Footprint extracted(const std::string& isoPath, Layout layout = Layout::FAT32,
+                        uint64_t extraFileBytes = 0);
+
+    // Partition holding the ISO image itself, block for block
+    uint64_t rawPartitionBytes(uint64_t isoBytes);
+}
+
+#endif // PARTITION_SIZING_HPP
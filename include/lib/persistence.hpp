@@ -3,9 +3,25 @@
 
 #include "lib/fs_supports.hpp"
 #include "lib/mbr_gpt.hpp"
+#include "lib/block_target.hpp"
 #include <string>
 
 namespace Persistence {
+    
+    // How the ISO partition of an existing stick holds the ISO
+    enum class UpdateMode {
+        RAW,        // ISO image written into the partition
+        EXTRACT     // FAT32 with the ISO tree copied in
+    };
+    
+    struct UpdatePlan {
+        UpdateMode mode;
+        BlockTarget::Partition target;  // The ISO partition, found by content
+        uint64_t required;          // Bytes the new ISO needs in it
+        int keptPartitions;
+        bool differential = false;  // EXTRACT: sync changed files only
+        bool compareHash = false;   // ...judging changes by content
+    };
     bool createPersistencePartition(
         const std::string& device,
         size_t sizeInMB,
@@ -21,6 +37,19 @@ namespace Persistence {
     );
     
     size_t calculateOptimalSize(size_t isoSize, size_t deviceSize);
+    
+    // Reads the partition table of a stick built earlier, finds the
+    // partition holding the ISO image or its extracted MYISO volume (not
+    // the ESP) and checks that the new ISO fits the way it will go in
+    // (reformat, or a differential sync into the current free space);
+    // throws when it cannot be updated
+    UpdatePlan planUpdate(const std::string& isoPath, const std::string& device,
+                          bool differential = false);
+    
+    // Rewrites the ISO partition only, as planned by planUpdate; boot code
+    // and every other partition (persistence) are left untouched, and a
+    // new hybrid image at sector 0 gets the other partitions carried over
+    bool updateISO(const std::string& isoPath, const std::string& device, const UpdatePlan& plan);
 }
 
 #endif // PERSISTENCE_HPP
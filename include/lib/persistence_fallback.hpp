@@ -2,7 +2,9 @@
 #define PERSISTENCE_FALLBACK_HPP
 
 #include "lib/fs_supports.hpp"
+#include "lib/fat_writer.hpp"
 #include <string>
+#include <cstdint>
 
 namespace PersistenceFallback {
     bool createFileBased(
@@ -11,6 +13,17 @@ namespace PersistenceFallback {
         const std::string& label = "casper-rw"
     );
     
+    // Reserves a contiguous casper-rw file in a FAT32 volume that is being
+    // populated and formats it as ext4; returns its byte offset on device
+    uint64_t createInVolume(
+        FatWriter::Volume& volume,
+        const std::string& device,
+        size_t sizeInMB,
+        const std::string& label = "casper-rw"
+    );
+    
+    // Lays out one FAT32 partition with the ISO tree and a persistence
+    // file, without mounting anything
     bool setupFallbackPersistence(
         const std::string& isoPath,
         const std::string& device,
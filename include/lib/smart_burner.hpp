@@ -2,8 +2,11 @@
 #define SMART_BURNER_HPP
 
 #include "iso_analyzer.hpp"
+#include "task_graph.hpp"
+#include "fs_creator.hpp"
 #include <string>
 #include <vector>
+#include <memory>
 
 namespace SmartBurner {
     
@@ -16,34 +19,68 @@ namespace SmartBurner {
         size_t persistenceSizeMB;
         std::string persistenceFS;
         bool fastMode;
+        bool seal = true;           // Write the verification manifest at the end
+        Pipeline::Observer onTask;  // Progress of the burn pipeline
     };
     
+    // State handed between the tasks of one burn (partition names)
+    struct BurnContext;
+    
     class IntelligentBurner {
     public:
         static bool burnWithStrategy(const BurnConfig& config);
+        static void sealManifest(const BurnConfig& config);
+        
+        // The ESP is the ISO's EFI boot image, block-copied and grown to
+        // the partition; espSectors sizes the partition for it
+        static uint32_t espSectors(const ISOAnalyzer::ISOStructure& structure);
         
     private:
-        static bool burnHybridPreserve(const BurnConfig& config);
-        static bool burnSmartExtract(const BurnConfig& config);
-        static bool burnMultipart(const BurnConfig& config);
-        static bool burnRawCopy(const BurnConfig& config);
+        // Each strategy adds its steps to the graph; the returned task is
+        // the last one touching the device
+        static Pipeline::TaskId planHybridPreserve(Pipeline::TaskGraph& graph,
+                                                   const BurnConfig& config,
+                                                   std::shared_ptr<BurnContext> context);
+        static Pipeline::TaskId planSmartExtract(Pipeline::TaskGraph& graph,
+                                                 const BurnConfig& config);
+        static Pipeline::TaskId planMultipart(Pipeline::TaskGraph& graph,
+                                              const BurnConfig& config);
+        static Pipeline::TaskId planRawCopy(Pipeline::TaskGraph& graph,
+                                            const BurnConfig& config);
+        
+        // One FAT32 partition with the ISO tree and a casper-rw file, for
+        // hybrid images whose own table leaves no slot for persistence
+        static bool needsPersistenceFile(const BurnConfig& config);
+        static Pipeline::TaskId planPersistenceFile(Pipeline::TaskGraph& graph,
+                                                    const BurnConfig& config);
+        
+        static Pipeline::TaskId planDevicePrep(Pipeline::TaskGraph& graph,
+                                               const BurnConfig& config);
         
         static bool createPartitionLayout(const std::string& device,
-                                         const ISOAnalyzer::ISOStructure& structure,
+                                         const std::string& isoPath,
                                          bool withPersistence,
                                          size_t persistenceSizeMB);
         
-        static bool extractAndCopyISO(const std::string& isoPath,
-                                     const std::string& mountPoint);
+        // Partitions are addressed as byte ranges of the whole device, so
+        // sticks and image files take the same path
+        static void settlePartitions(const std::string& device);
+        static bool formatPartition(const std::string& device, int number,
+                                    const std::string& fsType, const std::string& label,
+                                    const std::vector<FilesystemCreator::SeedEntry>& seed = {});
+        static bool formatPersistence(const std::string& device, int number,
+                                      const std::string& fsType);
+        static bool writeContents(const std::string& device, int number,
+                                  const std::string& isoPath);
         
-        static bool setupUEFIBoot(const std::string& partition,
+        static bool setupUEFIBoot(const std::string& device, int number,
+                                 const ISOAnalyzer::ISOStructure& structure,
                                  const std::string& isoPath);
         
         static bool setupLegacyBoot(const std::string& partition,
                                    const std::string& isoPath);
         
-        static std::string mountPartition(const std::string& partition);
-        static void unmountPartition(const std::string& mountPoint);
+        static std::string partitionPath(const std::string& device, int number);
     };
 }
 
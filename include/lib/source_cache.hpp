@@ -0,0 +1,61 @@
+#ifndef SOURCE_CACHE_HPP
+#define SOURCE_CACHE_HPP
+
+#include <string>
+#include <memory>
+#include <cstdint>
+
+// Whole ISO images held in RAM for the burn station and batch mode, so jobs
+// burning one image at different times read memory instead of the disk or a
+// page cache that memory pressure already emptied. Images live in memfd files
+// whose mappings are advised for transparent huge pages; ISO readers reach
+// them through openSource(), which falls back to the file itself.
+namespace SourceCache {
+
+    struct Stats {
+        uint64_t hits;              // Jobs whose image was resident or loading
+        uint64_t misses;            // Jobs that started its load or ran uncached
+        uint64_t prefetched;        // Loads started ahead of their jobs
+        uint64_t evicted;
+        uint64_t rejected;          // Admissions refused for lack of room
+        uint64_t residentBytes;
+        uint64_t capacityBytes;
+        size_t images;
+    };
+
+    struct Entry;
+
+    // Keeps an image resident, and out of eviction, while a job burns it
+    class Lease {
+    private:
+        std::shared_ptr<Entry> entry;
+
+    public:
+        Lease() = default;
+        explicit Lease(std::shared_ptr<Entry> cached);
+
+        bool cached() const { return entry != nullptr; }
+    };
+
+    // Turns the cache on with a byte budget; 0 takes MYISO_SOURCE_CACHE_MB,
+    // else half of the available memory. Until then everything reads disk.
+    void enable(uint64_t capacityBytes = 0);
+    bool enabled();
+
+    // Starts loading the image if it earns its room and returns at once;
+    // until the load completes openSource() reads the file as before
+    Lease acquire(const std::string& isoPath);
+
+    // Starts loading an image in the background; expectedJobs counts toward
+    // its popularity when admission has to choose
+    void prefetch(const std::string& isoPath, uint64_t expectedJobs = 1);
+
+    // open(isoPath, O_RDONLY) with its own file offset, served from RAM when
+    // the image is resident, else from its staged copy while one exists
+    int openSource(const std::string& isoPath);
+
+    Stats stats();
+    std::string describe(const Stats& stats);
+}
+
+#endif // SOURCE_CACHE_HPP
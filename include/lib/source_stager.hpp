@@ -0,0 +1,66 @@
+#ifndef SOURCE_STAGER_HPP
+#define SOURCE_STAGER_HPP
+
+#include "lib/write_plan.hpp"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Copies ISOs from slow or network storage to a local staging area with
+// several concurrent pread streams over disjoint chunks. Burns start at once:
+// readers of the staged copy wait only for chunks that have not arrived yet,
+// and those chunks jump the queue. Completed copies can be kept in an LRU
+// staging cache.
+//
+// http:// URLs are always staged: the first sectors come with the probe,
+// the rest through parallel range requests, and the arrived prefix is
+// hashed in order with SHA-256.
+//
+// MYISO_STAGING           auto (sources on network filesystems), always, off
+// MYISO_STAGING_DIR       local directory, or "ram" for an in-memory copy
+//                         (default /var/tmp/myiso-staging)
+// MYISO_STAGING_STREAMS   concurrent read streams (default 4)
+// MYISO_STAGING_CACHE_MB  keep completed copies up to this size (default 0)
+namespace SourceStager {
+
+    struct Stage;
+
+    // The last holder stops the streams, then keeps the copy in the staging
+    // cache or deletes it
+    using Handle = std::shared_ptr<Stage>;
+
+    // Starts (or joins) staging the ISO or URL; nullptr when it is read in
+    // place. Given a staged copy's path, returns the stage it belongs to.
+    Handle stage(const std::string& isoPath);
+
+    // The staged copy as a path every ISO reader can open, for as long as
+    // the handle lives
+    std::string stagedPath(const Handle& stage);
+
+    // Waits for a URL source to arrive in full and throws when staging
+    // failed or its digest is not the expected one; other stages pass
+    void verify(const Handle& stage);
+
+    // A descriptor on the staged copy with its own offset; -1 when the ISO
+    // is not being staged
+    int openStaged(const std::string& isoPath);
+
+    // Blocks until a range of a staged descriptor has arrived; returns at
+    // once for any other descriptor. Throws when staging failed.
+    void await(int fd, uint64_t offset, uint64_t length);
+
+    // Blocks until the whole staged copy at path has arrived, for readers
+    // outside this process (loop devices) that cannot wait per range;
+    // returns at once for any other file. Throws when staging failed.
+    void complete(const std::string& path);
+
+    // The source's data extents for a staged descriptor, whose own holes
+    // may only mean "not staged yet"; false for any other descriptor
+    bool sourceExtents(int fd, uint64_t size, std::vector<Pipeline::Extent>& extents);
+
+    // NFS, SMB/CIFS, 9p, Ceph or FUSE
+    bool networkFilesystem(const std::string& path);
+}
+
+#endif // SOURCE_STAGER_HPP
@@ -0,0 +1,82 @@
+#ifndef TASK_GRAPH_HPP
+#define TASK_GRAPH_HPP
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <memory>
+#include <map>
+#include <cstddef>
+#include "lib/write_plan.hpp"
+
+namespace Pipeline {
+
+    using TaskId = size_t;
+    
+    // Receives the part of the declared footprint that is still live
+    using WriteWork = std::function<bool(const std::vector<Extent>&)>;
+
+    // Told about every task that finished, with the count finished so far
+    using Observer = std::function<void(const std::string& task, size_t finished, size_t total)>;
+
+    // Common resource tags. Tasks naming the same tag never overlap and run
+    // in the order they were added; anything else may run concurrently.
+    const std::string DEVICE_HEAD = "device:head";     // MBR/GPT and the first MiB
+    const std::string DEVICE_TAIL = "device:tail";     // backup GPT, manifest
+    const std::string DEVICE_DATA = "device:data";     // everything in between
+    const std::string SOURCE_STREAM = "source";
+
+    std::string partitionTag(int number);
+
+    // Small dependency-graph executor. Workers keep their own deque of ready
+    // tasks and steal from each other when idle; a finished task pushes the
+    // successors it unblocked onto the deque of the worker that ran it.
+    //
+    // Before anything runs, tasks that declared their device writes are
+    // planned back to front: writes that a task ordered after them
+    // overwrites anyway are trimmed or dropped.
+    class TaskGraph {
+    private:
+        struct Task;
+        struct Worker;
+
+        std::vector<std::unique_ptr<Task>> tasks;
+        std::map<std::string, TaskId> lastHolder;
+        unsigned workerCount;
+        uint64_t savedBytes;
+        Observer observer;
+
+        void planWrites();
+
+    public:
+        explicit TaskGraph(unsigned workers = 0);
+        ~TaskGraph();
+        TaskGraph(const TaskGraph&) = delete;
+        TaskGraph& operator=(const TaskGraph&) = delete;
+
+        // A task returning false stops the graph: nothing new is started and
+        // run() returns false once running tasks finish
+        TaskId add(const std::string& name, std::function<bool()> work,
+                   const std::vector<TaskId>& after = {},
+                   const std::vector<std::string>& resources = {});
+
+        // Same as add(), with the byte ranges the task writes on the device
+        TaskId addWrites(const std::string& name, WriteKind kind,
+                         const std::vector<Extent>& footprint, WriteWork work,
+                         const std::vector<TaskId>& after = {},
+                         const std::vector<std::string>& resources = {});
+
+        size_t size() const;
+
+        // Called from the worker that ran the task
+        void setObserver(Observer callback);
+
+        // Bytes the planning pass removed in the last run()
+        uint64_t bytesSaved() const;
+
+        // Rethrows the first exception raised by a task
+        bool run();
+    };
+}
+
+#endif // TASK_GRAPH_HPP
@@ -0,0 +1,43 @@
+#ifndef WRITE_PLAN_HPP
+#define WRITE_PLAN_HPP
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+namespace Pipeline {
+
+    // Byte range on the target device
+    struct Extent {
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    // Set of byte ranges, kept sorted and merged
+    class ExtentMap {
+    private:
+        std::map<uint64_t, uint64_t> ranges;    // start -> end (exclusive)
+
+    public:
+        ExtentMap() = default;
+        ExtentMap(const std::vector<Extent>& extents);
+
+        void add(uint64_t offset, uint64_t length);
+        void add(const ExtentMap& other);
+        void subtract(const ExtentMap& other);
+
+        bool covers(const ExtentMap& other) const;
+        bool empty() const;
+        uint64_t bytes() const;
+        std::vector<Extent> extents() const;
+    };
+
+    // How a task's declared writes may be changed by the planning pass
+    enum class WriteKind {
+        FIXED,          // always written in full
+        TRIMMABLE,      // only the ranges no later task overwrites are written
+        DROPPABLE       // skipped when later tasks overwrite all of it
+    };
+}
+
+#endif // WRITE_PLAN_HPP
@@ -2,14 +2,119 @@
 #define LOGS_HPP
 
 #include <string>
+#include <sstream>
+#include <utility>
+#include <type_traits>
+
+// Lowest level compiled in: 0 debug, 1 info, 2 success, 3 warning, 4 error,
+// 5 fatal. Calls below it compile to nothing (e.g. -DMYISO_LOG_LEVEL=1).
+#ifndef MYISO_LOG_LEVEL
+#define MYISO_LOG_LEVEL 0
+#endif
 
 namespace Logs {
-    void info(const std::string& message);
-    void success(const std::string& message);
-    void warning(const std::string& message);
-    void error(const std::string& message);
-    void fatal(const std::string& message);
-    void debug(const std::string& message);
+    enum class Level : int {
+        DEBUG = 0,
+        INFO = 1,
+        SUCCESS = 2,
+        WARNING = 3,
+        ERROR = 4,
+        FATAL = 5
+    };
+
+    void setLevel(Level level);
+    bool parseLevel(const std::string& name, Level& level);
+    bool isEnabled(Level level);
+
+    // Mirrors every record as one JSON object per line into the given file
+    bool setJsonSink(const std::string& path);
+
+    // Blocks until everything logged so far has been written out. Call before
+    // writing to the terminal directly (prompts, progress bars, reports).
+    void flush();
+
+    // Hands a finished record to the background writer; never blocks
+    void submit(Level level, std::string message);
+
+    // Prefix of this thread, for handing it to threads it starts
+    std::string currentPrefix();
+
+    // Tags every record logged from this thread while in scope, e.g. the
+    // device a worker is burning. Nested prefixes are joined.
+
+    class ScopedPrefix {
+    private:
+        std::string previous;
+
+    public:
+        explicit ScopedPrefix(const std::string& prefix);
+        ~ScopedPrefix();
+        ScopedPrefix(const ScopedPrefix&) = delete;
+        ScopedPrefix& operator=(const ScopedPrefix&) = delete;
+    };
+
+    namespace detail {
+        template <typename T>
+        std::string format(T&& value) {
+            if constexpr (std::is_convertible_v<T&&, std::string>) {
+                return std::string(std::forward<T>(value));
+            } else {
+                std::ostringstream stream;
+                stream << value;
+                return stream.str();
+            }
+        }
+
+        template <typename First, typename Second, typename... Rest>
+        std::string format(First&& first, Second&& second, Rest&&... rest) {
+            std::ostringstream stream;
+            stream << std::forward<First>(first) << std::forward<Second>(second);
+            ((stream << std::forward<Rest>(rest)), ...);
+            return stream.str();
+        }
+
+        // Arguments are only formatted once the level is known to be enabled
+        template <Level L, typename... Args>
+        void log(Args&&... args) {
+            if constexpr (static_cast<int>(L) >= MYISO_LOG_LEVEL) {
+                if (isEnabled(L)) {
+                    submit(L, format(std::forward<Args>(args)...));
+                }
+            } else {
+                ((void)args, ...);
+            }
+        }
+    }
+
+    template <typename... Args>
+    void info(Args&&... args) {
+        detail::log<Level::INFO>(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void success(Args&&... args) {
+        detail::log<Level::SUCCESS>(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void warning(Args&&... args) {
+        detail::log<Level::WARNING>(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void error(Args&&... args) {
+        detail::log<Level::ERROR>(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void fatal(Args&&... args) {
+        detail::log<Level::FATAL>(std::forward<Args>(args)...);
+    }
+
+    template <typename... Args>
+    void debug(Args&&... args) {
+        detail::log<Level::DEBUG>(std::forward<Args>(args)...);
+    }
 }
 
 #endif // LOGS_HPP
@@ -0,0 +1,35 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace Hash {
+
+    using Digest = std::array<uint8_t, 32>;
+
+    class SHA256 {
+    private:
+        uint32_t state[8];
+        uint8_t block[64];
+        size_t blockLen;
+        uint64_t totalLen;
+
+    public:
+        SHA256();
+
+        void update(const void* data, size_t length);
+        Digest finish();
+
+    private:
+        void transform(const uint8_t* chunk);
+    };
+
+    Digest sha256(const void* data, size_t length);
+    Digest combine(const Digest& left, const Digest& right);
+    std::string toHex(const Digest& digest);
+}
+
+#endif // SHA256_HPP
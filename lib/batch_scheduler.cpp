@@ -0,0 +1,689 @@
+#include "lib/batch_scheduler.hpp"
+#include "lib/burn_planner.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include "utils/colors.hpp"
+#include <sys/stat.h>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+namespace BatchScheduler {
+
+    static const double MB = 1024.0 * 1024.0;
+
+    // Share of a USB link's signalling rate left for bulk data after
+    // protocol overhead
+    static const double LINK_EFFICIENCY = 0.7;
+
+    // Throughput is only measured on jobs long enough to be meaningful,
+    // and a shared link only counts as saturated when jobs on it ran
+    // clearly slower than the device alone
+    static const double MIN_MEASURED_SECONDS = 2.0;
+    static const double SATURATED_RATIO = 0.8;
+
+    using Entry = std::map<std::string, std::string>;
+
+    // ---- Manifest ------------------------------------------------------
+
+    static std::string trim(const std::string& text) {
+        size_t start = text.find_first_not_of(" \t\r");
+        if (start == std::string::npos) return "";
+        size_t end = text.find_last_not_of(" \t\r");
+        return text.substr(start, end - start + 1);
+    }
+
+    static void appendUtf8(std::string& out, uint32_t code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    // The subset of TOML a job list needs: [[job]] headers, comments and
+    // key = "string" | 'literal' | integer | boolean
+    static std::vector<Entry> readToml(const std::string& path, const std::string& text,
+                                       Entry& defaults) {
+        std::vector<Entry> jobs;
+        Entry* current = &defaults;
+
+        std::istringstream input(text);
+        std::string raw;
+        size_t number = 0;
+        while (std::getline(input, raw)) {
+            number++;
+            std::string line = trim(raw);
+            std::string where = "line " + std::to_string(number) + ": ";
+            if (line.empty() || line[0] == '#') continue;
+
+            if (line[0] == '[') {
+                std::string header = trim(line.substr(0, line.find('#')));
+                if (header != "[[job]]" && header != "[[jobs]]") {
+                    throw FileError(path, where + "only [[job]] tables are supported");
+                }
+                jobs.emplace_back();
+                current = &jobs.back();
+                continue;
+            }
+
+            size_t equals = line.find('=');
+            if (equals == std::string::npos) {
+                throw FileError(path, where + "expected key = value");
+            }
+            std::string key = trim(line.substr(0, equals));
+            std::string rest = trim(line.substr(equals + 1));
+            std::string value;
+            size_t end = 0;
+
+            if (!rest.empty() && rest[0] == '"') {
+                for (end = 1; end < rest.size() && rest[end] != '"'; end++) {
+                    if (rest[end] != '\\') {
+                        value += rest[end];
+                        continue;
+                    }
+                    if (++end == rest.size()) break;
+                    switch (rest[end]) {
+                        case 'n': value += '\n'; break;
+                        case 't': value += '\t'; break;
+                        case 'u':
+                            if (end + 4 >= rest.size()) {
+                                throw FileError(path, where + "bad \\u escape");
+                            }
+                            appendUtf8(value, strtoul(rest.substr(end + 1, 4).c_str(), nullptr, 16));
+                            end += 4;
+                            break;
+                        default: value += rest[end]; break;
+                    }
+                }
+                if (end >= rest.size()) {
+                    throw FileError(path, where + "unterminated string");
+                }
+                end++;
+            } else if (!rest.empty() && rest[0] == '\'') {
+                end = rest.find('\'', 1);
+                if (end == std::string::npos) {
+                    throw FileError(path, where + "unterminated string");
+                }
+                value = rest.substr(1, end - 1);
+                end++;
+            } else {
+                end = std::min(rest.find('#'), rest.size());
+                value = trim(rest.substr(0, end));
+                value.erase(std::remove(value.begin(), value.end(), '_'), value.end());
+                bool integer = !value.empty() &&
+                               std::all_of(value.begin(), value.end(), ::isdigit);
+                if (!integer && value != "true" && value != "false") {
+                    throw FileError(path, where + "value of " + key +
+                                    " must be a quoted string, an integer or a boolean");
+                }
+            }
+
+            std::string trailing = trim(rest.substr(end));
+            if (!trailing.empty() && trailing[0] != '#') {
+                throw FileError(path, where + "unexpected text after value");
+            }
+            if (key.empty() || current->count(key)) {
+                throw FileError(path, where + "missing or repeated key");
+            }
+            (*current)[key] = value;
+        }
+        return jobs;
+    }
+
+    struct Json {
+        enum class Kind { NUL, BOOLEAN, NUMBER, STRING, ARRAY, OBJECT };
+
+        Kind kind = Kind::NUL;
+        std::string text;                                   // Scalars
+        std::vector<std::pair<std::string, Json>> members;  // Objects, in order
+        std::vector<Json> items;                            // Arrays
+    };
+
+    class JsonReader {
+    private:
+        const std::string& path;
+        const std::string& text;
+        size_t pos = 0;
+
+        [[noreturn]] void fail(const std::string& message) {
+            size_t line = 1 + std::count(text.begin(), text.begin() + std::min(pos, text.size()), '\n');
+            throw FileError(path, "line " + std::to_string(line) + ": " + message);
+        }
+
+        void skipBlanks() {
+            while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) pos++;
+        }
+
+        bool consume(char c) {
+            skipBlanks();
+            if (pos < text.size() && text[pos] == c) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        void expect(char c) {
+            if (!consume(c)) fail(std::string("expected '") + c + "'");
+        }
+
+        uint32_t hex4() {
+            if (pos + 4 > text.size()) fail("bad \\u escape");
+            std::string digits = text.substr(pos, 4);
+            pos += 4;
+            char* end = nullptr;
+            uint32_t code = strtoul(digits.c_str(), &end, 16);
+            if (*end != '\0') fail("bad \\u escape");
+            return code;
+        }
+
+        std::string string() {
+            expect('"');
+            std::string out;
+            while (pos < text.size() && text[pos] != '"') {
+                char c = text[pos++];
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+                if (pos >= text.size()) break;
+                char escape = text[pos++];
+                switch (escape) {
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'u': {
+                        uint32_t code = hex4();
+                        // Surrogate pair: the low half follows as another escape
+                        if (code >= 0xD800 && code < 0xDC00 &&
+                            text.compare(pos, 2, "\\u") == 0) {
+                            pos += 2;
+                            code = 0x10000 + ((code - 0xD800) << 10) + (hex4() - 0xDC00);
+                        }
+                        appendUtf8(out, code);
+                        break;
+                    }
+                    default: out += escape; break;
+                }
+            }
+            if (pos >= text.size()) fail("unterminated string");
+            pos++;
+            return out;
+        }
+
+    public:
+        JsonReader(const std::string& file, const std::string& content)
+            : path(file), text(content) {}
+
+        Json value() {
+            Json result;
+            skipBlanks();
+            if (pos >= text.size()) fail("unexpected end of file");
+
+            char c = text[pos];
+            if (c == '{') {
+                result.kind = Json::Kind::OBJECT;
+                pos++;
+                if (consume('}')) return result;
+                do {
+                    skipBlanks();
+                    std::string key = string();
+                    expect(':');
+                    result.members.emplace_back(key, value());
+                } while (consume(','));
+                expect('}');
+            } else if (c == '[') {
+                result.kind = Json::Kind::ARRAY;
+                pos++;
+                if (consume(']')) return result;
+                do {
+                    result.items.push_back(value());
+                } while (consume(','));
+                expect(']');
+            } else if (c == '"') {
+                result.kind = Json::Kind::STRING;
+                result.text = string();
+            } else if (text.compare(pos, 4, "true") == 0 || text.compare(pos, 5, "false") == 0) {
+                result.kind = Json::Kind::BOOLEAN;
+                result.text = c == 't' ? "true" : "false";
+                pos += result.text.size();
+            } else if (text.compare(pos, 4, "null") == 0) {
+                pos += 4;
+            } else if (c == '-' || isdigit(static_cast<unsigned char>(c))) {
+                result.kind = Json::Kind::NUMBER;
+                size_t start = pos;
+                while (pos < text.size() && strchr("+-.eE0123456789", text[pos])) pos++;
+                result.text = text.substr(start, pos - start);
+            } else {
+                fail(std::string("unexpected '") + c + "'");
+            }
+            return result;
+        }
+
+        Json document() {
+            Json root = value();
+            skipBlanks();
+            if (pos != text.size()) fail("unexpected text after the document");
+            return root;
+        }
+    };
+
+    static Entry jsonEntry(const std::string& path, const Json& object, const std::string& label) {
+        if (object.kind != Json::Kind::OBJECT) {
+            throw FileError(path, label + " must be an object");
+        }
+
+        Entry entry;
+        for (const auto& member : object.members) {
+            const Json& value = member.second;
+            if (value.kind == Json::Kind::NUL) continue;
+            if (value.kind == Json::Kind::ARRAY || value.kind == Json::Kind::OBJECT) {
+                throw FileError(path, label + ": " + member.first +
+                                " must be a string, a number or a boolean");
+            }
+            entry[member.first] = value.text;
+        }
+        return entry;
+    }
+
+    static std::vector<Entry> readJson(const std::string& path, const std::string& text,
+                                       Entry& defaults) {
+        Json root = JsonReader(path, text).document();
+
+        const Json* list = &root;
+        if (root.kind == Json::Kind::OBJECT) {
+            list = nullptr;
+            for (const auto& member : root.members) {
+                if (member.first == "jobs") {
+                    list = &member.second;
+                } else if (member.first == "defaults") {
+                    defaults = jsonEntry(path, member.second, "defaults");
+                } else {
+                    throw FileError(path, "unknown top-level key: " + member.first);
+                }
+            }
+            if (!list) throw FileError(path, "no \"jobs\" array");
+        }
+        if (list->kind != Json::Kind::ARRAY) {
+            throw FileError(path, "jobs must be an array");
+        }
+
+        std::vector<Entry> jobs;
+        for (size_t i = 0; i < list->items.size(); i++) {
+            jobs.push_back(jsonEntry(path, list->items[i], "job " + std::to_string(i + 1)));
+        }
+        return jobs;
+    }
+
+    // Manifest keys become the CLI-style arguments the station already parses
+    static BurnStation::JobSpec toSpec(const std::string& path, const Entry& defaults,
+                                       const Entry& job, const std::string& label) {
+        static const std::map<std::string, std::string> FLAGS = {
+            {"iso", "-i"}, {"device", "-o"}, {"persistence", "-p"},
+            {"fs", "-f"}, {"table", "-t"}, {"size", "--size"}
+        };
+
+        Entry merged = job;
+        merged.insert(defaults.begin(), defaults.end());
+
+        std::vector<std::string> args;
+        for (const auto& item : merged) {
+            if (item.first == "fast") {
+                if (item.second != "true" && item.second != "false") {
+                    throw FileError(path, label + ": fast must be true or false");
+                }
+                if (item.second == "true") args.push_back("-m");
+                continue;
+            }
+
+            auto flag = FLAGS.find(item.first);
+            if (flag == FLAGS.end()) {
+                throw FileError(path, label + ": unknown key " + item.first);
+            }
+            args.push_back(flag->second);
+            args.push_back(item.second);
+        }
+
+        BurnStation::JobSpec spec;
+        std::string error;
+        if (!BurnStation::parseJob(args, spec, error)) {
+            throw FileError(path, label + ": " + error);
+        }
+        return spec;
+    }
+
+    std::vector<BurnStation::JobSpec> readManifest(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) {
+            throw FileError(path, "Cannot open batch manifest");
+        }
+        std::stringstream content;
+        content << file.rdbuf();
+        std::string text = content.str();
+
+        // By extension, else by the first character: TOML opens with a key,
+        // a comment or "[[", JSON with "{" or a single "["
+        bool json;
+        size_t dot = path.find_last_of('.');
+        std::string extension = dot == std::string::npos ? "" : path.substr(dot + 1);
+        if (extension == "json" || extension == "toml") {
+            json = extension == "json";
+        } else {
+            size_t first = text.find_first_not_of(" \t\r\n");
+            json = first != std::string::npos &&
+                   (text[first] == '{' || (text[first] == '[' && text.compare(first, 2, "[[") != 0));
+        }
+
+        Entry defaults;
+        std::vector<Entry> entries = json ? readJson(path, text, defaults) :
+                                            readToml(path, text, defaults);
+        if (entries.empty()) {
+            throw FileError(path, "Batch manifest has no jobs");
+        }
+
+        std::vector<BurnStation::JobSpec> specs;
+        for (size_t i = 0; i < entries.size(); i++) {
+            specs.push_back(toSpec(path, defaults, entries[i], "job " + std::to_string(i + 1)));
+        }
+        return specs;
+    }
+
+    // ---- Planning ------------------------------------------------------
+
+    Link linkOf(const std::string& device) {
+        char resolved[PATH_MAX];
+        std::string real = realpath(device.c_str(), resolved) ? resolved : device;
+
+        struct stat st;
+        if (stat(real.c_str(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+            return {real, 0.0};
+        }
+
+        // /sys/devices/pci0000:00/0000:00:14.0/usb2/2-1/... -> usb2
+        std::string sysfs = "/sys/block/" + real.substr(real.find_last_of('/') + 1);
+        std::string path = realpath(sysfs.c_str(), resolved) ? resolved : sysfs;
+        for (size_t at = path.find("/usb"); at != std::string::npos; at = path.find("/usb", at + 1)) {
+            size_t end = path.find('/', at + 1);
+            std::string hub = path.substr(at + 1, end == std::string::npos ? std::string::npos : end - at - 1);
+            if (hub.size() <= 3 || !std::all_of(hub.begin() + 3, hub.end(), ::isdigit)) continue;
+
+            // Signalling rate in Mbit/s: 480 for USB 2, 5000 and up for USB 3
+            double mbits = 480.0;
+            std::ifstream("/sys/bus/usb/devices/" + hub + "/speed") >> mbits;
+            return {hub, mbits / 8.0 * LINK_EFFICIENCY};
+        }
+
+        return {real, 0.0};
+    }
+
+    unsigned linkCapacity(const Link& link, double deviceMBps) {
+        if (link.bandwidthMBps <= 0.0 || deviceMBps <= 0.0) return UINT_MAX;
+        return std::max(1u, static_cast<unsigned>(link.bandwidthMBps / deviceMBps));
+    }
+
+    std::vector<Job> plan(const std::vector<BurnStation::JobSpec>& specs,
+                          BurnStation::SourceTable& sources) {
+        std::vector<Job> jobs;
+
+        for (size_t i = 0; i < specs.size(); i++) {
+            const BurnStation::JobSpec& spec = specs[i];
+
+            Job job;
+            job.index = i + 1;
+            job.spec = spec;
+            job.link = linkOf(spec.device);
+
+            char resolved[PATH_MAX];
+            job.deviceKey = realpath(spec.device.c_str(), resolved) ? resolved : spec.device;
+
+            // Every job of one ISO shares a single analysis
+            job.source = sources.acquire(spec.isoPath);
+
+            BurnPlanner::DeviceProfile device = BurnPlanner::profileDevice(spec.device);
+            BurnPlanner::Plan burnPlan = BurnPlanner::plan(job.source->structure,
+                                                           job.source->composition, device,
+                                                           spec.persistenceSizeMB > 0);
+            job.deviceMBps = device.sequentialMBps;
+            job.strategy = BurnPlanner::strategyName(burnPlan.strategy);
+            job.estimatedSeconds = 0.0;
+            job.bytesWritten = 0;
+            for (const auto& estimate : burnPlan.estimates) {
+                if (estimate.strategy == burnPlan.strategy) {
+                    job.estimatedSeconds = estimate.seconds;
+                    job.bytesWritten = estimate.bytesWritten;
+                }
+            }
+            jobs.push_back(job);
+        }
+
+        // Longest first keeps the makespan short; equal estimates stay
+        // together per ISO so its burns overlap on the cached image
+        std::stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+            if (a.estimatedSeconds != b.estimatedSeconds) {
+                return a.estimatedSeconds > b.estimatedSeconds;
+            }
+            return a.spec.isoPath < b.spec.isoPath;
+        });
+        return jobs;
+    }
+
+    static std::string formatSeconds(double seconds) {
+        char text[32];
+        snprintf(text, sizeof(text), seconds < 10 ? "%.1f s" : "%.0f s", seconds);
+        return text;
+    }
+
+    void printPlan(const std::vector<Job>& jobs) {
+        std::map<std::string, size_t> perSource;
+        std::map<std::string, std::pair<Link, double>> links;
+        for (const auto& job : jobs) {
+            perSource[job.spec.isoPath]++;
+            auto& link = links[job.link.key];
+            link.first = job.link;
+            link.second = std::max(link.second, job.deviceMBps);
+        }
+
+        Logs::flush();
+        std::cout << "\n" << Colors::bold("Batch Plan:") << " " << jobs.size() << " jobs, "
+                  << perSource.size() << " sources, started longest first\n";
+        for (const auto& job : jobs) {
+            std::cout << "  #" << job.index << "  " << job.spec.isoPath << " -> " << job.spec.device
+                      << "  " << job.strategy << ", ~" << formatSeconds(job.estimatedSeconds)
+                      << (job.spec.persistenceSizeMB ? ", " + std::to_string(job.spec.persistenceSizeMB) +
+                          " MB " + job.spec.persistenceFS + " persistence" : "") << "\n";
+        }
+
+        std::cout << "\n" << Colors::bold("Shared Links:") << "\n";
+        bool shared = false;
+        for (const auto& item : links) {
+            const Link& link = item.second.first;
+            if (link.bandwidthMBps <= 0.0) continue;
+            shared = true;
+            std::cout << "  " << link.key << ": ~" << static_cast<int>(link.bandwidthMBps)
+                      << " MB/s, at most " << linkCapacity(link, item.second.second)
+                      << " concurrent burns\n";
+        }
+        if (!shared) {
+            std::cout << "  none, every target runs independently\n";
+        }
+        std::cout << std::endl;
+    }
+
+    // ---- Execution -----------------------------------------------------
+
+    struct LinkState {
+        Link link;
+        double deviceMBps = 0.0;        // Per burn, measured once a burn ran alone
+        unsigned running = 0;
+    };
+
+    struct Outcome {
+        bool ok = false;
+        std::string error;
+        double seconds = 0.0;
+    };
+
+    bool run(std::vector<Job>& jobs) {
+        std::mutex mutex;
+        std::condition_variable changed;
+
+        std::map<std::string, LinkState> links;
+        for (const auto& job : jobs) {
+            LinkState& state = links[job.link.key];
+            state.link = job.link;
+            state.deviceMBps = std::max(state.deviceMBps, job.deviceMBps);
+        }
+
+        std::vector<Job*> pending;
+        for (auto& job : jobs) pending.push_back(&job);
+
+        std::set<std::string> busyDevices;
+        std::vector<Outcome> outcomes(jobs.size());
+        std::vector<std::thread> threads;
+        unsigned running = 0;
+        unsigned slots = std::max(4u, std::thread::hardware_concurrency());
+
+        // Every image starts loading into RAM now, in the order its first
+        // job runs, weighted by how many jobs will burn it
+        SourceCache::enable();
+        std::vector<std::string> order;
+        std::map<std::string, uint64_t> uses;
+        for (const auto& job : jobs) {
+            if (uses[job.spec.isoPath]++ == 0) order.push_back(job.spec.isoPath);
+        }
+        for (const auto& isoPath : order) {
+            SourceCache::prefetch(isoPath, uses[isoPath]);
+        }
+
+        auto execute = [&](Job* job, Outcome* outcome) {
+            Logs::ScopedPrefix scope("job " + std::to_string(job->index) + " " + job->spec.device);
+
+            auto started = std::chrono::steady_clock::now();
+            unsigned sharers;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                sharers = links[job->link.key].running;
+            }
+
+            try {
+                outcome->ok = BurnStation::runJob(job->spec, *job->source, nullptr);
+                if (!outcome->ok) outcome->error = "Burn operation failed";
+            } catch (const std::exception& e) {
+                outcome->error = e.what();
+            }
+            outcome->seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - started).count();
+
+            if (outcome->ok) {
+                Logs::success("Job finished in " + formatSeconds(outcome->seconds));
+            } else {
+                Logs::error("Job failed: " + outcome->error);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            LinkState& link = links[job->link.key];
+            sharers = std::max(sharers, link.running);
+
+            // What the link really delivered replaces the sysfs figures: a
+            // burn alone measures the device, slow burns side by side
+            // measure the link
+            if (outcome->ok && link.link.bandwidthMBps > 0.0 &&
+                outcome->seconds >= MIN_MEASURED_SECONDS && job->bytesWritten > 0) {
+                double rate = job->bytesWritten / MB / outcome->seconds;
+                if (sharers <= 1) {
+                    link.deviceMBps = rate;
+                } else if (rate < link.deviceMBps * SATURATED_RATIO) {
+                    link.link.bandwidthMBps = std::min(link.link.bandwidthMBps, rate * sharers);
+                }
+                Logs::debug("Link ", link.link.key, ": ", static_cast<int>(rate), " MB/s per burn with ",
+                            sharers, " sharing, capacity now ",
+                            linkCapacity(link.link, link.deviceMBps));
+            }
+
+            link.running--;
+            busyDevices.erase(job->deviceKey);
+            running--;
+            changed.notify_all();
+        };
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!pending.empty()) {
+                // The longest job whose device is free and whose link has room
+                auto next = std::find_if(pending.begin(), pending.end(), [&](Job* job) {
+                    const LinkState& link = links[job->link.key];
+                    return !busyDevices.count(job->deviceKey) &&
+                           link.running < linkCapacity(link.link, link.deviceMBps);
+                });
+                if (next == pending.end() || running >= slots) {
+                    changed.wait(lock);
+                    continue;
+                }
+
+                Job* job = *next;
+                pending.erase(next);
+                busyDevices.insert(job->deviceKey);
+                links[job->link.key].running++;
+                running++;
+
+                Logs::info("Starting job " + std::to_string(job->index) + ": " + job->spec.isoPath +
+                           " -> " + job->spec.device + " (~" + formatSeconds(job->estimatedSeconds) + ")");
+                threads.emplace_back(execute, job, &outcomes[job - jobs.data()]);
+            }
+            changed.wait(lock, [&] { return running == 0; });
+        }
+
+        for (auto& thread : threads) thread.join();
+
+        size_t failed = 0;
+        Logs::flush();
+        std::cout << "\n" << Colors::bold("Batch Summary:") << "\n";
+        for (size_t i = 0; i < jobs.size(); i++) {
+            const Job& job = jobs[i];
+            const Outcome& outcome = outcomes[i];
+            std::string line = "  #" + std::to_string(job.index) + "  " + job.spec.isoPath + " -> " +
+                               job.spec.device + "  ";
+            if (outcome.ok) {
+                std::cout << Colors::green(line + "done in " + formatSeconds(outcome.seconds) +
+                                           " (estimated " + formatSeconds(job.estimatedSeconds) + ")") << "\n";
+            } else {
+                failed++;
+                std::cout << Colors::red(line + "failed: " + outcome.error) << "\n";
+            }
+        }
+        std::cout << std::endl;
+
+        Logs::info("Source cache: " + SourceCache::describe(SourceCache::stats()));
+        if (failed) {
+            Logs::error(std::to_string(failed) + " of " + std::to_string(jobs.size()) + " jobs failed");
+        } else {
+            Logs::success("All " + std::to_string(jobs.size()) + " jobs finished");
+        }
+        return failed == 0;
+    }
+}
@@ -0,0 +1,587 @@
+#include "lib/block_manifest.hpp"
+#include "lib/mbr_gpt.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include "utils/progress_bar.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <cstring>
+#include <cstddef>
+#include <iostream>
+#include <ctime>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+
+namespace BlockManifest {
+
+    static const char MAGIC[8] = {'M', 'Y', 'I', 'S', 'O', 'M', 'K', 'L'};
+    static const uint32_t VERSION = 1;
+    static const size_t HEADER_BLOCK = 4096;
+
+    static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static int openDevice(const std::string& device, int flags) {
+        int fd = open(device.c_str(), flags | O_DIRECT);
+        if (fd < 0) {
+            fd = open(device.c_str(), flags);
+        }
+        return fd;
+    }
+
+    static uint64_t querySize(int fd) {
+        uint64_t size = 0;
+        if (ioctl(fd, BLKGETSIZE64, &size) == 0) {
+            return size;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            return st.st_size;
+        }
+        return 0;
+    }
+
+    static bool readFully(int fd, void* buffer, size_t length, uint64_t offset) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t got = pread(fd, static_cast<uint8_t*>(buffer) + done,
+                                length - done, offset + done);
+            if (got <= 0) return false;
+            done += got;
+        }
+        return true;
+    }
+
+    static bool writeFully(int fd, const void* buffer, size_t length, uint64_t offset) {
+        size_t done = 0;
+        while (done < length) {
+            ssize_t put = pwrite(fd, static_cast<const uint8_t*>(buffer) + done,
+                                 length - done, offset + done);
+            if (put <= 0) return false;
+            done += put;
+        }
+        return true;
+    }
+
+    // Leaves never straddle two extents, so each extent is split on its own
+    static std::vector<Extent> splitChunks(const std::vector<Extent>& extents,
+                                           uint32_t chunkSize) {
+        std::vector<Extent> chunks;
+        for (const auto& extent : extents) {
+            for (uint64_t pos = 0; pos < extent.length; pos += chunkSize) {
+                uint64_t len = std::min<uint64_t>(chunkSize, extent.length - pos);
+                chunks.push_back({extent.offset + pos, len});
+            }
+        }
+        return chunks;
+    }
+
+    static std::vector<uint64_t> levelOffsets(uint64_t leafCount) {
+        std::vector<uint64_t> offsets;
+        uint64_t offset = 0;
+        uint64_t width = leafCount;
+
+        while (true) {
+            offsets.push_back(offset);
+            offset += width;
+            if (width <= 1) break;
+            width = (width + 1) / 2;
+        }
+        offsets.push_back(offset);
+        return offsets;
+    }
+
+    struct PartitionSpan {
+        Extent extent;
+        uint8_t type;
+    };
+
+    // Linux filesystem data (0FC63DAF-8483-4772-8E79-3D69D8477DE4) as stored
+    static const uint8_t GPT_LINUX_DATA[16] = {
+        0xAF, 0x3D, 0xC6, 0x0F, 0x83, 0x84, 0x72, 0x47,
+        0x8E, 0x79, 0x3D, 0x69, 0xD8, 0x47, 0x7D, 0xE4
+    };
+
+    // Entries of the primary GPT. Linux data partitions are reported as
+    // 0x83 like their MBR counterparts, anything else as 0xEE.
+    static bool readGPT(int fd, const uint8_t* head, std::vector<PartitionSpan>& partitions) {
+        BootStructures::GPTHeader header;
+        memcpy(&header, head + 512, sizeof(header));
+        if (memcmp(header.signature, "EFI PART", 8) != 0 ||
+            header.sizeOfPartitionEntry < sizeof(BootStructures::GPTPartitionEntry) ||
+            header.numberOfPartitionEntries == 0 || header.numberOfPartitionEntries > 1024) {
+            return false;
+        }
+
+        // O_DIRECT wants the array read in whole aligned blocks
+        uint64_t start = header.partitionEntryLBA * 512;
+        uint64_t length = static_cast<uint64_t>(header.numberOfPartitionEntries) *
+                          header.sizeOfPartitionEntry;
+        uint64_t blockStart = start / 4096 * 4096;
+        uint64_t blockLength = alignUp(start + length, 4096) - blockStart;
+
+        void* raw;
+        if (posix_memalign(&raw, 4096, blockLength) != 0) return false;
+        uint8_t* array = static_cast<uint8_t*>(raw);
+
+        bool ok = readFully(fd, array, blockLength, blockStart);
+        for (uint32_t i = 0; ok && i < header.numberOfPartitionEntries; i++) {
+            BootStructures::GPTPartitionEntry entry;
+            memcpy(&entry, array + (start - blockStart) + i * header.sizeOfPartitionEntry,
+                   sizeof(entry));
+
+            static const uint8_t unused[16] = {};
+            if (memcmp(entry.partitionTypeGUID, unused, 16) == 0) continue;
+            if (entry.lastLBA < entry.firstLBA) continue;
+
+            uint8_t type = memcmp(entry.partitionTypeGUID, GPT_LINUX_DATA, 16) == 0 ? 0x83 : 0xEE;
+            partitions.push_back({{entry.firstLBA * 512, (entry.lastLBA - entry.firstLBA + 1) * 512},
+                                  type});
+        }
+
+        free(raw);
+        return ok;
+    }
+
+    // Reads the MBR partition entries. The GPT protective entry spans the
+    // whole disk, so the GPT itself is read in its place: a hybrid image
+    // may keep partitions, persistence among them, that the MBR never lists
+    static std::vector<PartitionSpan> readPartitions(int fd) {
+        std::vector<PartitionSpan> partitions;
+
+        void* raw;
+        if (posix_memalign(&raw, 4096, 4096) != 0) return partitions;
+        uint8_t* sector = static_cast<uint8_t*>(raw);
+
+        bool protective = false;
+        if (readFully(fd, sector, 4096, 0) && sector[510] == 0x55 && sector[511] == 0xAA) {
+            for (int i = 0; i < 4; i++) {
+                const uint8_t* entry = sector + 446 + i * 16;
+                uint8_t type = entry[4];
+                if (type == 0xEE) protective = true;
+                if (type == 0x00 || type == 0xEE) continue;
+
+                uint32_t start, count;
+                memcpy(&start, entry + 8, 4);
+                memcpy(&count, entry + 12, 4);
+
+                partitions.push_back({{static_cast<uint64_t>(start) * 512,
+                                       static_cast<uint64_t>(count) * 512}, type});
+            }
+        }
+
+        bool readable = !protective || readGPT(fd, sector, partitions);
+        free(raw);
+
+        if (!readable) {
+            throw MyISOException("Protective MBR without a readable GPT, partitions unknown");
+        }
+        return partitions;
+    }
+
+    std::vector<Hash::Digest> hashExtents(int fd, const std::vector<Extent>& extents,
+                                          uint32_t chunkSize, const std::string& label) {
+        std::vector<Extent> chunks = splitChunks(extents, chunkSize);
+        std::vector<Hash::Digest> leaves(chunks.size());
+
+        uint64_t totalBytes = 0;
+        for (const auto& chunk : chunks) totalBytes += chunk.length;
+
+        unsigned workers = std::max(1u, std::min(8u, std::thread::hardware_concurrency()));
+        workers = std::min<unsigned>(workers, std::max<size_t>(1, chunks.size()));
+
+        std::atomic<size_t> nextChunk(0);
+        std::atomic<uint64_t> bytesDone(0);
+        std::atomic<bool> failed(false);
+
+        auto worker = [&]() {
+            void* raw;
+            if (posix_memalign(&raw, 4096, chunkSize) != 0) {
+                failed = true;
+                return;
+            }
+            uint8_t* buffer = static_cast<uint8_t*>(raw);
+
+            size_t index;
+            while (!failed && (index = nextChunk++) < chunks.size()) {
+                const Extent& chunk = chunks[index];
+                if (!readFully(fd, buffer, chunk.length, chunk.offset)) {
+                    failed = true;
+                    break;
+                }
+                leaves[index] = Hash::sha256(buffer, chunk.length);
+                bytesDone += chunk.length;
+            }
+
+            free(raw);
+        };
+
+        std::vector<std::thread> threads;
+        for (unsigned i = 0; i < workers; i++) {
+            threads.emplace_back(worker);
+        }
+
+        ProgressBar progress(totalBytes, label);
+        while (bytesDone < totalBytes && !failed) {
+            progress.update(bytesDone);
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        }
+
+        for (auto& t : threads) t.join();
+
+        if (failed) {
+            std::cout << std::endl;
+            throw MyISOException("Read error while hashing device blocks");
+        }
+
+        progress.finish();
+        return leaves;
+    }
+
+    std::vector<Hash::Digest> buildTree(const std::vector<Hash::Digest>& leaves) {
+        std::vector<Hash::Digest> nodes(leaves);
+        if (nodes.empty()) return nodes;
+
+        size_t levelStart = 0;
+        size_t width = leaves.size();
+
+        while (width > 1) {
+            for (size_t i = 0; i < width; i += 2) {
+                if (i + 1 < width) {
+                    nodes.push_back(Hash::combine(nodes[levelStart + i], nodes[levelStart + i + 1]));
+                } else {
+                    // Odd node is promoted unchanged
+                    Hash::Digest promoted = nodes[levelStart + i];
+                    nodes.push_back(promoted);
+                }
+            }
+            levelStart += width;
+            width = (width + 1) / 2;
+        }
+
+        return nodes;
+    }
+
+    std::vector<Extent> coveredExtents(const std::string& device, bool rawImage,
+                                       uint64_t isoSize) {
+        std::vector<Extent> extents;
+
+        if (rawImage) {
+            extents.push_back({0, alignUp(isoSize, 512)});
+            return extents;
+        }
+
+        int fd = openDevice(device, O_RDONLY);
+        if (fd < 0) {
+            throw DeviceError(device, "Cannot open device to read partition table");
+        }
+        std::vector<PartitionSpan> partitions;
+        try {
+            partitions = readPartitions(fd);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+
+        // Partition table and alignment gap
+        extents.push_back({0, 1024 * 1024});
+
+        // Persistence partitions change at runtime and are not covered
+        for (const auto& part : partitions) {
+            if (part.type == 0x83) continue;
+            extents.push_back(part.extent);
+        }
+
+        std::sort(extents.begin(), extents.end(),
+                  [](const Extent& a, const Extent& b) { return a.offset < b.offset; });
+
+        std::vector<Extent> merged;
+        for (const auto& extent : extents) {
+            if (!merged.empty() && merged.back().offset + merged.back().length >= extent.offset) {
+                uint64_t end = std::max(merged.back().offset + merged.back().length,
+                                        extent.offset + extent.length);
+                merged.back().length = end - merged.back().offset;
+            } else {
+                merged.push_back(extent);
+            }
+        }
+
+        return merged;
+    }
+
+    bool sealDevice(const std::string& device, const std::vector<Extent>& extents,
+                    const std::vector<Hash::Digest>& expected) {
+        if (extents.empty() || extents.size() > static_cast<size_t>(MAX_EXTENTS)) {
+            Logs::warning("Block manifest skipped: unsupported extent layout");
+            return false;
+        }
+
+        Logs::info("Writing self-verification manifest to " + device);
+
+        int fd = openDevice(device, O_RDWR);
+        if (fd < 0) {
+            throw DeviceError(device, "Cannot open device for manifest");
+        }
+
+        uint64_t deviceSize = querySize(fd);
+
+        uint64_t coveredBytes = 0;
+        uint64_t highestUsed = 0;
+        for (const auto& extent : extents) {
+            coveredBytes += extent.length;
+            highestUsed = std::max(highestUsed, extent.offset + extent.length);
+        }
+        // Every partition, GPT-only ones included, must end before the manifest
+        std::vector<PartitionSpan> partitions;
+        try {
+            partitions = readPartitions(fd);
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        for (const auto& part : partitions) {
+            highestUsed = std::max(highestUsed, part.extent.offset + part.extent.length);
+        }
+
+        uint64_t leafCount = (coveredBytes + CHUNK_SIZE - 1) / CHUNK_SIZE + extents.size();
+        uint64_t treeBytes = alignUp(leafCount * 2 * sizeof(Hash::Digest), 4096);
+
+        if (deviceSize < TAIL_RESERVE + HEADER_BLOCK + treeBytes ||
+            highestUsed > deviceSize - TAIL_RESERVE - HEADER_BLOCK - treeBytes) {
+            close(fd);
+            Logs::warning("Block manifest skipped: no free space at the end of the device");
+            return false;
+        }
+
+        std::vector<Hash::Digest> leaves = hashExtents(fd, extents, CHUNK_SIZE, "Hashing blocks");
+        
+        // Leaf 0 holds the partition table, which may be edited after the copy
+        if (!expected.empty()) {
+            uint64_t mismatches = 0;
+            for (size_t i = 1; i < leaves.size() && i < expected.size(); i++) {
+                if (leaves[i] != expected[i]) mismatches++;
+            }
+            
+            if (mismatches > 0) {
+                Logs::warning(std::to_string(mismatches) + 
+                             " blocks on the device differ from the source image");
+            } else {
+                Logs::success("Device contents match the source image index");
+            }
+        }
+        
+        std::vector<Hash::Digest> tree = buildTree(leaves);
+
+        uint64_t headerOffset = deviceSize - TAIL_RESERVE - HEADER_BLOCK;
+        uint64_t treeLength = alignUp(tree.size() * sizeof(Hash::Digest), 4096);
+        uint64_t treeOffset = headerOffset - treeLength;
+
+        void* raw;
+        if (posix_memalign(&raw, 4096, treeLength + HEADER_BLOCK) != 0) {
+            close(fd);
+            throw MyISOException("Failed to allocate manifest buffer");
+        }
+        uint8_t* buffer = static_cast<uint8_t*>(raw);
+        memset(buffer, 0, treeLength + HEADER_BLOCK);
+
+        for (size_t i = 0; i < tree.size(); i++) {
+            memcpy(buffer + i * sizeof(Hash::Digest), tree[i].data(), sizeof(Hash::Digest));
+        }
+
+        ManifestHeader* header = reinterpret_cast<ManifestHeader*>(buffer + treeLength);
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = VERSION;
+        header->chunkSize = CHUNK_SIZE;
+        header->deviceSize = deviceSize;
+        header->treeOffset = treeOffset;
+        header->nodeCount = tree.size();
+        header->leafCount = leaves.size();
+        header->extentCount = extents.size();
+        for (size_t i = 0; i < extents.size(); i++) {
+            header->extents[i] = extents[i];
+        }
+        memcpy(header->rootHash, tree.back().data(), 32);
+        header->createdAt = time(nullptr);
+
+        Hash::Digest headerHash = Hash::sha256(header, offsetof(ManifestHeader, headerHash));
+        memcpy(header->headerHash, headerHash.data(), 32);
+
+        bool ok = writeFully(fd, buffer, treeLength + HEADER_BLOCK, treeOffset);
+        free(raw);
+
+        fsync(fd);
+        close(fd);
+
+        if (!ok) {
+            throw DeviceError(device, "Failed to write block manifest");
+        }
+
+        Logs::success("Manifest sealed: " + std::to_string(leaves.size()) + " blocks, root " +
+                      Hash::toHex(tree.back()).substr(0, 16));
+        return true;
+    }
+
+    bool dropManifest(const std::string& device) {
+        int fd = openDevice(device, O_RDWR);
+        if (fd < 0) return false;
+
+        uint64_t deviceSize = querySize(fd);
+        if (deviceSize < TAIL_RESERVE + HEADER_BLOCK) {
+            close(fd);
+            return false;
+        }
+
+        void* raw;
+        if (posix_memalign(&raw, 4096, HEADER_BLOCK) != 0) {
+            close(fd);
+            return false;
+        }
+
+        uint64_t headerOffset = deviceSize - TAIL_RESERVE - HEADER_BLOCK;
+        bool found = readFully(fd, raw, HEADER_BLOCK, headerOffset) &&
+                     memcmp(raw, MAGIC, sizeof(MAGIC)) == 0;
+        if (found) {
+            memset(raw, 0, HEADER_BLOCK);
+            found = writeFully(fd, raw, HEADER_BLOCK, headerOffset);
+            fsync(fd);
+        }
+        free(raw);
+        close(fd);
+        return found;
+    }
+
+    // Walks both trees from the root and collects the leaves whose subtrees differ
+    static void locateMismatches(const std::vector<Hash::Digest>& stored,
+                                 const std::vector<Hash::Digest>& actual,
+                                 const std::vector<uint64_t>& offsets,
+                                 size_t level, uint64_t index,
+                                 std::vector<uint64_t>& badLeaves) {
+        uint64_t node = offsets[level] + index;
+        if (stored[node] == actual[node]) return;
+
+        if (level == 0) {
+            badLeaves.push_back(index);
+            return;
+        }
+
+        uint64_t childWidth = offsets[level] - offsets[level - 1];
+        for (uint64_t child = index * 2; child < index * 2 + 2 && child < childWidth; child++) {
+            locateMismatches(stored, actual, offsets, level - 1, child, badLeaves);
+        }
+    }
+
+    VerifyReport verifyDevice(const std::string& device) {
+        VerifyReport report{false, false, 0, {}};
+
+        int fd = openDevice(device, O_RDONLY);
+        if (fd < 0) {
+            throw DeviceError(device, "Cannot open device for verification");
+        }
+
+        uint64_t deviceSize = querySize(fd);
+        if (deviceSize < TAIL_RESERVE + HEADER_BLOCK) {
+            close(fd);
+            return report;
+        }
+
+        void* raw;
+        if (posix_memalign(&raw, 4096, HEADER_BLOCK) != 0) {
+            close(fd);
+            throw MyISOException("Failed to allocate manifest buffer");
+        }
+
+        ManifestHeader header;
+        bool headerRead = readFully(fd, raw, HEADER_BLOCK, deviceSize - TAIL_RESERVE - HEADER_BLOCK);
+        memcpy(&header, raw, sizeof(ManifestHeader));
+        free(raw);
+
+        if (!headerRead || memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+            close(fd);
+            return report;
+        }
+
+        Hash::Digest headerHash = Hash::sha256(&header, offsetof(ManifestHeader, headerHash));
+        if (memcmp(headerHash.data(), header.headerHash, 32) != 0 ||
+            header.version != VERSION || header.deviceSize != deviceSize ||
+            header.extentCount == 0 || header.extentCount > MAX_EXTENTS ||
+            header.chunkSize == 0 || header.chunkSize % 4096 != 0) {
+            close(fd);
+            Logs::warning("Manifest header on " + device + " is damaged");
+            return report;
+        }
+
+        report.manifestFound = true;
+
+        std::vector<Extent> extents(header.extents, header.extents + header.extentCount);
+        std::vector<uint64_t> offsets = levelOffsets(header.leafCount);
+
+        if (splitChunks(extents, header.chunkSize).size() != header.leafCount ||
+            offsets.back() != header.nodeCount) {
+            close(fd);
+            Logs::warning("Manifest tree geometry is inconsistent");
+            report.manifestFound = false;
+            return report;
+        }
+
+        uint64_t treeLength = alignUp(header.nodeCount * sizeof(Hash::Digest), 4096);
+        if (posix_memalign(&raw, 4096, treeLength) != 0) {
+            close(fd);
+            throw MyISOException("Failed to allocate manifest buffer");
+        }
+
+        if (!readFully(fd, raw, treeLength, header.treeOffset)) {
+            free(raw);
+            close(fd);
+            throw DeviceError(device, "Cannot read manifest tree");
+        }
+
+        std::vector<Hash::Digest> stored(header.nodeCount);
+        for (size_t i = 0; i < stored.size(); i++) {
+            memcpy(stored[i].data(), static_cast<uint8_t*>(raw) + i * 32, 32);
+        }
+        free(raw);
+
+        // The stored leaves must reproduce the sealed root, otherwise the
+        // manifest itself has rotted
+        std::vector<Hash::Digest> storedLeaves(stored.begin(), stored.begin() + header.leafCount);
+        if (buildTree(storedLeaves) != stored ||
+            memcmp(stored.back().data(), header.rootHash, 32) != 0) {
+            close(fd);
+            Logs::warning("Manifest tree failed its own integrity check");
+            report.manifestFound = false;
+            return report;
+        }
+
+        Logs::info("Verifying " + std::to_string(header.leafCount) + " blocks against manifest");
+
+        std::vector<Hash::Digest> leaves = hashExtents(fd, extents, header.chunkSize, "Verifying");
+        close(fd);
+
+        std::vector<Hash::Digest> actual = buildTree(leaves);
+        for (const auto& extent : extents) report.bytesChecked += extent.length;
+
+        std::vector<uint64_t> badLeaves;
+        locateMismatches(stored, actual, offsets, offsets.size() - 2, 0, badLeaves);
+        report.intact = badLeaves.empty();
+
+        std::vector<Extent> chunks = splitChunks(extents, header.chunkSize);
+        for (uint64_t leaf : badLeaves) {
+            const Extent& chunk = chunks[leaf];
+            if (!report.corrupted.empty() &&
+                report.corrupted.back().offset + report.corrupted.back().length == chunk.offset) {
+                report.corrupted.back().length += chunk.length;
+            } else {
+                report.corrupted.push_back(chunk);
+            }
+        }
+
+        return report;
+    }
+}
@@ -0,0 +1,295 @@
+#include "lib/block_target.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/errors.hpp"
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <memory>
+
+namespace BlockTarget {
+    
+    static const size_t ZERO_SIZE = 1024 * 1024;
+    static const size_t COPY_SIZE = 4 * 1024 * 1024;
+    
+    bool isImageFile(const std::string& path) {
+        struct stat st;
+        return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+    }
+    
+    bool createImage(const std::string& path, uint64_t size) {
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        
+        bool sized = ftruncate(fd, size) == 0;
+        close(fd);
+        return sized;
+    }
+    
+    uint64_t parseSize(const std::string& text) {
+        if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) {
+            return 0;
+        }
+        
+        char* end = nullptr;
+        uint64_t value = strtoull(text.c_str(), &end, 10);
+        std::string suffix(end);
+        
+        if (suffix.size() == 2 && (suffix[1] == 'B' || suffix[1] == 'b')) {
+            suffix.pop_back();
+        }
+        if (suffix.size() > 1) {
+            return 0;
+        }
+        
+        switch (suffix.empty() ? '\0' : toupper(static_cast<unsigned char>(suffix[0]))) {
+            case '\0': return value;
+            case 'K': return value << 10;
+            case 'M': return value << 20;
+            case 'G': return value << 30;
+            case 'T': return value << 40;
+            default: return 0;
+        }
+    }
+    
+    uint64_t querySize(int fd) {
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            return 0;
+        }
+        
+        if (S_ISREG(st.st_mode)) {
+            return st.st_size;
+        }
+        
+        uint64_t size = 0;
+        if (ioctl(fd, BLKGETSIZE64, &size) != 0) {
+            return 0;
+        }
+        return size;
+    }
+    
+    uint64_t querySize(const std::string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return 0;
+        }
+        
+        uint64_t size = querySize(fd);
+        close(fd);
+        return size;
+    }
+    
+    std::vector<Pipeline::Extent> mapData(int fd, uint64_t size) {
+        std::vector<Pipeline::Extent> extents;
+        
+        // Holes of a copy still being staged are not zeros yet
+        if (SourceStager::sourceExtents(fd, size, extents)) {
+            return extents;
+        }
+        
+        off_t offset = 0;
+        while (static_cast<uint64_t>(offset) < size) {
+            off_t start = lseek(fd, offset, SEEK_DATA);
+            if (start < 0) {
+                // ENXIO: only a hole is left. Anything else means holes are
+                // not supported here, so read the rest as data
+                if (errno != ENXIO) extents.push_back({static_cast<uint64_t>(offset), size - offset});
+                break;
+            }
+            if (static_cast<uint64_t>(start) >= size) break;
+            
+            off_t end = lseek(fd, start, SEEK_HOLE);
+            uint64_t stop = end < 0 ? size : std::min<uint64_t>(end, size);
+            extents.push_back({static_cast<uint64_t>(start), stop - start});
+            offset = stop;
+        }
+        
+        return extents;
+    }
+    
+    bool isHole(int fd, uint64_t offset, uint64_t length) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+            return false;
+        }
+        
+        off_t next = lseek(fd, offset, SEEK_DATA);
+        if (next < 0) {
+            return errno == ENXIO;
+        }
+        return static_cast<uint64_t>(next) >= offset + length;
+    }
+    
+    bool tryZeroRange(int fd, uint64_t offset, uint64_t length, bool keepAllocated) {
+        if (length == 0) return true;
+        
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            if (keepAllocated && fallocate(fd, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE, offset, length) == 0) {
+                return true;
+            }
+            // Keeps the file size, so a range past the end is not zeroed;
+            // it reads back as zeros anyway
+            return fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0 ||
+                   fallocate(fd, FALLOC_FL_ZERO_RANGE, offset, length) == 0;
+        }
+        
+        uint64_t range[2] = {offset, length};
+        return ioctl(fd, BLKZEROOUT, range) == 0;
+    }
+    
+    void zeroRange(int fd, const std::string& path, uint64_t offset, uint64_t length) {
+        if (tryZeroRange(fd, offset, length)) return;
+        
+        // No zeroing support: write the zeros ourselves
+        void* zeros;
+        if (posix_memalign(&zeros, 4096, ZERO_SIZE) != 0) {
+            throw MyISOException("Failed to allocate aligned buffer");
+        }
+        memset(zeros, 0, ZERO_SIZE);
+        
+        uint64_t done = 0;
+        while (done < length) {
+            size_t chunk = std::min<uint64_t>(ZERO_SIZE, length - done);
+            ssize_t written = pwrite(fd, zeros, chunk, offset + done);
+            if (written <= 0) {
+                free(zeros);
+                throw DeviceError(path, "Write operation failed");
+            }
+            done += written;
+        }
+        
+        free(zeros);
+    }
+    
+    bool cloneRange(int inputFd, uint64_t inputOffset, int outputFd, uint64_t outputOffset,
+                    uint64_t length) {
+        SourceStager::await(inputFd, inputOffset, length);
+        
+        struct file_clone_range range;
+        range.src_fd = inputFd;
+        range.src_offset = inputOffset;
+        range.src_length = length;
+        range.dest_offset = outputOffset;
+        return ioctl(outputFd, FICLONERANGE, &range) == 0;
+    }
+    
+    // Largest head of the range FICLONERANGE accepts: both files on one
+    // filesystem, block-aligned offsets, and a block-aligned length unless
+    // the range runs to the end of the source
+    static uint64_t cloneableLength(int inputFd, uint64_t inputOffset, int outputFd,
+                                    uint64_t outputOffset, uint64_t length) {
+        struct stat in, out;
+        if (fstat(inputFd, &in) != 0 || fstat(outputFd, &out) != 0 ||
+            !S_ISREG(in.st_mode) || !S_ISREG(out.st_mode) || in.st_dev != out.st_dev) {
+            return 0;
+        }
+        
+        uint64_t block = std::max<uint64_t>(out.st_blksize, 512);
+        if (inputOffset % block != 0 || outputOffset % block != 0) {
+            return 0;
+        }
+        
+        if (inputOffset + length != static_cast<uint64_t>(in.st_size)) {
+            length -= length % block;
+        }
+        return length;
+    }
+    
+    uint64_t copyRange(int inputFd, uint64_t inputOffset, int outputFd, uint64_t outputOffset,
+                       uint64_t length) {
+        uint64_t done = 0;
+        uint64_t shared = 0;
+        
+        SourceStager::await(inputFd, inputOffset, length);
+        
+        uint64_t cloneable = cloneableLength(inputFd, inputOffset, outputFd, outputOffset, length);
+        if (cloneable > 0 && cloneRange(inputFd, inputOffset, outputFd, outputOffset, cloneable)) {
+            done = shared = cloneable;
+        }
+        
+        while (done < length) {
+            loff_t in = inputOffset + done;
+            loff_t out = outputOffset + done;
+            ssize_t copied = copy_file_range(inputFd, &in, outputFd, &out, length - done, 0);
+            if (copied <= 0) break;
+            done += copied;
+        }
+        
+        if (done == length) return shared;
+        
+        // EXDEV, EINVAL (block device), or an old kernel
+        std::unique_ptr<uint8_t[]> buffer(new uint8_t[COPY_SIZE]);
+        while (done < length) {
+            size_t want = std::min<uint64_t>(COPY_SIZE, length - done);
+            ssize_t got = pread(inputFd, buffer.get(), want, inputOffset + done);
+            if (got <= 0) {
+                throw MyISOException("Read operation failed");
+            }
+            
+            ssize_t put = 0;
+            while (put < got) {
+                ssize_t written = pwrite(outputFd, buffer.get() + put, got - put,
+                                         outputOffset + done + put);
+                if (written <= 0) {
+                    throw MyISOException("Write operation failed");
+                }
+                put += written;
+            }
+            done += got;
+        }
+        
+        return shared;
+    }
+    
+    std::vector<Partition> readPartitions(const std::string& path) {
+        std::vector<Partition> partitions;
+        
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw DeviceError(path, "Cannot open target to read partition table");
+        }
+        
+        uint8_t mbr[512];
+        ssize_t got = pread(fd, mbr, sizeof(mbr), 0);
+        close(fd);
+        
+        if (got != sizeof(mbr) || mbr[510] != 0x55 || mbr[511] != 0xAA) {
+            return partitions;
+        }
+        
+        for (int i = 0; i < 4; i++) {
+            const uint8_t* entry = mbr + 446 + i * 16;
+            uint32_t start, count;
+            memcpy(&start, entry + 8, sizeof(start));
+            memcpy(&count, entry + 12, sizeof(count));
+            
+            if (entry[4] == 0 || count == 0) continue;
+            
+            partitions.push_back({i + 1, entry[4], entry[0] == 0x80,
+                                  static_cast<uint64_t>(start) * 512,
+                                  static_cast<uint64_t>(count) * 512});
+        }
+        
+        return partitions;
+    }
+    
+    bool findPartition(const std::string& path, int number, Partition& partition) {
+        for (const auto& candidate : readPartitions(path)) {
+            if (candidate.number == number) {
+                partition = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+}
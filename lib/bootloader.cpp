@@ -1,4 +1,9 @@
 #include "lib/bootloader.hpp"
+#include "lib/block_target.hpp"
+#include "lib/fat_writer.hpp"
+#include "lib/mbr_gpt.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
 #include "utils/progress_bar.hpp"
@@ -7,30 +12,23 @@
 #include <sys/stat.h>
 #include <sys/mount.h>
 #include <cstring>
-#include <fstream>
+#include <sstream>
 #include <filesystem>
 
 namespace Bootloader {
     
-    BootloaderInstaller::BootloaderInstaller(const std::string& dev, BootType type)
-        : device(dev), mountPoint("/tmp/myiso_boot_" + std::to_string(getpid())), 
-          bootType(type) {
-    }
-    
-    BootloaderInstaller::~BootloaderInstaller() {
-        if (std::filesystem::exists(mountPoint)) {
-            umount(mountPoint.c_str());
-            std::filesystem::remove_all(mountPoint);
-        }
+    BootloaderInstaller::BootloaderInstaller(const std::string& dev, BootType type, bool mbr)
+        : device(dev), bootType(type), writeMBR(mbr) {
     }
     
     bool BootloaderInstaller::detectBootType(const std::string& isoPath) {
         Logs::info("Detecting bootloader type from ISO");
         
-        int fd = open(isoPath.c_str(), O_RDONLY);
+        int fd = SourceCache::openSource(isoPath);
         if (fd < 0) return false;
         
         char buffer[32768];
+        SourceStager::await(fd, 0, sizeof(buffer));
         ssize_t bytes = read(fd, buffer, sizeof(buffer));
         close(fd);
         
@@ -72,6 +70,9 @@ namespace Bootloader {
             }
         }
         
+        // A loop device reads past the per-range waits on a staged copy
+        SourceStager::complete(isoPath);
+        
         std::string losetup = "losetup " + loopDevice + " " + isoPath + " 2>/dev/null";
         if (system(losetup.c_str()) != 0) {
             Logs::warning("Failed to setup loop device, using direct dd method");
@@ -99,53 +100,76 @@ namespace Bootloader {
         return true;
     }
     
-    bool BootloaderInstaller::installSyslinux() {
-        Logs::info("Installing SYSLINUX bootloader");
-        
-        std::filesystem::create_directories(mountPoint);
-        
-        std::string part1 = device;
-        if (device.back() >= '0' && device.back() <= '9') {
-            part1 = device + "1";
-        } else {
-            part1 = device + "1";
+    bool BootloaderInstaller::writeConfig(const std::string& path, const std::string& contents) {
+        BlockTarget::Partition part;
+        if (!BlockTarget::findPartition(device, 1, part)) {
+            Logs::warning("No first partition on " + device + " for bootloader files");
+            return false;
         }
         
-        if (mount(part1.c_str(), mountPoint.c_str(), "vfat", 0, nullptr) != 0) {
-            Logs::warning("Failed to mount partition for bootloader installation");
+        try {
+            FatWriter::Volume volume(device, part.offset);
+            volume.open();
+            volume.load();
+            
+            // Keys of files() are upper-case and relative to the root
+            std::string key;
+            for (char c : path) {
+                key += static_cast<char>(toupper(static_cast<unsigned char>(c)));
+            }
+            
+            size_t slash = 0;
+            while ((slash = path.find('/', slash + 1)) != std::string::npos) {
+                if (!volume.files().count(key.substr(0, slash))) {
+                    volume.makeDirectory(path.substr(0, slash));
+                }
+            }
+            
+            if (volume.files().count(key)) {
+                volume.remove(path);
+            }
+            
+            volume.addFile(path, contents);
+            volume.commit();
+        } catch (const MyISOException& e) {
+            // Raw hybrid layouts keep ISO9660 in partition 1
+            Logs::warning("Cannot write bootloader files to partition 1: " + std::string(e.what()));
             return false;
         }
         
-        std::string syslinuxDir = mountPoint + "/syslinux";
-        std::filesystem::create_directories(syslinuxDir);
-        
-        std::ofstream cfg(syslinuxDir + "/syslinux.cfg");
-        if (cfg.is_open()) {
-            cfg << "DEFAULT menu.c32\n";
-            cfg << "PROMPT 0\n";
-            cfg << "TIMEOUT 300\n";
-            cfg << "\n";
-            cfg << "MENU TITLE MyISO Boot Menu\n";
-            cfg << "MENU BACKGROUND splash.png\n";
-            cfg << "\n";
-            cfg << "LABEL linux\n";
-            cfg << "  MENU LABEL Boot Linux\n";
-            cfg << "  KERNEL /casper/vmlinuz\n";
-            cfg << "  APPEND initrd=/casper/initrd boot=casper quiet splash ---\n";
-            cfg << "\n";
-            cfg << "LABEL persistent\n";
-            cfg << "  MENU LABEL Boot with Persistence\n";
-            cfg << "  KERNEL /casper/vmlinuz\n";
-            cfg << "  APPEND initrd=/casper/initrd boot=casper persistent quiet splash ---\n";
-            cfg.close();
+        return true;
+    }
+    
+    bool BootloaderInstaller::installSyslinux() {
+        Logs::info("Installing SYSLINUX bootloader");
+        
+        std::ostringstream cfg;
+        cfg << "DEFAULT menu.c32\n";
+        cfg << "PROMPT 0\n";
+        cfg << "TIMEOUT 300\n";
+        cfg << "\n";
+        cfg << "MENU TITLE MyISO Boot Menu\n";
+        cfg << "MENU BACKGROUND splash.png\n";
+        cfg << "\n";
+        cfg << "LABEL linux\n";
+        cfg << "  MENU LABEL Boot Linux\n";
+        cfg << "  KERNEL /casper/vmlinuz\n";
+        cfg << "  APPEND initrd=/casper/initrd boot=casper quiet splash ---\n";
+        cfg << "\n";
+        cfg << "LABEL persistent\n";
+        cfg << "  MENU LABEL Boot with Persistence\n";
+        cfg << "  KERNEL /casper/vmlinuz\n";
+        cfg << "  APPEND initrd=/casper/initrd boot=casper persistent quiet splash ---\n";
+        
+        if (!writeConfig("syslinux/syslinux.cfg", cfg.str())) {
+            Logs::warning("Failed to write SYSLINUX configuration");
+            return false;
         }
         
-        if (!writeSyslinuxMBR()) {
+        if (writeMBR && !writeSyslinuxMBR()) {
             Logs::warning("Failed to write SYSLINUX MBR");
         }
         
-        umount(mountPoint.c_str());
-        
         Logs::success("SYSLINUX bootloader installed");
         return true;
     }
@@ -153,53 +177,42 @@ namespace Bootloader {
     bool BootloaderInstaller::installGrub() {
         Logs::info("Installing GRUB bootloader");
         
-        std::filesystem::create_directories(mountPoint);
-        
-        std::string part1 = device + "1";
-        if (mount(part1.c_str(), mountPoint.c_str(), "vfat", 0, nullptr) != 0) {
+        std::ostringstream cfg;
+        cfg << "set timeout=10\n";
+        cfg << "set default=0\n";
+        cfg << "\n";
+        cfg << "menuentry \"Boot Linux\" {\n";
+        cfg << "  linux /casper/vmlinuz boot=casper quiet splash ---\n";
+        cfg << "  initrd /casper/initrd\n";
+        cfg << "}\n";
+        cfg << "\n";
+        cfg << "menuentry \"Boot with Persistence\" {\n";
+        cfg << "  linux /casper/vmlinuz boot=casper persistent quiet splash ---\n";
+        cfg << "  initrd /casper/initrd\n";
+        cfg << "}\n";
+        
+        if (!writeConfig("boot/grub/grub.cfg", cfg.str())) {
+            Logs::warning("Failed to write GRUB configuration");
             return false;
         }
         
-        std::string grubDir = mountPoint + "/boot/grub";
-        std::filesystem::create_directories(grubDir);
-        
-        std::ofstream cfg(grubDir + "/grub.cfg");
-        if (cfg.is_open()) {
-            cfg << "set timeout=10\n";
-            cfg << "set default=0\n";
-            cfg << "\n";
-            cfg << "menuentry \"Boot Linux\" {\n";
-            cfg << "  linux /casper/vmlinuz boot=casper quiet splash ---\n";
-            cfg << "  initrd /casper/initrd\n";
-            cfg << "}\n";
-            cfg << "\n";
-            cfg << "menuentry \"Boot with Persistence\" {\n";
-            cfg << "  linux /casper/vmlinuz boot=casper persistent quiet splash ---\n";
-            cfg << "  initrd /casper/initrd\n";
-            cfg << "}\n";
-            cfg.close();
-        }
-        
-        umount(mountPoint.c_str());
-        
         Logs::success("GRUB bootloader installed");
         return true;
     }
     
     bool BootloaderInstaller::writeSyslinuxMBR() {
-        std::vector<uint8_t> mbrCode = getSyslinuxMBRCode();
-        
-        int fd = open(device.c_str(), O_RDWR | O_SYNC);
-        if (fd < 0) return false;
-        
-        if (write(fd, mbrCode.data(), 440) != 440) {
-            close(fd);
+        // Goes through the staged table so the disk signature and partition
+        // entries in sector 0 are rewritten from what was just read
+        try {
+            BootStructures::PartitionTable table(device);
+            table.initialize();
+            table.writeBootloader(getSyslinuxMBRCode());
+            table.commit();
+        } catch (const MyISOException& e) {
+            Logs::warning(e.what());
             return false;
         }
         
-        fsync(fd);
-        close(fd);
-        
         return true;
     }
     
@@ -236,8 +249,21 @@ namespace Bootloader {
         }
     }
     
-    bool installBootloader(const std::string& device, const std::string& isoPath) {
-        BootloaderInstaller installer(device);
+    bool stageBootCode(BootStructures::PartitionTable& table, const std::string& isoPath) {
+        BootloaderInstaller probe("");
+        probe.detectBootType(isoPath);
+        
+        // Only the SYSLINUX path carries MBR code; GRUB is configured in place
+        if (probe.getBootType() == BootType::GRUB) {
+            return false;
+        }
+        
+        table.writeBootloader(BootloaderInstaller::getSyslinuxMBRCode());
+        return true;
+    }
+    
+    bool installBootloader(const std::string& device, const std::string& isoPath, bool writeMBR) {
+        BootloaderInstaller installer(device, BootType::AUTO, writeMBR);
         
         installer.detectBootType(isoPath);
         
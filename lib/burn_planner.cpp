@@ -0,0 +1,259 @@
+#include "lib/burn_planner.hpp"
+#include "lib/iso_index.hpp"
+#include "lib/block_target.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <climits>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+namespace BurnPlanner {
+
+    static const double MB = 1024.0 * 1024.0;
+    static const uint64_t CLUSTER_SIZE = 4096;
+    static const uint64_t SMALL_FILE = 64 * 1024;
+    static const uint64_t FAT32_MAX_FILE = 0xFFFFFFFFULL;
+
+    // Block devices wait for partition nodes after every table change
+    // (sleep, partprobe, sleep in settlePartitions)
+    static const double SETTLE_SECONDS = 4.0;
+
+    // Boot sectors, FATs and root directory of a fresh filesystem
+    static const uint64_t FORMAT_WRITES = 8;
+
+    // cp through a mounted vfat: file tail, directory entry, FAT sector
+    static const uint64_t VFAT_WRITES_PER_FILE = 3;
+
+    // The structural choice is kept unless another strategy is clearly faster
+    static const double SWITCH_MARGIN = 1.05;
+
+    std::string strategyName(ISOAnalyzer::BurnStrategy strategy) {
+        switch (strategy) {
+            case ISOAnalyzer::BurnStrategy::RAW_COPY: return "Raw copy";
+            case ISOAnalyzer::BurnStrategy::SMART_EXTRACT: return "Smart extract";
+            case ISOAnalyzer::BurnStrategy::HYBRID_PRESERVE: return "Hybrid preserve";
+            case ISOAnalyzer::BurnStrategy::MULTIPART: return "Multi-partition";
+        }
+        return "Unknown";
+    }
+
+    Composition analyzeComposition(const std::string& isoPath) {
+        Composition composition = {0, 0, 0, 0, 0, 0, 0, false};
+        ISO9660::Image image;
+
+        std::unique_ptr<ISOIndex::Index> index = ISOIndex::Index::open(isoPath);
+        if (index) {
+            image = index->image();
+            composition.isoBytes = index->isoSize();
+            composition.zeroBytes = std::min<uint64_t>(index->zeroChunks() * index->chunkSize(),
+                                                       composition.isoBytes);
+            composition.zeroKnown = true;
+        } else {
+            if (!ISO9660::readImage(isoPath, image)) {
+                throw FileError(isoPath, "Cannot read ISO directory tree");
+            }
+
+            // Without an index only holes of a sparse ISO are known zeros
+            int fd = open(isoPath.c_str(), O_RDONLY);
+            if (fd < 0) {
+                throw FileError(isoPath, "Cannot open ISO file");
+            }
+            composition.isoBytes = BlockTarget::querySize(fd);
+            uint64_t data = 0;
+            for (const auto& extent : BlockTarget::mapData(fd, composition.isoBytes)) {
+                data += extent.length;
+            }
+            close(fd);
+
+            composition.zeroBytes = composition.isoBytes - std::min(data, composition.isoBytes);
+            composition.zeroKnown = composition.zeroBytes > 0;
+        }
+
+        for (const auto& entry : image.entries) {
+            if (entry.isDirectory) {
+                if (entry.path != "/") composition.directoryCount++;
+                continue;
+            }
+
+            composition.fileCount++;
+            composition.fileBytes += entry.size;
+            composition.largestFile = std::max(composition.largestFile, entry.size);
+            if (entry.size < SMALL_FILE) composition.smallFiles++;
+        }
+
+        return composition;
+    }
+
+    static bool readProfile(const char* text, DeviceProfile& profile) {
+        double sequential = 0, iops = 0;
+        if (!text || sscanf(text, "%lf:%lf", &sequential, &iops) != 2 ||
+            sequential <= 0 || iops <= 0) {
+            return false;
+        }
+
+        profile.kind += " (measured)";
+        profile.sequentialMBps = sequential;
+        profile.smallWriteIOPS = iops;
+        return true;
+    }
+
+    DeviceProfile profileDevice(const std::string& device) {
+        DeviceProfile profile;
+
+        // Anything but a block device is (or becomes) an image file.
+        // Typical figures per device class; cheap flash sticks write large
+        // blocks acceptably but crawl on scattered 4 KiB writes
+        struct stat st;
+        if (stat(device.c_str(), &st) != 0 || !S_ISBLK(st.st_mode)) {
+            profile = {"image file", 1000.0, 20000.0, true};
+        } else {
+            char resolved[PATH_MAX];
+            std::string name = realpath(device.c_str(), resolved) ? resolved : device;
+            name = name.substr(name.find_last_of('/') + 1);
+
+            std::string sysfs = "/sys/block/" + name;
+            std::string path = realpath(sysfs.c_str(), resolved) ? resolved : sysfs;
+
+            int rotational = 0;
+            std::ifstream(sysfs + "/queue/rotational") >> rotational;
+
+            if (path.find("/usb") != std::string::npos) {
+                profile = {"USB flash", 25.0, 150.0, false};
+            } else if (rotational) {
+                profile = {"hard disk", 120.0, 80.0, false};
+            } else {
+                profile = {"solid-state", 500.0, 10000.0, false};
+            }
+        }
+
+        readProfile(getenv("MYISO_DEVICE_PROFILE"), profile);
+        return profile;
+    }
+
+    static void cost(Estimate& estimate, const DeviceProfile& device, uint64_t bytes,
+                     uint64_t smallWrites, int settles) {
+        estimate.bytesWritten = bytes;
+        estimate.smallWrites = smallWrites;
+        estimate.seconds = bytes / (device.sequentialMBps * MB) +
+                           smallWrites / device.smallWriteIOPS +
+                           (device.imageFile ? 0 : settles * SETTLE_SECONDS);
+    }
+
+    Plan plan(const ISOAnalyzer::ISOStructure& structure, const Composition& composition,
+              const DeviceProfile& device, bool persistence) {
+        Plan result;
+        result.composition = composition;
+        result.device = device;
+
+        // Whole-image copies write the zero ranges too, unless the target
+        // keeps them as holes
+        uint64_t imageBytes = composition.isoBytes -
+                              (device.imageFile ? composition.zeroBytes : 0);
+
+        // Extraction writes file data cluster by cluster plus the FATs and
+        // directories; through vfat every file also costs scattered updates
+        uint64_t clusters = (composition.fileBytes + CLUSTER_SIZE - 1) / CLUSTER_SIZE +
+                            composition.fileCount / 2 + composition.directoryCount;
+        uint64_t extractBytes = clusters * CLUSTER_SIZE + clusters * 4 * 2;
+        uint64_t extractWrites = FORMAT_WRITES + (device.imageFile ?
+            composition.directoryCount :
+            (composition.fileCount + composition.directoryCount) * VFAT_WRITES_PER_FILE);
+        uint64_t persistWrites = persistence ? FORMAT_WRITES : 0;
+
+        bool fitsFAT32 = composition.largestFile <= FAT32_MAX_FILE;
+        bool dataOnly = !structure.hasElTorito && !structure.hasUEFI;
+
+        const ISOAnalyzer::BurnStrategy all[] = {
+            ISOAnalyzer::BurnStrategy::RAW_COPY,
+            ISOAnalyzer::BurnStrategy::HYBRID_PRESERVE,
+            ISOAnalyzer::BurnStrategy::SMART_EXTRACT,
+            ISOAnalyzer::BurnStrategy::MULTIPART
+        };
+
+        for (ISOAnalyzer::BurnStrategy strategy : all) {
+            Estimate estimate = {strategy, true, "", 0, 0, 0.0};
+
+            switch (strategy) {
+                case ISOAnalyzer::BurnStrategy::RAW_COPY:
+                    if (persistence) {
+                        estimate.valid = false;
+                        estimate.reason = "leaves no persistence partition";
+                    } else if (!structure.isHybrid && !dataOnly) {
+                        estimate.valid = false;
+                        estimate.reason = "not a hybrid image, would not boot from USB";
+                    }
+                    cost(estimate, device, imageBytes, 0, 0);
+                    break;
+
+                case ISOAnalyzer::BurnStrategy::HYBRID_PRESERVE:
+                    if (!structure.isHybrid || structure.embeddedPartitions.empty()) {
+                        estimate.valid = false;
+                        estimate.reason = "no embedded partition table";
+                    }
+                    cost(estimate, device, imageBytes, persistWrites, persistence ? 2 : 0);
+                    break;
+
+                case ISOAnalyzer::BurnStrategy::SMART_EXTRACT:
+                    if (!fitsFAT32) {
+                        estimate.valid = false;
+                        estimate.reason = "a file exceeds the FAT32 4 GiB limit";
+                    } else if (structure.isMultiBoot) {
+                        estimate.valid = false;
+                        estimate.reason = "UEFI and BIOS boot need separate partitions";
+                    }
+                    cost(estimate, device, extractBytes, extractWrites + persistWrites, 1);
+                    break;
+
+                case ISOAnalyzer::BurnStrategy::MULTIPART:
+                    if (!fitsFAT32) {
+                        estimate.valid = false;
+                        estimate.reason = "a file exceeds the FAT32 4 GiB limit";
+                    } else if (!structure.hasUEFI) {
+                        estimate.valid = false;
+                        estimate.reason = "no UEFI boot files for an ESP";
+                    }
+                    cost(estimate, device, extractBytes + structure.efiImage.size,
+                         extractWrites + persistWrites +
+                         (structure.efiImage.size > 0 ? 0 : FORMAT_WRITES), 1);
+                    break;
+            }
+
+            result.estimates.push_back(estimate);
+        }
+
+        // Start from the structural choice and switch only for a clear win
+        result.strategy = ISOAnalyzer::determineBurnStrategy(structure);
+        const Estimate* chosen = nullptr;
+        for (const auto& estimate : result.estimates) {
+            if (estimate.strategy == result.strategy && estimate.valid) chosen = &estimate;
+        }
+
+        for (const auto& estimate : result.estimates) {
+            if (!estimate.valid) continue;
+            if (!chosen || estimate.seconds * SWITCH_MARGIN < chosen->seconds) {
+                chosen = &estimate;
+            }
+        }
+
+        if (chosen) {
+            result.strategy = chosen->strategy;
+            Logs::debug("Burn planner: ", strategyName(chosen->strategy), ", estimated ",
+                        static_cast<int>(chosen->seconds + 0.5), " s on ", device.kind);
+        } else {
+            Logs::warning("No strategy passed the planner checks, using " +
+                          strategyName(result.strategy));
+        }
+
+        return result;
+    }
+
+    Plan plan(const std::string& isoPath, const std::string& device,
+              const ISOAnalyzer::ISOStructure& structure, bool persistence) {
+        return plan(structure, analyzeComposition(isoPath), profileDevice(device), persistence);
+    }
+}
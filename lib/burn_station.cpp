@@ -0,0 +1,731 @@
+#include "lib/burn_station.hpp"
+#include "lib/smart_burner.hpp"
+#include "lib/iso_burner.hpp"
+#include "lib/dev_handler.hpp"
+#include "lib/block_target.hpp"
+#include "lib/fs_supports.hpp"
+#include "lib/partition_sizing.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/http_source.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+namespace BurnStation {
+
+    static const size_t QUEUE_CAPACITY = 256;
+    static const size_t MAX_LINE = 64 * 1024;
+
+    // Written by the signal handler, read by the accept loop
+    static int signalPipe = -1;
+
+    struct Station::Client {
+        int fd;
+        std::mutex writeMutex;
+        std::atomic<bool> finished{false};
+
+        // Jobs this client follows; watchAll follows every job
+        std::mutex watchMutex;
+        std::set<uint64_t> watching;
+        bool watchAll = false;
+
+        explicit Client(int socket) : fd(socket) {}
+
+        ~Client() {
+            close(fd);
+        }
+
+        bool follows(uint64_t job) {
+            std::lock_guard<std::mutex> lock(watchMutex);
+            return watchAll || watching.count(job) > 0;
+        }
+
+        // A client that went away just stops receiving events
+        void send(const std::string& line) {
+            std::string data = line + "\n";
+            std::lock_guard<std::mutex> lock(writeMutex);
+            size_t sent = 0;
+            while (sent < data.size()) {
+                ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0) return;
+                sent += n;
+            }
+        }
+    };
+
+    struct Station::Job {
+        uint64_t id;
+        JobSpec spec;
+        std::string deviceKey;          // Resolved device path, one lane per device
+
+        std::mutex mutex;
+        JobState state = JobState::QUEUED;
+        std::string error;
+        std::string task;
+        size_t finishedTasks = 0;
+        size_t totalTasks = 0;
+    };
+
+    static std::string jsonString(const std::string& text) {
+        std::string out = "\"";
+        for (unsigned char c : text) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                    } else {
+                        out += static_cast<char>(c);
+                    }
+            }
+        }
+        return out + "\"";
+    }
+
+    static std::string errorEvent(const std::string& message) {
+        return "{\"event\":\"error\",\"message\":" + jsonString(message) + "}";
+    }
+
+    std::string stateName(JobState state) {
+        switch (state) {
+            case JobState::QUEUED: return "queued";
+            case JobState::RUNNING: return "running";
+            case JobState::DONE: return "done";
+            case JobState::FAILED: return "failed";
+            case JobState::CANCELLED: return "cancelled";
+        }
+        return "unknown";
+    }
+
+    std::vector<std::string> tokenize(const std::string& line) {
+        std::vector<std::string> tokens;
+        std::string current;
+        bool inToken = false;
+        bool quoted = false;
+
+        for (size_t i = 0; i < line.size(); i++) {
+            char c = line[i];
+            if (c == '\\' && i + 1 < line.size()) {
+                current += line[++i];
+                inToken = true;
+            } else if (c == '"') {
+                quoted = !quoted;
+                inToken = true;
+            } else if (!quoted && (c == ' ' || c == '\t' || c == '\r' || c == '\n')) {
+                if (inToken) tokens.push_back(current);
+                current.clear();
+                inToken = false;
+            } else {
+                current += c;
+                inToken = true;
+            }
+        }
+        if (inToken) tokens.push_back(current);
+        return tokens;
+    }
+
+    bool parseJob(const std::vector<std::string>& args, JobSpec& spec, std::string& error) {
+        std::vector<std::string> positional;
+
+        for (size_t i = 0; i < args.size(); i++) {
+            const std::string& arg = args[i];
+            bool hasValue = i + 1 < args.size();
+
+            if (arg == "-m") {
+                spec.fastMode = true;
+            } else if (arg == "-i" || arg == "-o" || arg == "-p" || arg == "-f" ||
+                       arg == "-t" || arg == "--size") {
+                if (!hasValue) {
+                    error = arg + " needs a value";
+                    return false;
+                }
+                const std::string& value = args[++i];
+
+                if (arg == "-i") {
+                    spec.isoPath = value;
+                } else if (arg == "-o") {
+                    spec.device = value;
+                } else if (arg == "-p") {
+                    char* end = nullptr;
+                    spec.persistenceSizeMB = strtoul(value.c_str(), &end, 10);
+                    if (value.empty() || *end != '\0' || spec.persistenceSizeMB == 0) {
+                        error = "Invalid persistence size: " + value;
+                        return false;
+                    }
+                } else if (arg == "-f") {
+                    FilesystemSupport::FSType type = FilesystemSupport::parseFSType(value);
+                    if (!FilesystemSupport::isSupported(type)) {
+                        error = "Unsupported filesystem: " + value;
+                        return false;
+                    }
+                    spec.persistenceFS = FilesystemSupport::getFSName(type);
+                } else if (arg == "-t") {
+                    std::string type = value;
+                    std::transform(type.begin(), type.end(), type.begin(), ::tolower);
+                    if (type != "mbr" && type != "gpt") {
+                        error = "Invalid partition table type: " + value;
+                        return false;
+                    }
+                    spec.tableType = type == "gpt" ? BootStructures::TableType::GPT :
+                                                     BootStructures::TableType::MBR;
+                } else {
+                    spec.imageSize = BlockTarget::parseSize(value);
+                    if (spec.imageSize == 0) {
+                        error = "Invalid image size: " + value;
+                        return false;
+                    }
+                }
+            } else if (!arg.empty() && arg[0] == '-') {
+                error = "Unknown option: " + arg;
+                return false;
+            } else {
+                positional.push_back(arg);
+            }
+        }
+
+        if (!positional.empty() && spec.isoPath.empty()) {
+            spec.isoPath = positional.front();
+            positional.erase(positional.begin());
+        }
+        if (!positional.empty() && spec.device.empty()) {
+            spec.device = positional.front();
+            positional.erase(positional.begin());
+        }
+
+        if (!positional.empty()) {
+            error = "Unexpected argument: " + positional.front();
+            return false;
+        }
+        if (spec.isoPath.empty() || spec.device.empty()) {
+            error = "A job needs an ISO and a device";
+            return false;
+        }
+        return true;
+    }
+
+    Source::~Source() {
+        if (fd >= 0) close(fd);
+    }
+
+    std::shared_ptr<Source> SourceTable::acquire(const std::string& isoPath) {
+        // A URL is streamed into a staged copy that is analyzed and burned
+        // like a file; a new version on the server brings a new stage
+        SourceStager::Handle staged;
+        std::string path = isoPath;
+        if (HttpSource::isUrl(isoPath)) {
+            staged = SourceStager::stage(isoPath);
+            path = SourceStager::stagedPath(staged);
+        }
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            throw FileError(isoPath, "Cannot access ISO file");
+        }
+
+        std::shared_ptr<Source> source;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::shared_ptr<Source>& slot = sources[isoPath];
+
+            // A replaced ISO gets a fresh entry; jobs still holding the old
+            // one finish with it
+            bool replaced = staged ? slot && slot->staged != staged :
+                            slot && (slot->size != static_cast<uint64_t>(st.st_size) ||
+                                     slot->mtime != st.st_mtime);
+            if (!slot || replaced) {
+                slot = std::make_shared<Source>();
+                slot->isoPath = path;
+                slot->staged = staged;
+                slot->size = st.st_size;
+                slot->mtime = st.st_mtime;
+            }
+            source = slot;
+        }
+
+        std::lock_guard<std::mutex> lock(source->mutex);
+        if (source->analyzed) {
+            Logs::debug("Reusing analysis of ", isoPath);
+            return source;
+        }
+
+        if (!ISOBurner::validateISO(source->isoPath)) {
+            throw FileError(isoPath, "Invalid ISO file");
+        }
+
+        source->fd = open(source->isoPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source->fd < 0) {
+            throw FileError(isoPath, "Cannot open ISO file");
+        }
+
+        // Concurrent burns of one ISO then read it from the page cache
+        // instead of each streaming it from disk
+        posix_fadvise(source->fd, 0, 0, POSIX_FADV_WILLNEED);
+
+        source->structure = ISOAnalyzer::SmartAnalyzer::analyzeISO(source->isoPath);
+        source->composition = BurnPlanner::analyzeComposition(source->isoPath);
+        source->analyzed = true;
+        return source;
+    }
+
+    bool runJob(const JobSpec& spec, Source& source,
+                const std::function<void(const std::string&, size_t, size_t)>& observer) {
+        bool imageTarget = spec.imageSize > 0 || BlockTarget::isImageFile(spec.device);
+        if (!imageTarget && !DeviceHandler::validateDevice(spec.device)) {
+            throw DeviceError(spec.device, "Invalid block device");
+        }
+        if (spec.imageSize > 0 && !BlockTarget::createImage(spec.device, spec.imageSize)) {
+            throw FileError(spec.device, "Cannot create image file");
+        }
+
+        uint64_t deviceSize = BlockTarget::querySize(spec.device);
+        if (source.structure.isoDataSize > deviceSize) {
+            throw DeviceError(spec.device, "Device too small for ISO");
+        }
+
+        bool persistence = spec.persistenceSizeMB > 0;
+        if (persistence) {
+            uint64_t required = PartitionSizing::rawPartitionBytes(source.structure.isoDataSize) +
+                                static_cast<uint64_t>(spec.persistenceSizeMB) * 1024 * 1024;
+            if (required > deviceSize) {
+                throw FilesystemError("Insufficient storage for " +
+                                      std::to_string(spec.persistenceSizeMB) +
+                                      " MB persistence on " + spec.device);
+            }
+        }
+
+        BurnPlanner::Plan plan = BurnPlanner::plan(source.structure, source.composition,
+                                                   BurnPlanner::profileDevice(spec.device),
+                                                   persistence);
+
+        SmartBurner::BurnConfig config;
+        config.isoPath = source.isoPath;
+        config.device = spec.device;
+        config.isoStructure = source.structure;
+        config.strategy = plan.strategy;
+        config.persistence = persistence;
+        config.persistenceSizeMB = spec.persistenceSizeMB;
+        config.persistenceFS = spec.persistenceFS;
+        config.fastMode = spec.fastMode;
+        config.onTask = observer;
+
+        // Readers opened once the image is resident get RAM; until then, or
+        // when it is not admitted, a network source is staged locally as the
+        // burn runs
+        SourceStager::Handle staged = SourceStager::stage(source.isoPath);
+        SourceCache::Lease lease = SourceCache::acquire(source.isoPath);
+
+        Logs::info("Burning " + spec.isoPath + " (" + BurnPlanner::strategyName(plan.strategy) + ")");
+        bool success = SmartBurner::IntelligentBurner::burnWithStrategy(config);
+        if (success) SourceStager::verify(staged);
+        return success;
+    }
+
+    static void onSignal(int) {
+        char byte = 1;
+        if (signalPipe >= 0) {
+            ssize_t ignored = write(signalPipe, &byte, 1);
+            (void)ignored;
+        }
+    }
+
+    Station::Station(const std::string& socket, unsigned workers)
+        : socketPath(socket), workerCount(workers), listenFd(-1),
+          queue(QUEUE_CAPACITY), stopping(false), nextJob(1) {
+        stopPipe[0] = stopPipe[1] = -1;
+
+        // Jobs mostly wait on their devices; a few more workers than cores
+        // keep every attached stick busy
+        if (workerCount == 0) {
+            workerCount = std::max(4u, std::thread::hardware_concurrency());
+        }
+    }
+
+    Station::~Station() {
+        if (listenFd >= 0) close(listenFd);
+        if (stopPipe[0] >= 0) close(stopPipe[0]);
+        if (stopPipe[1] >= 0) close(stopPipe[1]);
+    }
+
+    static std::string describe(uint64_t id, const JobSpec& spec, JobState state,
+                                const std::string& task, size_t finished, size_t total,
+                                const std::string& error) {
+        std::string line = "{\"event\":\"job\",\"job\":" + std::to_string(id) +
+                           ",\"state\":" + jsonString(stateName(state)) +
+                           ",\"iso\":" + jsonString(spec.isoPath) +
+                           ",\"device\":" + jsonString(spec.device);
+        if (total > 0) {
+            line += ",\"task\":" + jsonString(task) + ",\"done\":" + std::to_string(finished) +
+                    ",\"total\":" + std::to_string(total);
+        }
+        if (!error.empty()) {
+            line += ",\"error\":" + jsonString(error);
+        }
+        return line + "}";
+    }
+
+    void Station::publish(const Job& job, const std::string& line) {
+        std::vector<std::shared_ptr<Client>> targets;
+        {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            for (const auto& client : clients) {
+                if (!client->finished.load() && client->follows(job.id)) {
+                    targets.push_back(client);
+                }
+            }
+        }
+
+        for (const auto& client : targets) {
+            client->send(line);
+        }
+    }
+
+    void Station::finish(Job& job, JobState state, const std::string& error) {
+        std::string line;
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.state = state;
+            job.error = error;
+            line = "{\"event\":\"state\",\"job\":" + std::to_string(job.id) +
+                   ",\"state\":" + jsonString(stateName(state)) +
+                   (error.empty() ? "" : ",\"error\":" + jsonString(error)) + "}";
+        }
+        publish(job, line);
+    }
+
+    void Station::execute(std::shared_ptr<Job> job) {
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->state = JobState::RUNNING;
+        }
+        publish(*job, "{\"event\":\"state\",\"job\":" + std::to_string(job->id) +
+                      ",\"state\":\"running\"}");
+
+        Logs::ScopedPrefix scope("job " + std::to_string(job->id) + " " + job->spec.device);
+
+        auto observer = [this, job](const std::string& task, size_t finished, size_t total) {
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->task = task;
+                job->finishedTasks = finished;
+                job->totalTasks = total;
+            }
+            publish(*job, "{\"event\":\"progress\",\"job\":" + std::to_string(job->id) +
+                          ",\"task\":" + jsonString(task) + ",\"done\":" + std::to_string(finished) +
+                          ",\"total\":" + std::to_string(total) + "}");
+        };
+
+        std::string error;
+        bool ok = false;
+        try {
+            std::shared_ptr<Source> source = sources.acquire(job->spec.isoPath);
+            ok = runJob(job->spec, *source, observer);
+            if (!ok) error = "Burn operation failed";
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+
+        if (ok) {
+            Logs::success("Job finished");
+            finish(*job, JobState::DONE);
+        } else {
+            Logs::error("Job failed: " + error);
+            finish(*job, JobState::FAILED, error);
+        }
+    }
+
+    void Station::workerLoop() {
+        while (true) {
+            std::shared_ptr<Job> job;
+            if (!queue.tryPop(job)) {
+                if (stopping.load()) break;
+
+                // Submitters only notify; the timeout covers a lost wakeup
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait_for(lock, std::chrono::milliseconds(100));
+                continue;
+            }
+
+            if (stopping.load()) {
+                finish(*job, JobState::CANCELLED);
+                continue;
+            }
+
+            // One job per device at a time; later ones wait in its lane and
+            // are run by whichever worker holds the device
+            {
+                std::lock_guard<std::mutex> lock(laneMutex);
+                if (busyDevices.count(job->deviceKey)) {
+                    lanes[job->deviceKey].push_back(job);
+                    continue;
+                }
+                busyDevices.insert(job->deviceKey);
+            }
+
+            std::string device = job->deviceKey;
+            while (job) {
+                execute(job);
+
+                std::lock_guard<std::mutex> lock(laneMutex);
+                std::deque<std::shared_ptr<Job>>& lane = lanes[device];
+                if (!lane.empty() && !stopping.load()) {
+                    job = lane.front();
+                    lane.pop_front();
+                } else {
+                    busyDevices.erase(device);
+                    job.reset();
+                }
+            }
+        }
+    }
+
+    void Station::command(Client& client, const std::vector<std::string>& args) {
+        const std::string& name = args.front();
+
+        if (name == "burn") {
+            JobSpec spec;
+            std::string error;
+            if (!parseJob(std::vector<std::string>(args.begin() + 1, args.end()), spec, error)) {
+                client.send(errorEvent(error));
+                return;
+            }
+
+            auto job = std::make_shared<Job>();
+            job->spec = spec;
+            char resolved[PATH_MAX];
+            job->deviceKey = realpath(spec.device.c_str(), resolved) ? resolved : spec.device;
+
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                job->id = nextJob++;
+                jobs[job->id] = job;
+            }
+            {
+                std::lock_guard<std::mutex> lock(client.watchMutex);
+                client.watching.insert(job->id);
+            }
+
+            if (stopping.load()) {
+                finish(*job, JobState::CANCELLED, "Station is shutting down");
+                return;
+            }
+
+            client.send("{\"event\":\"queued\",\"job\":" + std::to_string(job->id) +
+                        ",\"iso\":" + jsonString(spec.isoPath) +
+                        ",\"device\":" + jsonString(spec.device) + "}");
+
+            if (!queue.tryPush(std::shared_ptr<Job>(job))) {
+                finish(*job, JobState::CANCELLED, "Job queue is full");
+                return;
+            }
+            wake.notify_one();
+            Logs::info("Job " + std::to_string(job->id) + " queued: " + spec.isoPath +
+                       " -> " + spec.device);
+
+            // Loads while the job waits for a worker or its device
+            SourceCache::prefetch(spec.isoPath);
+        } else if (name == "status") {
+            std::vector<std::shared_ptr<Job>> snapshot;
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                for (const auto& item : jobs) snapshot.push_back(item.second);
+            }
+            for (const auto& job : snapshot) {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                client.send(describe(job->id, job->spec, job->state, job->task,
+                                     job->finishedTasks, job->totalTasks, job->error));
+            }
+
+            SourceCache::Stats cache = SourceCache::stats();
+            client.send("{\"event\":\"cache\",\"hits\":" + std::to_string(cache.hits) +
+                        ",\"misses\":" + std::to_string(cache.misses) +
+                        ",\"prefetched\":" + std::to_string(cache.prefetched) +
+                        ",\"evicted\":" + std::to_string(cache.evicted) +
+                        ",\"rejected\":" + std::to_string(cache.rejected) +
+                        ",\"images\":" + std::to_string(cache.images) +
+                        ",\"residentMB\":" + std::to_string(cache.residentBytes / (1024 * 1024)) +
+                        ",\"capacityMB\":" + std::to_string(cache.capacityBytes / (1024 * 1024)) + "}");
+            client.send("{\"event\":\"end\"}");
+        } else if (name == "watch") {
+            std::lock_guard<std::mutex> lock(client.watchMutex);
+            if (args.size() < 2) {
+                client.watchAll = true;
+            } else {
+                client.watching.insert(strtoull(args[1].c_str(), nullptr, 10));
+            }
+        } else if (name == "shutdown") {
+            client.send("{\"event\":\"shutdown\"}");
+            char byte = 1;
+            ssize_t ignored = write(stopPipe[1], &byte, 1);
+            (void)ignored;
+        } else {
+            client.send(errorEvent("Unknown command: " + name));
+        }
+    }
+
+    void Station::serve(std::shared_ptr<Client> client) {
+        std::string buffer;
+        char chunk[4096];
+
+        while (true) {
+            ssize_t n = recv(client->fd, chunk, sizeof(chunk), 0);
+            if (n <= 0) break;
+            buffer.append(chunk, n);
+
+            size_t newline;
+            while ((newline = buffer.find('\n')) != std::string::npos) {
+                std::vector<std::string> args = tokenize(buffer.substr(0, newline));
+                buffer.erase(0, newline + 1);
+                if (!args.empty()) command(*client, args);
+            }
+
+            if (buffer.size() > MAX_LINE) {
+                client->send(errorEvent("Command line too long"));
+                break;
+            }
+        }
+
+        client->finished.store(true);
+    }
+
+    void Station::reapClients() {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        for (size_t i = 0; i < clients.size();) {
+            if (clients[i]->finished.load()) {
+                clientThreads[i].join();
+                clients.erase(clients.begin() + i);
+                clientThreads.erase(clientThreads.begin() + i);
+            } else {
+                i++;
+            }
+        }
+    }
+
+    int Station::run() {
+        if (socketPath.size() >= sizeof(sockaddr_un::sun_path)) {
+            throw MyISOException("Socket path too long: " + socketPath);
+        }
+
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+        // A socket nobody answers on is left over from a crashed station
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe >= 0) {
+            bool answered = connect(probe, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+            close(probe);
+            if (answered) {
+                throw MyISOException("A burn station is already listening on " + socketPath);
+            }
+        }
+        unlink(socketPath.c_str());
+
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 ||
+            bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            listen(listenFd, 16) != 0) {
+            throw MyISOException("Cannot listen on " + socketPath + ": " + strerror(errno));
+        }
+
+        // Jobs write to raw devices as root; only root may submit them
+        chmod(socketPath.c_str(), 0600);
+
+        if (pipe2(stopPipe, O_CLOEXEC) != 0) {
+            throw MyISOException("Cannot create stop pipe");
+        }
+        signalPipe = stopPipe[1];
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+        signal(SIGPIPE, SIG_IGN);
+
+        SourceCache::enable();
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.emplace_back(&Station::workerLoop, this);
+        }
+
+        Logs::success("Burn station listening on " + socketPath + " (" +
+                      std::to_string(workerCount) + " workers)");
+
+        while (true) {
+            pollfd fds[2] = {{listenFd, POLLIN, 0}, {stopPipe[0], POLLIN, 0}};
+            if (poll(fds, 2, 1000) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents) break;
+
+            reapClients();
+
+            if (fds[0].revents & POLLIN) {
+                int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0) continue;
+
+                auto client = std::make_shared<Client>(fd);
+                std::lock_guard<std::mutex> lock(clientMutex);
+                clients.push_back(client);
+                clientThreads.emplace_back(&Station::serve, this, client);
+            }
+        }
+
+        Logs::info("Burn station stopping; running jobs finish first");
+        stopping.store(true);
+        close(listenFd);
+        listenFd = -1;
+        unlink(socketPath.c_str());
+
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+
+        // Whatever never started is reported as cancelled
+        std::shared_ptr<Job> job;
+        while (queue.tryPop(job)) {
+            finish(*job, JobState::CANCELLED);
+        }
+        for (auto& lane : lanes) {
+            for (const auto& waiting : lane.second) {
+                finish(*waiting, JobState::CANCELLED);
+            }
+        }
+        lanes.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            for (const auto& client : clients) {
+                shutdown(client->fd, SHUT_RDWR);
+            }
+        }
+        for (auto& thread : clientThreads) thread.join();
+        clientThreads.clear();
+        clients.clear();
+
+        signalPipe = -1;
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+
+        Logs::info("Source cache: " + SourceCache::describe(SourceCache::stats()));
+        Logs::success("Burn station stopped");
+        return 0;
+    }
+}
@@ -1,4 +1,5 @@
 #include "lib/dev_handler.hpp"
+#include "lib/block_target.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
 #include <fstream>
@@ -12,6 +13,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
 
 namespace DeviceHandler {
     
@@ -66,61 +68,83 @@ namespace DeviceHandler {
     bool wipeDevice(const std::string& device) {
         Logs::info("Wiping device " + device + " (clearing all partition data)");
         
-        int fd = open(device.c_str(), O_WRONLY | O_SYNC);
-        if (fd < 0) {
-            throw DeviceError(device, "Cannot open device for wiping");
+        uint64_t deviceSize = getDeviceSize(device);
+        wipeRange(device, 0, std::min(WIPE_SIZE, deviceSize));
+        if (deviceSize > WIPE_SIZE) {
+            uint64_t tail = std::max(WIPE_SIZE, deviceSize - WIPE_SIZE);
+            wipeRange(device, tail, deviceSize - tail);
         }
         
-        // Zero out first 10MB (MBR, GPT, partition tables, filesystem signatures)
-        const size_t WIPE_SIZE = 10 * 1024 * 1024;
-        const size_t BUFFER_SIZE = 1024 * 1024; // 1MB buffer
+        rereadPartitions(device);
         
-        uint8_t* zeros = new uint8_t[BUFFER_SIZE];
-        memset(zeros, 0, BUFFER_SIZE);
+        Logs::success("Device wiped successfully");
+        return true;
+    }
+    
+    bool wipeRange(const std::string& device, uint64_t offset, uint64_t length) {
+        int fd = open(device.c_str(), O_WRONLY);
+        if (fd < 0) {
+            throw DeviceError(device, "Cannot open device for wiping");
+        }
         
-        size_t totalWritten = 0;
-        while (totalWritten < WIPE_SIZE) {
-            ssize_t written = write(fd, zeros, BUFFER_SIZE);
-            if (written < 0) {
-                delete[] zeros;
-                close(fd);
-                throw DeviceError(device, "Failed to wipe device");
-            }
-            totalWritten += written;
-        }
-        
-        // Also zero out last 10MB (backup GPT)
-        uint64_t deviceSize;
-        if (ioctl(fd, BLKGETSIZE64, &deviceSize) == 0) {
-            off_t endPosition = deviceSize - WIPE_SIZE;
-            if (lseek(fd, endPosition, SEEK_SET) == endPosition) {
-                totalWritten = 0;
-                while (totalWritten < WIPE_SIZE) {
-                    ssize_t written = write(fd, zeros, BUFFER_SIZE);
-                    if (written < 0) break;
-                    totalWritten += written;
-                }
-            }
+        try {
+            BlockTarget::zeroRange(fd, device, offset, length);
+        } catch (...) {
+            close(fd);
+            throw;
         }
         
-        delete[] zeros;
         fsync(fd);
         close(fd);
+        return true;
+    }
+    
+    void rereadPartitions(const std::string& device) {
+        // Image files are addressed by offset, nothing to re-read
+        if (BlockTarget::isImageFile(device)) return;
         
         // Force kernel to re-read partition table
-        fd = open(device.c_str(), O_RDONLY);
+        int fd = open(device.c_str(), O_RDONLY);
         if (fd >= 0) {
             ioctl(fd, BLKRRPART);
             close(fd);
         }
         
         sleep(1);
-        
-        Logs::success("Device wiped successfully");
-        return true;
+    }
+    
+    Pipeline::TaskId planWipe(Pipeline::TaskGraph& graph, const std::string& device,
+                              const std::vector<Pipeline::TaskId>& after) {
+        uint64_t deviceSize = getDeviceSize(device);
+        uint64_t headSize = std::min(WIPE_SIZE, deviceSize);
+        uint64_t tailStart = std::max(headSize, deviceSize - headSize);
+        
+        auto wipe = [device](const std::vector<Pipeline::Extent>& extents) {
+            for (const auto& extent : extents) {
+                wipeRange(device, extent.offset, extent.length);
+            }
+            return true;
+        };
+        
+        Pipeline::TaskId head = graph.addWrites("Wipe device head", Pipeline::WriteKind::TRIMMABLE,
+                                                {{0, headSize}}, wipe, after, 
+                                                {Pipeline::DEVICE_HEAD});
+        Pipeline::TaskId tail = graph.addWrites("Wipe device tail", Pipeline::WriteKind::TRIMMABLE,
+                                                {{tailStart, deviceSize - tailStart}}, wipe, after, 
+                                                {Pipeline::DEVICE_TAIL});
+        
+        return graph.add("Re-read partition table", [device]() {
+            rereadPartitions(device);
+            Logs::success("Device wiped successfully");
+            return true;
+        }, {head, tail}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_TAIL});
     }
     
     size_t getDeviceSize(const std::string& device) {
+        if (BlockTarget::isImageFile(device)) {
+            return BlockTarget::querySize(device);
+        }
+        
         std::string sizeFile = "/sys/class/block/" + 
                                device.substr(device.find_last_of('/') + 1) + 
                                "/size";
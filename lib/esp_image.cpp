@@ -0,0 +1,237 @@
+#include "lib/esp_image.hpp"
+#include "lib/block_target.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace ESPImage {
+
+    static const uint64_t ALIGNMENT = 1024 * 1024;
+
+    // The fields of a FAT12/16/32 boot sector that decide its layout
+    struct Geometry {
+        uint32_t bytesPerSector;
+        uint32_t sectorsPerCluster;
+        uint32_t totalSectors;
+        uint32_t fatSectors;
+        uint32_t numFATs;
+        uint32_t reservedSectors;
+        uint32_t dataStart;             // First data sector
+        uint32_t clusters;
+        int bits;                       // 12, 16 or 32, from the cluster count
+    };
+
+    static uint16_t read16(const uint8_t* p) {
+        return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t read32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    static void write16(uint8_t* p, uint16_t value) {
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+    }
+
+    static void write32(uint8_t* p, uint32_t value) {
+        write16(p, value & 0xFFFF);
+        write16(p + 2, value >> 16);
+    }
+
+    static bool parseBoot(const uint8_t* boot, Geometry& geometry) {
+        if (boot[510] != 0x55 || boot[511] != 0xAA) return false;
+
+        geometry.bytesPerSector = read16(boot + 11);
+        geometry.sectorsPerCluster = boot[13];
+        geometry.reservedSectors = read16(boot + 14);
+        geometry.numFATs = boot[16];
+        uint32_t rootEntries = read16(boot + 17);
+        geometry.totalSectors = read16(boot + 19) ? read16(boot + 19) : read32(boot + 32);
+        geometry.fatSectors = read16(boot + 22) ? read16(boot + 22) : read32(boot + 36);
+
+        uint32_t bps = geometry.bytesPerSector;
+        uint32_t spc = geometry.sectorsPerCluster;
+        if ((bps != 512 && bps != 1024 && bps != 2048 && bps != 4096) ||
+            spc == 0 || (spc & (spc - 1)) != 0 || geometry.reservedSectors == 0 ||
+            geometry.numFATs == 0 || geometry.fatSectors == 0) {
+            return false;
+        }
+
+        uint32_t rootSectors = (rootEntries * 32 + bps - 1) / bps;
+        uint64_t dataStart = geometry.reservedSectors +
+                             static_cast<uint64_t>(geometry.numFATs) * geometry.fatSectors + rootSectors;
+        if (geometry.totalSectors <= dataStart) return false;
+
+        geometry.dataStart = static_cast<uint32_t>(dataStart);
+        geometry.clusters = (geometry.totalSectors - geometry.dataStart) / spc;
+        geometry.bits = geometry.clusters < 4085 ? 12 : (geometry.clusters < 65525 ? 16 : 32);
+        return true;
+    }
+
+    // Byte range of FAT entries [first, last) in one FAT copy; FAT12 bytes
+    // shared with the entry before first are left out
+    static std::pair<uint64_t, uint64_t> entryBytes(int bits, uint64_t first, uint64_t last) {
+        if (bits == 12) {
+            return {first * 3 / 2 + (first & 1), (last * 3 + 1) / 2};
+        }
+        return {first * bits / 8, last * bits / 8};
+    }
+
+    bool locate(const std::string& isoPath, const ISO9660::Image& image, BootImage& boot) {
+        for (const auto& entry : image.bootEntries) {
+            if (entry.platform != static_cast<uint8_t>(ISO9660::BootPlatform::EFI)) continue;
+
+            int fd = SourceCache::openSource(isoPath);
+            if (fd < 0) return false;
+
+            uint8_t sector[512];
+            uint64_t offset = static_cast<uint64_t>(entry.loadRBA) * ISO9660::SECTOR_SIZE;
+            SourceStager::await(fd, offset, sizeof(sector));
+            bool read = pread(fd, sector, sizeof(sector), offset) == sizeof(sector);
+            uint64_t isoSize = BlockTarget::querySize(fd);
+            close(fd);
+
+            Geometry geometry;
+            if (!read || !parseBoot(sector, geometry)) {
+                Logs::debug("EFI boot entry at RBA ", entry.loadRBA, " is not a FAT image");
+                continue;
+            }
+
+            uint64_t size = static_cast<uint64_t>(geometry.totalSectors) * geometry.bytesPerSector;
+            if (offset + size > isoSize) {
+                Logs::warning("EFI boot image extends past the end of the ISO");
+                continue;
+            }
+
+            const ISO9660::Entry* file = ISO9660::findByLBA(image, entry.loadRBA);
+            boot = BootImage{offset, size, file ? file->path : ""};
+
+            Logs::debug("EFI boot image ", boot.path.empty() ? "(catalog only)" : boot.path,
+                        ": FAT", geometry.bits, ", ", boot.size / 1024, " KB");
+            return true;
+        }
+
+        return false;
+    }
+
+    bool locate(const std::string& isoPath, BootImage& boot) {
+        ISO9660::Image image;
+        if (!ISO9660::readImage(isoPath, image)) return false;
+        return locate(isoPath, image, boot);
+    }
+
+    uint64_t partitionSize(const BootImage& boot) {
+        return (boot.size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+
+    // Extends the volume over the partition when its FATs have unused
+    // entries; the cluster count never crosses into another FAT type
+    static void growVolume(int fd, const std::string& device, uint64_t offset, uint64_t length) {
+        uint8_t boot[512];
+        Geometry geometry;
+        if (pread(fd, boot, sizeof(boot), offset) != sizeof(boot) || !parseBoot(boot, geometry)) {
+            throw FilesystemError("ESP image on " + device + " has no valid FAT boot sector");
+        }
+
+        uint32_t bps = geometry.bytesPerSector;
+        uint64_t fatEntries = static_cast<uint64_t>(geometry.fatSectors) * bps * 8 / geometry.bits;
+        uint64_t typeLimit = geometry.bits == 12 ? 4084 : (geometry.bits == 16 ? 65524 : 0x0FFFFFF5);
+        uint64_t fitClusters = (length / bps - geometry.dataStart) / geometry.sectorsPerCluster;
+        uint64_t clusters = std::min({fatEntries - 2, typeLimit, fitClusters});
+
+        // Hidden sectors point at the partition for firmware that checks it
+        write32(boot + 28, static_cast<uint32_t>(offset / 512));
+
+        if (clusters > geometry.clusters) {
+            // The new entries must already read as free
+            std::pair<uint64_t, uint64_t> range = entryBytes(geometry.bits, geometry.clusters + 2,
+                                                              clusters + 2);
+            std::vector<uint8_t> entries(range.second - range.first);
+            uint64_t fatOffset = offset + static_cast<uint64_t>(geometry.reservedSectors) * bps;
+            if (pread(fd, entries.data(), entries.size(), fatOffset + range.first) !=
+                    static_cast<ssize_t>(entries.size())) {
+                throw DeviceError(device, "Failed to read ESP allocation table");
+            }
+
+            if (std::all_of(entries.begin(), entries.end(), [](uint8_t b) { return b == 0; })) {
+                uint32_t total = geometry.dataStart +
+                                 static_cast<uint32_t>(clusters) * geometry.sectorsPerCluster;
+                if (geometry.bits != 32 && total < 65536) {
+                    write16(boot + 19, static_cast<uint16_t>(total));
+                    write32(boot + 32, 0);
+                } else {
+                    write16(boot + 19, 0);
+                    write32(boot + 32, total);
+                }
+
+                Logs::debug("ESP grown from ", geometry.clusters, " to ", clusters, " clusters");
+                geometry.clusters = static_cast<uint32_t>(clusters);
+            }
+        }
+
+        if (pwrite(fd, boot, sizeof(boot), offset) != sizeof(boot)) {
+            throw DeviceError(device, "Failed to update ESP boot sector");
+        }
+
+        if (geometry.bits != 32) return;
+
+        // FAT32 keeps a backup boot sector and a free count in FSInfo
+        uint16_t backup = read16(boot + 50);
+        if (backup != 0 && backup != 0xFFFF &&
+            pwrite(fd, boot, sizeof(boot), offset + static_cast<uint64_t>(backup) * bps) != sizeof(boot)) {
+            throw DeviceError(device, "Failed to update ESP backup boot sector");
+        }
+
+        uint16_t fsInfo = read16(boot + 48);
+        uint8_t info[512];
+        uint64_t infoOffset = offset + static_cast<uint64_t>(fsInfo) * bps;
+        if (fsInfo != 0 && fsInfo != 0xFFFF &&
+            pread(fd, info, sizeof(info), infoOffset) == sizeof(info) &&
+            read32(info) == 0x41615252) {
+            write32(info + 488, 0xFFFFFFFF);
+            if (pwrite(fd, info, sizeof(info), infoOffset) != sizeof(info)) {
+                throw DeviceError(device, "Failed to update ESP FSInfo");
+            }
+        }
+    }
+
+    bool write(const std::string& isoPath, const BootImage& boot,
+               const std::string& device, uint64_t offset, uint64_t length) {
+        if (boot.size > length) {
+            throw DeviceError(device, "ESP partition is smaller than the EFI boot image");
+        }
+
+        int input = SourceCache::openSource(isoPath);
+        if (input < 0) {
+            throw FileError(isoPath, "Cannot open ISO for the EFI boot image");
+        }
+
+        int output = open(device.c_str(), O_RDWR);
+        if (output < 0) {
+            close(input);
+            throw DeviceError(device, "Cannot open device for the ESP");
+        }
+
+        Logs::info("Copying EFI boot image (" + std::to_string(boot.size / 1024) + " KB) to ESP");
+
+        try {
+            BlockTarget::copyRange(input, boot.offset, output, offset, boot.size);
+            growVolume(output, device, offset, length);
+        } catch (...) {
+            close(input);
+            close(output);
+            throw;
+        }
+
+        close(input);
+        close(output);
+        return true;
+    }
+}
@@ -0,0 +1,1053 @@
+#include "lib/fat_writer.hpp"
+#include "lib/block_target.hpp"
+#include "lib/iso9660.hpp"
+#include "lib/iso_analyzer.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include "utils/progress_bar.hpp"
+#include "utils/sha256.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+
+namespace FatWriter {
+
+    static const uint32_t END_OF_CHAIN = 0x0FFFFFFF;
+    static const uint32_t CHAIN_END_MIN = 0x0FFFFFF8;
+    static const uint8_t ATTR_VOLUME_ID = 0x08;
+    static const uint8_t ATTR_DIRECTORY = 0x10;
+    static const uint8_t ATTR_ARCHIVE = 0x20;
+    static const uint8_t ATTR_LONG_NAME = 0x0F;
+    static const uint8_t CASE_LOWER_BASE = 0x08;
+    static const uint8_t CASE_LOWER_EXT = 0x10;
+    static const uint32_t FSINFO_LEAD = 0x41615252;
+    static const size_t ENTRY_SIZE = 32;
+    static const size_t LFN_CHARS = 13;
+    static const uint8_t DELETED = 0xE5;
+    static const uint64_t BOOT_ALIGNMENT = 4 * 1024 * 1024;   // Common flash erase block
+
+    // Persistence files living next to the ISO tree are not ISO content
+    static const std::set<std::string> SYNC_KEPT = {"CASPER-RW", "PERSISTENCE", "SYSTEM VOLUME INFORMATION"};
+
+    static uint16_t read16(const uint8_t* p) {
+        return p[0] | (p[1] << 8);
+    }
+
+    static uint32_t read32(const uint8_t* p) {
+        return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    static void write16(uint8_t* p, uint16_t value) {
+        p[0] = value & 0xFF;
+        p[1] = value >> 8;
+    }
+
+    static void write32(uint8_t* p, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            p[i] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    static std::string upper(const std::string& text) {
+        std::string result = text;
+        std::transform(result.begin(), result.end(), result.begin(), ::toupper);
+        return result;
+    }
+
+    static std::string normalize(const std::string& path) {
+        size_t start = path.find_first_not_of('/');
+        if (start == std::string::npos) return "";
+        std::string result = path.substr(start);
+        while (!result.empty() && result.back() == '/') result.pop_back();
+        return result;
+    }
+
+    static void fatTimestamp(int64_t mtime, uint16_t& date, uint16_t& time) {
+        time_t seconds = mtime > 0 ? static_cast<time_t>(mtime) : ::time(nullptr);
+        struct tm local;
+        localtime_r(&seconds, &local);
+
+        int year = std::max(1980, std::min(2107, local.tm_year + 1900));
+        date = ((year - 1980) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday;
+        time = (local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2);
+    }
+
+    static void fillShortEntry(uint8_t* entry, const char* name11, uint8_t attributes,
+                               uint8_t caseFlags, uint32_t cluster, uint32_t size,
+                               int64_t mtime) {
+        memset(entry, 0, ENTRY_SIZE);
+        memcpy(entry, name11, 11);
+        entry[11] = attributes;
+        entry[12] = caseFlags;
+
+        uint16_t date, time;
+        fatTimestamp(mtime, date, time);
+        write16(entry + 14, time);
+        write16(entry + 16, date);
+        write16(entry + 18, date);
+        write16(entry + 20, cluster >> 16);
+        write16(entry + 22, time);
+        write16(entry + 24, date);
+        write16(entry + 26, cluster & 0xFFFF);
+        write32(entry + 28, size);
+    }
+
+    // ISO names are UTF-8; long names are stored as UTF-16 (BMP only)
+    static std::vector<uint16_t> toUTF16(const std::string& text) {
+        std::vector<uint16_t> result;
+        for (size_t i = 0; i < text.size();) {
+            uint8_t c = text[i];
+            uint32_t code = c;
+            size_t length = 1;
+            if (c >= 0xF0) { code = c & 0x07; length = 4; }
+            else if (c >= 0xE0) { code = c & 0x0F; length = 3; }
+            else if (c >= 0xC0) { code = c & 0x1F; length = 2; }
+
+            for (size_t k = 1; k < length && i + k < text.size(); k++) {
+                code = (code << 6) | (text[i + k] & 0x3F);
+            }
+            result.push_back(code > 0xFFFF ? '_' : static_cast<uint16_t>(code));
+            i += length;
+        }
+        return result;
+    }
+
+    static std::string fromUTF16(const std::vector<uint16_t>& chars) {
+        std::string result;
+        for (uint16_t code : chars) {
+            if (code < 0x80) {
+                result += static_cast<char>(code);
+            } else if (code < 0x800) {
+                result += static_cast<char>(0xC0 | (code >> 6));
+                result += static_cast<char>(0x80 | (code & 0x3F));
+            } else {
+                result += static_cast<char>(0xE0 | (code >> 12));
+                result += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (code & 0x3F));
+            }
+        }
+        return result;
+    }
+
+    static uint8_t shortChecksum(const uint8_t* name11) {
+        uint8_t checksum = 0;
+        for (int i = 0; i < 11; i++) {
+            checksum = ((checksum & 1) << 7) + (checksum >> 1) + name11[i];
+        }
+        return checksum;
+    }
+
+    static bool validShortChar(char c) {
+        return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+               strchr("$%'-_@~`!(){}^#&", c) != nullptr;
+    }
+
+    // Letters of one case only; returns 1 for lower, 0 for upper or none, -1 mixed
+    static int letterCase(const std::string& text) {
+        bool lower = false, upperSeen = false;
+        for (char c : text) {
+            if (c >= 'a' && c <= 'z') lower = true;
+            if (c >= 'A' && c <= 'Z') upperSeen = true;
+        }
+        if (lower && upperSeen) return -1;
+        return lower ? 1 : 0;
+    }
+
+    Volume::Volume(const std::string& dev, uint64_t offset)
+        : device(dev), baseOffset(offset), deviceFd(-1), bytesPerSector(0), clusterSize(0),
+          reservedSectors(0), numFATs(0), fatSectors(0), rootCluster(0), fsInfoSector(0),
+          dataOffset(0), nextFree(2), sequenceNext(0), sequenceEnd(0) {
+    }
+
+    Volume::~Volume() {
+        if (deviceFd >= 0) close(deviceFd);
+    }
+
+    void Volume::open() {
+        deviceFd = ::open(device.c_str(), O_RDWR);
+        if (deviceFd < 0) {
+            throw DeviceError(device, "Cannot open FAT32 volume");
+        }
+
+        uint8_t boot[512];
+        if (pread(deviceFd, boot, sizeof(boot), baseOffset) != sizeof(boot) ||
+            boot[510] != 0x55 || boot[511] != 0xAA || memcmp(boot + 0x52, "FAT32   ", 8) != 0) {
+            throw FilesystemError("No FAT32 boot sector at offset " + std::to_string(baseOffset) +
+                                  " of " + device);
+        }
+
+        bytesPerSector = read16(boot + 11);
+        uint32_t sectorsPerCluster = boot[13];
+        reservedSectors = read16(boot + 14);
+        numFATs = boot[16];
+        uint32_t totalSectors = read16(boot + 19) ? read16(boot + 19) : read32(boot + 32);
+        fatSectors = read32(boot + 36);
+        rootCluster = read32(boot + 44);
+        fsInfoSector = read16(boot + 48);
+
+        if (bytesPerSector == 0 || sectorsPerCluster == 0 || numFATs == 0 || fatSectors == 0) {
+            throw FilesystemError("Invalid FAT32 boot sector on " + device);
+        }
+
+        clusterSize = bytesPerSector * sectorsPerCluster;
+        uint64_t metaSectors = reservedSectors + static_cast<uint64_t>(numFATs) * fatSectors;
+        dataOffset = metaSectors * bytesPerSector;
+
+        uint64_t dataClusters = (totalSectors - metaSectors) / sectorsPerCluster;
+        uint64_t fatEntries = static_cast<uint64_t>(fatSectors) * bytesPerSector / 4;
+        fat.assign(std::min(dataClusters + 2, fatEntries), 0);
+
+        if (rootCluster < 2 || rootCluster >= fat.size()) {
+            throw FilesystemError("Invalid FAT32 root cluster on " + device);
+        }
+
+        fat[0] = 0x0FFFFFF8;
+        fat[1] = END_OF_CHAIN;
+        fat[rootCluster] = END_OF_CHAIN;
+        nextFree = rootCluster + 1;
+
+        Directory& root = directories[""];
+        root.firstCluster = rootCluster;
+
+        char label[11];
+        memcpy(label, boot + 0x47, sizeof(label));
+        if (memcmp(label, "NO NAME    ", 11) != 0 && label[0] != ' ' && label[0] != '\0') {
+            root.entries.resize(ENTRY_SIZE);
+            fillShortEntry(root.entries.data(), label, ATTR_VOLUME_ID, 0, 0, 0, 0);
+        }
+
+        Logs::debug("FAT32 volume: ", clusterSize, " byte clusters, ", fat.size() - 2,
+                    " clusters, data at ", dataOffset);
+    }
+
+    void Volume::load() {
+        uint64_t fatBytes = static_cast<uint64_t>(fatSectors) * bytesPerSector;
+        std::vector<uint8_t> table(std::min<uint64_t>(fatBytes, fat.size() * 4ULL));
+        if (pread(deviceFd, table.data(), table.size(), baseOffset + 
+                  static_cast<uint64_t>(reservedSectors) * bytesPerSector) !=
+            static_cast<ssize_t>(table.size())) {
+            throw DeviceError(device, "Failed to read FAT");
+        }
+        for (size_t i = 0; i < table.size() / 4; i++) {
+            fat[i] = read32(table.data() + i * 4) & 0x0FFFFFFF;
+        }
+
+        directories.clear();
+        existing.clear();
+        releasing.clear();
+        loadDirectory("", "", rootCluster);
+
+        nextFree = 2;
+        while (nextFree < fat.size() && fat[nextFree] != 0) nextFree++;
+
+        Logs::debug("FAT32: loaded ", existing.size(), " entries, ", freeBytes() / (1024 * 1024),
+                    " MB free");
+    }
+
+    void Volume::loadDirectory(const std::string& key, const std::string& path, uint32_t cluster) {
+        if (directories.size() > fat.size()) {
+            throw FilesystemError("Directory loop on " + device);
+        }
+
+        Directory& dir = directories[key];
+        dir.firstCluster = cluster;
+
+        std::vector<uint8_t> data;
+        for (uint32_t link : chain(cluster)) {
+            size_t at = data.size();
+            data.resize(at + clusterSize);
+            if (pread(deviceFd, data.data() + at, clusterSize, clusterOffset(link)) !=
+                static_cast<ssize_t>(clusterSize)) {
+                throw DeviceError(device, "Failed to read directory " + path);
+            }
+        }
+
+        std::vector<std::pair<std::string, uint32_t>> children;
+        std::vector<uint16_t> longName;
+        uint8_t longChecksum = 0;
+        size_t longStart = 0;
+
+        size_t end = 0;
+        for (; end + ENTRY_SIZE <= data.size() && data[end] != 0; end += ENTRY_SIZE) {
+            const uint8_t* entry = data.data() + end;
+            if (entry[0] == DELETED) {
+                longName.clear();
+                continue;
+            }
+
+            if (entry[11] == ATTR_LONG_NAME) {
+                // Parts come last first; each holds 13 UTF-16 characters
+                static const int slots[LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+                size_t part = entry[0] & 0x1F;
+                if (entry[0] & 0x40) {
+                    longName.assign(part * LFN_CHARS, 0xFFFF);
+                    longChecksum = entry[13];
+                    longStart = end;
+                }
+                if (part == 0 || part * LFN_CHARS > longName.size()) {
+                    longName.clear();
+                    continue;
+                }
+                for (size_t k = 0; k < LFN_CHARS; k++) {
+                    longName[(part - 1) * LFN_CHARS + k] = read16(entry + slots[k]);
+                }
+                continue;
+            }
+
+            std::string short11(reinterpret_cast<const char*>(entry), 11);
+            dir.shortNames.insert(short11);
+
+            if ((entry[11] & ATTR_VOLUME_ID) || entry[0] == '.') {
+                longName.clear();
+                continue;
+            }
+
+            std::string name;
+            size_t start = end;
+            if (!longName.empty() && longChecksum == shortChecksum(entry)) {
+                size_t length = 0;
+                while (length < longName.size() && longName[length] != 0 && longName[length] != 0xFFFF) {
+                    length++;
+                }
+                longName.resize(length);
+                name = fromUTF16(longName);
+                start = longStart;
+            } else {
+                std::string base = short11.substr(0, 8);
+                std::string ext = short11.substr(8);
+                if (base[0] == 0x05) base[0] = static_cast<char>(DELETED);
+                base.erase(base.find_last_not_of(' ') + 1);
+                ext.erase(ext.find_last_not_of(' ') + 1);
+                if (entry[12] & CASE_LOWER_BASE) {
+                    std::transform(base.begin(), base.end(), base.begin(), ::tolower);
+                }
+                if (entry[12] & CASE_LOWER_EXT) {
+                    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+                }
+                name = ext.empty() ? base : base + "." + ext;
+            }
+            longName.clear();
+
+            FileInfo info;
+            info.path = path + "/" + name;
+            info.isDirectory = entry[11] & ATTR_DIRECTORY;
+            info.cluster = (static_cast<uint32_t>(read16(entry + 20)) << 16) | read16(entry + 26);
+            info.size = read32(entry + 28);
+            info.time = read16(entry + 22);
+            info.date = read16(entry + 24);
+            info.parent = key;
+            info.entryStart = start;
+            info.entryEnd = end + ENTRY_SIZE;
+
+            std::string childKey = upper(normalize(info.path));
+            existing[childKey] = info;
+            if (info.isDirectory && info.cluster >= 2 && info.cluster < fat.size()) {
+                children.push_back({childKey, info.cluster});
+            }
+        }
+
+        dir.entries.assign(data.begin(), data.begin() + end);
+
+        for (const auto& child : children) {
+            loadDirectory(child.first, existing[child.first].path, child.second);
+        }
+    }
+
+    const std::map<std::string, FileInfo>& Volume::files() const {
+        return existing;
+    }
+
+    void Volume::remove(const std::string& path) {
+        std::string key = upper(normalize(path));
+        auto it = existing.find(key);
+        if (it == existing.end()) {
+            throw FilesystemError("No such entry on FAT32 volume: " + path);
+        }
+        FileInfo info = it->second;
+
+        if (info.isDirectory) {
+            // Children go with it; their entries vanish with the directory
+            std::string prefix = key + "/";
+            for (auto child = existing.begin(); child != existing.end();) {
+                if (child->first.compare(0, prefix.size(), prefix) == 0) {
+                    release(child->second.cluster);
+                    child = existing.erase(child);
+                } else {
+                    ++child;
+                }
+            }
+            for (auto dir = directories.begin(); dir != directories.end();) {
+                dir = dir->first.compare(0, prefix.size(), prefix) == 0 ? directories.erase(dir) : std::next(dir);
+            }
+            directories.erase(key);
+        }
+
+        release(info.cluster);
+        existing.erase(key);
+
+        auto parent = directories.find(info.parent);
+        if (parent != directories.end()) {
+            std::vector<uint8_t>& entries = parent->second.entries;
+            parent->second.shortNames.erase(std::string(
+                reinterpret_cast<const char*>(&entries[info.entryEnd - ENTRY_SIZE]), 11));
+            for (size_t at = info.entryStart; at < info.entryEnd; at += ENTRY_SIZE) {
+                entries[at] = DELETED;
+            }
+        }
+    }
+
+    bool Volume::beginSequence(const std::vector<uint64_t>& sizes, uint64_t alignment) {
+        uint64_t count = 0;
+        for (uint64_t size : sizes) count += (size + clusterSize - 1) / clusterSize;
+        if (count == 0) return false;
+
+        uint64_t start = findRun(count, alignment);
+        if (start == 0) start = findRun(count, 0);
+        if (start == 0) return false;
+
+        // The run stays zero in the FAT until its files take it; nothing
+        // else may allocate while the sequence is open
+        sequenceNext = static_cast<uint32_t>(start);
+        sequenceEnd = static_cast<uint32_t>(start + count);
+        return true;
+    }
+
+    void Volume::endSequence() {
+        sequenceNext = 0;
+        sequenceEnd = 0;
+    }
+
+    std::array<uint8_t, 32> Volume::hashFile(const FileInfo& file) const {
+        Hash::SHA256 hash;
+        std::vector<uint8_t> buffer(1024 * 1024);
+        for (const auto& range : file.size ? ranges(file.cluster, file.size) : std::vector<SourceExtent>()) {
+            for (uint64_t done = 0; done < range.length;) {
+                size_t length = std::min<uint64_t>(buffer.size(), range.length - done);
+                if (pread(deviceFd, buffer.data(), length, range.offset + done) !=
+                    static_cast<ssize_t>(length)) {
+                    throw DeviceError(device, "Failed to read " + file.path);
+                }
+                hash.update(buffer.data(), length);
+                done += length;
+            }
+        }
+        return hash.finish();
+    }
+
+    uint64_t Volume::clusterOffset(uint32_t cluster) const {
+        return baseOffset + dataOffset + static_cast<uint64_t>(cluster - 2) * clusterSize;
+    }
+
+    uint64_t Volume::findRun(uint64_t count, uint64_t alignment) const {
+        // Candidate starts are every cluster, or only those at an aligned
+        // device offset; a used cluster moves the search past itself
+        uint64_t step = 1;
+        uint64_t start = nextFree;
+        if (alignment > clusterSize && alignment % clusterSize == 0) {
+            step = alignment / clusterSize;
+            while (start < nextFree + step && clusterOffset(start) % alignment != 0) start++;
+            if (start == nextFree + step) return 0;
+        }
+
+        while (start + count <= fat.size()) {
+            uint64_t used = start;
+            while (used < start + count && fat[used] == 0) used++;
+            if (used == start + count) return start;
+            start += ((used - start) / step + 1) * step;
+        }
+        return 0;
+    }
+
+    uint32_t Volume::allocate(uint64_t bytes) {
+        uint64_t count = (bytes + clusterSize - 1) / clusterSize;
+        if (count == 0) return 0;
+
+        std::vector<uint32_t> clusters;
+        uint64_t start = 0;
+        if (sequenceNext + count <= sequenceEnd) {
+            start = sequenceNext;
+            sequenceNext += count;
+        } else {
+            // First fit from the lowest free cluster; on a fresh volume that
+            // is the whole free space, so this is a bump allocator there
+            start = findRun(count, 0);
+        }
+
+        if (start != 0) {
+            for (uint64_t i = 0; i < count; i++) clusters.push_back(start + i);
+        }
+
+        // No single run is left: chain whatever is free
+        if (clusters.empty()) {
+            for (uint64_t cluster = nextFree; cluster < fat.size() && clusters.size() < count; cluster++) {
+                if (fat[cluster] == 0) clusters.push_back(cluster);
+            }
+            if (clusters.size() < count) {
+                throw FilesystemError("Not enough space on FAT32 volume " + device);
+            }
+            Logs::debug("FAT32: fragmented allocation of ", count, " clusters");
+        }
+
+        for (size_t i = 0; i + 1 < clusters.size(); i++) {
+            fat[clusters[i]] = clusters[i + 1];
+        }
+        fat[clusters.back()] = END_OF_CHAIN;
+
+        while (nextFree < fat.size() && fat[nextFree] != 0) nextFree++;
+        return clusters.front();
+    }
+
+    void Volume::release(uint32_t first) {
+        // The chain stays allocated until commit() writes a tree that no
+        // longer uses it
+        std::vector<uint32_t> clusters = chain(first);
+        releasing.insert(releasing.end(), clusters.begin(), clusters.end());
+    }
+
+    std::vector<uint32_t> Volume::chain(uint32_t first) const {
+        std::vector<uint32_t> clusters;
+        for (uint32_t cluster = first; cluster >= 2 && cluster < CHAIN_END_MIN;
+             cluster = fat[cluster]) {
+            clusters.push_back(cluster);
+            if (clusters.size() > fat.size()) break;
+        }
+        return clusters;
+    }
+
+    std::vector<SourceExtent> Volume::ranges(uint32_t first, uint64_t size) const {
+        std::vector<SourceExtent> result;
+        uint64_t left = size;
+        for (uint32_t cluster : chain(first)) {
+            if (left == 0) break;
+            uint64_t length = std::min<uint64_t>(clusterSize, left);
+            uint64_t offset = clusterOffset(cluster);
+            if (!result.empty() && result.back().offset + result.back().length == offset) {
+                result.back().length += length;
+            } else {
+                result.push_back({offset, length});
+            }
+            left -= length;
+        }
+        if (left > 0) {
+            throw FilesystemError("Cluster chain shorter than file on " + device);
+        }
+        return result;
+    }
+
+    Volume::Directory& Volume::parentOf(const std::string& path, std::string& name) {
+        std::string normalized = normalize(path);
+        size_t slash = normalized.find_last_of('/');
+
+        std::string parent = slash == std::string::npos ? "" : normalized.substr(0, slash);
+        name = slash == std::string::npos ? normalized : normalized.substr(slash + 1);
+
+        auto it = directories.find(upper(parent));
+        if (it == directories.end()) {
+            throw FilesystemError("Parent directory missing for " + path);
+        }
+        if (name.empty()) {
+            throw FilesystemError("Invalid path: " + path);
+        }
+        return it->second;
+    }
+
+    std::string Volume::makeShortName(Directory& dir, const std::string& name,
+                                      uint8_t& caseFlags, bool& needsLong) {
+        size_t dot = name.find_last_of('.');
+        std::string base = (dot == std::string::npos || dot == 0) ? name : name.substr(0, dot);
+        std::string ext = (dot == std::string::npos || dot == 0) ? "" : name.substr(dot + 1);
+
+        caseFlags = 0;
+        needsLong = true;
+
+        // Names that already are 8.3 only differ by case, which the NT case
+        // bits record without long-name entries
+        std::string upperBase = upper(base);
+        std::string upperExt = upper(ext);
+        bool fits = !base.empty() && base.size() <= 8 && ext.size() <= 3 &&
+                    std::all_of(upperBase.begin(), upperBase.end(), validShortChar) &&
+                    std::all_of(upperExt.begin(), upperExt.end(), validShortChar) &&
+                    letterCase(base) >= 0 && letterCase(ext) >= 0;
+
+        std::string shortName;
+        if (fits) {
+            shortName = upperBase;
+            shortName.resize(8, ' ');
+            shortName += upperExt;
+            shortName.resize(11, ' ');
+
+            if (dir.shortNames.count(shortName) == 0) {
+                needsLong = false;
+                if (letterCase(base) == 1) caseFlags |= CASE_LOWER_BASE;
+                if (letterCase(ext) == 1) caseFlags |= CASE_LOWER_EXT;
+                dir.shortNames.insert(shortName);
+                return shortName;
+            }
+        }
+
+        auto basis = [](const std::string& text, size_t limit) {
+            std::string result;
+            for (char c : upper(text)) {
+                if (c == ' ' || c == '.') continue;
+                result += validShortChar(c) ? c : '_';
+                if (result.size() == limit) break;
+            }
+            return result;
+        };
+
+        std::string basisBase = basis(base, 8);
+        std::string basisExt = basis(ext, 3);
+        if (basisBase.empty()) basisBase = "_";
+
+        for (int n = 1; n < 1000000; n++) {
+            std::string tail = "~" + std::to_string(n);
+            shortName = basisBase.substr(0, 8 - tail.size()) + tail;
+            shortName.resize(8, ' ');
+            shortName += basisExt;
+            shortName.resize(11, ' ');
+
+            if (dir.shortNames.count(shortName) == 0) {
+                dir.shortNames.insert(shortName);
+                return shortName;
+            }
+        }
+
+        throw FilesystemError("Too many similar names for " + name);
+    }
+
+    void Volume::addEntry(Directory& dir, const std::string& name, uint8_t attributes,
+                          uint32_t cluster, uint32_t size, int64_t mtime) {
+        uint8_t caseFlags;
+        bool needsLong;
+        std::string shortName = makeShortName(dir, name, caseFlags, needsLong);
+
+        if (needsLong) {
+            uint8_t checksum = shortChecksum(reinterpret_cast<const uint8_t*>(shortName.data()));
+
+            std::vector<uint16_t> chars = toUTF16(name);
+            if (chars.size() > 255) {
+                throw FilesystemError("Name too long for FAT32: " + name);
+            }
+            size_t count = (chars.size() + LFN_CHARS - 1) / LFN_CHARS;
+
+            // Long-name slots precede the short entry, last part first
+            static const int slots[LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+            for (size_t part = count; part >= 1; part--) {
+                uint8_t entry[ENTRY_SIZE];
+                memset(entry, 0, sizeof(entry));
+                entry[0] = part | (part == count ? 0x40 : 0);
+                entry[11] = ATTR_LONG_NAME;
+                entry[13] = checksum;
+
+                for (size_t k = 0; k < LFN_CHARS; k++) {
+                    size_t index = (part - 1) * LFN_CHARS + k;
+                    uint16_t value = index < chars.size() ? chars[index] :
+                                     (index == chars.size() ? 0x0000 : 0xFFFF);
+                    write16(entry + slots[k], value);
+                }
+                dir.entries.insert(dir.entries.end(), entry, entry + ENTRY_SIZE);
+            }
+        }
+
+        uint8_t entry[ENTRY_SIZE];
+        fillShortEntry(entry, shortName.c_str(), attributes, caseFlags, cluster, size, mtime);
+        dir.entries.insert(dir.entries.end(), entry, entry + ENTRY_SIZE);
+    }
+
+    void Volume::makeDirectory(const std::string& path, int64_t mtime) {
+        std::string name;
+        Directory& parent = parentOf(path, name);
+        uint32_t parentCluster = parent.firstCluster == rootCluster ? 0 : parent.firstCluster;
+
+        uint32_t cluster = allocate(clusterSize);
+        addEntry(parent, name, ATTR_DIRECTORY, cluster, 0, mtime);
+
+        Directory dir;
+        dir.firstCluster = cluster;
+        dir.entries.resize(2 * ENTRY_SIZE);
+        fillShortEntry(dir.entries.data(), ".          ", ATTR_DIRECTORY, 0, cluster, 0, mtime);
+        fillShortEntry(dir.entries.data() + ENTRY_SIZE, "..         ", ATTR_DIRECTORY, 0,
+                       parentCluster, 0, mtime);
+
+        directories[upper(normalize(path))] = std::move(dir);
+    }
+
+    void Volume::addFile(const std::string& path, int sourceFd,
+                         const std::vector<SourceExtent>& extents, uint64_t size,
+                         int64_t mtime) {
+        if (size > 0xFFFFFFFFULL) {
+            throw FilesystemError("File too large for FAT32 (4 GiB limit): " + path);
+        }
+
+        std::string name;
+        Directory& parent = parentOf(path, name);
+
+        uint32_t first = allocate(size);
+        std::vector<SourceExtent> targets = size ? ranges(first, size) : std::vector<SourceExtent>();
+
+        // Walk source extents and target runs side by side
+        uint64_t written = 0;
+        size_t target = 0;
+        uint64_t targetUsed = 0;
+        for (const auto& extent : extents) {
+            uint64_t extentUsed = 0;
+            while (extentUsed < extent.length && written < size) {
+                uint64_t length = std::min({extent.length - extentUsed,
+                                            targets[target].length - targetUsed, size - written});
+                BlockTarget::copyRange(sourceFd, extent.offset + extentUsed, deviceFd,
+                                       targets[target].offset + targetUsed, length);
+                extentUsed += length;
+                targetUsed += length;
+                written += length;
+                if (targetUsed == targets[target].length) {
+                    target++;
+                    targetUsed = 0;
+                }
+            }
+            if (written == size) break;
+        }
+
+        if (written != size) {
+            throw FilesystemError("Source extents do not cover " + path);
+        }
+
+        addEntry(parent, name, ATTR_ARCHIVE, first, size, mtime);
+    }
+
+    void Volume::addFile(const std::string& path, const std::string& contents, int64_t mtime) {
+        if (contents.size() > 0xFFFFFFFFULL) {
+            throw FilesystemError("File too large for FAT32 (4 GiB limit): " + path);
+        }
+
+        std::string name;
+        Directory& parent = parentOf(path, name);
+
+        uint32_t first = allocate(contents.size());
+        uint64_t written = 0;
+        for (const auto& range : contents.empty() ? std::vector<SourceExtent>() :
+                                 ranges(first, contents.size())) {
+            if (pwrite(deviceFd, contents.data() + written, range.length, range.offset) !=
+                static_cast<ssize_t>(range.length)) {
+                throw DeviceError(device, "Failed to write " + path);
+            }
+            written += range.length;
+        }
+
+        addEntry(parent, name, ATTR_ARCHIVE, first, contents.size(), mtime);
+    }
+
+    uint64_t Volume::reserveFile(const std::string& path, uint64_t size, int64_t mtime) {
+        if (size > 0xFFFFFFFFULL) {
+            throw FilesystemError("File too large for FAT32 (4 GiB limit): " + path);
+        }
+
+        std::string name;
+        Directory& parent = parentOf(path, name);
+
+        uint32_t first = allocate(size);
+        if (first && ranges(first, size).size() != 1) {
+            release(first);
+            throw FilesystemError("No contiguous free space for " + path);
+        }
+        addEntry(parent, name, ATTR_ARCHIVE, first, size, mtime);
+        return first ? clusterOffset(first) : 0;
+    }
+
+    void Volume::commit() {
+        for (auto& item : directories) {
+            Directory& dir = item.second;
+
+            // Deleted entries are dropped instead of written as 0xE5 slots,
+            // since the whole directory is rewritten anyway
+            std::vector<uint8_t> live;
+            for (size_t i = 0; i < dir.entries.size(); i += ENTRY_SIZE) {
+                if (dir.entries[i] == DELETED) continue;
+                live.insert(live.end(), dir.entries.begin() + i, dir.entries.begin() + i + ENTRY_SIZE);
+            }
+            dir.entries.swap(live);
+
+            std::vector<uint32_t> clusters = chain(dir.firstCluster);
+
+            uint64_t needed = std::max<uint64_t>(1, (dir.entries.size() + clusterSize - 1) / clusterSize);
+            if (needed > clusters.size()) {
+                uint32_t extra = allocate((needed - clusters.size()) * clusterSize);
+                fat[clusters.back()] = extra;
+                clusters = chain(dir.firstCluster);
+            }
+
+            // Zero padding marks the end of the directory
+            std::vector<uint8_t> data(clusters.size() * clusterSize, 0);
+            std::copy(dir.entries.begin(), dir.entries.end(), data.begin());
+
+            for (size_t i = 0; i < clusters.size(); i++) {
+                if (pwrite(deviceFd, data.data() + i * clusterSize, clusterSize,
+                           clusterOffset(clusters[i])) != static_cast<ssize_t>(clusterSize)) {
+                    throw DeviceError(device, "Failed to write directory " + item.first);
+                }
+            }
+        }
+
+        for (uint32_t cluster : releasing) {
+            fat[cluster] = 0;
+            nextFree = std::min(nextFree, cluster);
+        }
+        releasing.clear();
+
+        // Only the used head of each FAT is written; the rest is zeroed
+        // cheaply (holes in images, BLKZEROOUT on devices)
+        uint64_t used = fat.size();
+        while (used > 2 && fat[used - 1] == 0) used--;
+
+        uint64_t fatBytes = static_cast<uint64_t>(fatSectors) * bytesPerSector;
+        uint64_t usedBytes = std::min<uint64_t>(fatBytes,
+            (used * 4 + bytesPerSector - 1) / bytesPerSector * bytesPerSector);
+
+        std::vector<uint8_t> table(usedBytes, 0);
+        for (uint64_t i = 0; i < used; i++) {
+            write32(table.data() + i * 4, fat[i]);
+        }
+
+        for (uint32_t copy = 0; copy < numFATs; copy++) {
+            uint64_t offset = baseOffset + (reservedSectors + static_cast<uint64_t>(copy) * fatSectors) *
+                              bytesPerSector;
+            if (pwrite(deviceFd, table.data(), usedBytes, offset) != static_cast<ssize_t>(usedBytes)) {
+                throw DeviceError(device, "Failed to write FAT");
+            }
+            BlockTarget::zeroRange(deviceFd, device, offset + usedBytes, fatBytes - usedBytes);
+        }
+
+        // FSInfo and its backup six sectors later, next to the backup boot sector
+        uint32_t freeClusters = freeBytes() / clusterSize;
+        for (uint32_t sector : {fsInfoSector, fsInfoSector + 6}) {
+            if (sector == 0 || sector >= reservedSectors) continue;
+
+            uint8_t info[512];
+            uint64_t offset = baseOffset + static_cast<uint64_t>(sector) * bytesPerSector;
+            if (pread(deviceFd, info, sizeof(info), offset) != sizeof(info) ||
+                read32(info) != FSINFO_LEAD) {
+                continue;
+            }
+
+            write32(info + 488, freeClusters);
+            write32(info + 492, nextFree);
+            pwrite(deviceFd, info, sizeof(info), offset);
+        }
+    }
+
+    uint64_t Volume::freeBytes() const {
+        uint64_t free = std::count(fat.begin() + std::min<size_t>(nextFree, fat.size()), fat.end(), 0u);
+        return free * clusterSize;
+    }
+
+    uint32_t Volume::clusterBytes() const {
+        return clusterSize;
+    }
+
+    uint64_t copyISO(const std::string& isoPath, Volume& volume) {
+        ISO9660::Image image;
+        if (!ISO9660::readImage(isoPath, image)) {
+            throw FileError(isoPath, "Cannot read ISO directory tree");
+        }
+
+        int isoFd = SourceCache::openSource(isoPath);
+        if (isoFd < 0) {
+            throw FileError(isoPath, "Cannot open ISO file");
+        }
+
+        uint64_t total = 0;
+        for (const auto& entry : image.entries) {
+            if (!entry.isDirectory) total += entry.size;
+        }
+
+        if (total > volume.freeBytes()) {
+            close(isoFd);
+            throw FilesystemError("ISO contents do not fit on the FAT32 volume");
+        }
+
+        // Boot files go right after the directories, in read order, so a
+        // boot streams them front to back from the start of the volume
+        std::vector<const ISO9660::Entry*> bootFiles = ISOAnalyzer::SmartAnalyzer::bootReadOrder(image);
+        std::set<const ISO9660::Entry*> placed(bootFiles.begin(), bootFiles.end());
+
+        ProgressBar progress(total, "Copying files");
+        uint64_t copied = 0;
+
+        auto copyEntry = [&](const ISO9660::Entry& entry) {
+            std::vector<SourceExtent> extents;
+            for (const auto& extent : entry.extents) {
+                extents.push_back({static_cast<uint64_t>(extent.lba) * ISO9660::SECTOR_SIZE,
+                                   extent.length});
+            }
+
+            volume.addFile(entry.path, isoFd, extents, entry.size, entry.mtime);
+            copied += entry.size;
+            progress.update(copied);
+        };
+
+        try {
+            for (const auto& entry : image.entries) {
+                if (entry.isDirectory && entry.path != "/") {
+                    volume.makeDirectory(entry.path, entry.mtime);
+                }
+            }
+
+            // The alignment gap is only spent when the volume has room for it
+            std::vector<uint64_t> sizes;
+            uint64_t bootBytes = 0;
+            for (const ISO9660::Entry* entry : bootFiles) {
+                sizes.push_back(entry->size);
+                bootBytes += entry->size;
+            }
+            uint64_t alignment = volume.freeBytes() >= total + BOOT_ALIGNMENT ? BOOT_ALIGNMENT : 0;
+
+            if (volume.beginSequence(sizes, alignment)) {
+                Logs::debug("FAT32: ", bootFiles.size(), " boot files (", bootBytes / 1024,
+                            " KB) placed first in read order");
+            }
+            for (const ISO9660::Entry* entry : bootFiles) {
+                copyEntry(*entry);
+            }
+            volume.endSequence();
+
+            for (const auto& entry : image.entries) {
+                if (!entry.isDirectory && !placed.count(&entry)) {
+                    copyEntry(entry);
+                }
+            }
+        } catch (...) {
+            close(isoFd);
+            throw;
+        }
+
+        progress.finish();
+        close(isoFd);
+        return copied;
+    }
+
+    bool sameTimestamp(const FileInfo& file, int64_t mtime) {
+        uint16_t date, time;
+        fatTimestamp(mtime, date, time);
+        return file.date == date && file.time == time;
+    }
+
+    static Hash::Digest hashExtents(int fd, const std::vector<ISO9660::Extent>& extents, uint64_t size) {
+        Hash::SHA256 hash;
+        std::vector<uint8_t> buffer(1024 * 1024);
+        uint64_t left = size;
+        for (const auto& extent : extents) {
+            uint64_t offset = static_cast<uint64_t>(extent.lba) * ISO9660::SECTOR_SIZE;
+            uint64_t length = std::min<uint64_t>(extent.length, left);
+            for (uint64_t done = 0; done < length;) {
+                size_t chunk = std::min<uint64_t>(buffer.size(), length - done);
+                SourceStager::await(fd, offset + done, chunk);
+                if (pread(fd, buffer.data(), chunk, offset + done) != static_cast<ssize_t>(chunk)) {
+                    throw FileError("ISO", "Failed to read file data");
+                }
+                hash.update(buffer.data(), chunk);
+                done += chunk;
+            }
+            left -= length;
+        }
+        return hash.finish();
+    }
+
+    uint64_t syncBytes(const std::string& isoPath, const Volume& volume) {
+        ISO9660::Image image;
+        if (!ISO9660::readImage(isoPath, image)) {
+            throw FileError(isoPath, "Cannot read ISO directory tree");
+        }
+
+        uint64_t cluster = volume.clusterBytes();
+        uint64_t needed = 0;
+        for (const auto& entry : image.entries) {
+            if (entry.path == "/") continue;
+
+            auto found = volume.files().find(upper(normalize(entry.path)));
+            bool kept = found != volume.files().end() && found->second.isDirectory == entry.isDirectory &&
+                        (entry.isDirectory || (found->second.size == entry.size &&
+                                               sameTimestamp(found->second, entry.mtime)));
+            if (kept) continue;
+
+            uint64_t size = entry.isDirectory ? cluster : entry.size;
+            needed += (size + cluster - 1) / cluster * cluster;
+        }
+        return needed;
+    }
+
+    SyncStats syncISO(const std::string& isoPath, Volume& volume, bool compareHash) {
+        ISO9660::Image image;
+        if (!ISO9660::readImage(isoPath, image)) {
+            throw FileError(isoPath, "Cannot read ISO directory tree");
+        }
+
+        std::map<std::string, const ISO9660::Entry*> wanted;
+        for (const auto& entry : image.entries) {
+            if (entry.path != "/") wanted[upper(normalize(entry.path))] = &entry;
+        }
+
+        SyncStats stats;
+
+        // Stale entries first, so paths changing kind can be re-added
+        std::vector<std::string> stale;
+        for (const auto& item : volume.files()) {
+            auto match = wanted.find(item.first);
+            bool sameKind = match != wanted.end() && match->second->isDirectory == item.second.isDirectory;
+            if (!sameKind && !SYNC_KEPT.count(item.first)) stale.push_back(item.first);
+        }
+        for (const auto& key : stale) {
+            if (volume.files().count(key) == 0) continue;       // Went with its directory
+            volume.remove(key);
+            stats.removed++;
+        }
+
+        int isoFd = SourceCache::openSource(isoPath);
+        if (isoFd < 0) {
+            throw FileError(isoPath, "Cannot open ISO file");
+        }
+
+        try {
+            for (const auto& entry : image.entries) {
+                if (entry.path == "/") continue;
+
+                auto found = volume.files().find(upper(normalize(entry.path)));
+                if (entry.isDirectory) {
+                    if (found == volume.files().end()) volume.makeDirectory(entry.path, entry.mtime);
+                    continue;
+                }
+
+                if (found != volume.files().end()) {
+                    const FileInfo& file = found->second;
+                    bool same = file.size == entry.size &&
+                                (compareHash ? volume.hashFile(file) == hashExtents(isoFd, entry.extents, entry.size)
+                                             : sameTimestamp(file, entry.mtime));
+                    if (same) {
+                        stats.unchanged++;
+                        continue;
+                    }
+                    volume.remove(entry.path);
+                }
+
+                std::vector<SourceExtent> extents;
+                for (const auto& extent : entry.extents) {
+                    extents.push_back({static_cast<uint64_t>(extent.lba) * ISO9660::SECTOR_SIZE,
+                                       extent.length});
+                }
+                volume.addFile(entry.path, isoFd, extents, entry.size, entry.mtime);
+                stats.copiedFiles++;
+                stats.copiedBytes += entry.size;
+            }
+        } catch (...) {
+            close(isoFd);
+            throw;
+        }
+
+        close(isoFd);
+        Logs::info("Sync: ", stats.copiedFiles, " files copied (", stats.copiedBytes / (1024 * 1024),
+                   " MB), ", stats.removed, " removed, ", stats.unchanged, " unchanged");
+        return stats;
+    }
+}
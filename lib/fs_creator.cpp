@@ -1,4 +1,5 @@
 #include "lib/fs_creator.hpp"
+#include "lib/block_target.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
 #include <fcntl.h>
@@ -6,13 +7,28 @@
 #include <sys/ioctl.h>
 #include <linux/fs.h>
 #include <cstring>
+#include <cstddef>
 #include <ctime>
 #include <random>
+#include <algorithm>
 
 namespace FilesystemCreator {
     
+    static bool writeAt(int fd, uint64_t offset, const void* data, size_t length) {
+        return pwrite(fd, data, length, offset) == static_cast<ssize_t>(length);
+    }
+    
+    // Size of the volume, whether it is a whole device or a slice of one
+    static uint64_t volumeSize(int fd, uint64_t offset, uint64_t length) {
+        if (length > 0) return length;
+        
+        uint64_t size = BlockTarget::querySize(fd);
+        return size > offset ? size - offset : 0;
+    }
+    
     // FAT32 Implementation
-    FAT32Creator::FAT32Creator(const std::string& dev) : device(dev), deviceFd(-1) {}
+    FAT32Creator::FAT32Creator(const std::string& dev, uint64_t offset, uint64_t length)
+        : device(dev), deviceFd(-1), baseOffset(offset), volumeLength(length) {}
     
     FAT32Creator::~FAT32Creator() {
         if (deviceFd >= 0) close(deviceFd);
@@ -21,34 +37,28 @@ namespace FilesystemCreator {
     bool FAT32Creator::create(const std::string& label) {
         Logs::info("Creating optimized FAT32 filesystem on " + device);
         
-        deviceFd = open(device.c_str(), O_RDWR | O_SYNC | O_DIRECT);
+        deviceFd = open(device.c_str(), O_RDWR);
         if (deviceFd < 0) {
-            deviceFd = open(device.c_str(), O_RDWR | O_SYNC);
-            if (deviceFd < 0) {
-                throw DeviceError(device, "Cannot open for FAT32 creation");
-            }
+            throw DeviceError(device, "Cannot open for FAT32 creation");
         }
         
-        uint64_t deviceSize;
-        if (ioctl(deviceFd, BLKGETSIZE64, &deviceSize) < 0) {
+        uint64_t deviceSize = volumeSize(deviceFd, baseOffset, volumeLength);
+        if (deviceSize == 0) {
             throw DeviceError(device, "Cannot determine device size");
         }
         
         sectorCount = deviceSize / 512;
-        Logs::debug("FAT32: " + std::to_string(sectorCount) + " sectors");
+        Logs::debug("FAT32: ", sectorCount, " sectors at offset ", baseOffset);
         
         if (!writeBootSector(label)) return false;
         if (!writeFSInfo()) return false;
         if (!writeFATs()) return false;
         if (!initializeRootDirectory()) return false;
         
-        fsync(deviceFd);
-        
         // Verify filesystem integrity
-        lseek(deviceFd, 0, SEEK_SET);
         uint8_t verify[512];
-        read(deviceFd, verify, 512);
-        if (verify[510] != 0x55 || verify[511] != 0xAA) {
+        if (pread(deviceFd, verify, 512, baseOffset) != 512 ||
+            verify[510] != 0x55 || verify[511] != 0xAA) {
             Logs::warning("FAT32 boot signature verification failed");
         }
         
@@ -56,6 +66,33 @@ namespace FilesystemCreator {
         return true;
     }
     
+    uint32_t FAT32Creator::fatSectorsFor(uint64_t sectors) {
+        // Microsoft's FAT32 sizing for 8-sector clusters and two FATs; the
+        // boot sector and the FAT/root layout must agree on it
+        uint64_t perFATSector = (256 * 8 + 2) / 2;
+        return (sectors - 32 + perFATSector - 1) / perFATSector;
+    }
+    
+    uint32_t FAT32Creator::reservedSectorsFor(uint64_t sectors) {
+        // At least 32, padded so the data region starts on a cluster
+        // boundary; clusters then never straddle a 4K flash page
+        uint32_t fatSectors = fatSectorsFor(sectors);
+        return 32 + (8 - (2 * fatSectors) % 8) % 8;
+    }
+    
+    std::vector<Pipeline::Extent> FAT32Creator::footprint(uint64_t volumeBytes) {
+        uint32_t fatSectors = fatSectorsFor(volumeBytes / 512);
+        uint64_t reserved = reservedSectorsFor(volumeBytes / 512);
+        
+        return {
+            {0, 2 * 512},                               // boot sector, FSInfo
+            {6 * 512, 2 * 512},                         // their backups
+            {reserved * 512, 512},                      // first FAT
+            {(reserved + fatSectors) * 512, 512},       // second FAT
+            {(reserved + 2 * static_cast<uint64_t>(fatSectors)) * 512, 4096}   // root directory
+        };
+    }
+    
     bool FAT32Creator::writeBootSector(const std::string& label) {
         FAT32BootSector bs;
         memset(&bs, 0, sizeof(FAT32BootSector));
@@ -67,7 +104,7 @@ namespace FilesystemCreator {
         memcpy(bs.oemName, "MSWIN4.1", 8);
         bs.bytesPerSector = 512;
         bs.sectorsPerCluster = 8;
-        bs.reservedSectorCount = 32;
+        bs.reservedSectorCount = reservedSectorsFor(sectorCount);
         bs.numFATs = 2;
         bs.rootEntryCount = 0;
         bs.totalSectors16 = 0;
@@ -75,12 +112,10 @@ namespace FilesystemCreator {
         bs.FATSize16 = 0;
         bs.sectorsPerTrack = 63;
         bs.numberOfHeads = 255;
-        bs.hiddenSectors = 0;
+        bs.hiddenSectors = baseOffset / 512;
         bs.totalSectors32 = sectorCount;
         
-        uint32_t tmpVal1 = sectorCount - bs.reservedSectorCount;
-        uint32_t tmpVal2 = (256 * bs.sectorsPerCluster) + bs.numFATs;
-        bs.FATSize32 = (tmpVal1 + tmpVal2 - 1) / tmpVal2;
+        bs.FATSize32 = fatSectorsFor(sectorCount);
         
         bs.extFlags = 0;
         bs.fsVersion = 0;
@@ -100,13 +135,8 @@ namespace FilesystemCreator {
         
         bs.signature = 0xAA55;
         
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) return false;
-        if (write(deviceFd, &bs, sizeof(FAT32BootSector)) != sizeof(FAT32BootSector))
-            return false;
-        
-        if (lseek(deviceFd, 6 * 512, SEEK_SET) != 6 * 512) return false;
-        if (write(deviceFd, &bs, sizeof(FAT32BootSector)) != sizeof(FAT32BootSector))
-            return false;
+        if (!writeAt(deviceFd, baseOffset, &bs, sizeof(FAT32BootSector))) return false;
+        if (!writeAt(deviceFd, baseOffset + 6 * 512, &bs, sizeof(FAT32BootSector))) return false;
         
         return true;
     }
@@ -121,17 +151,14 @@ namespace FilesystemCreator {
         fsi.nextFree = 0xFFFFFFFF;
         fsi.trailSignature = 0xAA550000;
         
-        if (lseek(deviceFd, 512, SEEK_SET) != 512) return false;
-        if (write(deviceFd, &fsi, sizeof(FSInfo)) != sizeof(FSInfo)) return false;
-        
-        if (lseek(deviceFd, 7 * 512, SEEK_SET) != 7 * 512) return false;
-        if (write(deviceFd, &fsi, sizeof(FSInfo)) != sizeof(FSInfo)) return false;
+        if (!writeAt(deviceFd, baseOffset + 512, &fsi, sizeof(FSInfo))) return false;
+        if (!writeAt(deviceFd, baseOffset + 7 * 512, &fsi, sizeof(FSInfo))) return false;
         
         return true;
     }
     
     bool FAT32Creator::writeFATs() {
-        uint32_t fatSectors = ((sectorCount - 32) / 256) + 1;
+        uint32_t fatSectors = fatSectorsFor(sectorCount);
         
         uint32_t fat[128];
         memset(fat, 0, sizeof(fat));
@@ -140,73 +167,112 @@ namespace FilesystemCreator {
         fat[1] = 0x0FFFFFFF;
         fat[2] = 0x0FFFFFFF;
         
-        off_t fat1Offset = 32 * 512;
-        off_t fat2Offset = (32 + fatSectors) * 512;
-        
-        if (lseek(deviceFd, fat1Offset, SEEK_SET) != fat1Offset) return false;
-        if (write(deviceFd, fat, 512) != 512) return false;
+        uint64_t reserved = reservedSectorsFor(sectorCount);
+        uint64_t fat1Offset = reserved * 512;
+        uint64_t fat2Offset = (reserved + fatSectors) * 512;
         
-        if (lseek(deviceFd, fat2Offset, SEEK_SET) != fat2Offset) return false;
-        if (write(deviceFd, fat, 512) != 512) return false;
+        if (!writeAt(deviceFd, baseOffset + fat1Offset, fat, 512)) return false;
+        if (!writeAt(deviceFd, baseOffset + fat2Offset, fat, 512)) return false;
         
         return true;
     }
     
     bool FAT32Creator::initializeRootDirectory() {
-        uint32_t fatSectors = ((sectorCount - 32) / 256) + 1;
-        off_t dataStart = (32 + 2 * fatSectors) * 512;
+        uint32_t fatSectors = fatSectorsFor(sectorCount);
+        uint64_t dataStart = (reservedSectorsFor(sectorCount) + 2 * static_cast<uint64_t>(fatSectors)) * 512;
         
         uint8_t zeros[4096];
         memset(zeros, 0, sizeof(zeros));
         
-        if (lseek(deviceFd, dataStart, SEEK_SET) != dataStart) return false;
-        if (write(deviceFd, zeros, 4096) != 4096) return false;
+        if (!writeAt(deviceFd, baseOffset + dataStart, zeros, 4096)) return false;
         
         return true;
     }
     
     // EXT4 Implementation
-    EXT4Creator::EXT4Creator(const std::string& dev) : device(dev), deviceFd(-1) {}
+    static const uint32_t EXT4_BLOCK_SIZE = 4096;
+    static const uint32_t EXT4_BLOCKS_PER_GROUP = 32768;
+    static const uint32_t EXT4_INODE_SIZE = 256;
+    static const uint32_t EXT4_INODE_RATIO = 16384;
+    static const uint32_t EXT4_MAX_EXTENT = 32768;
+    
+    static const uint32_t EXT4_ROOT_INO = 2;
+    static const uint32_t EXT4_JOURNAL_INO = 8;
+    static const uint32_t EXT4_FIRST_INO = 11;
+    
+    static const uint32_t COMPAT_HAS_JOURNAL = 0x0004;
+    static const uint32_t INCOMPAT_FILETYPE = 0x0002;
+    static const uint32_t INCOMPAT_EXTENTS = 0x0040;
+    static const uint32_t RO_COMPAT_SPARSE_SUPER = 0x0001;
+    static const uint32_t RO_COMPAT_LARGE_FILE = 0x0002;
+    static const uint32_t RO_COMPAT_GDT_CSUM = 0x0010;
+    static const uint32_t RO_COMPAT_DIR_NLINK = 0x0020;
+    static const uint32_t RO_COMPAT_EXTRA_ISIZE = 0x0040;
+    
+    static const uint16_t BG_INODE_UNINIT = 0x0001;
+    static const uint32_t EXT4_EXTENTS_FL = 0x00080000;
+    static const uint16_t EXT4_EXTENT_MAGIC = 0xF30A;
+    static const uint8_t FT_REG_FILE = 1;
+    static const uint8_t FT_DIR = 2;
+    
+    static void putBigEndian32(uint8_t* p, uint32_t value) {
+        p[0] = value >> 24;
+        p[1] = value >> 16;
+        p[2] = value >> 8;
+        p[3] = value;
+    }
+    
+    EXT4Creator::EXT4Creator(const std::string& dev, uint64_t offset, uint64_t length)
+        : device(dev), deviceFd(-1), baseOffset(offset), volumeLength(length), blockCount(0),
+          groupCount(0), inodesPerGroup(0), inodeTableBlocks(0), gdtBlocks(0),
+          nextInode(EXT4_FIRST_INO), createdAt(0) {}
     
     EXT4Creator::~EXT4Creator() {
         if (deviceFd >= 0) close(deviceFd);
     }
     
+    void EXT4Creator::addDirectory(const std::string& path, uint16_t mode) {
+        seeds.push_back({path, "", true, mode});
+    }
+    
+    void EXT4Creator::addFile(const std::string& path, const std::string& contents, uint16_t mode) {
+        seeds.push_back({path, contents, false, mode});
+    }
+    
     bool EXT4Creator::create(const std::string& label) {
         Logs::info("Creating optimized EXT4 filesystem on " + device);
         
-        deviceFd = open(device.c_str(), O_RDWR | O_SYNC | O_DIRECT);
+        // Buffered: metadata writes are small and unaligned, and the caller
+        // flushes the device once every partition is done
+        deviceFd = open(device.c_str(), O_RDWR);
         if (deviceFd < 0) {
-            deviceFd = open(device.c_str(), O_RDWR | O_SYNC);
-            if (deviceFd < 0) {
-                throw DeviceError(device, "Cannot open for EXT4 creation");
-            }
+            throw DeviceError(device, "Cannot open for EXT4 creation");
         }
         
-        uint64_t deviceSize;
-        if (ioctl(deviceFd, BLKGETSIZE64, &deviceSize) < 0) {
+        uint64_t deviceSize = volumeSize(deviceFd, baseOffset, volumeLength);
+        if (deviceSize == 0) {
             throw DeviceError(device, "Cannot determine device size");
         }
         
-        blockCount = deviceSize / 4096;
-        Logs::debug("EXT4: " + std::to_string(blockCount) + " blocks");
+        blockCount = deviceSize / EXT4_BLOCK_SIZE;
+        createdAt = time(nullptr);
+        generateUUID(uuid);
         
-        // Zero out first 8KB for clean slate
-        uint8_t zeros[8192];
-        memset(zeros, 0, sizeof(zeros));
-        lseek(deviceFd, 0, SEEK_SET);
-        write(deviceFd, zeros, sizeof(zeros));
+        computeLayout();
+        Logs::debug("EXT4: ", blockCount, " blocks, ", groupCount, " groups, ",
+                    inodesPerGroup, " inodes per group");
         
-        if (!writeSuperBlock(label)) return false;
-        if (!createBlockGroups()) return false;
         if (!createRootInode()) return false;
-        
-        fsync(deviceFd);
+        if (!writeSeeds()) return false;
+        if (!createJournal()) return false;
+        if (!writeDirectories()) return false;
+        if (!writeInodes()) return false;
+        if (!createBlockGroups()) return false;
+        if (!writeSuperBlock(label)) return false;
         
         // Verify superblock magic
-        lseek(deviceFd, 1024 + 56, SEEK_SET);
-        uint16_t magic;
-        read(deviceFd, &magic, 2);
+        uint16_t magic = 0;
+        pread(deviceFd, &magic, 2, baseOffset + 1024 + 56);
         if (magic != 0xEF53) {
             Logs::warning("EXT4 superblock magic verification failed");
         }
@@ -215,79 +281,485 @@ namespace FilesystemCreator {
         return true;
     }
     
+    uint16_t EXT4Creator::groupChecksum(const uint8_t* uuid, uint32_t group, const void* desc) {
+        // CRC16 (poly 0x8005, reflected) over UUID, group number and the
+        // descriptor up to its checksum field
+        uint16_t crc = 0xFFFF;
+        auto update = [&crc](const uint8_t* data, size_t length) {
+            for (size_t i = 0; i < length; i++) {
+                crc ^= data[i];
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+                }
+            }
+        };
+        
+        uint8_t number[4] = {
+            static_cast<uint8_t>(group), static_cast<uint8_t>(group >> 8),
+            static_cast<uint8_t>(group >> 16), static_cast<uint8_t>(group >> 24)
+        };
+        update(uuid, 16);
+        update(number, sizeof(number));
+        update(static_cast<const uint8_t*>(desc), offsetof(Ext4GroupDesc, bg_checksum));
+        return crc;
+    }
+    
+    bool EXT4Creator::hasSuperBlockBackup(uint32_t group) const {
+        if (group <= 1) return true;
+        for (uint32_t base : {3u, 5u, 7u}) {
+            uint64_t power = base;
+            while (power < group) power *= base;
+            if (power == group) return true;
+        }
+        return false;
+    }
+    
+    uint32_t EXT4Creator::groupBlocks(uint32_t group) const {
+        uint64_t start = static_cast<uint64_t>(group) * EXT4_BLOCKS_PER_GROUP;
+        return std::min<uint64_t>(EXT4_BLOCKS_PER_GROUP, blockCount - start);
+    }
+    
+    void EXT4Creator::computeLayout() {
+        if (blockCount > 0xFFFFFFFFULL) {
+            throw FilesystemError("Volume too large for ext4 without 64bit support");
+        }
+        
+        // A short last group that cannot hold its own metadata is dropped
+        while (true) {
+            groupCount = (blockCount + EXT4_BLOCKS_PER_GROUP - 1) / EXT4_BLOCKS_PER_GROUP;
+            
+            uint64_t wanted = blockCount * EXT4_BLOCK_SIZE / EXT4_INODE_RATIO;
+            uint64_t perGroup = (wanted + groupCount - 1) / groupCount;
+            perGroup = std::max<uint64_t>(32, std::min<uint64_t>(8192, perGroup));
+            inodesPerGroup = (perGroup + 15) / 16 * 16;
+            inodeTableBlocks = inodesPerGroup * EXT4_INODE_SIZE / EXT4_BLOCK_SIZE;
+            gdtBlocks = (groupCount * sizeof(Ext4GroupDesc) + EXT4_BLOCK_SIZE - 1) / EXT4_BLOCK_SIZE;
+            
+            uint32_t last = groupCount - 1;
+            uint32_t overhead = (hasSuperBlockBackup(last) ? 1 + gdtBlocks : 0) + 2 + inodeTableBlocks;
+            if (groupCount > 1 && groupBlocks(last) < overhead + 64) {
+                blockCount -= groupBlocks(last);
+                continue;
+            }
+            if (groupBlocks(0) < overhead + 64) {
+                throw FilesystemError("Volume too small for ext4");
+            }
+            break;
+        }
+        
+        groups.assign(groupCount, Ext4GroupDesc());
+        blockBitmaps.assign(groupCount, std::vector<uint8_t>(EXT4_BLOCK_SIZE, 0));
+        
+        for (uint32_t g = 0; g < groupCount; g++) {
+            uint64_t start = static_cast<uint64_t>(g) * EXT4_BLOCKS_PER_GROUP;
+            uint64_t meta = start + (hasSuperBlockBackup(g) ? 1 + gdtBlocks : 0);
+            
+            memset(&groups[g], 0, sizeof(Ext4GroupDesc));
+            groups[g].bg_block_bitmap = meta;
+            groups[g].bg_inode_bitmap = meta + 1;
+            groups[g].bg_inode_table = meta + 2;
+            markUsed(start, meta + 2 + inodeTableBlocks - start);
+        }
+    }
+    
+    void EXT4Creator::markUsed(uint64_t block, uint64_t count) {
+        for (uint64_t b = block; b < block + count; b++) {
+            uint32_t group = b / EXT4_BLOCKS_PER_GROUP;
+            uint32_t bit = b % EXT4_BLOCKS_PER_GROUP;
+            blockBitmaps[group][bit / 8] |= 1 << (bit % 8);
+        }
+    }
+    
+    uint32_t EXT4Creator::allocateBlocks(uint32_t count) {
+        auto isFree = [this](uint64_t b) {
+            uint32_t bit = b % EXT4_BLOCKS_PER_GROUP;
+            return !(blockBitmaps[b / EXT4_BLOCKS_PER_GROUP][bit / 8] & (1 << (bit % 8)));
+        };
+        
+        // First fit: everything is allocated up front, so the free space is
+        // one run per group after its metadata
+        uint64_t run = 0;
+        for (uint64_t b = 0; b < blockCount; b++) {
+            run = isFree(b) ? run + 1 : 0;
+            if (run == count) {
+                uint64_t start = b + 1 - count;
+                markUsed(start, count);
+                return start;
+            }
+        }
+        
+        throw FilesystemError("Not enough contiguous space on ext4 volume");
+    }
+    
+    EXT4Creator::Ext4Inode& EXT4Creator::newInode(uint32_t number, uint16_t mode, uint16_t links) {
+        Ext4Inode& inode = inodes[number];
+        memset(&inode, 0, sizeof(Ext4Inode));
+        inode.i_mode = mode;
+        inode.i_links_count = links;
+        inode.i_atime = inode.i_ctime = inode.i_mtime = inode.i_crtime = createdAt;
+        inode.i_extra_isize = 32;
+        return inode;
+    }
+    
+    void EXT4Creator::setExtents(Ext4Inode& inode, uint32_t start, uint32_t count) {
+        // Contiguous runs only, so the four extents of the inode body cover
+        // up to 512 MiB
+        uint32_t extents = (count + EXT4_MAX_EXTENT - 1) / EXT4_MAX_EXTENT;
+        if (extents > 4) {
+            throw FilesystemError("File too large for an inline extent tree");
+        }
+        
+        uint8_t* root = reinterpret_cast<uint8_t*>(inode.i_block);
+        memset(root, 0, sizeof(inode.i_block));
+        
+        uint16_t header[6] = {EXT4_EXTENT_MAGIC, static_cast<uint16_t>(extents), 4, 0, 0, 0};
+        memcpy(root, header, 12);
+        
+        for (uint32_t i = 0; i < extents; i++) {
+            uint32_t logical = i * EXT4_MAX_EXTENT;
+            uint16_t length = std::min(EXT4_MAX_EXTENT, count - logical);
+            uint16_t startHigh = 0;
+            uint32_t startLow = start + logical;
+            
+            uint8_t* extent = root + 12 + i * 12;
+            memcpy(extent, &logical, 4);
+            memcpy(extent + 4, &length, 2);
+            memcpy(extent + 6, &startHigh, 2);
+            memcpy(extent + 8, &startLow, 4);
+        }
+        
+        inode.i_flags |= EXT4_EXTENTS_FL;
+        inode.i_blocks_lo = count * (EXT4_BLOCK_SIZE / 512);
+    }
+    
+    bool EXT4Creator::createRootInode() {
+        newInode(EXT4_ROOT_INO, 040755, 3);
+        newInode(EXT4_FIRST_INO, 040700, 2);
+        
+        directories[EXT4_ROOT_INO] = {
+            {EXT4_ROOT_INO, FT_DIR, "."},
+            {EXT4_ROOT_INO, FT_DIR, ".."},
+            {EXT4_FIRST_INO, FT_DIR, "lost+found"}
+        };
+        directories[EXT4_FIRST_INO] = {
+            {EXT4_FIRST_INO, FT_DIR, "."},
+            {EXT4_ROOT_INO, FT_DIR, ".."}
+        };
+        
+        directoryPaths[""] = EXT4_ROOT_INO;
+        directoryPaths["lost+found"] = EXT4_FIRST_INO;
+        
+        nextInode = EXT4_FIRST_INO + 1;
+        return true;
+    }
+    
+    bool EXT4Creator::writeSeeds() {
+        for (const auto& seed : seeds) {
+            std::string path = seed.path;
+            while (!path.empty() && path.front() == '/') path.erase(0, 1);
+            while (!path.empty() && path.back() == '/') path.pop_back();
+            
+            size_t slash = path.find_last_of('/');
+            std::string parentPath = slash == std::string::npos ? "" : path.substr(0, slash);
+            std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+            
+            auto parent = directoryPaths.find(parentPath);
+            if (name.empty() || name.size() > 255 || parent == directoryPaths.end()) {
+                throw FilesystemError("Cannot seed ext4 entry: " + seed.path);
+            }
+            
+            // Seeds share group 0 with the reserved inodes, which keeps every
+            // other inode table uninitialized
+            if (nextInode > inodesPerGroup) {
+                throw FilesystemError("Too many seeded entries for ext4 volume");
+            }
+            uint32_t number = nextInode++;
+            
+            if (seed.isDirectory) {
+                newInode(number, 040000 | (seed.mode & 07777), 2);
+                inodes[parent->second].i_links_count++;
+                directories[number] = {
+                    {number, FT_DIR, "."},
+                    {parent->second, FT_DIR, ".."}
+                };
+                directoryPaths[path] = number;
+                directories[parent->second].push_back({number, FT_DIR, name});
+                continue;
+            }
+            
+            Ext4Inode& inode = newInode(number, 0100000 | (seed.mode & 07777), 1);
+            uint64_t size = seed.contents.size();
+            inode.i_size_lo = size & 0xFFFFFFFF;
+            inode.i_size_high = size >> 32;
+            
+            uint32_t count = (size + EXT4_BLOCK_SIZE - 1) / EXT4_BLOCK_SIZE;
+            uint32_t start = count ? allocateBlocks(count) : 0;
+            setExtents(inode, start, count);
+            
+            if (count) {
+                std::vector<uint8_t> data(static_cast<size_t>(count) * EXT4_BLOCK_SIZE, 0);
+                memcpy(data.data(), seed.contents.data(), size);
+                if (!writeAt(deviceFd, baseOffset + static_cast<uint64_t>(start) * EXT4_BLOCK_SIZE,
+                             data.data(), data.size())) {
+                    return false;
+                }
+            }
+            
+            directories[parent->second].push_back({number, FT_REG_FILE, name});
+        }
+        return true;
+    }
+    
+    bool EXT4Creator::createJournal() {
+        // Same steps as mke2fs; tiny volumes go without a journal
+        uint32_t journalBlocks = blockCount < 2048 ? 0 :
+                                 blockCount < 32768 ? 1024 :
+                                 blockCount < 262144 ? 4096 :
+                                 blockCount < 524288 ? 8192 : 16384;
+        if (journalBlocks == 0) return true;
+        
+        uint32_t start = allocateBlocks(journalBlocks);
+        Ext4Inode& inode = newInode(EXT4_JOURNAL_INO, 0100600, 1);
+        inode.i_size_lo = journalBlocks * EXT4_BLOCK_SIZE;
+        setExtents(inode, start, journalBlocks);
+        
+        uint64_t offset = baseOffset + static_cast<uint64_t>(start) * EXT4_BLOCK_SIZE;
+        
+        // s_start = 0 marks the journal clean, so the rest is never read
+        // before the kernel writes it; zero it only when that is free
+        if (!BlockTarget::tryZeroRange(deviceFd, offset + EXT4_BLOCK_SIZE,
+                                       static_cast<uint64_t>(journalBlocks - 1) * EXT4_BLOCK_SIZE, true)) {
+            Logs::debug("EXT4: journal left uninitialized, it is empty");
+        }
+        
+        uint8_t jsb[EXT4_BLOCK_SIZE];
+        memset(jsb, 0, sizeof(jsb));
+        putBigEndian32(jsb + 0, 0xC03B3998);        // JBD2 magic
+        putBigEndian32(jsb + 4, 4);                 // superblock v2
+        putBigEndian32(jsb + 12, EXT4_BLOCK_SIZE);
+        putBigEndian32(jsb + 16, journalBlocks);
+        putBigEndian32(jsb + 20, 1);                // first log block
+        putBigEndian32(jsb + 24, 1);                // first sequence
+        memcpy(jsb + 48, uuid, 16);
+        putBigEndian32(jsb + 64, 1);                // one user
+        
+        return writeAt(deviceFd, offset, jsb, sizeof(jsb));
+    }
+    
+    bool EXT4Creator::writeDirectories() {
+        for (auto& item : directories) {
+            const std::vector<DirEntry>& entries = item.second;
+            std::vector<uint8_t> data(EXT4_BLOCK_SIZE, 0);
+            
+            size_t blockStart = 0;
+            size_t position = 0;
+            size_t lastEntry = 0;
+            for (const auto& entry : entries) {
+                uint16_t length = (8 + entry.name.size() + 3) / 4 * 4;
+                if (position + length > blockStart + EXT4_BLOCK_SIZE) {
+                    // Last entry of a block spans to its end
+                    uint16_t rest = blockStart + EXT4_BLOCK_SIZE - lastEntry;
+                    memcpy(&data[lastEntry + 4], &rest, 2);
+                    blockStart += EXT4_BLOCK_SIZE;
+                    position = blockStart;
+                    data.resize(blockStart + EXT4_BLOCK_SIZE, 0);
+                }
+                
+                uint8_t nameLength = entry.name.size();
+                memcpy(&data[position], &entry.inode, 4);
+                memcpy(&data[position + 4], &length, 2);
+                data[position + 6] = nameLength;
+                data[position + 7] = entry.fileType;
+                memcpy(&data[position + 8], entry.name.data(), nameLength);
+                
+                lastEntry = position;
+                position += length;
+            }
+            uint16_t rest = blockStart + EXT4_BLOCK_SIZE - lastEntry;
+            memcpy(&data[lastEntry + 4], &rest, 2);
+            
+            // lost+found gets room up front so fsck never has to grow it
+            if (item.first == EXT4_FIRST_INO) {
+                while (data.size() < 4 * EXT4_BLOCK_SIZE) {
+                    size_t empty = data.size();
+                    data.resize(empty + EXT4_BLOCK_SIZE, 0);
+                    uint16_t whole = EXT4_BLOCK_SIZE;
+                    memcpy(&data[empty + 4], &whole, 2);
+                }
+            }
+            
+            uint32_t count = data.size() / EXT4_BLOCK_SIZE;
+            uint32_t start = allocateBlocks(count);
+            if (!writeAt(deviceFd, baseOffset + static_cast<uint64_t>(start) * EXT4_BLOCK_SIZE,
+                         data.data(), data.size())) {
+                return false;
+            }
+            
+            Ext4Inode& inode = inodes[item.first];
+            inode.i_size_lo = data.size();
+            setExtents(inode, start, count);
+        }
+        return true;
+    }
+    
+    bool EXT4Creator::writeInodes() {
+        // Everything lives in group 0; later tables stay uninitialized. The
+        // whole first table is written so it also clears old signatures
+        // (ISO9660, FAT) in the first megabytes of a reused device
+        std::vector<uint8_t> table(static_cast<size_t>(inodeTableBlocks) * EXT4_BLOCK_SIZE, 0);
+        
+        for (const auto& item : inodes) {
+            memcpy(&table[(item.first - 1) * EXT4_INODE_SIZE], &item.second, sizeof(Ext4Inode));
+        }
+        
+        return writeAt(deviceFd, baseOffset + static_cast<uint64_t>(groups[0].bg_inode_table) * EXT4_BLOCK_SIZE,
+                       table.data(), table.size());
+    }
+    
+    bool EXT4Creator::createBlockGroups() {
+        uint32_t usedInodes = nextInode - 1;
+        uint32_t dirs = 0;
+        for (const auto& item : inodes) {
+            if ((item.second.i_mode & 0170000) == 040000) dirs++;
+        }
+        
+        std::vector<uint8_t> inodeBitmap(EXT4_BLOCK_SIZE);
+        for (uint32_t g = 0; g < groupCount; g++) {
+            std::vector<uint8_t>& blockBitmap = blockBitmaps[g];
+            uint32_t blocks = groupBlocks(g);
+            
+            uint32_t freeBlocks = 0;
+            for (uint32_t bit = 0; bit < blocks; bit++) {
+                if (!(blockBitmap[bit / 8] & (1 << (bit % 8)))) freeBlocks++;
+            }
+            // Bits past the end of the last group count as used
+            for (uint32_t bit = blocks; bit < EXT4_BLOCK_SIZE * 8; bit++) {
+                blockBitmap[bit / 8] |= 1 << (bit % 8);
+            }
+            
+            uint32_t groupUsed = g == 0 ? usedInodes : 0;
+            std::fill(inodeBitmap.begin(), inodeBitmap.end(), 0);
+            for (uint32_t bit = 0; bit < EXT4_BLOCK_SIZE * 8; bit++) {
+                if (bit < groupUsed || bit >= inodesPerGroup) {
+                    inodeBitmap[bit / 8] |= 1 << (bit % 8);
+                }
+            }
+            
+            Ext4GroupDesc& desc = groups[g];
+            desc.bg_free_blocks_count = freeBlocks;
+            desc.bg_free_inodes_count = inodesPerGroup - groupUsed;
+            desc.bg_used_dirs_count = g == 0 ? dirs : 0;
+            desc.bg_flags = g == 0 ? 0 : BG_INODE_UNINIT;
+            desc.bg_itable_unused = inodesPerGroup - groupUsed;
+            desc.bg_checksum = groupChecksum(uuid, g, &desc);
+            
+            if (!writeAt(deviceFd, baseOffset + static_cast<uint64_t>(desc.bg_block_bitmap) * EXT4_BLOCK_SIZE,
+                         blockBitmap.data(), EXT4_BLOCK_SIZE) ||
+                !writeAt(deviceFd, baseOffset + static_cast<uint64_t>(desc.bg_inode_bitmap) * EXT4_BLOCK_SIZE,
+                         inodeBitmap.data(), EXT4_BLOCK_SIZE)) {
+                return false;
+            }
+        }
+        
+        std::vector<uint8_t> table(static_cast<size_t>(gdtBlocks) * EXT4_BLOCK_SIZE, 0);
+        memcpy(table.data(), groups.data(), groups.size() * sizeof(Ext4GroupDesc));
+        
+        for (uint32_t g = 0; g < groupCount; g++) {
+            if (!hasSuperBlockBackup(g)) continue;
+            uint64_t block = static_cast<uint64_t>(g) * EXT4_BLOCKS_PER_GROUP + 1;
+            if (!writeAt(deviceFd, baseOffset + block * EXT4_BLOCK_SIZE, table.data(), table.size())) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
     bool EXT4Creator::writeSuperBlock(const std::string& label) {
         Ext4SuperBlock sb;
         memset(&sb, 0, sizeof(Ext4SuperBlock));
         
-        uint32_t inodesPerGroup = 8192;
-        uint32_t blocksPerGroup = 32768;
-        uint32_t blockGroups = (blockCount + blocksPerGroup - 1) / blocksPerGroup;
+        uint64_t freeBlocks = 0;
+        for (const auto& desc : groups) freeBlocks += desc.bg_free_blocks_count;
         
-        sb.s_inodes_count = inodesPerGroup * blockGroups;
+        sb.s_inodes_count = inodesPerGroup * groupCount;
         sb.s_blocks_count_lo = blockCount;
         sb.s_r_blocks_count_lo = blockCount / 20;
-        sb.s_free_blocks_count_lo = blockCount - 1000;
-        sb.s_free_inodes_count = sb.s_inodes_count - 11;
+        sb.s_free_blocks_count_lo = freeBlocks;
+        sb.s_free_inodes_count = sb.s_inodes_count - (nextInode - 1);
         sb.s_first_data_block = 0;
         sb.s_log_block_size = 2;
         sb.s_log_cluster_size = 2;
-        sb.s_blocks_per_group = blocksPerGroup;
-        sb.s_clusters_per_group = blocksPerGroup;
+        sb.s_blocks_per_group = EXT4_BLOCKS_PER_GROUP;
+        sb.s_clusters_per_group = EXT4_BLOCKS_PER_GROUP;
         sb.s_inodes_per_group = inodesPerGroup;
-        sb.s_mtime = time(nullptr);
-        sb.s_wtime = time(nullptr);
+        sb.s_wtime = createdAt;
         sb.s_mnt_count = 0;
-        sb.s_max_mnt_count = 65535;
+        sb.s_max_mnt_count = 0xFFFF;
         sb.s_magic = 0xEF53;
         sb.s_state = 1;
         sb.s_errors = 1;
-        sb.s_minor_rev_level = 0;
-        sb.s_lastcheck = time(nullptr);
+        sb.s_lastcheck = createdAt;
         sb.s_checkinterval = 0;
         sb.s_creator_os = 0;
         sb.s_rev_level = 1;
-        sb.s_def_resuid = 0;
-        sb.s_def_resgid = 0;
-        sb.s_first_ino = 11;
-        sb.s_inode_size = 256;
-        sb.s_block_group_nr = 0;
-        sb.s_feature_compat = 0x38;
-        sb.s_feature_incompat = 0x2C2;
-        sb.s_feature_ro_compat = 0x7B;
-        
-        generateUUID(sb.s_uuid);
+        sb.s_first_ino = EXT4_FIRST_INO;
+        sb.s_inode_size = EXT4_INODE_SIZE;
+        sb.s_feature_incompat = INCOMPAT_FILETYPE | INCOMPAT_EXTENTS;
+        sb.s_feature_ro_compat = RO_COMPAT_SPARSE_SUPER | RO_COMPAT_LARGE_FILE | RO_COMPAT_GDT_CSUM |
+                                 RO_COMPAT_DIR_NLINK | RO_COMPAT_EXTRA_ISIZE;
+        memcpy(sb.s_uuid, uuid, sizeof(uuid));
+        sb.s_mkfs_time = createdAt;
+        sb.s_min_extra_isize = 32;
+        sb.s_want_extra_isize = 32;
+        
+        auto journal = inodes.find(EXT4_JOURNAL_INO);
+        if (journal != inodes.end()) {
+            sb.s_feature_compat |= COMPAT_HAS_JOURNAL;
+            sb.s_journal_inum = EXT4_JOURNAL_INO;
+            
+            // Backup of the journal inode's extent root and size
+            sb.s_jnl_backup_type = 1;
+            memcpy(sb.s_jnl_blocks, journal->second.i_block, sizeof(journal->second.i_block));
+            sb.s_jnl_blocks[15] = journal->second.i_size_high;
+            sb.s_jnl_blocks[16] = journal->second.i_size_lo;
+        }
         
         std::string labelPadded = label;
         labelPadded.resize(16, '\0');
         memcpy(sb.s_volume_name, labelPadded.c_str(), 16);
         
-        if (lseek(deviceFd, 1024, SEEK_SET) != 1024) return false;
-        if (write(deviceFd, &sb, sizeof(Ext4SuperBlock)) != sizeof(Ext4SuperBlock))
-            return false;
+        // The primary superblock sits 1 KiB into block 0; the rest of that
+        // block is the (cleared) boot area
+        uint8_t block[EXT4_BLOCK_SIZE];
+        memset(block, 0, sizeof(block));
+        memcpy(block + 1024, &sb, sizeof(Ext4SuperBlock));
+        if (!writeAt(deviceFd, baseOffset, block, sizeof(block))) return false;
+        
+        for (uint32_t g = 1; g < groupCount; g++) {
+            if (!hasSuperBlockBackup(g)) continue;
+            sb.s_block_group_nr = g;
+            uint64_t start = static_cast<uint64_t>(g) * EXT4_BLOCKS_PER_GROUP * EXT4_BLOCK_SIZE;
+            if (!writeAt(deviceFd, baseOffset + start, &sb, sizeof(Ext4SuperBlock))) return false;
+        }
         
         return true;
     }
     
-    bool EXT4Creator::createBlockGroups() {
-        return true;
-    }
-    
-    bool EXT4Creator::createRootInode() {
-        return true;
-    }
-    
     void EXT4Creator::generateUUID(uint8_t* uuid) {
         std::random_device rd;
         std::mt19937 gen(rd());
-        std::uniform_int_distribution<uint8_t> dis(0, 255);
+        std::uniform_int_distribution<int> dis(0, 255);
         
         for (int i = 0; i < 16; i++) {
             uuid[i] = dis(gen);
         }
+        uuid[6] = (uuid[6] & 0x0F) | 0x40;
+        uuid[8] = (uuid[8] & 0x3F) | 0x80;
     }
     
     // NTFS Implementation
-    NTFSCreator::NTFSCreator(const std::string& dev) : device(dev), deviceFd(-1) {}
+    NTFSCreator::NTFSCreator(const std::string& dev, uint64_t offset, uint64_t length)
+        : device(dev), deviceFd(-1), baseOffset(offset), volumeLength(length) {}
     
     NTFSCreator::~NTFSCreator() {
         if (deviceFd >= 0) close(deviceFd);
@@ -296,13 +768,13 @@ namespace FilesystemCreator {
     bool NTFSCreator::create(const std::string& label) {
         Logs::info("Creating NTFS filesystem on " + device);
         
-        deviceFd = open(device.c_str(), O_RDWR | O_SYNC);
+        deviceFd = open(device.c_str(), O_RDWR);
         if (deviceFd < 0) {
             throw DeviceError(device, "Cannot open for NTFS creation");
         }
         
-        uint64_t deviceSize;
-        if (ioctl(deviceFd, BLKGETSIZE64, &deviceSize) < 0) {
+        uint64_t deviceSize = volumeSize(deviceFd, baseOffset, volumeLength);
+        if (deviceSize == 0) {
             throw DeviceError(device, "Cannot determine device size");
         }
         
@@ -311,7 +783,6 @@ namespace FilesystemCreator {
         if (!writeBootSector(label)) return false;
         if (!initializeMFT()) return false;
         
-        fsync(deviceFd);
         Logs::success("NTFS filesystem created");
         return true;
     }
@@ -330,7 +801,7 @@ namespace FilesystemCreator {
         bs.mediaDescriptor = 0xF8;
         bs.sectorsPerTrack = 63;
         bs.numberOfHeads = 255;
-        bs.hiddenSectors = 0;
+        bs.hiddenSectors = baseOffset / 512;
         bs.totalSectors = sectorCount;
         bs.mftCluster = sectorCount / 2;
         bs.mftMirrorCluster = sectorCount - 1;
@@ -341,9 +812,7 @@ namespace FilesystemCreator {
         bs.volumeSerialNumber = rd();
         bs.signature = 0xAA55;
         
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) return false;
-        if (write(deviceFd, &bs, sizeof(NTFSBootSector)) != sizeof(NTFSBootSector))
-            return false;
+        if (!writeAt(deviceFd, baseOffset, &bs, sizeof(NTFSBootSector))) return false;
         
         return true;
     }
@@ -354,15 +823,27 @@ namespace FilesystemCreator {
     
     // Main interface
     bool createFilesystem(const std::string& device, const std::string& fsType,
-                         const std::string& label) {
+                         const std::string& label, uint64_t offset, uint64_t length,
+                         const std::vector<SeedEntry>& seed) {
+        if (!seed.empty() && fsType != "ext4") {
+            Logs::warning("Seed files are only written on ext4, skipping them on " + fsType);
+        }
+        
         if (fsType == "fat32" || fsType == "FAT32") {
-            FAT32Creator creator(device);
+            FAT32Creator creator(device, offset, length);
             return creator.create(label.empty() ? "MyISO" : label);
         } else if (fsType == "ext4") {
-            EXT4Creator creator(device);
+            EXT4Creator creator(device, offset, length);
+            for (const auto& entry : seed) {
+                if (entry.isDirectory) {
+                    creator.addDirectory(entry.path, entry.mode);
+                } else {
+                    creator.addFile(entry.path, entry.contents, entry.mode);
+                }
+            }
             return creator.create(label.empty() ? "persistence" : label);
         } else if (fsType == "ntfs") {
-            NTFSCreator creator(device);
+            NTFSCreator creator(device, offset, length);
             return creator.create(label.empty() ? "MyISO" : label);
         } else {
             throw FilesystemError("Unsupported filesystem type: " + fsType);
@@ -0,0 +1,419 @@
+#include "lib/golden_image.hpp"
+#include "lib/dev_handler.hpp"
+#include "lib/block_target.hpp"
+#include "lib/iso_index.hpp"
+#include "lib/write_plan.hpp"
+#include "lib/fs_creator.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include "utils/progress_bar.hpp"
+#include "utils/sha256.hpp"
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+namespace GoldenImage {
+
+    // Bumped whenever the pipeline starts producing different images
+    static const char KEY_VERSION[] = "MIGOLD2";
+    static const size_t COPY_BUFFER = 4 * 1024 * 1024;
+
+    // On-disk locations of the per-device identifiers
+    static const uint32_t MBR_SIGNATURE_OFFSET = 440;
+    static const uint32_t MBR_TABLE_OFFSET = 446;
+    static const uint8_t MBR_TYPE_GPT = 0xEE;
+    static const uint32_t FAT32_BACKUP_FIELD = 0x32;
+    static const uint32_t FAT32_VOLUME_ID = 0x43;
+    static const uint32_t FAT32_TYPE_FIELD = 0x52;
+    static const uint32_t NTFS_SERIAL = 0x48;
+    static const uint32_t EXT4_SUPERBLOCK = 1024;
+    static const uint32_t EXT4_MAGIC_FIELD = 0x38;
+    static const uint32_t EXT4_INCOMPAT_FIELD = 0x60;
+    static const uint32_t EXT4_RO_COMPAT_FIELD = 0x64;
+    static const uint32_t EXT4_UUID_FIELD = 0x68;
+    static const uint32_t EXT4_BLOCKS_FIELD = 0x04;
+    static const uint32_t EXT4_FIRST_BLOCK_FIELD = 0x14;
+    static const uint32_t EXT4_LOG_BLOCK_FIELD = 0x18;
+    static const uint32_t EXT4_PER_GROUP_FIELD = 0x20;
+    static const uint32_t EXT4_GDT_CSUM = 0x10;
+    static const uint32_t EXT4_METADATA_CSUM = 0x400;
+    static const uint32_t EXT4_64BIT = 0x80;
+    static const uint32_t EXT4_CSUM_SEED = 0x2000;
+
+    static bool makeDirectories(const std::string& path) {
+        for (size_t pos = 1; pos <= path.size(); pos++) {
+            if (pos == path.size() || path[pos] == '/') {
+                std::string part = path.substr(0, pos);
+                if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    static void randomBytes(uint8_t* out, size_t length) {
+        std::random_device rd;
+        for (size_t i = 0; i < length; i++) {
+            out[i] = rd() & 0xFF;
+        }
+    }
+
+    static bool readAt(int fd, void* buffer, size_t length, uint64_t offset) {
+        return pread(fd, buffer, length, offset) == static_cast<ssize_t>(length);
+    }
+
+    static bool writeAt(int fd, const void* buffer, size_t length, uint64_t offset) {
+        return pwrite(fd, buffer, length, offset) == static_cast<ssize_t>(length);
+    }
+
+    std::string cacheDir() {
+        const char* dir = getenv("MYISO_CACHE_DIR");
+        return (dir && *dir) ? std::string(dir) : DEFAULT_CACHE_DIR;
+    }
+
+    std::string cacheKey(const SmartBurner::BurnConfig& config) {
+        ISOIndex::IndexKey isoKey;
+        if (!ISOIndex::computeKey(config.isoPath, isoKey)) {
+            throw FileError(config.isoPath, "Cannot read ISO for golden image key");
+        }
+
+        Hash::SHA256 hash;
+        hash.update(KEY_VERSION, sizeof(KEY_VERSION));
+        hash.update(&isoKey, sizeof(isoKey));
+
+        int32_t strategy = static_cast<int32_t>(config.strategy);
+        uint8_t persistence = config.persistence ? 1 : 0;
+        uint64_t persistenceSize = config.persistence ? config.persistenceSizeMB : 0;
+        hash.update(&strategy, sizeof(strategy));
+        hash.update(&persistence, sizeof(persistence));
+        hash.update(&persistenceSize, sizeof(persistenceSize));
+        hash.update(config.persistenceFS.data(), config.persistenceFS.size());
+
+        // Half the digest is plenty to tell cache entries apart
+        return Hash::toHex(hash.finish()).substr(0, 32);
+    }
+
+    bool isBakeable(const SmartBurner::BurnConfig& config) {
+        return config.strategy == ISOAnalyzer::BurnStrategy::SMART_EXTRACT ||
+               config.strategy == ISOAnalyzer::BurnStrategy::MULTIPART;
+    }
+
+    // End of the last partition: nothing the layout writes lies beyond it
+    static uint64_t layoutEnd(const std::string& path) {
+        uint64_t end = 0;
+        for (const auto& partition : BlockTarget::readPartitions(path)) {
+            end = std::max(end, partition.offset + partition.length);
+        }
+        return end;
+    }
+
+    bool bake(const SmartBurner::BurnConfig& config, const std::string& imagePath,
+              uint64_t workspaceSize) {
+        Logs::info("Baking golden image " + imagePath);
+
+        std::string partial = imagePath + ".partial";
+        int fd = open(partial.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw FileError(partial, "Cannot create golden image");
+        }
+
+        if (ftruncate(fd, workspaceSize) != 0) {
+            close(fd);
+            unlink(partial.c_str());
+            throw FileError(partial, "Cannot size golden image");
+        }
+        close(fd);
+
+        // Partitions of the image are addressed by offset, so the pipeline
+        // writes the file directly
+        SmartBurner::BurnConfig bakeConfig = config;
+        bakeConfig.device = partial;
+        bakeConfig.seal = false;
+
+        bool baked = false;
+        try {
+            baked = SmartBurner::IntelligentBurner::burnWithStrategy(bakeConfig);
+        } catch (...) {
+            unlink(partial.c_str());
+            throw;
+        }
+
+        // Partitions are sized from the ISO alone; the space past them is
+        // the target's own, so the image stops there and fits any device
+        // that holds the layout
+        uint64_t end = baked ? layoutEnd(partial) : 0;
+        if (!baked || end == 0 || truncate(partial.c_str(), end) != 0 ||
+            rename(partial.c_str(), imagePath.c_str()) != 0) {
+            unlink(partial.c_str());
+            return false;
+        }
+
+        Logs::success("Golden image baked: " + imagePath);
+        return true;
+    }
+
+    uint64_t copyAllocated(const std::string& imagePath, const std::string& device) {
+        int inputFd = open(imagePath.c_str(), O_RDONLY);
+        if (inputFd < 0) {
+            throw FileError(imagePath, "Cannot open golden image");
+        }
+
+        int outputFd = open(device.c_str(), O_WRONLY);
+        if (outputFd < 0) {
+            close(inputFd);
+            throw DeviceError(device, "Cannot open device for writing");
+        }
+
+        uint64_t imageSize = BlockTarget::querySize(inputFd);
+        uint64_t deviceSize = BlockTarget::querySize(outputFd);
+        if (imageSize > deviceSize) {
+            close(inputFd);
+            close(outputFd);
+            throw DeviceError(device, "Device is smaller than the golden image");
+        }
+
+        // Allocated extents of the sparse image
+        Pipeline::ExtentMap data(BlockTarget::mapData(inputFd, imageSize));
+
+        // Holes read back as zeros in the image; on the device they only
+        // need zeros where old partition tables and signatures live
+        uint64_t headSize = std::min(DeviceHandler::WIPE_SIZE, deviceSize);
+        uint64_t tailStart = std::max(headSize, deviceSize - headSize);
+        Pipeline::ExtentMap zeros({{0, headSize}, {tailStart, deviceSize - tailStart}});
+        zeros.subtract(data);
+
+        std::vector<Pipeline::Extent> extents = data.extents();
+        ProgressBar progress(data.bytes(), "Golden Copy");
+
+        // Image targets next to the cache share its blocks instead
+        uint64_t copied = 0;
+        uint64_t reflinked = 0;
+        try {
+            for (const auto& extent : extents) {
+                uint64_t done = 0;
+                while (done < extent.length) {
+                    uint64_t want = std::min<uint64_t>(COPY_BUFFER, extent.length - done);
+                    reflinked += BlockTarget::copyRange(inputFd, extent.offset + done,
+                                                        outputFd, extent.offset + done, want);
+                    done += want;
+                    copied += want;
+                    progress.update(copied);
+                }
+            }
+
+            for (const auto& extent : zeros.extents()) {
+                BlockTarget::zeroRange(outputFd, device, extent.offset, extent.length);
+            }
+        } catch (...) {
+            close(inputFd);
+            close(outputFd);
+            throw;
+        }
+
+        progress.finish();
+
+        fsync(outputFd);
+        close(inputFd);
+        close(outputFd);
+
+        Logs::info("Golden image: copied " + std::to_string(copied / 1024) + " KB allocated out of " +
+                  std::to_string(imageSize / (1024 * 1024)) + " MB");
+        if (reflinked > 0) {
+            Logs::info("Golden image: " + std::to_string(reflinked / 1024) +
+                      " KB shared by reflink, not written");
+        }
+        return copied;
+    }
+
+    static int stampPartition(int fd, const std::string& device, uint64_t start) {
+        uint8_t boot[512];
+        if (!readAt(fd, boot, sizeof(boot), start)) {
+            return 0;
+        }
+
+        if (memcmp(boot + FAT32_TYPE_FIELD, "FAT32   ", 8) == 0) {
+            uint8_t serial[4];
+            randomBytes(serial, sizeof(serial));
+
+            uint16_t backup;
+            memcpy(&backup, boot + FAT32_BACKUP_FIELD, sizeof(backup));
+
+            if (!writeAt(fd, serial, sizeof(serial), start + FAT32_VOLUME_ID)) {
+                throw DeviceError(device, "Failed to stamp FAT32 volume ID");
+            }
+            if (backup != 0 && backup != 0xFFFF) {
+                writeAt(fd, serial, sizeof(serial), start + backup * 512ULL + FAT32_VOLUME_ID);
+            }
+            return 1;
+        }
+
+        if (memcmp(boot + 3, "NTFS    ", 8) == 0) {
+            uint8_t serial[8];
+            randomBytes(serial, sizeof(serial));
+            if (!writeAt(fd, serial, sizeof(serial), start + NTFS_SERIAL)) {
+                throw DeviceError(device, "Failed to stamp NTFS serial number");
+            }
+            return 1;
+        }
+
+        uint8_t super[1024];
+        if (!readAt(fd, super, sizeof(super), start + EXT4_SUPERBLOCK)) {
+            return 0;
+        }
+
+        uint16_t magic;
+        memcpy(&magic, super + EXT4_MAGIC_FIELD, sizeof(magic));
+        if (magic != 0xEF53) {
+            return 0;
+        }
+
+        uint32_t incompat, roCompat;
+        memcpy(&incompat, super + EXT4_INCOMPAT_FIELD, sizeof(incompat));
+        memcpy(&roCompat, super + EXT4_RO_COMPAT_FIELD, sizeof(roCompat));
+
+        // Checksums are seeded from the UUID unless csum_seed is set
+        if ((roCompat & EXT4_METADATA_CSUM) && !(incompat & EXT4_CSUM_SEED)) {
+            Logs::warning("ext4 with metadata checksums keeps the baked UUID");
+            return 0;
+        }
+        bool groupChecksums = (roCompat & EXT4_GDT_CSUM) && !(roCompat & EXT4_METADATA_CSUM);
+        if (groupChecksums && (incompat & EXT4_64BIT)) {
+            Logs::warning("ext4 with 64-bit group descriptors keeps the baked UUID");
+            return 0;
+        }
+
+        uint8_t uuid[16];
+        randomBytes(uuid, sizeof(uuid));
+        uuid[6] = (uuid[6] & 0x0F) | 0x40;
+        uuid[8] = (uuid[8] & 0x3F) | 0x80;
+
+        if (!writeAt(fd, uuid, sizeof(uuid), start + EXT4_SUPERBLOCK + EXT4_UUID_FIELD)) {
+            throw DeviceError(device, "Failed to stamp ext4 UUID");
+        }
+
+        // uninit_bg descriptor checksums include the UUID. Only the primary
+        // table is redone; backups stay consistent with their own superblocks
+        if (groupChecksums) {
+            uint32_t blocks, firstBlock, logBlock, perGroup;
+            memcpy(&blocks, super + EXT4_BLOCKS_FIELD, sizeof(blocks));
+            memcpy(&firstBlock, super + EXT4_FIRST_BLOCK_FIELD, sizeof(firstBlock));
+            memcpy(&logBlock, super + EXT4_LOG_BLOCK_FIELD, sizeof(logBlock));
+            memcpy(&perGroup, super + EXT4_PER_GROUP_FIELD, sizeof(perGroup));
+
+            uint64_t blockSize = 1024ULL << logBlock;
+            uint32_t groupCount = (blocks - firstBlock + perGroup - 1) / perGroup;
+            uint64_t tableOffset = start + (firstBlock + 1) * blockSize;
+
+            // 32-byte descriptors with the checksum in the last two bytes
+            std::vector<uint8_t> table(groupCount * 32ULL);
+            size_t tableBytes = table.size();
+            if (!readAt(fd, table.data(), tableBytes, tableOffset)) {
+                throw DeviceError(device, "Failed to read ext4 group descriptors");
+            }
+            for (uint32_t g = 0; g < groupCount; g++) {
+                uint8_t* desc = &table[g * 32ULL];
+                uint16_t checksum = FilesystemCreator::EXT4Creator::groupChecksum(uuid, g, desc);
+                memcpy(desc + 30, &checksum, sizeof(checksum));
+            }
+            if (!writeAt(fd, table.data(), tableBytes, tableOffset)) {
+                throw DeviceError(device, "Failed to update ext4 group descriptors");
+            }
+        }
+        return 1;
+    }
+
+    int stampIdentifiers(const std::string& device) {
+        int fd = open(device.c_str(), O_RDWR);
+        if (fd < 0) {
+            throw DeviceError(device, "Cannot open device for stamping");
+        }
+
+        uint8_t mbr[512];
+        if (!readAt(fd, mbr, sizeof(mbr), 0) || mbr[510] != 0x55 || mbr[511] != 0xAA) {
+            close(fd);
+            Logs::warning("No MBR on " + device + ", identifiers left as baked");
+            return 0;
+        }
+
+        int stamped = 0;
+
+        try {
+            for (int i = 0; i < 4; i++) {
+                const uint8_t* entry = mbr + MBR_TABLE_OFFSET + i * 16;
+                uint8_t type = entry[4];
+                uint32_t startLBA;
+                memcpy(&startLBA, entry + 8, sizeof(startLBA));
+
+                if (type == 0 || startLBA == 0) continue;
+
+                if (type == MBR_TYPE_GPT) {
+                    Logs::warning("GPT identifiers are not stamped, keeping the baked GUIDs");
+                    continue;
+                }
+
+                stamped += stampPartition(fd, device, static_cast<uint64_t>(startLBA) * 512);
+            }
+
+            uint8_t signature[4];
+            randomBytes(signature, sizeof(signature));
+            memcpy(mbr + MBR_SIGNATURE_OFFSET, signature, sizeof(signature));
+            if (!writeAt(fd, mbr, sizeof(mbr), 0)) {
+                throw DeviceError(device, "Failed to stamp disk signature");
+            }
+            stamped++;
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+
+        fsync(fd);
+        close(fd);
+
+        Logs::debug("Golden image: ", stamped, " identifiers stamped on ", device);
+        return stamped;
+    }
+
+    bool burn(const SmartBurner::BurnConfig& config) {
+        if (!isBakeable(config)) {
+            Logs::info("Raw copies are already a straight block copy, not baking");
+            return SmartBurner::IntelligentBurner::burnWithStrategy(config);
+        }
+
+        uint64_t deviceSize = DeviceHandler::getDeviceSize(config.device);
+        std::string dir = cacheDir();
+        if (!makeDirectories(dir)) {
+            throw FileError(dir, "Cannot create golden image cache directory");
+        }
+
+        std::string imagePath = dir + "/" + cacheKey(config) + ".img";
+
+        if (access(imagePath.c_str(), R_OK) == 0) {
+            Logs::info("Using cached golden image " + imagePath);
+        } else if (!bake(config, imagePath, deviceSize)) {
+            Logs::error("Baking failed");
+            return false;
+        }
+
+        // The device tail past the image is zeroed by the copy, so a sealed
+        // manifest or table left there by an earlier burn does not survive
+        DeviceHandler::unmountDevice(config.device);
+        copyAllocated(imagePath, config.device);
+        stampIdentifiers(config.device);
+        DeviceHandler::rereadPartitions(config.device);
+
+        if (config.seal) {
+            SmartBurner::IntelligentBurner::sealManifest(config);
+        }
+
+        Logs::success("Golden image written to " + config.device);
+        return true;
+    }
+}
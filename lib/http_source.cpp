@@ -0,0 +1,380 @@
+#include "lib/http_source.hpp"
+#include "lib/errors.hpp"
+#include "misc/version.hpp"
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+namespace HttpSource {
+
+    static const int TIMEOUT_SECONDS = 30;
+    static const int MAX_REDIRECTS = 5;
+    static const size_t MAX_HEADER = 64 * 1024;
+    static const size_t BLOCK = 1024 * 1024;
+
+    static std::string lower(std::string text) {
+        std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+        return text;
+    }
+
+    static std::string trim(const std::string& text) {
+        size_t first = text.find_first_not_of(" \t");
+        size_t last = text.find_last_not_of(" \t\r");
+        return first == std::string::npos ? "" : text.substr(first, last - first + 1);
+    }
+
+    bool isUrl(const std::string& path) {
+        std::string scheme = lower(path.substr(0, 8));
+        return scheme.compare(0, 7, "http://") == 0 || scheme == "https://";
+    }
+
+    // Conditions a range on the version seen by the probe; weak ETags may
+    // not be used for byte ranges
+    static std::string condition(const Resource& resource) {
+        if (!resource.etag.empty() && resource.etag.compare(0, 2, "W/") != 0) {
+            return "If-Match: " + resource.etag + "\r\n";
+        }
+        if (!resource.lastModified.empty()) {
+            return "If-Unmodified-Since: " + resource.lastModified + "\r\n";
+        }
+        return "";
+    }
+
+    Connection::Connection(const std::string& address) : fd(-1), changed(false) {
+        setURL(address);
+    }
+
+    Connection::~Connection() {
+        disconnect();
+    }
+
+    void Connection::setURL(const std::string& address) {
+        size_t hash = address.find('#');
+        url = address.substr(0, hash);
+        if (hash != std::string::npos) fragment = address.substr(hash + 1);
+
+        if (lower(url.substr(0, 8)) == "https://") {
+            throw FileError(url, "HTTPS is not supported by this build; use an http:// mirror");
+        }
+        if (lower(url.substr(0, 7)) != "http://") {
+            throw FileError(url, "Not an http:// URL");
+        }
+
+        std::string rest = url.substr(7);
+        size_t slash = rest.find('/');
+        std::string authority = rest.substr(0, slash);
+        target = slash == std::string::npos ? "/" : rest.substr(slash);
+
+        size_t at = authority.rfind('@');
+        if (at != std::string::npos) authority = authority.substr(at + 1);
+
+        port = "80";
+        if (!authority.empty() && authority[0] == '[') {
+            size_t close = authority.find(']');
+            if (close == std::string::npos) throw FileError(url, "Malformed host");
+            host = authority.substr(1, close - 1);
+            if (authority.compare(close + 1, 1, ":") == 0) port = authority.substr(close + 2);
+        } else {
+            size_t colon = authority.rfind(':');
+            host = authority.substr(0, colon);
+            if (colon != std::string::npos) port = authority.substr(colon + 1);
+        }
+        if (host.empty() || port.empty()) {
+            throw FileError(url, "Malformed URL");
+        }
+    }
+
+    void Connection::connectServer() {
+        struct addrinfo hints = {};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        struct addrinfo* addresses = nullptr;
+        int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+        if (status != 0) {
+            throw FileError(url, std::string("Cannot resolve ") + host + ": " + gai_strerror(status));
+        }
+
+        int lastError = 0;
+        for (struct addrinfo* address = addresses; address && fd < 0; address = address->ai_next) {
+            fd = socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC, address->ai_protocol);
+            if (fd < 0) {
+                lastError = errno;
+                continue;
+            }
+
+            // A stalled server fails the stream instead of hanging the burn
+            struct timeval timeout = {TIMEOUT_SECONDS, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            if (connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+                lastError = errno;
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(addresses);
+
+        if (fd < 0) {
+            throw FileError(url, "Cannot connect to " + host + ":" + port + ": " + strerror(lastError));
+        }
+    }
+
+    void Connection::disconnect() {
+        if (fd >= 0) close(fd);
+        fd = -1;
+        inbox.clear();
+    }
+
+    Connection::Response Connection::request(const std::string& headers) {
+        std::string hostHeader = host.find(':') != std::string::npos ? "[" + host + "]" : host;
+        if (port != "80") hostHeader += ":" + port;
+
+        std::string message = "GET " + target + " HTTP/1.1\r\n"
+                              "Host: " + hostHeader + "\r\n"
+                              "User-Agent: MyISO/" + Version::VERSION + "\r\n"
+                              "Accept-Encoding: identity\r\n" +
+                              headers + "\r\n";
+
+        // A kept-alive connection the server has since closed gets one
+        // fresh attempt
+        for (int attempt = 0;; attempt++) {
+            bool reused = fd >= 0;
+            if (!reused) connectServer();
+            inbox.clear();
+
+            bool sent = true;
+            for (size_t done = 0; done < message.size();) {
+                ssize_t n = send(fd, message.data() + done, message.size() - done, MSG_NOSIGNAL);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    sent = false;
+                    break;
+                }
+                done += n;
+            }
+
+            size_t end = std::string::npos;
+            int error = sent ? 0 : errno;
+            char buffer[16 * 1024];
+            while (sent && (end = inbox.find("\r\n\r\n")) == std::string::npos) {
+                if (inbox.size() > MAX_HEADER) {
+                    disconnect();
+                    throw FileError(url, "Response header too large");
+                }
+                ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) {
+                    error = n < 0 ? errno : 0;
+                    break;
+                }
+                inbox.append(buffer, n);
+            }
+
+            if (end == std::string::npos) {
+                bool silent = inbox.empty();
+                disconnect();
+                if (reused && silent && attempt == 0) continue;
+                throw FileError(url, !silent ? std::string("Truncated response header") :
+                                error == EAGAIN || error == EWOULDBLOCK ? std::string("No response (timed out)") :
+                                error ? std::string("No response: ") + strerror(error) :
+                                std::string("Connection closed without a response"));
+            }
+
+            std::string header = inbox.substr(0, end + 2);
+            inbox.erase(0, end + 4);
+
+            Response response;
+            size_t lineEnd = header.find("\r\n");
+            std::string statusLine = header.substr(0, lineEnd);
+            if (statusLine.compare(0, 5, "HTTP/") != 0 || statusLine.find(' ') == std::string::npos) {
+                disconnect();
+                throw FileError(url, "Not an HTTP response");
+            }
+            response.status = atoi(statusLine.c_str() + statusLine.find(' ') + 1);
+            response.close = statusLine.compare(0, 8, "HTTP/1.0") == 0;
+
+            for (size_t start = lineEnd + 2; start < header.size();) {
+                size_t stop = header.find("\r\n", start);
+                std::string line = header.substr(start, stop - start);
+                start = stop + 2;
+
+                size_t colon = line.find(':');
+                if (colon == std::string::npos) continue;
+                std::string name = lower(trim(line.substr(0, colon)));
+                std::string value = trim(line.substr(colon + 1));
+
+                if (name == "content-length") {
+                    response.length = strtoull(value.c_str(), nullptr, 10);
+                    response.hasLength = true;
+                } else if (name == "connection") {
+                    response.close = lower(value).find("close") != std::string::npos;
+                } else if (name == "transfer-encoding" && lower(value) != "identity") {
+                    disconnect();
+                    throw FileError(url, "Server sent a " + value + " body; a Content-Length is required");
+                } else if (name == "location") {
+                    response.location = value;
+                } else if (name == "content-range") {
+                    response.contentRange = value;
+                } else if (name == "etag") {
+                    response.etag = value;
+                } else if (name == "last-modified") {
+                    response.lastModified = value;
+                }
+            }
+            return response;
+        }
+    }
+
+    void Connection::receive(uint8_t* buffer, size_t length) {
+        size_t buffered = std::min(length, inbox.size());
+        memcpy(buffer, inbox.data(), buffered);
+        inbox.erase(0, buffered);
+
+        for (size_t done = buffered; done < length;) {
+            ssize_t n = recv(fd, buffer + done, length - done, MSG_WAITALL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                std::string cause = n == 0 ? "connection closed early" :
+                                    (errno == EAGAIN || errno == EWOULDBLOCK) ? "timed out" : strerror(errno);
+                disconnect();
+                throw FileError(url, "Transfer failed: " + cause);
+            }
+            done += n;
+        }
+    }
+
+    // Skips a body we do not want; large or unsized ones cost the connection
+    void Connection::discard(const Response& response) {
+        if (response.hasLength && response.length <= BLOCK && !response.close) {
+            std::vector<uint8_t> scratch(response.length);
+            receive(scratch.data(), scratch.size());
+        } else {
+            disconnect();
+        }
+    }
+
+    Resource Connection::probe(uint64_t headBytes, std::string& head) {
+        Resource resource;
+        if (!fragment.empty()) {
+            std::string digest = lower(fragment.compare(0, 7, "sha256=") == 0 ? fragment.substr(7) : "");
+            if (digest.size() != 64 || digest.find_first_not_of("0123456789abcdef") != std::string::npos) {
+                throw FileError(url, "The fragment must be #sha256=<64 hex digits>");
+            }
+            resource.sha256 = digest;
+        }
+
+        Response response;
+        for (int redirects = 0;; redirects++) {
+            response = request("Range: bytes=0-" + std::to_string(headBytes - 1) + "\r\n");
+
+            bool redirect = response.status == 301 || response.status == 302 || response.status == 303 ||
+                            response.status == 307 || response.status == 308;
+            if (!redirect || response.location.empty()) break;
+            if (redirects == MAX_REDIRECTS) {
+                disconnect();
+                throw FileError(url, "Too many redirects");
+            }
+
+            std::string location = response.location;
+            if (!isUrl(location)) {
+                std::string origin = url.substr(0, url.find('/', 7));
+                location = location[0] == '/' ? origin + location :
+                           url.substr(0, url.find_last_of('/') + 1) + location;
+            }
+            disconnect();
+            setURL(location);
+        }
+
+        try {
+            if (response.status == 206) {
+                // Content-Range: bytes 0-<last>/<size>
+                size_t slash = response.contentRange.find('/');
+                if (slash == std::string::npos || response.contentRange[slash + 1] == '*') {
+                    throw FileError(url, "Server did not report the size");
+                }
+                resource.size = strtoull(response.contentRange.c_str() + slash + 1, nullptr, 10);
+                resource.ranges = true;
+                head.resize(response.length);
+                receive(reinterpret_cast<uint8_t*>(&head[0]), head.size());
+                if (response.close) disconnect();
+            } else if (response.status == 200) {
+                if (!response.hasLength) {
+                    throw FileError(url, "Server did not report the size");
+                }
+                resource.size = response.length;
+                head.resize(std::min<uint64_t>(headBytes, response.length));
+                receive(reinterpret_cast<uint8_t*>(&head[0]), head.size());
+                disconnect();
+            } else if (response.status == 416) {
+                throw FileError(url, "Empty file on the server");
+            } else {
+                throw FileError(url, "HTTP status " + std::to_string(response.status));
+            }
+        } catch (...) {
+            disconnect();
+            throw;
+        }
+
+        resource.url = url;
+        resource.etag = response.etag;
+        resource.lastModified = response.lastModified;
+
+        std::string path = target.substr(0, target.find('?'));
+        resource.name = path.substr(path.find_last_of('/') + 1);
+        if (resource.name.empty()) resource.name = "download.iso";
+        return resource;
+    }
+
+    void Connection::read(const Resource& resource, uint64_t offset, uint64_t length, uint8_t* buffer) {
+        std::string range = "bytes " + std::to_string(offset) + "-" + std::to_string(offset + length - 1) +
+                            "/" + std::to_string(resource.size);
+        Response response = request("Range: bytes=" + std::to_string(offset) + "-" +
+                                    std::to_string(offset + length - 1) + "\r\n" + condition(resource));
+
+        if (response.status == 412) {
+            changed = true;
+            discard(response);
+            throw FileError(resource.url, "Changed on the server while streaming");
+        }
+        if (response.status != 206 || response.contentRange != range || response.length != length) {
+            disconnect();
+            throw FileError(resource.url, response.status == 200 ? std::string("Server ignored the range request") :
+                            response.status == 206 ? "Server answered " + response.contentRange + " for " + range :
+                            "HTTP status " + std::to_string(response.status));
+        }
+
+        receive(buffer, length);
+        if (response.close) disconnect();
+    }
+
+    void Connection::readAll(const Resource& resource,
+                             const std::function<bool(const uint8_t*, size_t)>& sink) {
+        Response response = request(condition(resource));
+        if (response.status != 200 || !response.hasLength || response.length != resource.size) {
+            disconnect();
+            throw FileError(resource.url, response.status == 412 ? std::string("Changed on the server while streaming") :
+                            response.status == 200 ? std::string("Size changed on the server") :
+                            "HTTP status " + std::to_string(response.status));
+        }
+
+        std::vector<uint8_t> block(BLOCK);
+        for (uint64_t done = 0; done < response.length;) {
+            size_t length = std::min<uint64_t>(BLOCK, response.length - done);
+            receive(block.data(), length);
+            done += length;
+            if (!sink(block.data(), length)) {
+                disconnect();
+                return;
+            }
+        }
+        if (response.close) disconnect();
+    }
+}
@@ -0,0 +1,346 @@
+#include "lib/iso9660.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
+#include "utils/logs.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <cstring>
+#include <ctime>
+#include <set>
+
+namespace ISO9660 {
+
+    static const int MAX_DEPTH = 64;
+    static const uint32_t MAX_DIRECTORY_SIZE = 64 * 1024 * 1024;
+
+    struct Reader {
+        int fd;
+        Image& image;
+        bool rockRidge;
+        uint8_t suspSkip;
+        std::set<uint32_t> visited;
+    };
+
+    static uint16_t le16(const uint8_t* p) {
+        return static_cast<uint16_t>(p[0] | (p[1] << 8));
+    }
+
+    static uint32_t le32(const uint8_t* p) {
+        return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+               (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+    }
+
+    static bool readAt(int fd, void* buffer, size_t length, uint64_t offset) {
+        SourceStager::await(fd, offset, length);
+
+        size_t done = 0;
+        while (done < length) {
+            ssize_t got = pread(fd, static_cast<uint8_t*>(buffer) + done, length - done, offset + done);
+            if (got <= 0) return false;
+            done += got;
+        }
+        return true;
+    }
+
+    static int64_t recordTime(const uint8_t* date) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_year = date[0];
+        tm.tm_mon = date[1] > 0 ? date[1] - 1 : 0;
+        tm.tm_mday = date[2] > 0 ? date[2] : 1;
+        tm.tm_hour = date[3];
+        tm.tm_min = date[4];
+        tm.tm_sec = date[5];
+
+        // Last byte is the GMT offset in 15 minute steps
+        int8_t gmtOffset = static_cast<int8_t>(date[6]);
+        return static_cast<int64_t>(timegm(&tm)) - gmtOffset * 15 * 60;
+    }
+
+    static std::string plainName(const uint8_t* name, uint8_t length) {
+        std::string result(reinterpret_cast<const char*>(name), length);
+
+        size_t version = result.find(';');
+        if (version != std::string::npos) result.erase(version);
+        if (!result.empty() && result.back() == '.') result.pop_back();
+
+        return result;
+    }
+
+    struct SystemUse {
+        std::string name;
+        bool hasName = false;
+        bool relocated = false;     // RE: lives in rr_moved, listed elsewhere
+        uint32_t childLink = 0;     // CL: placeholder for a relocated directory
+    };
+
+    static void parseSystemUse(Reader& reader, const uint8_t* area, size_t length,
+                               SystemUse& su, int depth) {
+        size_t pos = 0;
+        while (pos + 4 <= length) {
+            const uint8_t* entry = area + pos;
+            uint8_t entryLength = entry[2];
+            if (entryLength < 4 || pos + entryLength > length) break;
+
+            if (entry[0] == 'N' && entry[1] == 'M' && entryLength >= 5) {
+                uint8_t flags = entry[4];
+                if (!(flags & 0x06)) {
+                    su.name.append(reinterpret_cast<const char*>(entry + 5), entryLength - 5);
+                    su.hasName = true;
+                }
+            } else if (entry[0] == 'R' && entry[1] == 'E') {
+                su.relocated = true;
+            } else if (entry[0] == 'C' && entry[1] == 'L' && entryLength >= 12) {
+                su.childLink = le32(entry + 4);
+            } else if (entry[0] == 'C' && entry[1] == 'E' && entryLength >= 28 && depth < 8) {
+                uint32_t block = le32(entry + 4);
+                uint32_t offset = le32(entry + 12);
+                uint32_t ceLength = le32(entry + 20);
+
+                if (ceLength > 0 && ceLength <= SECTOR_SIZE * 4) {
+                    std::vector<uint8_t> continuation(ceLength);
+                    if (readAt(reader.fd, continuation.data(), ceLength,
+                               static_cast<uint64_t>(block) * SECTOR_SIZE + offset)) {
+                        parseSystemUse(reader, continuation.data(), ceLength, su, depth + 1);
+                    }
+                }
+            } else if (entry[0] == 'S' && entry[1] == 'T') {
+                break;
+            }
+
+            pos += entryLength;
+        }
+    }
+
+    static bool directoryLength(int fd, uint32_t lba, uint32_t& length) {
+        uint8_t sector[SECTOR_SIZE];
+        if (!readAt(fd, sector, SECTOR_SIZE, static_cast<uint64_t>(lba) * SECTOR_SIZE)) {
+            return false;
+        }
+        if (sector[0] < 34) return false;
+
+        length = le32(sector + 10);
+        return true;
+    }
+
+    static void walkDirectory(Reader& reader, uint32_t lba, uint32_t size,
+                              const std::string& path, int depth) {
+        if (depth > MAX_DEPTH || size == 0 || size > MAX_DIRECTORY_SIZE) return;
+        if (!reader.visited.insert(lba).second) return;
+
+        std::vector<uint8_t> data(size);
+        if (!readAt(reader.fd, data.data(), size, static_cast<uint64_t>(lba) * SECTOR_SIZE)) {
+            Logs::warning("ISO9660: unreadable directory at LBA " + std::to_string(lba));
+            return;
+        }
+
+        Entry pending;
+        bool hasPending = false;
+
+        size_t pos = 0;
+        while (pos < size) {
+            uint8_t recordLength = data[pos];
+
+            // Records never cross sectors; a zero length pads to the next one
+            if (recordLength == 0) {
+                pos = (pos / SECTOR_SIZE + 1) * SECTOR_SIZE;
+                continue;
+            }
+            if (recordLength < 34 || pos + recordLength > size) break;
+
+            const uint8_t* record = data.data() + pos;
+            pos += recordLength;
+
+            uint8_t nameLength = record[32];
+            if (33u + nameLength > recordLength) continue;
+
+            const uint8_t* name = record + 33;
+            if (nameLength == 1 && (name[0] == 0 || name[0] == 1)) continue;
+
+            uint8_t flags = record[25];
+
+            size_t suOffset = 33 + nameLength + ((nameLength % 2 == 0) ? 1 : 0) + reader.suspSkip;
+            SystemUse su;
+            if (reader.rockRidge && suOffset < recordLength) {
+                parseSystemUse(reader, record + suOffset, recordLength - suOffset, su, 0);
+            }
+            if (su.relocated) continue;
+
+            std::string entryName = su.hasName ? su.name : plainName(name, nameLength);
+            std::string entryPath = (path == "/" ? "" : path) + "/" + entryName;
+
+            uint32_t extentLBA = le32(record + 2);
+            uint32_t dataLength = le32(record + 10);
+            bool isDirectory = (flags & 0x02) != 0 || su.childLink != 0;
+
+            if (su.childLink != 0) {
+                extentLBA = su.childLink;
+                if (!directoryLength(reader.fd, extentLBA, dataLength)) continue;
+            }
+
+            // Multi-extent files repeat the record once per extent
+            if (hasPending && pending.path == entryPath) {
+                pending.extents.push_back({extentLBA, dataLength});
+                pending.size += dataLength;
+            } else {
+                if (hasPending) reader.image.entries.push_back(pending);
+
+                pending = Entry();
+                pending.path = entryPath;
+                pending.isDirectory = isDirectory;
+                pending.size = dataLength;
+                pending.mtime = recordTime(record + 18);
+                pending.extents.push_back({extentLBA, dataLength});
+                hasPending = true;
+            }
+
+            if (flags & 0x80) continue;
+
+            reader.image.entries.push_back(pending);
+            hasPending = false;
+
+            if (isDirectory) {
+                walkDirectory(reader, extentLBA, dataLength, entryPath, depth + 1);
+            }
+        }
+
+        if (hasPending) reader.image.entries.push_back(pending);
+    }
+
+    static void readBootCatalog(int fd, Image& image) {
+        uint8_t catalog[SECTOR_SIZE];
+        if (!readAt(fd, catalog, SECTOR_SIZE,
+                    static_cast<uint64_t>(image.bootCatalogLBA) * SECTOR_SIZE)) {
+            return;
+        }
+
+        // Validation entry
+        if (catalog[0] != 0x01 || catalog[30] != 0x55 || catalog[31] != 0xAA) return;
+
+        auto parseEntry = [&](const uint8_t* entry, uint8_t platform) {
+            BootEntry boot;
+            boot.platform = platform;
+            boot.bootable = entry[0] == 0x88;
+            boot.mediaType = entry[1] & 0x0F;
+            boot.sectorCount = le16(entry + 6);
+            boot.loadRBA = le32(entry + 8);
+            image.bootEntries.push_back(boot);
+        };
+
+        parseEntry(catalog + 32, catalog[1]);
+
+        size_t pos = 64;
+        while (pos + 32 <= SECTOR_SIZE) {
+            uint8_t headerId = catalog[pos];
+            if (headerId != 0x90 && headerId != 0x91) break;
+
+            uint8_t platform = catalog[pos + 1];
+            uint16_t count = le16(catalog + pos + 2);
+            pos += 32;
+
+            for (uint16_t i = 0; i < count && pos + 32 <= SECTOR_SIZE; i++) {
+                parseEntry(catalog + pos, platform);
+                pos += 32;
+
+                // Selection criteria extensions
+                while (pos + 32 <= SECTOR_SIZE && catalog[pos] == 0x44) pos += 32;
+            }
+
+            if (headerId == 0x91) break;
+        }
+    }
+
+    bool readImage(int fd, Image& image) {
+        image = Image();
+        image.volumeBlocks = 0;
+        image.bootCatalogLBA = 0;
+        image.rockRidge = false;
+
+        uint8_t descriptor[SECTOR_SIZE];
+        uint8_t rootRecord[34];
+        bool havePVD = false;
+
+        for (uint32_t sector = 16; sector < 16 + 32; sector++) {
+            if (!readAt(fd, descriptor, SECTOR_SIZE, static_cast<uint64_t>(sector) * SECTOR_SIZE)) {
+                return false;
+            }
+            if (memcmp(descriptor + 1, "CD001", 5) != 0) return false;
+
+            uint8_t type = descriptor[0];
+            if (type == 255) break;
+
+            if (type == 1 && !havePVD) {
+                havePVD = true;
+                image.volumeBlocks = le32(descriptor + 80);
+                image.volumeId.assign(reinterpret_cast<char*>(descriptor + 40), 32);
+                image.volumeId.erase(image.volumeId.find_last_not_of(' ') + 1);
+                memcpy(rootRecord, descriptor + 156, 34);
+            } else if (type == 0 && memcmp(descriptor + 7, "EL TORITO SPECIFICATION", 23) == 0) {
+                image.bootCatalogLBA = le32(descriptor + 0x47);
+            }
+        }
+
+        if (!havePVD) return false;
+
+        uint32_t rootLBA = le32(rootRecord + 2);
+        uint32_t rootSize = le32(rootRecord + 10);
+
+        Reader reader{fd, image, false, 0, {}};
+
+        // SUSP "SP" in the root's "." record announces Rock Ridge
+        uint8_t rootSector[SECTOR_SIZE];
+        if (readAt(fd, rootSector, SECTOR_SIZE, static_cast<uint64_t>(rootLBA) * SECTOR_SIZE)) {
+            uint8_t dotLength = rootSector[0];
+            const uint8_t* su = rootSector + 34;
+            if (dotLength >= 41 && su[0] == 'S' && su[1] == 'P' && su[4] == 0xBE && su[5] == 0xEF) {
+                reader.rockRidge = true;
+                reader.suspSkip = su[6];
+                image.rockRidge = true;
+            }
+        }
+
+        Entry root;
+        root.path = "/";
+        root.isDirectory = true;
+        root.size = rootSize;
+        root.mtime = recordTime(rootRecord + 18);
+        root.extents.push_back({rootLBA, rootSize});
+        image.entries.push_back(root);
+
+        walkDirectory(reader, rootLBA, rootSize, "/", 0);
+
+        if (image.bootCatalogLBA != 0) {
+            readBootCatalog(fd, image);
+        }
+
+        return true;
+    }
+
+    bool readImage(const std::string& isoPath, Image& image) {
+        int fd = SourceCache::openSource(isoPath);
+        if (fd < 0) return false;
+
+        bool ok = readImage(fd, image);
+        close(fd);
+        return ok;
+    }
+
+    const Entry* findEntry(const Image& image, const std::string& path) {
+        for (const auto& entry : image.entries) {
+            if (strcasecmp(entry.path.c_str(), path.c_str()) == 0) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+
+    const Entry* findByLBA(const Image& image, uint32_t lba) {
+        for (const auto& entry : image.entries) {
+            if (!entry.isDirectory && !entry.extents.empty() && entry.extents[0].lba == lba) {
+                return &entry;
+            }
+        }
+        return nullptr;
+    }
+}
@@ -1,9 +1,12 @@
 #include "lib/iso_analyzer.hpp"
+#include "lib/iso_index.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
 #include <fstream>
 #include <cstring>
 #include <algorithm>
+#include <memory>
+#include <strings.h>
 
 namespace ISOAnalyzer {
     
@@ -11,21 +14,42 @@ namespace ISOAnalyzer {
         Logs::info("Performing deep analysis of ISO structure...");
         
         ISOStructure structure;
+        structure.efiImage = ESPImage::BootImage{0, 0, ""};
         structure.isHybrid = checkHybridISO(isoPath);
-        structure.hasElTorito = checkElTorito(isoPath);
-        structure.hasUEFI = checkUEFI(isoPath);
-        structure.hasLegacyBoot = structure.hasElTorito || structure.isHybrid;
         structure.embeddedPartitions = extractEmbeddedPartitions(isoPath);
-        structure.bootFiles = findBootFiles(isoPath);
+        
+        // A matching sidecar index already holds the boot catalog and
+        // directory tree, so the ISO body is never scanned
+        std::unique_ptr<ISOIndex::Index> index = ISOIndex::Index::open(isoPath);
+        if (index) {
+            Logs::info("Using precomputed index " + ISOIndex::sidecarPath(isoPath));
+            
+            ISO9660::Image image = index->image();
+            structure.hasElTorito = !image.bootEntries.empty();
+            structure.hasUEFI = checkUEFI(image);
+            structure.bootFiles = findBootFiles(image);
+            structure.isoDataSize = index->isoSize();
+            ESPImage::locate(isoPath, image, structure.efiImage);
+        } else {
+            structure.hasElTorito = checkElTorito(isoPath);
+            structure.hasUEFI = checkUEFI(isoPath);
+            structure.bootFiles = findBootFiles(isoPath);
+            
+            // Calculate ISO data size
+            std::ifstream file(isoPath, std::ios::binary | std::ios::ate);
+            structure.isoDataSize = file.tellg();
+            file.close();
+            
+            if (structure.hasUEFI) {
+                ESPImage::locate(isoPath, structure.efiImage);
+            }
+        }
+        
+        structure.hasLegacyBoot = structure.hasElTorito || structure.isHybrid;
         
         // Determine if multi-boot
         structure.isMultiBoot = structure.hasUEFI && structure.hasLegacyBoot;
         
-        // Calculate ISO data size
-        std::ifstream file(isoPath, std::ios::binary | std::ios::ate);
-        structure.isoDataSize = file.tellg();
-        file.close();
-        
         // Determine boot type
         if (structure.isMultiBoot) {
             structure.bootType = "Multi-Boot (UEFI + Legacy)";
@@ -43,6 +67,9 @@ namespace ISOAnalyzer {
         Logs::info("  Type: " + structure.bootType);
         Logs::info("  Hybrid: " + std::string(structure.isHybrid ? "Yes" : "No"));
         Logs::info("  UEFI: " + std::string(structure.hasUEFI ? "Yes" : "No"));
+        if (structure.efiImage.size > 0) {
+            Logs::info("  EFI Boot Image: " + std::to_string(structure.efiImage.size / 1024) + " KB");
+        }
         Logs::info("  Legacy Boot: " + std::string(structure.hasLegacyBoot ? "Yes" : "No"));
         Logs::info("  Embedded Partitions: " + std::to_string(structure.embeddedPartitions.size()));
         
@@ -232,6 +259,90 @@ namespace ISOAnalyzer {
         return partitions;
     }
     
+    bool SmartAnalyzer::checkUEFI(const ISO9660::Image& image) {
+        for (const auto& boot : image.bootEntries) {
+            if (boot.platform == static_cast<uint8_t>(ISO9660::BootPlatform::EFI)) {
+                return true;
+            }
+        }
+        
+        for (const auto& entry : image.entries) {
+            if (strncasecmp(entry.path.c_str(), "/efi/boot/", 10) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    std::vector<std::string> SmartAnalyzer::findBootFiles(const ISO9660::Image& image) {
+        std::vector<std::string> bootFiles;
+        
+        // Kernel and initrd names usually carry a version suffix
+        const std::vector<std::string> exact = {
+            "isolinux.bin", "syslinux.bin", "bootx64.efi", "bootia32.efi",
+            "grubx64.efi", "grub.cfg"
+        };
+        const std::vector<std::string> prefixes = {"vmlinuz", "initrd"};
+        
+        for (const auto& entry : image.entries) {
+            if (entry.isDirectory) continue;
+            
+            std::string name = entry.path.substr(entry.path.find_last_of('/') + 1);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            
+            bool match = std::find(exact.begin(), exact.end(), name) != exact.end();
+            for (const auto& prefix : prefixes) {
+                if (name.compare(0, prefix.size(), prefix) == 0) match = true;
+            }
+            
+            if (match) bootFiles.push_back(entry.path);
+        }
+        
+        return bootFiles;
+    }
+    
+    std::vector<const ISO9660::Entry*> SmartAnalyzer::bootReadOrder(const ISO9660::Image& image) {
+        auto stage = [](const std::string& path) {
+            std::string name = path.substr(path.find_last_of('/') + 1);
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            
+            auto endsWith = [&name](const std::string& suffix) {
+                return name.size() >= suffix.size() &&
+                       name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+            };
+            
+            if (endsWith(".squashfs")) return 4;
+            if (name.compare(0, 6, "initrd") == 0) return 3;
+            if (name.compare(0, 7, "vmlinuz") == 0) return 2;
+            if (endsWith(".cfg")) return 1;
+            return 0;
+        };
+        
+        // findBootFiles leaves out the live root images and the
+        // ISOLINUX/SYSLINUX menus
+        std::vector<std::string> paths = findBootFiles(image);
+        for (const auto& entry : image.entries) {
+            if (entry.isDirectory) continue;
+            
+            std::string name = entry.path.substr(entry.path.find_last_of('/') + 1);
+            if (stage(entry.path) == 4 || strcasecmp(name.c_str(), "isolinux.cfg") == 0 ||
+                strcasecmp(name.c_str(), "syslinux.cfg") == 0) {
+                paths.push_back(entry.path);
+            }
+        }
+        
+        std::vector<const ISO9660::Entry*> order;
+        for (const auto& path : paths) {
+            const ISO9660::Entry* entry = ISO9660::findEntry(image, path);
+            if (entry && entry->size > 0) order.push_back(entry);
+        }
+        
+        std::stable_sort(order.begin(), order.end(), [&stage](const ISO9660::Entry* a, const ISO9660::Entry* b) {
+            return stage(a->path) < stage(b->path);
+        });
+        return order;
+    }
+    
     std::vector<std::string> SmartAnalyzer::findBootFiles(const std::string& isoPath) {
         std::vector<std::string> bootFiles;
         
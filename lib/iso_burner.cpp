@@ -1,6 +1,11 @@
 #include "lib/iso_burner.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
 #include "lib/errors.hpp"
 #include "lib/bootloader.hpp"
+#include "lib/iso_index.hpp"
+#include "lib/dev_handler.hpp"
+#include "lib/block_target.hpp"
 #include "utils/logs.hpp"
 #include "utils/progress_bar.hpp"
 #include <fstream>
@@ -8,6 +13,11 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <cstring>
+#include <memory>
+#include <algorithm>
 
 namespace ISOBurner {
     
@@ -127,22 +137,33 @@ namespace ISOBurner {
     bool burnRawMode(const std::string& isoPath, const std::string& device) {
         Logs::info("Burning ISO in RAW mode with optimized I/O");
         
-        int inputFd = open(isoPath.c_str(), O_RDONLY);
+        int inputFd = SourceCache::openSource(isoPath);
         if (inputFd < 0) {
             throw FileError(isoPath, "Cannot open ISO file");
         }
         
-        int outputFd = open(device.c_str(), O_WRONLY | O_SYNC | O_DIRECT);
-        if (outputFd < 0) {
+        // Image files go through the page cache and are flushed once at the
+        // end; O_DIRECT would only defeat copy_file_range there
+        bool imageTarget = BlockTarget::isImageFile(device);
+        int outputFd = imageTarget ? open(device.c_str(), O_WRONLY) :
+                                     open(device.c_str(), O_WRONLY | O_SYNC | O_DIRECT);
+        if (outputFd < 0 && !imageTarget) {
             outputFd = open(device.c_str(), O_WRONLY | O_SYNC);
-            if (outputFd < 0) {
-                close(inputFd);
-                throw DeviceError(device, "Cannot open device for writing");
-            }
+        }
+        if (outputFd < 0) {
+            close(inputFd);
+            throw DeviceError(device, "Cannot open device for writing");
         }
         
         size_t totalSize = getISOSize(isoPath);
-        ProgressBar progress(totalSize, "Writing ISO");
+        
+        // Holes in a sparse source are zeroed on the target without reading
+        // them; the progress bar only counts bytes that are actually read
+        std::vector<Pipeline::Extent> data = BlockTarget::mapData(inputFd, totalSize);
+        uint64_t dataBytes = 0;
+        for (const auto& extent : data) dataBytes += extent.length;
+        
+        ProgressBar progress(dataBytes, "Writing ISO");
         
         const size_t BUFFER_SIZE = 4 * 1024 * 1024;
         
@@ -155,20 +176,100 @@ namespace ISOBurner {
         
         char* buffer = static_cast<char*>(alignedBuffer);
         size_t bytesWritten = 0;
+        uint64_t dataDone = 0;
+        uint64_t holeBytes = 0;
+        size_t nextData = 0;
+        
+        // Zero chunks recorded in the sidecar index are cleared on the device
+        // without reading them from the source
+        std::unique_ptr<ISOIndex::Index> index = ISOIndex::Index::open(isoPath);
+        const uint64_t chunkSize = index ? index->chunkSize() : BUFFER_SIZE;
+        auto isZeroChunk = [&](uint64_t offset) {
+            return index && offset % chunkSize == 0 && offset + chunkSize <= totalSize &&
+                   index->isZeroChunk(offset / chunkSize);
+        };
+        
+        if (index) {
+            Logs::info("Using block index: " + std::to_string(index->zeroChunks()) + 
+                      " zero chunks will not be read");
+        }
+        
+        // An image on the same btrfs/XFS filesystem as the ISO can share its
+        // blocks outright, embedded partitions included
+        if (imageTarget && BlockTarget::cloneRange(inputFd, 0, outputFd, 0, totalSize)) {
+            Logs::info("Reflinked ISO into " + device + ", no data copied");
+            bytesWritten = totalSize;
+            dataDone = dataBytes;
+            progress.update(dataDone);
+        }
         
         try {
-            ssize_t bytesRead;
-            while ((bytesRead = read(inputFd, buffer, BUFFER_SIZE)) > 0) {
-                size_t totalWritten = 0;
+            while (bytesWritten < totalSize) {
+                while (nextData < data.size() &&
+                       data[nextData].offset + data[nextData].length <= bytesWritten) {
+                    nextData++;
+                }
+                
+                uint64_t dataStart = nextData < data.size() ? data[nextData].offset : totalSize;
+                if (dataStart > bytesWritten) {
+                    uint64_t run = dataStart - bytesWritten;
+                    
+                    // A hole in an image target already reads as zeros
+                    if (!BlockTarget::isHole(outputFd, bytesWritten, run)) {
+                        BlockTarget::zeroRange(outputFd, device, bytesWritten, run);
+                    }
+                    
+                    holeBytes += run;
+                    bytesWritten += run;
+                    continue;
+                }
                 
+                uint64_t dataEnd = data[nextData].offset + data[nextData].length;
+                
+                if (isZeroChunk(bytesWritten)) {
+                    uint64_t run = 0;
+                    while (bytesWritten + run < dataEnd && isZeroChunk(bytesWritten + run)) {
+                        run += chunkSize;
+                    }
+                    run = std::min<uint64_t>(run, dataEnd - bytesWritten);
+                    
+                    BlockTarget::zeroRange(outputFd, device, bytesWritten, run);
+                    
+                    bytesWritten += run;
+                    dataDone += run;
+                    progress.update(dataDone);
+                    continue;
+                }
+                
+                size_t want = std::min<uint64_t>(BUFFER_SIZE, dataEnd - bytesWritten);
+                for (uint64_t offset = bytesWritten + chunkSize; offset < bytesWritten + want; 
+                     offset += chunkSize) {
+                    if (isZeroChunk(offset)) {
+                        want = offset - bytesWritten;
+                        break;
+                    }
+                }
+                
+                if (imageTarget) {
+                    BlockTarget::copyRange(inputFd, bytesWritten, outputFd, bytesWritten, want);
+                    bytesWritten += want;
+                    dataDone += want;
+                    progress.update(dataDone);
+                    continue;
+                }
+                
+                SourceStager::await(inputFd, bytesWritten, want);
+                ssize_t bytesRead = pread(inputFd, buffer, want, bytesWritten);
+                if (bytesRead <= 0) {
+                    throw FileError(isoPath, "Read operation failed");
+                }
+                
+                size_t totalWritten = 0;
                 while (totalWritten < static_cast<size_t>(bytesRead)) {
-                    ssize_t written = write(outputFd, buffer + totalWritten, 
-                                           bytesRead - totalWritten);
+                    ssize_t written = pwrite(outputFd, buffer + totalWritten, 
+                                            bytesRead - totalWritten, bytesWritten + totalWritten);
                     
                     if (written < 0) {
-                        free(alignedBuffer);
-                        close(inputFd);
-                        close(outputFd);
                         throw DeviceError(device, "Write operation failed");
                     }
                     
@@ -176,12 +277,18 @@ namespace ISOBurner {
                 }
                 
                 bytesWritten += bytesRead;
-                progress.update(bytesWritten);
+                dataDone += bytesRead;
+                progress.update(dataDone);
             }
             
             progress.finish();
             free(alignedBuffer);
             
+            if (holeBytes > 0) {
+                Logs::info("Sparse source: " + std::to_string(holeBytes / (1024 * 1024)) +
+                          " MB of holes zeroed without reading");
+            }
+            
         } catch (...) {
             free(alignedBuffer);
             close(inputFd);
@@ -202,7 +309,7 @@ namespace ISOBurner {
     bool burnFastMode(const std::string& isoPath, const std::string& device) {
         Logs::info("Burning ISO in FAST mode with zero-copy I/O");
         
-        int inputFd = open(isoPath.c_str(), O_RDONLY);
+        int inputFd = SourceCache::openSource(isoPath);
         if (inputFd < 0) {
             throw FileError(isoPath, "Cannot open ISO file");
         }
@@ -223,6 +330,7 @@ namespace ISOBurner {
             while (bytesWritten < totalSize) {
                 size_t toWrite = std::min(CHUNK_SIZE, totalSize - bytesWritten);
                 
+                SourceStager::await(inputFd, bytesWritten, toWrite);
                 ssize_t sent = sendfile(outputFd, inputFd, nullptr, toWrite);
                 
                 if (sent <= 0) {
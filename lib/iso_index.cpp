@@ -0,0 +1,337 @@
+#include "lib/iso_index.hpp"
+#include "lib/block_manifest.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+namespace ISOIndex {
+
+    static const char MAGIC[8] = {'M', 'I', 'I', 'D', 'X', '0', '0', '1'};
+    static const uint32_t VERSION = 1;
+    static const size_t HEAD_BYTES = 64 * 1024;
+
+    static uint64_t align8(uint64_t value) {
+        return (value + 7) & ~7ULL;
+    }
+
+    std::string sidecarPath(const std::string& isoPath) {
+        return isoPath + ".miidx";
+    }
+
+    bool computeKey(const std::string& isoPath, IndexKey& key) {
+        memset(&key, 0, sizeof(key));
+
+        int fd = ::open(isoPath.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) {
+            close(fd);
+            return false;
+        }
+
+        key.size = st.st_size;
+        key.mtimeSec = st.st_mtim.tv_sec;
+        key.mtimeNsec = st.st_mtim.tv_nsec;
+
+        std::vector<uint8_t> head(std::min<uint64_t>(HEAD_BYTES, st.st_size));
+        ssize_t got = pread(fd, head.data(), head.size(), 0);
+        close(fd);
+
+        if (got != static_cast<ssize_t>(head.size())) return false;
+
+        Hash::Digest digest = Hash::sha256(head.data(), head.size());
+        memcpy(key.headHash, digest.data(), 32);
+        return true;
+    }
+
+    Index::Index(void* map, size_t size)
+        : mapping(map), mappingSize(size), header(static_cast<const IndexHeader*>(map)) {
+    }
+
+    Index::~Index() {
+        munmap(mapping, mappingSize);
+    }
+
+    std::unique_ptr<Index> Index::open(const std::string& isoPath) {
+        IndexKey key;
+        if (!computeKey(isoPath, key)) return nullptr;
+
+        int fd = ::open(sidecarPath(isoPath).c_str(), O_RDONLY);
+        if (fd < 0) return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(IndexHeader)) {
+            close(fd);
+            return nullptr;
+        }
+
+        void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return nullptr;
+
+        const IndexHeader* header = static_cast<const IndexHeader*>(map);
+        uint64_t size = st.st_size;
+
+        bool valid = memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+                     header->version == VERSION &&
+                     header->totalSize == size &&
+                     header->chunkSize == BlockManifest::CHUNK_SIZE &&
+                     header->hashesOffset + header->chunkCount * 32 <= size &&
+                     header->zeroMapOffset + (header->chunkCount + 7) / 8 <= size &&
+                     header->filesOffset + header->fileCount * sizeof(FileRecord) <= size &&
+                     header->extentsOffset + header->extentCount * sizeof(ExtentRecord) <= size &&
+                     header->bootOffset + header->bootCount * sizeof(BootRecord) <= size &&
+                     header->stringsOffset + header->stringsSize <= size;
+
+        // A stale index (the ISO was replaced or touched) is simply ignored
+        if (!valid || memcmp(&header->key, &key, sizeof(IndexKey)) != 0) {
+            munmap(map, size);
+            return nullptr;
+        }
+
+        return std::unique_ptr<Index>(new Index(map, size));
+    }
+
+    uint32_t Index::chunkSize() const {
+        return header->chunkSize;
+    }
+
+    uint64_t Index::chunkCount() const {
+        return header->chunkCount;
+    }
+
+    uint64_t Index::zeroChunks() const {
+        return header->zeroChunks;
+    }
+
+    uint64_t Index::isoSize() const {
+        return header->key.size;
+    }
+
+    Hash::Digest Index::chunkHash(uint64_t chunk) const {
+        Hash::Digest digest;
+        memcpy(digest.data(), static_cast<const uint8_t*>(mapping) + header->hashesOffset + chunk * 32, 32);
+        return digest;
+    }
+
+    bool Index::isZeroChunk(uint64_t chunk) const {
+        if (chunk >= header->chunkCount) return false;
+        const uint8_t* bitmap = static_cast<const uint8_t*>(mapping) + header->zeroMapOffset;
+        return (bitmap[chunk / 8] >> (chunk % 8)) & 1;
+    }
+
+    ISO9660::Image Index::image() const {
+        ISO9660::Image image;
+        image.volumeBlocks = header->volumeBlocks;
+        image.bootCatalogLBA = header->bootCatalogLBA;
+        image.rockRidge = header->rockRidge != 0;
+
+        const uint8_t* base = static_cast<const uint8_t*>(mapping);
+        const FileRecord* files = reinterpret_cast<const FileRecord*>(base + header->filesOffset);
+        const ExtentRecord* extents = reinterpret_cast<const ExtentRecord*>(base + header->extentsOffset);
+        const BootRecord* boots = reinterpret_cast<const BootRecord*>(base + header->bootOffset);
+        const char* strings = reinterpret_cast<const char*>(base + header->stringsOffset);
+
+        if (header->volumeIdLength <= header->stringsSize) {
+            image.volumeId.assign(strings, header->volumeIdLength);
+        }
+
+        image.entries.reserve(header->fileCount);
+        for (uint64_t i = 0; i < header->fileCount; i++) {
+            const FileRecord& file = files[i];
+            if (file.pathOffset + file.pathLength > header->stringsSize ||
+                file.firstExtent + file.extentCount > header->extentCount) {
+                continue;
+            }
+
+            ISO9660::Entry entry;
+            entry.path.assign(strings + file.pathOffset, file.pathLength);
+            entry.isDirectory = file.isDirectory != 0;
+            entry.size = file.size;
+            entry.mtime = file.mtime;
+            for (uint32_t e = 0; e < file.extentCount; e++) {
+                entry.extents.push_back({extents[file.firstExtent + e].lba,
+                                         extents[file.firstExtent + e].length});
+            }
+            image.entries.push_back(entry);
+        }
+
+        for (uint64_t i = 0; i < header->bootCount; i++) {
+            ISO9660::BootEntry boot;
+            boot.platform = boots[i].platform;
+            boot.bootable = boots[i].bootable != 0;
+            boot.mediaType = boots[i].mediaType;
+            boot.sectorCount = boots[i].sectorCount;
+            boot.loadRBA = boots[i].loadRBA;
+            image.bootEntries.push_back(boot);
+        }
+
+        return image;
+    }
+
+    bool build(const std::string& isoPath) {
+        Logs::info("Building block index for " + isoPath);
+
+        IndexKey key;
+        if (!computeKey(isoPath, key)) {
+            throw FileError(isoPath, "Cannot read ISO for indexing");
+        }
+
+        int fd = ::open(isoPath.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw FileError(isoPath, "Cannot open ISO for indexing");
+        }
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+        const uint32_t chunkSize = BlockManifest::CHUNK_SIZE;
+        std::vector<Hash::Digest> hashes = BlockManifest::hashExtents(
+            fd, {{0, key.size}}, chunkSize, "Indexing");
+
+        ISO9660::Image image;
+        if (!ISO9660::readImage(fd, image)) {
+            Logs::warning("No ISO9660 directory found, indexing blocks only");
+        }
+        close(fd);
+
+        // Zero chunks are recognised by digest, no second pass over the data
+        std::vector<uint8_t> zeros(chunkSize, 0);
+        Hash::Digest zeroFull = Hash::sha256(zeros.data(), chunkSize);
+        Hash::Digest zeroTail = Hash::sha256(zeros.data(), key.size % chunkSize);
+
+        uint64_t chunkCount = hashes.size();
+        std::vector<uint8_t> zeroMap((chunkCount + 7) / 8, 0);
+        uint64_t zeroChunks = 0;
+
+        for (uint64_t i = 0; i < chunkCount; i++) {
+            bool tail = (i == chunkCount - 1) && (key.size % chunkSize != 0);
+            if (hashes[i] == (tail ? zeroTail : zeroFull)) {
+                zeroMap[i / 8] |= 1 << (i % 8);
+                zeroChunks++;
+            }
+        }
+
+        std::vector<FileRecord> files;
+        std::vector<ExtentRecord> extents;
+        std::string strings = image.volumeId;
+
+        for (const auto& entry : image.entries) {
+            FileRecord file;
+            file.pathOffset = strings.size();
+            file.pathLength = entry.path.size();
+            file.isDirectory = entry.isDirectory ? 1 : 0;
+            file.extentCount = entry.extents.size();
+            file.firstExtent = extents.size();
+            file.size = entry.size;
+            file.mtime = entry.mtime;
+            files.push_back(file);
+
+            strings += entry.path;
+            for (const auto& extent : entry.extents) {
+                extents.push_back({extent.lba, 0, extent.length});
+            }
+        }
+
+        std::vector<BootRecord> boots;
+        for (const auto& entry : image.bootEntries) {
+            BootRecord boot;
+            memset(&boot, 0, sizeof(boot));
+            boot.platform = entry.platform;
+            boot.bootable = entry.bootable ? 1 : 0;
+            boot.mediaType = entry.mediaType;
+            boot.sectorCount = entry.sectorCount;
+            boot.loadRBA = entry.loadRBA;
+            boots.push_back(boot);
+        }
+
+        IndexHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.chunkSize = chunkSize;
+        header.key = key;
+        header.chunkCount = chunkCount;
+        header.zeroChunks = zeroChunks;
+        header.volumeBlocks = image.volumeBlocks;
+        header.bootCatalogLBA = image.bootCatalogLBA;
+        header.rockRidge = image.rockRidge ? 1 : 0;
+        header.volumeIdLength = image.volumeId.size();
+
+        // Sections are 8-byte aligned so the mapped records can be read in place
+        uint64_t offset = align8(sizeof(IndexHeader));
+        header.hashesOffset = offset;
+        offset = align8(offset + chunkCount * 32);
+        header.zeroMapOffset = offset;
+        offset = align8(offset + zeroMap.size());
+        header.fileCount = files.size();
+        header.filesOffset = offset;
+        offset = align8(offset + files.size() * sizeof(FileRecord));
+        header.extentCount = extents.size();
+        header.extentsOffset = offset;
+        offset = align8(offset + extents.size() * sizeof(ExtentRecord));
+        header.bootCount = boots.size();
+        header.bootOffset = offset;
+        offset = align8(offset + boots.size() * sizeof(BootRecord));
+        header.stringsSize = strings.size();
+        header.stringsOffset = offset;
+        offset = align8(offset + strings.size());
+        header.totalSize = offset;
+
+        std::vector<uint8_t> buffer(offset, 0);
+        memcpy(buffer.data(), &header, sizeof(header));
+        for (uint64_t i = 0; i < chunkCount; i++) {
+            memcpy(buffer.data() + header.hashesOffset + i * 32, hashes[i].data(), 32);
+        }
+        memcpy(buffer.data() + header.zeroMapOffset, zeroMap.data(), zeroMap.size());
+        if (!files.empty()) {
+            memcpy(buffer.data() + header.filesOffset, files.data(), files.size() * sizeof(FileRecord));
+        }
+        if (!extents.empty()) {
+            memcpy(buffer.data() + header.extentsOffset, extents.data(), extents.size() * sizeof(ExtentRecord));
+        }
+        if (!boots.empty()) {
+            memcpy(buffer.data() + header.bootOffset, boots.data(), boots.size() * sizeof(BootRecord));
+        }
+        memcpy(buffer.data() + header.stringsOffset, strings.data(), strings.size());
+
+        // Write beside the ISO and rename so readers never map a partial file
+        std::string target = sidecarPath(isoPath);
+        std::string temp = target + ".tmp";
+
+        int out = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out < 0) {
+            throw FileError(target, "Cannot create index file");
+        }
+
+        size_t written = 0;
+        while (written < buffer.size()) {
+            ssize_t put = write(out, buffer.data() + written, buffer.size() - written);
+            if (put <= 0) {
+                close(out);
+                unlink(temp.c_str());
+                throw FileError(target, "Failed to write index file");
+            }
+            written += put;
+        }
+
+        fsync(out);
+        close(out);
+
+        if (rename(temp.c_str(), target.c_str()) != 0) {
+            unlink(temp.c_str());
+            throw FileError(target, "Failed to install index file");
+        }
+
+        Logs::success("Index written: " + target + " (" + std::to_string(chunkCount) + " chunks, " +
+                      std::to_string(zeroChunks) + " zero, " + std::to_string(files.size()) +
+                      " files, " + std::to_string(boots.size()) + " boot entries)");
+        return true;
+    }
+}
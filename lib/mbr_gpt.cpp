@@ -1,4 +1,5 @@
 #include "lib/mbr_gpt.hpp"
+#include "lib/block_target.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
 #include <fcntl.h>
@@ -29,7 +30,9 @@ namespace BootStructures {
     }
     
     PartitionTable::PartitionTable(const std::string& dev, TableType type)
-        : device(dev), deviceFd(-1), deviceSectors(0), tableType(type) {
+        : device(dev), deviceFd(-1), deviceSectors(0), tableType(type),
+          mbrLoaded(false), mbrDirty(false), stagedUpdates(0) {
+        memset(&stagedMBR, 0, sizeof(MBR));
     }
     
     PartitionTable::~PartitionTable() {
@@ -39,18 +42,18 @@ namespace BootStructures {
     }
     
     bool PartitionTable::initialize() {
-        deviceFd = open(device.c_str(), O_RDWR | O_SYNC);
+        deviceFd = open(device.c_str(), O_RDWR);
         if (deviceFd < 0) {
             throw DeviceError(device, "Cannot open device for partition table creation");
         }
         
-        uint64_t deviceSize;
-        if (ioctl(deviceFd, BLKGETSIZE64, &deviceSize) < 0) {
+        uint64_t deviceSize = BlockTarget::querySize(deviceFd);
+        if (deviceSize == 0) {
             throw DeviceError(device, "Cannot get device size");
         }
         
         deviceSectors = deviceSize / 512;
-        Logs::debug("Device sectors: " + std::to_string(deviceSectors));
+        Logs::debug("Device sectors: ", deviceSectors);
         
         return true;
     }
@@ -58,7 +61,7 @@ namespace BootStructures {
     bool PartitionTable::createMBR() {
         Logs::info("Creating optimized MBR partition table");
         
-        MBR mbr;
+        MBR& mbr = stagedMBR;
         memset(&mbr, 0, sizeof(MBR));
         
         // Generate cryptographically random disk signature
@@ -67,8 +70,7 @@ namespace BootStructures {
         std::uniform_int_distribution<uint32_t> dis;
         mbr.diskSignature = dis(gen);
         
-        Logs::debug("Generated disk signature: 0x" + 
-                   std::to_string(mbr.diskSignature));
+        Logs::debug("Generated disk signature: 0x", std::hex, mbr.diskSignature);
         
         // Initialize boot code area with NOPs for safety
         memset(mbr.bootCode, 0x90, sizeof(mbr.bootCode));
@@ -114,17 +116,9 @@ namespace BootStructures {
             Logs::warning("MBR structure size mismatch: " + std::to_string(sizeof(MBR)));
         }
         
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) {
-            throw DeviceError(device, "Failed to seek to MBR location");
-        }
-        
-        ssize_t written = write(deviceFd, &mbr, sizeof(MBR));
-        if (written != sizeof(MBR)) {
-            throw DeviceError(device, "Failed to write MBR (wrote " + 
-                            std::to_string(written) + " bytes)");
-        }
-        
-        fsync(deviceFd);
+        mbrLoaded = true;
+        mbrDirty = true;
+        stagedUpdates++;
         
         Logs::success("Optimized MBR created successfully");
         return true;
@@ -188,15 +182,8 @@ namespace BootStructures {
                   " sectors=" + std::to_string(sectorCount) + 
                   " bootable=" + std::string(bootable ? "yes" : "no"));
         
-        MBR mbr;
-        
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) {
-            throw DeviceError(device, "Failed to seek to MBR");
-        }
-        
-        if (read(deviceFd, &mbr, sizeof(MBR)) != sizeof(MBR)) {
-            throw DeviceError(device, "Failed to read MBR");
-        }
+        loadMBR();
+        MBR& mbr = stagedMBR;
         
         // Find first free partition slot
         int partIndex = -1;
@@ -231,20 +218,12 @@ namespace BootStructures {
             throw DeviceError(device, "Partition extends beyond device size");
         }
         
-        Logs::debug("Partition " + std::to_string(partIndex + 1) + ": " +
-                   "LBA=" + std::to_string(part.firstLBA) + 
-                   " Size=" + std::to_string(part.sectorCount) + 
-                   " Type=0x" + std::to_string(part.partitionType));
-        
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) {
-            throw DeviceError(device, "Failed to seek for MBR write");
-        }
+        Logs::debug("Partition ", partIndex + 1, ": LBA=", part.firstLBA,
+                    " Size=", part.sectorCount,
+                    " Type=0x", std::hex, static_cast<int>(part.partitionType));
         
-        if (write(deviceFd, &mbr, sizeof(MBR)) != sizeof(MBR)) {
-            throw DeviceError(device, "Failed to write partition to MBR");
-        }
-        
-        fsync(deviceFd);
+        mbrDirty = true;
+        stagedUpdates++;
         
         Logs::success("Partition " + std::to_string(partIndex + 1) + " added to MBR");
         return true;
@@ -253,32 +232,63 @@ namespace BootStructures {
     bool PartitionTable::makeBootable() {
         Logs::info("Setting partition as bootable");
         
-        MBR mbr;
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) {
+        try {
+            loadMBR();
+        } catch (const DeviceError&) {
             return false;
         }
         
-        if (read(deviceFd, &mbr, sizeof(MBR)) != sizeof(MBR)) {
-            return false;
+        stagedMBR.partitions[0].status = 0x80;
+        mbrDirty = true;
+        stagedUpdates++;
+        return true;
+    }
+    
+    bool PartitionTable::writeBootloader(const std::vector<uint8_t>& bootCode) {
+        if (bootCode.size() > sizeof(stagedMBR.bootCode)) {
+            throw DeviceError(device, "Boot code larger than the MBR code area");
         }
         
-        mbr.partitions[0].status = 0x80;
+        // Only the code area changes; the disk signature and partition
+        // entries are kept as staged
+        loadMBR();
+        memcpy(stagedMBR.bootCode, bootCode.data(), bootCode.size());
+        stagedMBR.signature = 0xAA55;
         
-        if (lseek(deviceFd, 0, SEEK_SET) != 0) {
-            return false;
-        }
+        mbrDirty = true;
+        stagedUpdates++;
+        return true;
+    }
+    
+    void PartitionTable::loadMBR() {
+        if (mbrLoaded) return;
         
-        if (write(deviceFd, &mbr, sizeof(MBR)) != sizeof(MBR)) {
-            return false;
+        if (pread(deviceFd, &stagedMBR, sizeof(MBR), 0) != sizeof(MBR)) {
+            throw DeviceError(device, "Failed to read MBR");
         }
-        
-        fsync(deviceFd);
-        return true;
+        mbrLoaded = true;
     }
     
     bool PartitionTable::commit() {
-        if (deviceFd >= 0) {
-            fsync(deviceFd);
+        if (deviceFd < 0) {
+            return true;
+        }
+        
+        if (mbrDirty) {
+            if (pwrite(deviceFd, &stagedMBR, sizeof(MBR), 0) != sizeof(MBR)) {
+                throw DeviceError(device, "Failed to write MBR");
+            }
+            
+            if (stagedUpdates > 1) {
+                Logs::debug("MBR committed in one write, ", (stagedUpdates - 1) * sizeof(MBR),
+                            " bytes of intermediate sector 0 writes skipped");
+            }
+            mbrDirty = false;
+            stagedUpdates = 0;
+        }
+        
+        fsync(deviceFd);
+        if (!BlockTarget::isImageFile(device)) {
             ioctl(deviceFd, BLKRRPART);
         }
         return true;
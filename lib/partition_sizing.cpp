@@ -0,0 +1,226 @@
+#include "lib/partition_sizing.hpp"
+#include "lib/fs_creator.hpp"
+#include "lib/iso_index.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include <map>
+#include <set>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+
+namespace PartitionSizing {
+
+    static const uint64_t ALIGNMENT = 1024 * 1024;
+    static const uint64_t ENTRY_SIZE = 32;
+
+    // Bootloader configs and the directories they live in are written
+    // after the tree is copied
+    static const uint64_t SPARE_BYTES = 1024 * 1024;
+
+    // FatWriter::copyISO starts the boot files on a flash erase block
+    // boundary, but only when the volume has this much room to spare
+    static const uint64_t BOOT_ALIGNMENT = 4 * 1024 * 1024;
+
+    // Fewer clusters and the volume is FAT16 by definition, whatever the
+    // boot sector says
+    static const uint64_t FAT32_MIN_CLUSTERS = 65525;
+    static const uint32_t FAT32_CLUSTER = 4096;
+
+    // Boot region plus its backup; the compressed up-case table every
+    // formatter writes
+    static const uint64_t EXFAT_BOOT_SECTORS = 24;
+    static const uint64_t EXFAT_UPCASE_BYTES = 5836;
+
+    static uint64_t alignUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    static uint64_t clustersFor(uint64_t bytes, uint64_t clusterSize) {
+        return (bytes + clusterSize - 1) / clusterSize;
+    }
+
+    static std::string parentOf(const std::string& path) {
+        size_t slash = path.find_last_of('/');
+        return slash == 0 || slash == std::string::npos ? "/" : path.substr(0, slash);
+    }
+
+    static std::string nameOf(const std::string& path) {
+        return path.substr(path.find_last_of('/') + 1);
+    }
+
+    // UTF-16 code units of a UTF-8 name; four-byte sequences take two
+    static uint64_t utf16Length(const std::string& name) {
+        uint64_t length = 0;
+        for (unsigned char c : name) {
+            if ((c & 0xC0) != 0x80) length++;
+            if (c >= 0xF0) length++;
+        }
+        return length;
+    }
+
+    // Directory entries one name takes on FAT32. A name stays a bare 8.3
+    // entry only when it is upper case: the kernel's vfat adds long-name
+    // slots for any lower-case letter, so the count covers both writers.
+    static uint64_t fat32Entries(const std::string& name, std::set<std::string>& shortNames) {
+        size_t dot = name.find_last_of('.');
+        bool hasExt = dot != std::string::npos && dot != 0;
+        std::string base = hasExt ? name.substr(0, dot) : name;
+        std::string ext = hasExt ? name.substr(dot + 1) : "";
+
+        auto shortChar = [](unsigned char c) {
+            return (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+                   (c != 0 && strchr("$%'-_@~`!(){}^#&", c) != nullptr);
+        };
+
+        bool fits = !base.empty() && base.size() <= 8 && ext.size() <= 3 &&
+                    std::all_of(base.begin(), base.end(), shortChar) &&
+                    std::all_of(ext.begin(), ext.end(), shortChar);
+
+        if (fits && shortNames.insert(name).second) return 1;
+        return 1 + (utf16Length(name) + 12) / 13;
+    }
+
+    // File entry, stream extension and 15 characters per name entry
+    static uint64_t exfatEntries(const std::string& name) {
+        return 2 + (utf16Length(name) + 14) / 15;
+    }
+
+    // Name of the extra root file; only its entry count matters
+    static const char EXTRA_FILE_NAME[] = "casper-rw";
+
+    // File data and directory clusters of the tree for one cluster size
+    static void countTree(const ISO9660::Image& image, Layout layout, uint32_t clusterSize,
+                          uint64_t extraFileBytes, Footprint& footprint) {
+        std::map<std::string, uint64_t> entries;
+        std::map<std::string, std::set<std::string>> shortNames;
+
+        // Root holds the volume label (and exFAT's bitmap and up-case
+        // entries); other FAT32 directories start with "." and ".."
+        entries["/"] = layout == Layout::FAT32 ? 1 : 3;
+
+        footprint.fileClusters = 0;
+        if (extraFileBytes > 0) {
+            entries["/"] += layout == Layout::FAT32 ?
+                fat32Entries(EXTRA_FILE_NAME, shortNames["/"]) : exfatEntries(EXTRA_FILE_NAME);
+            footprint.fileClusters += clustersFor(extraFileBytes, clusterSize);
+        }
+        for (const auto& entry : image.entries) {
+            if (entry.path == "/") continue;
+
+            std::string parent = parentOf(entry.path);
+            std::string name = nameOf(entry.path);
+            entries[parent] += layout == Layout::FAT32 ?
+                fat32Entries(name, shortNames[parent]) : exfatEntries(name);
+
+            if (entry.isDirectory) {
+                entries[entry.path] += layout == Layout::FAT32 ? 2 : 0;
+            } else {
+                footprint.fileClusters += clustersFor(entry.size, clusterSize);
+            }
+        }
+
+        footprint.directoryClusters = 0;
+        for (const auto& item : entries) {
+            footprint.directoryClusters += std::max<uint64_t>(1,
+                clustersFor(item.second * ENTRY_SIZE, clusterSize));
+        }
+
+        footprint.clusterSize = clusterSize;
+        footprint.systemClusters = 0;
+        footprint.spareClusters = clustersFor(SPARE_BYTES, clusterSize);
+    }
+
+    Footprint fat32(const ISO9660::Image& image, uint64_t extraFileBytes) {
+        Footprint footprint;
+        countTree(image, Layout::FAT32, FAT32_CLUSTER, extraFileBytes, footprint);
+        footprint.spareClusters += clustersFor(BOOT_ALIGNMENT, FAT32_CLUSTER);
+
+        uint64_t needed = std::max(FAT32_MIN_CLUSTERS, footprint.fileClusters +
+                                   footprint.directoryClusters + footprint.spareClusters);
+        uint64_t perCluster = FAT32_CLUSTER / 512;
+
+        // The FATs grow with the volume: add the clusters they took until
+        // the data region holds everything
+        uint64_t sectors = needed * perCluster;
+        uint64_t metadata = 0;
+        while (true) {
+            metadata = FilesystemCreator::FAT32Creator::reservedSectorsFor(sectors) +
+                       2ULL * FilesystemCreator::FAT32Creator::fatSectorsFor(sectors);
+            uint64_t clusters = (sectors - metadata) / perCluster;
+            if (clusters >= needed) break;
+            sectors += (needed - clusters) * perCluster;
+        }
+
+        footprint.metadataBytes = metadata * 512;
+        footprint.bytes = alignUp(sectors * 512, ALIGNMENT);
+        return footprint;
+    }
+
+    static uint32_t exfatDefaultCluster(uint64_t volumeBytes) {
+        if (volumeBytes <= 256ULL * 1024 * 1024) return 4096;
+        if (volumeBytes <= 32ULL * 1024 * 1024 * 1024) return 32768;
+        return 131072;
+    }
+
+    static Footprint exfatLayout(const ISO9660::Image& image, uint32_t clusterSize,
+                                 uint64_t extraFileBytes) {
+        Footprint footprint;
+        countTree(image, Layout::EXFAT, clusterSize, extraFileBytes, footprint);
+
+        uint64_t content = footprint.fileClusters + footprint.directoryClusters +
+                           footprint.spareClusters + clustersFor(EXFAT_UPCASE_BYTES, clusterSize);
+
+        // The allocation bitmap lives in the heap and covers itself
+        uint64_t bitmap = 0;
+        while (clustersFor(clustersFor(content + bitmap, 8), clusterSize) > bitmap) {
+            bitmap = clustersFor(clustersFor(content + bitmap, 8), clusterSize);
+        }
+
+        uint64_t clusters = content + bitmap;
+        footprint.systemClusters = clustersFor(EXFAT_UPCASE_BYTES, clusterSize) + bitmap;
+
+        uint64_t fatOffset = alignUp(EXFAT_BOOT_SECTORS * 512, clusterSize);
+        footprint.metadataBytes = fatOffset + alignUp((clusters + 2) * 4, clusterSize);
+        footprint.bytes = alignUp(footprint.metadataBytes + clusters * clusterSize, ALIGNMENT);
+        return footprint;
+    }
+
+    Footprint exfat(const ISO9660::Image& image, uint32_t clusterSize, uint64_t extraFileBytes) {
+        if (clusterSize != 0) {
+            return exfatLayout(image, clusterSize, extraFileBytes);
+        }
+
+        // The default depends on the volume size, which depends on the
+        // cluster size; larger clusters only ever grow the result
+        Footprint footprint = exfatLayout(image, 4096, extraFileBytes);
+        uint32_t chosen = exfatDefaultCluster(footprint.bytes);
+        while (chosen != footprint.clusterSize) {
+            footprint = exfatLayout(image, chosen, extraFileBytes);
+            chosen = std::max(chosen, exfatDefaultCluster(footprint.bytes));
+        }
+        return footprint;
+    }
+
+    Footprint extracted(const std::string& isoPath, Layout layout, uint64_t extraFileBytes) {
+        ISO9660::Image image;
+        std::unique_ptr<ISOIndex::Index> index = ISOIndex::Index::open(isoPath);
+        if (index) {
+            image = index->image();
+        } else if (!ISO9660::readImage(isoPath, image)) {
+            throw FileError(isoPath, "Cannot read ISO directory tree");
+        }
+
+        Footprint footprint = layout == Layout::FAT32 ? fat32(image, extraFileBytes) :
+                                                        exfat(image, 0, extraFileBytes);
+        Logs::debug("Extracted tree on ", layout == Layout::FAT32 ? "FAT32" : "exFAT", ": ",
+                    footprint.fileClusters, " file + ", footprint.directoryClusters,
+                    " directory clusters of ", footprint.clusterSize, " bytes, partition ",
+                    footprint.bytes / ALIGNMENT, " MB");
+        return footprint;
+    }
+
+    uint64_t rawPartitionBytes(uint64_t isoBytes) {
+        return alignUp(isoBytes, ALIGNMENT);
+    }
+}
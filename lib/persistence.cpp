@@ -4,9 +4,19 @@
 #include "lib/mbr_gpt.hpp"
 #include "lib/fs_creator.hpp"
 #include "lib/bootloader.hpp"
+#include "lib/task_graph.hpp"
+#include "lib/fat_writer.hpp"
+#include "lib/partition_sizing.hpp"
+#include "lib/iso9660.hpp"
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/block_manifest.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
+#include "utils/progress_bar.hpp"
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
@@ -41,8 +51,6 @@ namespace Persistence {
         
         FilesystemSupport::formatPartition(persistDevice, fsType, label);
         
-        DeviceHandler::syncDevice(device);
-        
         Logs::success("Persistence partition created: " + persistDevice);
         return true;
     }
@@ -62,7 +70,8 @@ namespace Persistence {
         size_t isoSize = ISOBurner::getISOSize(isoPath);
         size_t deviceSize = DeviceHandler::getDeviceSize(device);
         
-        size_t isoSizeMB = (isoSize / (1024 * 1024)) + 200;
+        // Partition 1 holds the ISO image block for block
+        size_t isoSizeMB = PartitionSizing::rawPartitionBytes(isoSize) / (1024 * 1024);
         size_t deviceSizeMB = deviceSize / (1024 * 1024);
         
         Logs::info("Device capacity: " + std::to_string(deviceSizeMB) + " MB");
@@ -70,7 +79,7 @@ namespace Persistence {
         Logs::info("Requested persistence: " + std::to_string(persistenceSizeMB) + " MB");
         
         // Calculate required space (ISO + persistence + overhead)
-        size_t overheadMB = 100; // MBR/GPT, alignment, filesystem overhead
+        size_t overheadMB = PartitionSizing::TABLE_OVERHEAD_MB;
         size_t totalRequired = isoSizeMB + persistenceSizeMB + overheadMB;
         
         Logs::info("Total required space: " + std::to_string(totalRequired) + " MB");
@@ -121,59 +130,16 @@ namespace Persistence {
         DeviceHandler::unmountDevice(device);
         
         Logs::info("Wiping existing data on device");
-        DeviceHandler::wipeDevice(device);
-        
-        Logs::info("Creating " + tableTypeStr + " partition table");
-        BootStructures::PartitionTable ptable(device, tableType);
-        ptable.initialize();
-        
-        if (tableType == BootStructures::TableType::MBR) {
-            ptable.createMBR();
-        } else {
-            ptable.createGPT();
-        }
         
         uint32_t isoSectors = (isoSizeMB * 1024 * 1024) / 512;
         uint32_t persistSectors = (persistenceSizeMB * 1024 * 1024) / 512;
         uint32_t startSector = 2048;
         
-        Logs::info("Creating ISO partition (" + std::to_string(isoSizeMB) + " MB)");
-        
-        try {
-            ptable.addMBRPartition(startSector, isoSectors, 
-                                   BootStructures::PartitionType::FAT32_LBA, true);
-        } catch (const std::exception& e) {
-            Logs::error("Failed to add ISO partition to MBR: " + std::string(e.what()));
-            throw DeviceError(device, "Cannot create ISO partition in partition table");
-        }
-        
-        Logs::info("Creating persistence partition (" + 
-                  std::to_string(persistenceSizeMB) + " MB)");
         BootStructures::PartitionType persistType = 
             (fsType == FilesystemSupport::FSType::EXT4) ? 
             BootStructures::PartitionType::LINUX_NATIVE : 
             BootStructures::PartitionType::FAT32_LBA;
         
-        try {
-            ptable.addMBRPartition(startSector + isoSectors, persistSectors, persistType, false);
-        } catch (const std::exception& e) {
-            Logs::error("Failed to add persistence partition to MBR: " + std::string(e.what()));
-            throw DeviceError(device, "Cannot create persistence partition in partition table");
-        }
-        
-        ptable.commit();
-        
-        sleep(2);
-        
-        int fd = open(device.c_str(), O_RDONLY);
-        if (fd >= 0) {
-            ioctl(fd, BLKRRPART);
-            close(fd);
-        }
-        
-        system(("partprobe " + device + " 2>/dev/null").c_str());
-        sleep(3);
-        
         // Determine partition device names
         std::string part1, part2;
         if (device.find("nvme") != std::string::npos || 
@@ -185,46 +151,413 @@ namespace Persistence {
             part2 = device + "2";
         }
         
-        // Verify partitions exist
-        struct stat st;
-        if (stat(part1.c_str(), &st) != 0) {
-            Logs::warning("Partition " + part1 + " not found, waiting...");
+        // Every step declares what it writes, so the planning pass can skip
+        // the parts of the wipe and of the part1 format that the ISO burn
+        // overwrites anyway. Past the partition table, the two partitions
+        // are disjoint and are written side by side.
+        Pipeline::TaskGraph graph;
+        
+        Pipeline::TaskId wiped = DeviceHandler::planWipe(graph, device);
+        
+        Pipeline::TaskId table = graph.addWrites("Create partition table", Pipeline::WriteKind::FIXED,
+                                                 {{0, 512}}, 
+                                                 [=](const std::vector<Pipeline::Extent>&) {
+            Logs::info("Creating " + tableTypeStr + " partition table");
+            BootStructures::PartitionTable ptable(device, tableType);
+            ptable.initialize();
+            
+            if (tableType == BootStructures::TableType::MBR) {
+                ptable.createMBR();
+            } else {
+                ptable.createGPT();
+            }
+            
+            Logs::info("Creating ISO partition (" + std::to_string(isoSizeMB) + " MB)");
+            
+            try {
+                ptable.addMBRPartition(startSector, isoSectors, 
+                                       BootStructures::PartitionType::FAT32_LBA, true);
+            } catch (const std::exception& e) {
+                Logs::error("Failed to add ISO partition to MBR: " + std::string(e.what()));
+                throw DeviceError(device, "Cannot create ISO partition in partition table");
+            }
+            
+            Logs::info("Creating persistence partition (" + 
+                      std::to_string(persistenceSizeMB) + " MB)");
+            
+            try {
+                ptable.addMBRPartition(startSector + isoSectors, persistSectors, persistType, false);
+            } catch (const std::exception& e) {
+                Logs::error("Failed to add persistence partition to MBR: " + std::string(e.what()));
+                throw DeviceError(device, "Cannot create persistence partition in partition table");
+            }
+            
+            // Boot code lands with the entries instead of in a later write
+            Bootloader::stageBootCode(ptable, isoPath);
+            ptable.commit();
+            
             sleep(2);
+            
+            DeviceHandler::rereadPartitions(device);
+            
             system(("partprobe " + device + " 2>/dev/null").c_str());
-            sleep(2);
+            sleep(3);
             
+            // Verify partitions exist
+            struct stat st;
             if (stat(part1.c_str(), &st) != 0) {
-                throw DeviceError(device, "Partition " + part1 + " was not created by kernel");
+                Logs::warning("Partition " + part1 + " not found, waiting...");
+                sleep(2);
+                system(("partprobe " + device + " 2>/dev/null").c_str());
+                sleep(2);
+                
+                if (stat(part1.c_str(), &st) != 0) {
+                    throw DeviceError(device, "Partition " + part1 + " was not created by kernel");
+                }
             }
+            
+            Logs::success("Partitions created and verified: " + part1 + ", " + part2);
+            return true;
+        }, {wiped}, {Pipeline::DEVICE_HEAD});
+        
+        // Footprints are in device offsets; part1 starts at startSector
+        uint64_t part1Offset = static_cast<uint64_t>(startSector) * 512;
+        std::vector<Pipeline::Extent> formatWrites = 
+            FilesystemCreator::FAT32Creator::footprint(static_cast<uint64_t>(isoSectors) * 512);
+        for (auto& extent : formatWrites) {
+            extent.offset += part1Offset;
         }
         
-        Logs::success("Partitions created and verified: " + part1 + ", " + part2);
+        Pipeline::TaskId formatted = graph.addWrites("Format ISO partition", Pipeline::WriteKind::DROPPABLE,
+                                                     formatWrites, 
+                                                     [part1](const std::vector<Pipeline::Extent>&) {
+            Logs::info("Formatting first partition as FAT32");
+            return FilesystemCreator::createFilesystem(part1, "fat32", "MYISO");
+        }, {table}, {Pipeline::partitionTag(1)});
+        
+        Pipeline::TaskId burned = graph.addWrites("Burn ISO partition", Pipeline::WriteKind::FIXED,
+                                                  {{part1Offset, isoSize}}, 
+                                                  [isoPath, part1](const std::vector<Pipeline::Extent>&) {
+            Logs::info("Burning ISO to first partition");
+            ISOBurner::burnISO(isoPath, part1, ISOBurner::BurnMode::RAW);
+            return true;
+        }, {formatted}, {Pipeline::partitionTag(1), Pipeline::SOURCE_STREAM});
+        
+        Pipeline::TaskId persisted = graph.add("Format persistence", [device, persistenceSizeMB, fsType]() {
+            return createPersistencePartition(device, persistenceSizeMB, fsType);
+        }, {table}, {Pipeline::partitionTag(2)});
+        
+        Pipeline::TaskId booted = graph.add("Install bootloader", [device, isoPath]() {
+            Logs::info("Installing bootloader");
+            Bootloader::installBootloader(device, isoPath, false);
+            return true;
+        }, {burned}, {Pipeline::DEVICE_HEAD, Pipeline::partitionTag(1)});
+        
+        graph.add("Sync device", [device]() {
+            return DeviceHandler::syncDevice(device);
+        }, {booted, persisted}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA});
+        
+        if (!graph.run()) {
+            return false;
+        }
         
-        Logs::info("Formatting first partition as FAT32");
-        FilesystemCreator::createFilesystem(part1, "fat32", "MYISO");
+        Logs::success("Bootable USB with persistence created successfully");
+        return true;
+    }
+    
+    size_t calculateOptimalSize(size_t isoSize, size_t deviceSize) {
+        size_t isoSizeMB = PartitionSizing::rawPartitionBytes(isoSize) / (1024 * 1024);
+        size_t deviceSizeMB = deviceSize / (1024 * 1024);
         
-        Logs::info("Burning ISO to first partition");
-        ISOBurner::burnISO(isoPath, part1, ISOBurner::BurnMode::RAW);
+        if (deviceSizeMB < isoSizeMB + PartitionSizing::TABLE_OVERHEAD_MB + 512) return 0;
+        size_t availableSpace = deviceSizeMB - isoSizeMB - PartitionSizing::TABLE_OVERHEAD_MB;
         
-        createPersistencePartition(device, persistenceSizeMB, fsType);
+        return std::min(availableSpace, static_cast<size_t>(16384));
+    }
+    
+    static const uint64_t ISO_DESCRIPTOR_OFFSET = 32768;
+    static const uint64_t UPDATE_CHUNK = 64ULL * 1024 * 1024;
+    
+    UpdatePlan planUpdate(const std::string& isoPath, const std::string& device, bool differential) {
+        std::vector<BlockTarget::Partition> partitions = BlockTarget::readPartitions(device);
+        for (const auto& partition : partitions) {
+            if (partition.type == 0xEE) {
+                throw DeviceError(device, "GPT layouts cannot be updated in place");
+            }
+        }
         
-        Logs::info("Installing bootloader");
-        Bootloader::installBootloader(device, isoPath);
+        int fd = open(device.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw DeviceError(device, "Cannot open device");
+        }
         
-        DeviceHandler::syncDevice(device);
+        // The ISO partition is found by what it holds, not by its slot: the
+        // image itself on raw layouts, the FAT32 volume labelled MYISO on
+        // extracted ones (behind the ESP on multi-partition sticks). An
+        // unlabelled FAT32 volume outside an ESP is the last resort.
+        const BlockTarget::Partition* image = nullptr;
+        const BlockTarget::Partition* labelled = nullptr;
+        const BlockTarget::Partition* unlabelled = nullptr;
+        for (const auto& partition : partitions) {
+            uint8_t boot[512];
+            char descriptor[6];
+            bool readBoot = pread(fd, boot, sizeof(boot), partition.offset) == sizeof(boot);
+            bool readISO = pread(fd, descriptor, sizeof(descriptor),
+                                 partition.offset + ISO_DESCRIPTOR_OFFSET) == sizeof(descriptor);
+            
+            if (readISO && memcmp(descriptor + 1, "CD001", 5) == 0) {
+                if (!image) image = &partition;
+            } else if (readBoot && memcmp(boot + 0x52, "FAT32   ", 8) == 0) {
+                if (memcmp(boot + 0x47, "MYISO      ", 11) == 0) {
+                    if (!labelled) labelled = &partition;
+                } else if (partition.type != 0xEF && !unlabelled) {
+                    unlabelled = &partition;
+                }
+            }
+        }
+        close(fd);
         
-        Logs::success("Bootable USB with persistence created successfully");
-        return true;
+        const BlockTarget::Partition* target = image ? image : labelled ? labelled : unlabelled;
+        if (!target) {
+            throw DeviceError(device, "No partition holds an ISO image or its extracted FAT32 contents");
+        }
+        
+        UpdatePlan plan;
+        plan.target = *target;
+        plan.keptPartitions = static_cast<int>(partitions.size()) - 1;
+        plan.differential = differential;
+        std::string targetName = "partition " + std::to_string(plan.target.number);
+        
+        // What the partition holds today decides how the new ISO goes in
+        if (image) {
+            plan.mode = UpdateMode::RAW;
+            plan.required = ISOBurner::getISOSize(isoPath);
+        } else {
+            plan.mode = UpdateMode::EXTRACT;
+            
+            // Before load() the volume counts as empty, which is what a
+            // reformat leaves
+            FatWriter::Volume volume(device, plan.target.offset);
+            volume.open();
+            uint64_t cluster = volume.clusterBytes();
+            uint64_t available = volume.freeBytes();
+            volume.load();
+            
+            // Same choice as updateISO: a persistence file forces a sync
+            bool fileByFile = differential || volume.files().count("CASPER-RW") ||
+                              volume.files().count("PERSISTENCE");
+            if (fileByFile) {
+                // New data only goes to clusters free today; what the sync
+                // frees is released when it commits
+                plan.required = FatWriter::syncBytes(isoPath, volume);
+                available = volume.freeBytes();
+            } else {
+                ISO9660::Image tree;
+                if (!ISO9660::readImage(isoPath, tree)) {
+                    throw FileError(isoPath, "Cannot read ISO directory tree");
+                }
+                
+                // Every file and directory takes whole clusters
+                plan.required = 0;
+                for (const auto& entry : tree.entries) {
+                    uint64_t size = entry.isDirectory ? cluster : entry.size;
+                    plan.required += (size + cluster - 1) / cluster * cluster;
+                }
+            }
+            
+            if (plan.required > available) {
+                throw DeviceError(device, "New ISO contents need " +
+                                  std::to_string(plan.required / (1024 * 1024)) + " MB, " + targetName + " has " +
+                                  std::to_string(available / (1024 * 1024)) + " MB " +
+                                  (fileByFile ? "free" : "of space"));
+            }
+        }
+        
+        if (plan.required > plan.target.length) {
+            throw DeviceError(device, "New ISO needs " + std::to_string(plan.required / (1024 * 1024)) +
+                              " MB, " + targetName + " is " + std::to_string(plan.target.length / (1024 * 1024)) +
+                              " MB");
+        }
+        
+        Logs::info("Update plan: " + targetName + " (" + std::to_string(plan.target.length / (1024 * 1024)) +
+                   " MB) gets the new ISO " + (plan.mode == UpdateMode::RAW ? "image" : "contents") +
+                   ", " + std::to_string(plan.keptPartitions) + " other partition(s) kept");
+        return plan;
     }
     
-    size_t calculateOptimalSize(size_t isoSize, size_t deviceSize) {
-        size_t isoSizeMB = isoSize / (1024 * 1024);
-        size_t deviceSizeMB = deviceSize / (1024 * 1024);
+    // The manifest sealed at burn time hashes the old ISO partition, so
+    // --verify would report the update as corruption
+    static void resealManifest(const std::string& device, const UpdatePlan& plan) {
+        bool rawImage = plan.mode == UpdateMode::RAW && plan.target.offset == 0;
+        bool sealed = false;
+        try {
+            sealed = BlockManifest::sealDevice(device,
+                                               BlockManifest::coveredExtents(device, rawImage, plan.required));
+        } catch (const std::exception& e) {
+            Logs::warning("Could not write verification manifest: " + std::string(e.what()));
+        }
         
-        size_t availableSpace = deviceSizeMB - isoSizeMB - 200;
+        if (!sealed && BlockManifest::dropManifest(device)) {
+            Logs::warning("Verification manifest dropped; --verify is unavailable until the next burn");
+        }
+    }
+    
+    // A hybrid stick boots the image's own table from sector 0, so a raw
+    // update there replaces the MBR. The partitions behind the image (the
+    // persistence partition added at burn time) must fit into the new
+    // image's table; checked before anything is written.
+    static std::vector<BlockTarget::Partition> carriedPartitions(const std::string& isoPath, int isoFd,
+                                                                 const std::string& device,
+                                                                 const UpdatePlan& plan) {
+        std::vector<BlockTarget::Partition> carried;
+        for (const auto& partition : BlockTarget::readPartitions(device)) {
+            // Entries inside the old image (its EFI partition) go with it
+            if (partition.offset < plan.target.offset + plan.target.length) continue;
+            if (partition.offset < plan.required) {
+                throw DeviceError(device, "New ISO would overlap partition " +
+                                  std::to_string(partition.number));
+            }
+            carried.push_back(partition);
+        }
+        if (carried.empty()) return carried;
         
-        if (availableSpace < 512) return 0;
+        BootStructures::MBR mbr;
+        SourceStager::await(isoFd, 0, sizeof(mbr));
+        if (pread(isoFd, &mbr, sizeof(mbr), 0) != sizeof(mbr) || mbr.signature != 0xAA55) {
+            throw FileError(isoPath, "New ISO has no partition table to carry partition " +
+                            std::to_string(carried.front().number) + " into");
+        }
         
-        return std::min(availableSpace, static_cast<size_t>(16384));
+        size_t freeSlots = 0;
+        for (const auto& entry : mbr.partitions) {
+            if (entry.partitionType == 0x00) {
+                freeSlots++;
+                continue;
+            }
+            uint64_t start = static_cast<uint64_t>(entry.firstLBA) * 512;
+            uint64_t end = start + static_cast<uint64_t>(entry.sectorCount) * 512;
+            for (const auto& partition : carried) {
+                if (start < partition.offset + partition.length && partition.offset < end) {
+                    throw FileError(isoPath, "New ISO's partition table overlaps partition " +
+                                    std::to_string(partition.number));
+                }
+            }
+        }
+        if (freeSlots < carried.size()) {
+            throw FileError(isoPath, "New ISO's partition table has no free slot for partition " +
+                            std::to_string(carried.back().number));
+        }
+        return carried;
+    }
+    
+    static void restorePartitions(const std::string& device,
+                                  const std::vector<BlockTarget::Partition>& carried) {
+        BootStructures::PartitionTable table(device);
+        table.initialize();
+        for (const auto& partition : carried) {
+            table.addMBRPartition(static_cast<uint32_t>(partition.offset / 512),
+                                  static_cast<uint32_t>(partition.length / 512),
+                                  static_cast<BootStructures::PartitionType>(partition.type),
+                                  partition.bootable);
+        }
+        table.commit();
+    }
+    
+    bool updateISO(const std::string& isoPath, const std::string& device, const UpdatePlan& plan) {
+        if (!BlockTarget::isImageFile(device)) {
+            DeviceHandler::unmountDevice(device);
+        }
+        
+        // Partitions are addressed by offset on the whole device, so the
+        // table is never re-read and no partition nodes are needed
+        if (plan.mode == UpdateMode::EXTRACT) {
+            FatWriter::Volume current(device, plan.target.offset);
+            current.open();
+            current.load();
+            
+            // A casper-rw file next to the ISO tree would go with a reformat
+            bool holdsPersistence = current.files().count("CASPER-RW") ||
+                                    current.files().count("PERSISTENCE");
+            if (holdsPersistence && !plan.differential) {
+                Logs::info("The ISO partition holds a persistence file, updating file by file");
+            }
+            
+            if (plan.differential || holdsPersistence) {
+                FatWriter::syncISO(isoPath, current, plan.compareHash);
+                current.commit();
+            } else {
+                char label[12] = {0};
+                int fd = open(device.c_str(), O_RDONLY);
+                if (fd >= 0) {
+                    pread(fd, label, 11, plan.target.offset + 0x47);
+                    close(fd);
+                }
+                std::string volumeLabel(label);
+                volumeLabel.erase(volumeLabel.find_last_not_of(' ') + 1);
+                
+                Logs::info("Reformatting partition " + std::to_string(plan.target.number) +
+                           " and copying the new ISO contents");
+                if (!FilesystemCreator::createFilesystem(device, "fat32", volumeLabel,
+                                                         plan.target.offset, plan.target.length)) {
+                    return false;
+                }
+                
+                FatWriter::Volume volume(device, plan.target.offset);
+                volume.open();
+                uint64_t copied = FatWriter::copyISO(isoPath, volume);
+                volume.commit();
+                
+                Logs::info("Copied " + std::to_string(copied / (1024 * 1024)) + " MB of ISO contents");
+            }
+        } else {
+            int isoFd = SourceCache::openSource(isoPath);
+            if (isoFd < 0) {
+                throw FileError(isoPath, "Cannot open ISO file");
+            }
+            int deviceFd = open(device.c_str(), O_RDWR);
+            if (deviceFd < 0) {
+                close(isoFd);
+                throw DeviceError(device, "Cannot open device for writing");
+            }
+            
+            if (plan.differential) {
+                Logs::warning("File-level sync needs an extracted partition, writing the whole image");
+            }
+            Logs::info("Writing the new ISO image into partition " + std::to_string(plan.target.number));
+            ProgressBar progress(plan.required, "Updating ISO");
+            std::vector<BlockTarget::Partition> carried;
+            try {
+                if (plan.target.offset == 0) {
+                    carried = carriedPartitions(isoPath, isoFd, device, plan);
+                }
+                for (uint64_t done = 0; done < plan.required; done += UPDATE_CHUNK) {
+                    uint64_t length = std::min(UPDATE_CHUNK, plan.required - done);
+                    BlockTarget::copyRange(isoFd, done, deviceFd, plan.target.offset + done, length);
+                    progress.update(done + length);
+                }
+            } catch (...) {
+                close(isoFd);
+                close(deviceFd);
+                throw;
+            }
+            progress.finish();
+            
+            fsync(deviceFd);
+            close(isoFd);
+            close(deviceFd);
+            
+            if (!carried.empty()) {
+                Logs::info("Carrying " + std::to_string(carried.size()) +
+                           " partition(s) into the new ISO's partition table");
+                restorePartitions(device, carried);
+            }
+        }
+        
+        DeviceHandler::syncDevice(device);
+        resealManifest(device, plan);
+        
+        Logs::success("Partition " + std::to_string(plan.target.number) +
+                      " updated; persistence left untouched");
+        return true;
     }
 }
@@ -1,9 +1,16 @@
 #include "lib/persistence_fallback.hpp"
-#include "lib/iso_burner.hpp"
+#include "lib/partition_sizing.hpp"
 #include "lib/dev_handler.hpp"
+#include "lib/fs_creator.hpp"
+#include "lib/fat_writer.hpp"
+#include "lib/block_target.hpp"
+#include "lib/mbr_gpt.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
+#include <fcntl.h>
+#include <unistd.h>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 
 namespace PersistenceFallback {
@@ -16,25 +23,27 @@ namespace PersistenceFallback {
         Logs::info("Creating file-based persistence (" + std::to_string(sizeInMB) + " MB)");
         
         std::string persistFile = mountPoint + "/" + label;
+        uint64_t size = static_cast<uint64_t>(sizeInMB) * 1024 * 1024;
         
-        std::string ddCmd = "dd if=/dev/zero of=" + persistFile + 
-                            " bs=1M count=" + std::to_string(sizeInMB) + 
-                            " 2>/dev/null";
+        int fd = open(persistFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw FileError(persistFile, "Cannot create persistence file");
+        }
         
+        // Reserve the space without writing zeros; unwritten extents read
+        // back as zeros, which is all the filesystem below expects
         Logs::info("Allocating persistence file...");
-        int result = system(ddCmd.c_str());
+        int error = fallocate(fd, 0, 0, size) == 0 ? 0 : posix_fallocate(fd, 0, size);
+        close(fd);
         
-        if (result != 0) {
-            throw FilesystemError("Failed to create persistence file");
+        if (error != 0) {
+            unlink(persistFile.c_str());
+            throw FilesystemError("Failed to allocate persistence file: " + std::string(strerror(error)));
         }
         
-        std::string mkfsCmd = "mkfs.ext4 -F -L " + label + " " + persistFile + 
-                              " > /dev/null 2>&1";
-        
         Logs::info("Formatting persistence file...");
-        result = system(mkfsCmd.c_str());
-        
-        if (result != 0) {
+        FilesystemCreator::EXT4Creator creator(persistFile);
+        if (!creator.create(label)) {
             throw FilesystemError("Failed to format persistence file");
         }
         
@@ -42,6 +51,29 @@ namespace PersistenceFallback {
         return true;
     }
     
+    uint64_t createInVolume(
+        FatWriter::Volume& volume,
+        const std::string& device,
+        size_t sizeInMB,
+        const std::string& label
+    ) {
+        Logs::info("Reserving contiguous persistence file (" + std::to_string(sizeInMB) + " MB)");
+        
+        uint64_t size = static_cast<uint64_t>(sizeInMB) * 1024 * 1024;
+        uint64_t offset = volume.reserveFile(label, size);
+        
+        // One cluster run, so the file is a plain LBA range of the device:
+        // the ext4 creator formats it in place like a partition
+        FilesystemCreator::EXT4Creator creator(device, offset, size);
+        if (!creator.create(label)) {
+            throw FilesystemError("Failed to format persistence file");
+        }
+        
+        Logs::success("File-based persistence created at byte " + std::to_string(offset) +
+                      " of " + device);
+        return offset;
+    }
+    
     bool setupFallbackPersistence(
         const std::string& isoPath,
         const std::string& device,
@@ -49,40 +81,52 @@ namespace PersistenceFallback {
     ) {
         Logs::info("Setting up fallback persistence method");
         
-        DeviceHandler::unmountDevice(device);
+        if (persistenceSizeMB >= 4096) {
+            throw FilesystemError("Persistence files on FAT32 are limited to 4095 MB");
+        }
         
-        Logs::info("Burning ISO to device");
-        ISOBurner::burnISO(isoPath, device, ISOBurner::BurnMode::RAW);
+        bool imageTarget = BlockTarget::isImageFile(device);
+        if (!imageTarget) {
+            DeviceHandler::unmountDevice(device);
+        }
         
-        DeviceHandler::syncDevice(device);
+        // A single FAT32 partition holding the ISO tree and casper-rw; its
+        // FATs and reserved region are sized over both together
+        uint64_t persistBytes = static_cast<uint64_t>(persistenceSizeMB) * 1024 * 1024;
+        uint64_t sectors = PartitionSizing::extracted(isoPath, PartitionSizing::Layout::FAT32,
+                                                      persistBytes).bytes / 512;
+        uint32_t startSector = 2048;
         
-        Logs::info("Mounting device to create persistence file");
-        std::string mountPoint = "/tmp/myiso_mount";
-        system(("mkdir -p " + mountPoint).c_str());
+        if ((startSector + sectors) * 512 > BlockTarget::querySize(device)) {
+            throw DeviceError(device, "Too small for the ISO contents and persistence file");
+        }
         
-        std::string mountCmd = "mount " + device + "1 " + mountPoint + " 2>/dev/null";
-        int result = system(mountCmd.c_str());
+        BootStructures::PartitionTable ptable(device, BootStructures::TableType::MBR);
+        ptable.initialize();
+        ptable.createMBR();
+        ptable.addMBRPartition(startSector, sectors, BootStructures::PartitionType::FAT32_LBA, true);
+        ptable.commit();
         
-        if (result != 0) {
-            Logs::warning("Could not mount device for file-based persistence");
+        uint64_t partitionOffset = static_cast<uint64_t>(startSector) * 512;
+        if (!FilesystemCreator::createFilesystem(device, "fat32", "MYISO",
+                                                 partitionOffset, sectors * 512)) {
             return false;
         }
         
-        try {
-            createFileBased(mountPoint, persistenceSizeMB);
-            
-            system(("umount " + mountPoint).c_str());
-            system(("rm -rf " + mountPoint).c_str());
-            
-            DeviceHandler::syncDevice(device);
-            
-            Logs::success("Fallback persistence setup complete");
-            return true;
-            
-        } catch (...) {
-            system(("umount " + mountPoint + " 2>/dev/null").c_str());
-            system(("rm -rf " + mountPoint).c_str());
-            throw;
+        // Nothing is mounted: the ISO tree and the persistence file go
+        // straight into the FAT structures
+        FatWriter::Volume volume(device, partitionOffset);
+        volume.open();
+        FatWriter::copyISO(isoPath, volume);
+        createInVolume(volume, device, persistenceSizeMB);
+        volume.commit();
+        
+        DeviceHandler::syncDevice(device);
+        if (!imageTarget) {
+            system(("partprobe " + device + " 2>/dev/null").c_str());
         }
+        
+        Logs::success("Fallback persistence setup complete");
+        return true;
     }
 }
@@ -3,240 +3,364 @@
 #include "lib/dev_handler.hpp"
 #include "lib/mbr_gpt.hpp"
 #include "lib/fs_creator.hpp"
+#include "lib/fat_writer.hpp"
+#include "lib/block_target.hpp"
+#include "lib/block_manifest.hpp"
+#include "lib/esp_image.hpp"
+#include "lib/partition_sizing.hpp"
+#include "lib/persistence_fallback.hpp"
+#include "lib/iso_index.hpp"
 #include "lib/errors.hpp"
 #include "utils/logs.hpp"
 #include <fstream>
-#include <sys/mount.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <cstdlib>
+#include <memory>
+#include <cstdio>
 
 namespace SmartBurner {
     
+    struct BurnContext {
+        std::string persistPart;
+    };
+    
     bool IntelligentBurner::burnWithStrategy(const BurnConfig& config) {
         Logs::info("Using intelligent burn strategy: " + 
                   std::to_string(static_cast<int>(config.strategy)));
         
+        Pipeline::TaskGraph graph;
+        auto context = std::make_shared<BurnContext>();
+        graph.setObserver(config.onTask);
+        Pipeline::TaskId last;
+        BurnConfig sealed = config;
+        
         switch (config.strategy) {
             case ISOAnalyzer::BurnStrategy::HYBRID_PRESERVE:
+                if (needsPersistenceFile(config)) {
+                    Logs::info("Strategy: ISO tree with a persistence file (hybrid table is full)");
+                    last = planPersistenceFile(graph, config);
+                    sealed.strategy = ISOAnalyzer::BurnStrategy::SMART_EXTRACT;
+                    break;
+                }
                 Logs::info("Strategy: Preserving hybrid ISO structure");
-                return burnHybridPreserve(config);
+                last = planHybridPreserve(graph, config, context);
+                break;
                 
             case ISOAnalyzer::BurnStrategy::SMART_EXTRACT:
                 Logs::info("Strategy: Smart extract and reorganize");
-                return burnSmartExtract(config);
+                last = planSmartExtract(graph, config);
+                break;
                 
             case ISOAnalyzer::BurnStrategy::MULTIPART:
                 Logs::info("Strategy: Multi-partition setup");
-                return burnMultipart(config);
+                last = planMultipart(graph, config);
+                break;
                 
             case ISOAnalyzer::BurnStrategy::RAW_COPY:
                 Logs::info("Strategy: Raw copy (fastest)");
-                return burnRawCopy(config);
+                last = planRawCopy(graph, config);
+                break;
                 
             default:
                 Logs::warning("Unknown strategy, falling back to raw copy");
-                return burnRawCopy(config);
+                last = planRawCopy(graph, config);
+                break;
+        }
+        
+        if (config.seal) {
+            graph.add("Seal manifest", [sealed]() {
+                sealManifest(sealed);
+                return true;
+            }, {last}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA, Pipeline::DEVICE_TAIL});
         }
+        
+        return graph.run();
+    }
+    
+    void IntelligentBurner::sealManifest(const BurnConfig& config) {
+        bool rawImage = config.strategy == ISOAnalyzer::BurnStrategy::RAW_COPY ||
+                        config.strategy == ISOAnalyzer::BurnStrategy::HYBRID_PRESERVE;
+        
+        // A missing manifest only disables field verification, the burn itself succeeded
+        try {
+            std::vector<BlockManifest::Extent> extents = BlockManifest::coveredExtents(
+                config.device, rawImage, config.isoStructure.isoDataSize);
+            
+            // Raw copies are block-identical to the ISO, so the index hashes
+            // double as the expected device contents
+            std::vector<Hash::Digest> expected;
+            std::unique_ptr<ISOIndex::Index> index;
+            if (rawImage && (index = ISOIndex::Index::open(config.isoPath)) &&
+                index->chunkSize() == BlockManifest::CHUNK_SIZE) {
+                for (uint64_t i = 0; i < index->chunkCount(); i++) {
+                    expected.push_back(index->chunkHash(i));
+                }
+            }
+            
+            BlockManifest::sealDevice(config.device, extents, expected);
+        } catch (const std::exception& e) {
+            Logs::warning("Could not write verification manifest: " + std::string(e.what()));
+        }
+    }
+    
+    Pipeline::TaskId IntelligentBurner::planDevicePrep(Pipeline::TaskGraph& graph,
+                                                       const BurnConfig& config) {
+        std::string device = config.device;
+        
+        Pipeline::TaskId unmount = graph.add("Unmount device", [device]() {
+            return DeviceHandler::unmountDevice(device);
+        }, {}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA, Pipeline::DEVICE_TAIL});
+        
+        // Whatever the burn itself overwrites (the whole head for raw
+        // copies) is trimmed from the wipe by the planning pass
+        return DeviceHandler::planWipe(graph, device, {unmount});
     }
     
-    bool IntelligentBurner::burnHybridPreserve(const BurnConfig& config) {
+    Pipeline::TaskId IntelligentBurner::planHybridPreserve(Pipeline::TaskGraph& graph,
+                                                           const BurnConfig& config,
+                                                           std::shared_ptr<BurnContext> context) {
         Logs::info("Preserving hybrid ISO structure with embedded partitions");
         
-        DeviceHandler::unmountDevice(config.device);
-        DeviceHandler::wipeDevice(config.device);
+        Pipeline::TaskId prep = planDevicePrep(graph, config);
         
         // For hybrid ISOs, just copy directly - they have their own partition table
-        ISOBurner::BurnMode mode = config.fastMode ? 
-            ISOBurner::BurnMode::FAST : ISOBurner::BurnMode::RAW;
+        Pipeline::TaskId burn = graph.addWrites("Copy hybrid image", Pipeline::WriteKind::FIXED,
+                                                {{0, ISOBurner::getISOSize(config.isoPath)}},
+                                                [config](const std::vector<Pipeline::Extent>&) {
+            ISOBurner::BurnMode mode = config.fastMode ? 
+                ISOBurner::BurnMode::FAST : ISOBurner::BurnMode::RAW;
+            return ISOBurner::burnISO(config.isoPath, config.device, mode);
+        }, {prep}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA, Pipeline::SOURCE_STREAM});
         
-        if (!ISOBurner::burnISO(config.isoPath, config.device, mode)) {
-            return false;
-        }
+        Pipeline::TaskId last = burn;
         
         // If persistence requested, add it as an additional partition
         if (config.persistence) {
-            Logs::info("Adding persistence partition to hybrid ISO");
-            
-            sleep(2);
-            system(("partprobe " + config.device + " 2>/dev/null").c_str());
-            sleep(2);
-            
-            // Find next available partition slot
             int nextPart = config.isoStructure.embeddedPartitions.size() + 1;
             
-            std::string persistPart;
-            if (config.device.find("nvme") != std::string::npos || 
-                config.device.find("mmcblk") != std::string::npos) {
-                persistPart = config.device + "p" + std::to_string(nextPart);
-            } else {
-                persistPart = config.device + std::to_string(nextPart);
-            }
-            
-            // Add persistence partition using available space
-            uint64_t deviceSize = DeviceHandler::getDeviceSize(config.device);
-            uint64_t usedSpace = config.isoStructure.isoDataSize;
-            uint64_t availableSpace = deviceSize - usedSpace;
-            
-            if (availableSpace > config.persistenceSizeMB * 1024 * 1024) {
-                // Use sfdisk to add partition
-                uint32_t startSector = (usedSpace / 512) + 2048;
-                uint32_t sectorCount = (config.persistenceSizeMB * 1024 * 1024) / 512;
+            Pipeline::TaskId added = graph.add("Add persistence partition", [config, context, nextPart]() {
+                Logs::info("Adding persistence partition to hybrid ISO");
                 
-                std::string cmd = "echo 'start=" + std::to_string(startSector) + 
-                                 ", size=" + std::to_string(sectorCount) + 
-                                 ", type=83' | sfdisk -a " + config.device + " 2>&1";
+                settlePartitions(config.device);
                 
-                system(cmd.c_str());
-                sleep(2);
-                system(("partprobe " + config.device + " 2>/dev/null").c_str());
-                sleep(2);
+                // Add persistence partition using available space
+                uint64_t deviceSize = DeviceHandler::getDeviceSize(config.device);
+                uint64_t usedSpace = config.isoStructure.isoDataSize;
+                uint64_t availableSpace = deviceSize - usedSpace;
                 
-                FilesystemCreator::createFilesystem(persistPart, config.persistenceFS, "persistence");
-            }
+                if (availableSpace > config.persistenceSizeMB * 1024 * 1024) {
+                    // Use sfdisk to add partition
+                    uint32_t startSector = (usedSpace / 512) + 2048;
+                    uint32_t sectorCount = (config.persistenceSizeMB * 1024 * 1024) / 512;
+                    
+                    std::string cmd = "echo 'start=" + std::to_string(startSector) + 
+                                     ", size=" + std::to_string(sectorCount) + 
+                                     ", type=83' | sfdisk -a " + config.device + " 2>&1";
+                    
+                    system(cmd.c_str());
+                    settlePartitions(config.device);
+                    
+                    context->persistPart = partitionPath(config.device, nextPart);
+                }
+                return true;
+            }, {burn}, {Pipeline::DEVICE_HEAD});
+            
+            last = graph.add("Format persistence", [config, context, nextPart]() {
+                if (context->persistPart.empty()) return true;
+                return formatPersistence(config.device, nextPart, config.persistenceFS);
+            }, {added}, {Pipeline::partitionTag(nextPart)});
         }
         
-        DeviceHandler::syncDevice(config.device);
-        return true;
+        std::string device = config.device;
+        return graph.add("Sync device", [device]() {
+            return DeviceHandler::syncDevice(device);
+        }, {last}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA});
     }
     
-    bool IntelligentBurner::burnSmartExtract(const BurnConfig& config) {
-        Logs::info("Smart extraction: Creating optimal partition layout");
-        
-        DeviceHandler::unmountDevice(config.device);
-        DeviceHandler::wipeDevice(config.device);
-        
-        // Create partition layout based on ISO requirements
-        if (!createPartitionLayout(config.device, config.isoStructure, 
-                                  config.persistence, config.persistenceSizeMB)) {
-            return false;
-        }
-        
-        // Determine first partition
-        std::string part1;
-        if (config.device.find("nvme") != std::string::npos || 
-            config.device.find("mmcblk") != std::string::npos) {
-            part1 = config.device + "p1";
-        } else {
-            part1 = config.device + "1";
-        }
-        
-        // Mount and extract ISO contents
-        std::string mountPoint = mountPartition(part1);
-        if (mountPoint.empty()) {
-            throw DeviceError(config.device, "Failed to mount partition for extraction");
-        }
+    bool IntelligentBurner::needsPersistenceFile(const BurnConfig& config) {
+        return config.persistence &&
+               config.isoStructure.embeddedPartitions.size() >= 4;
+    }
+    
+    Pipeline::TaskId IntelligentBurner::planPersistenceFile(Pipeline::TaskGraph& graph,
+                                                            const BurnConfig& config) {
+        Logs::warning("No free partition slot after the hybrid table, persistence goes into a file");
         
-        Logs::info("Extracting ISO contents to partition");
-        if (!extractAndCopyISO(config.isoPath, mountPoint)) {
-            unmountPartition(mountPoint);
-            return false;
-        }
+        Pipeline::TaskId prep = planDevicePrep(graph, config);
         
-        // Setup boot files
-        if (config.isoStructure.hasUEFI) {
-            setupUEFIBoot(part1, config.isoPath);
-        }
+        // Partitions, formats and fills the volume in one go: the file is
+        // reserved in the FAT once the tree is in
+        Pipeline::TaskId built = graph.add("Write ISO tree and persistence file", [config]() {
+            if (config.persistenceFS != "ext4") {
+                Logs::warning("Persistence files are always ext4, not " + config.persistenceFS);
+            }
+            return PersistenceFallback::setupFallbackPersistence(config.isoPath, config.device,
+                                                                 config.persistenceSizeMB);
+        }, {prep}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA, Pipeline::SOURCE_STREAM});
+        
+        std::string part1 = partitionPath(config.device, 1);
+        return graph.add("Set up boot files", [config, part1]() {
+            if (config.isoStructure.hasLegacyBoot) {
+                setupLegacyBoot(part1, config.isoPath);
+            }
+            return true;
+        }, {built}, {Pipeline::partitionTag(1)});
+    }
+    
+    Pipeline::TaskId IntelligentBurner::planSmartExtract(Pipeline::TaskGraph& graph,
+                                                         const BurnConfig& config) {
+        Logs::info("Smart extraction: Creating optimal partition layout");
         
-        if (config.isoStructure.hasLegacyBoot) {
-            setupLegacyBoot(part1, config.isoPath);
-        }
+        Pipeline::TaskId prep = planDevicePrep(graph, config);
         
-        unmountPartition(mountPoint);
-        DeviceHandler::syncDevice(config.device);
+        // Create partition layout based on ISO requirements
+        Pipeline::TaskId layout = graph.addWrites("Create partition layout", Pipeline::WriteKind::FIXED,
+                                                  {{0, 512}}, [config](const std::vector<Pipeline::Extent>&) {
+            return createPartitionLayout(config.device, config.isoPath, 
+                                         config.persistence, config.persistenceSizeMB);
+        }, {prep}, {Pipeline::DEVICE_HEAD});
+        
+        std::string part1 = partitionPath(config.device, 1);
+        std::string part1Tag = Pipeline::partitionTag(1);
+        
+        Pipeline::TaskId formatted = graph.add("Format data partition", [config]() {
+            return formatPartition(config.device, 1, "fat32", "MYISO");
+        }, {layout}, {part1Tag});
+        
+        Pipeline::TaskId copied = graph.add("Copy ISO contents", [config]() {
+            Logs::info("Extracting ISO contents to partition");
+            return writeContents(config.device, 1, config.isoPath);
+        }, {formatted}, {part1Tag, Pipeline::SOURCE_STREAM});
+        
+        // Setup boot files; UEFI firmware finds /EFI/BOOT in the copied tree
+        Pipeline::TaskId boot = graph.add("Set up boot files", [config, part1]() {
+            if (config.isoStructure.hasLegacyBoot) {
+                setupLegacyBoot(part1, config.isoPath);
+            }
+            return true;
+        }, {copied}, {part1Tag});
         
-        return true;
+        std::string device = config.device;
+        return graph.add("Sync device", [device]() {
+            return DeviceHandler::syncDevice(device);
+        }, {boot}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA});
     }
     
-    bool IntelligentBurner::burnMultipart(const BurnConfig& config) {
+    Pipeline::TaskId IntelligentBurner::planMultipart(Pipeline::TaskGraph& graph,
+                                                      const BurnConfig& config) {
         Logs::info("Multi-partition setup for complex boot requirements");
         
-        DeviceHandler::unmountDevice(config.device);
-        DeviceHandler::wipeDevice(config.device);
-        
-        BootStructures::PartitionTable ptable(config.device, 
-                                             BootStructures::TableType::MBR);
-        ptable.initialize();
-        ptable.createMBR();
-        
-        uint64_t deviceSectors = DeviceHandler::getDeviceSize(config.device) / 512;
-        uint32_t currentSector = 2048;
+        Pipeline::TaskId prep = planDevicePrep(graph, config);
         
-        // Partition 1: EFI System Partition (if UEFI)
-        if (config.isoStructure.hasUEFI) {
-            uint32_t espSize = 512 * 1024 * 1024 / 512; // 512MB for ESP
-            ptable.addMBRPartition(currentSector, espSize,
-                                  BootStructures::PartitionType::EFI_SYSTEM, true);
-            currentSector += espSize;
-            Logs::info("Created EFI System Partition (512 MB)");
-        }
-        
-        // Partition 2: Main data partition
-        uint64_t isoSectors = (config.isoStructure.isoDataSize / 512) + 4096;
-        ptable.addMBRPartition(currentSector, isoSectors,
-                              BootStructures::PartitionType::FAT32_LBA, 
-                              !config.isoStructure.hasUEFI);
-        currentSector += isoSectors;
-        Logs::info("Created main data partition");
-        
-        // Partition 3: Persistence (if requested)
-        if (config.persistence) {
-            uint32_t persistSectors = (config.persistenceSizeMB * 1024 * 1024) / 512;
-            ptable.addMBRPartition(currentSector, persistSectors,
-                                  BootStructures::PartitionType::LINUX_NATIVE, false);
-            Logs::info("Created persistence partition");
-        }
-        
-        ptable.commit();
+        Pipeline::TaskId layout = graph.addWrites("Create partition layout", Pipeline::WriteKind::FIXED,
+                                                  {{0, 512}}, [config](const std::vector<Pipeline::Extent>&) {
+            BootStructures::PartitionTable ptable(config.device, 
+                                                 BootStructures::TableType::MBR);
+            ptable.initialize();
+            ptable.createMBR();
+            
+            uint32_t currentSector = 2048;
+            
+            // Partition 1: EFI System Partition (if UEFI), as large as the
+            // ISO's EFI boot image when there is one
+            if (config.isoStructure.hasUEFI) {
+                uint32_t espSize = espSectors(config.isoStructure);
+                ptable.addMBRPartition(currentSector, espSize,
+                                      BootStructures::PartitionType::EFI_SYSTEM, true);
+                currentSector += espSize;
+                Logs::info("Created EFI System Partition (" + 
+                          std::to_string(espSize / 2048) + " MB)");
+            }
+            
+            // Partition 2: Main data partition, just large enough for the
+            // extracted tree
+            uint64_t isoSectors = PartitionSizing::extracted(config.isoPath).bytes / 512;
+            ptable.addMBRPartition(currentSector, isoSectors,
+                                  BootStructures::PartitionType::FAT32_LBA, 
+                                  !config.isoStructure.hasUEFI);
+            currentSector += isoSectors;
+            Logs::info("Created main data partition");
+            
+            // Partition 3: Persistence (if requested)
+            if (config.persistence) {
+                uint32_t persistSectors = (config.persistenceSizeMB * 1024 * 1024) / 512;
+                ptable.addMBRPartition(currentSector, persistSectors,
+                                      BootStructures::PartitionType::LINUX_NATIVE, false);
+                Logs::info("Created persistence partition");
+            }
+            
+            ptable.commit();
+            
+            settlePartitions(config.device);
+            return true;
+        }, {prep}, {Pipeline::DEVICE_HEAD});
+        
+        // Partitions are disjoint LBA ranges: every filesystem is created
+        // concurrently, and the copy into the data partition starts as soon
+        // as that one is formatted. Creators skip their own flushes; the
+        // final sync covers all of them.
+        int partNum = 1;
+        std::vector<Pipeline::TaskId> finished;
         
-        sleep(2);
-        system(("partprobe " + config.device + " 2>/dev/null").c_str());
-        sleep(2);
+        std::string device = config.device;
         
-        // Format and populate partitions
-        int partNum = 1;
         if (config.isoStructure.hasUEFI) {
-            std::string espPart = config.device + (config.device.find("nvme") != std::string::npos ? "p1" : "1");
-            FilesystemCreator::createFilesystem(espPart, "fat32", "EFI");
+            int espNum = partNum;
+            if (config.isoStructure.efiImage.size > 0) {
+                finished.push_back(graph.add("Write ESP image", [config, espNum]() {
+                    return setupUEFIBoot(config.device, espNum, config.isoStructure, config.isoPath);
+                }, {layout}, {Pipeline::partitionTag(partNum), Pipeline::SOURCE_STREAM}));
+            } else {
+                finished.push_back(graph.add("Format ESP", [device, espNum]() {
+                    return formatPartition(device, espNum, "fat32", "EFI");
+                }, {layout}, {Pipeline::partitionTag(partNum)}));
+            }
             partNum++;
         }
         
-        std::string dataPart = config.device + 
-            (config.device.find("nvme") != std::string::npos ? "p" : "") + 
-            std::to_string(partNum);
-        FilesystemCreator::createFilesystem(dataPart, "fat32", "MYISO");
+        int dataNum = partNum;
+        std::string dataTag = Pipeline::partitionTag(dataNum);
+        
+        Pipeline::TaskId formatted = graph.add("Format data partition", [device, dataNum]() {
+            return formatPartition(device, dataNum, "fat32", "MYISO");
+        }, {layout}, {dataTag});
         
         // Extract ISO to data partition
-        std::string mountPoint = mountPartition(dataPart);
-        extractAndCopyISO(config.isoPath, mountPoint);
-        unmountPartition(mountPoint);
+        finished.push_back(graph.add("Copy ISO contents", [config, dataNum]() {
+            return writeContents(config.device, dataNum, config.isoPath);
+        }, {formatted}, {dataTag, Pipeline::SOURCE_STREAM}));
         
         if (config.persistence) {
             partNum++;
-            std::string persistPart = config.device + 
-                (config.device.find("nvme") != std::string::npos ? "p" : "") + 
-                std::to_string(partNum);
-            FilesystemCreator::createFilesystem(persistPart, config.persistenceFS, "persistence");
+            int persistNum = partNum;
+            finished.push_back(graph.add("Format persistence", [config, persistNum]() {
+                return formatPersistence(config.device, persistNum, config.persistenceFS);
+            }, {layout}, {Pipeline::partitionTag(partNum)}));
         }
         
-        DeviceHandler::syncDevice(config.device);
-        return true;
+        return graph.add("Sync device", [device]() {
+            return DeviceHandler::syncDevice(device);
+        }, finished, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA});
     }
     
-    bool IntelligentBurner::burnRawCopy(const BurnConfig& config) {
+    Pipeline::TaskId IntelligentBurner::planRawCopy(Pipeline::TaskGraph& graph,
+                                                    const BurnConfig& config) {
         Logs::info("Using raw copy method (fastest, least processing)");
         
-        DeviceHandler::unmountDevice(config.device);
-        DeviceHandler::wipeDevice(config.device);
-        
-        ISOBurner::BurnMode mode = config.fastMode ? 
-            ISOBurner::BurnMode::FAST : ISOBurner::BurnMode::RAW;
+        Pipeline::TaskId prep = planDevicePrep(graph, config);
         
-        return ISOBurner::burnISO(config.isoPath, config.device, mode);
+        return graph.addWrites("Copy image", Pipeline::WriteKind::FIXED,
+                               {{0, ISOBurner::getISOSize(config.isoPath)}},
+                               [config](const std::vector<Pipeline::Extent>&) {
+            ISOBurner::BurnMode mode = config.fastMode ? 
+                ISOBurner::BurnMode::FAST : ISOBurner::BurnMode::RAW;
+            return ISOBurner::burnISO(config.isoPath, config.device, mode);
+        }, {prep}, {Pipeline::DEVICE_HEAD, Pipeline::DEVICE_DATA, Pipeline::SOURCE_STREAM});
     }
     
     bool IntelligentBurner::createPartitionLayout(const std::string& device,
-                                                 const ISOAnalyzer::ISOStructure& structure,
+                                                 const std::string& isoPath,
                                                  bool withPersistence,
                                                  size_t persistenceSizeMB) {
         
@@ -245,7 +369,7 @@ namespace SmartBurner {
         ptable.createMBR();
         
         uint32_t startSector = 2048;
-        uint32_t isoSectors = (structure.isoDataSize / 512) + 4096;
+        uint32_t isoSectors = PartitionSizing::extracted(isoPath).bytes / 512;
         
         ptable.addMBRPartition(startSector, isoSectors,
                               BootStructures::PartitionType::FAT32_LBA, true);
@@ -258,48 +382,81 @@ namespace SmartBurner {
         
         ptable.commit();
         
+        settlePartitions(device);
+        
+        return true;
+    }
+    
+    void IntelligentBurner::settlePartitions(const std::string& device) {
+        // Image files are addressed by offset, there are no nodes to wait for
+        if (BlockTarget::isImageFile(device)) return;
+        
         sleep(2);
         system(("partprobe " + device + " 2>/dev/null").c_str());
         sleep(2);
-        
-        return true;
     }
     
-    bool IntelligentBurner::extractAndCopyISO(const std::string& isoPath,
-                                             const std::string& mountPoint) {
-        
-        std::string loopDevice = "/dev/loop0";
-        for (int i = 0; i < 8; i++) {
-            loopDevice = "/dev/loop" + std::to_string(i);
-            struct stat st;
-            if (stat(loopDevice.c_str(), &st) != 0) break;
+    bool IntelligentBurner::formatPartition(const std::string& device, int number,
+                                            const std::string& fsType, const std::string& label,
+                                            const std::vector<FilesystemCreator::SeedEntry>& seed) {
+        // By offset on the whole device, like the contents written into it
+        // afterwards, so both share one cache and no partition node is needed
+        BlockTarget::Partition partition;
+        if (!BlockTarget::findPartition(device, number, partition)) {
+            throw DeviceError(device, "Partition " + std::to_string(number) + " not found");
         }
-        
-        std::string cmd = "losetup " + loopDevice + " " + isoPath + " 2>/dev/null";
-        if (system(cmd.c_str()) != 0) {
-            return false;
+        return FilesystemCreator::createFilesystem(device, fsType, label,
+                                                   partition.offset, partition.length, seed);
+    }
+    
+    bool IntelligentBurner::formatPersistence(const std::string& device, int number,
+                                              const std::string& fsType) {
+        // live-boot only uses a "persistence" volume that carries this file;
+        // writing it at format time saves mounting the partition afterwards
+        std::vector<FilesystemCreator::SeedEntry> seed;
+        if (fsType == "ext4") {
+            seed.push_back({"persistence.conf", "/ union\n", false, 0644});
         }
-        
-        std::string tmpMount = "/tmp/myiso_extract";
-        mkdir(tmpMount.c_str(), 0755);
-        
-        if (mount(loopDevice.c_str(), tmpMount.c_str(), "iso9660", MS_RDONLY, nullptr) == 0) {
-            cmd = "cp -a " + tmpMount + "/* " + mountPoint + "/ 2>/dev/null";
-            system(cmd.c_str());
-            
-            umount(tmpMount.c_str());
+        return formatPartition(device, number, fsType, "persistence", seed);
+    }
+    
+    bool IntelligentBurner::writeContents(const std::string& device, int number,
+                                          const std::string& isoPath) {
+        BlockTarget::Partition partition;
+        if (!BlockTarget::findPartition(device, number, partition)) {
+            throw DeviceError(device, "Partition " + std::to_string(number) + " not found");
         }
         
-        system(("losetup -d " + loopDevice + " 2>/dev/null").c_str());
-        rmdir(tmpMount.c_str());
+        // Files are laid into the fresh FAT straight from the ISO extents,
+        // in boot read order, on sticks and image files alike; no loop
+        // device or mount involved
+        FatWriter::Volume volume(device, partition.offset);
+        volume.open();
+        uint64_t copied = FatWriter::copyISO(isoPath, volume);
+        volume.commit();
         
+        Logs::info("Copied " + std::to_string(copied / (1024 * 1024)) + " MB of ISO contents");
         return true;
     }
     
-    bool IntelligentBurner::setupUEFIBoot(const std::string& partition,
+    uint32_t IntelligentBurner::espSectors(const ISOAnalyzer::ISOStructure& structure) {
+        if (structure.efiImage.size == 0) {
+            return 512 * 1024 * 1024 / 512;     // Formatted empty, as FAT32 needs room
+        }
+        return static_cast<uint32_t>(ESPImage::partitionSize(structure.efiImage) / 512);
+    }
+    
+    bool IntelligentBurner::setupUEFIBoot(const std::string& device, int number,
+                                         const ISOAnalyzer::ISOStructure& structure,
                                          const std::string& isoPath) {
         Logs::info("Setting up UEFI boot support");
-        return true;
+        
+        BlockTarget::Partition esp;
+        if (!BlockTarget::findPartition(device, number, esp)) {
+            throw DeviceError(device, "ESP partition " + std::to_string(number) + " not found");
+        }
+        
+        return ESPImage::write(isoPath, structure.efiImage, device, esp.offset, esp.length);
     }
     
     bool IntelligentBurner::setupLegacyBoot(const std::string& partition,
@@ -308,20 +465,12 @@ namespace SmartBurner {
         return true;
     }
     
-    std::string IntelligentBurner::mountPartition(const std::string& partition) {
-        std::string mountPoint = "/tmp/myiso_part_" + std::to_string(getpid());
-        mkdir(mountPoint.c_str(), 0755);
-        
-        if (mount(partition.c_str(), mountPoint.c_str(), "vfat", 0, nullptr) != 0) {
-            rmdir(mountPoint.c_str());
-            return "";
+    std::string IntelligentBurner::partitionPath(const std::string& device, int number) {
+        if (device.find("nvme") != std::string::npos || 
+            device.find("mmcblk") != std::string::npos ||
+            device.find("loop") != std::string::npos) {
+            return device + "p" + std::to_string(number);
         }
-        
-        return mountPoint;
-    }
-    
-    void IntelligentBurner::unmountPartition(const std::string& mountPoint) {
-        umount(mountPoint.c_str());
-        rmdir(mountPoint.c_str());
+        return device + std::to_string(number);
     }
 }
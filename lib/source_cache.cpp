@@ -0,0 +1,383 @@
+#include "lib/source_cache.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/block_target.hpp"
+#include "utils/logs.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+namespace SourceCache {
+
+    static const uint64_t MB = 1024 * 1024;
+    static const size_t CHUNK = 8 * MB;
+
+    // All-zero blocks are left as holes, so sparse readers still skip them
+    // and they cost no memory
+    static const size_t ZERO_BLOCK = 64 * 1024;
+
+    enum class State {
+        LOADING,
+        READY,
+        FAILED
+    };
+
+    struct Entry {
+        std::string key;            // Device and inode of the ISO
+        std::string isoPath;
+        uint64_t size = 0;
+        int64_t mtime = 0;
+        int fd = -1;                // The memfd
+        State state = State::LOADING;
+        uint64_t lastUse = 0;
+
+        ~Entry() {
+            if (fd >= 0) close(fd);
+        }
+    };
+
+    Lease::Lease(std::shared_ptr<Entry> cached) : entry(std::move(cached)) {}
+
+    namespace {
+        struct Cache {
+            std::mutex mutex;
+            std::map<std::string, std::shared_ptr<Entry>> entries;
+            std::map<std::string, uint64_t> requests;     // Also for images never admitted
+            std::vector<std::pair<std::thread, std::shared_ptr<Entry>>> loaders;
+            std::atomic<bool> stopping{false};
+            uint64_t capacity = 0;
+            uint64_t resident = 0;
+            uint64_t tick = 0;
+            Stats counters = {};
+
+            // Loads still running when the process exits are abandoned
+            ~Cache() {
+                stopping = true;
+                for (auto& loader : loaders) loader.first.join();
+            }
+        };
+
+        Cache& cache() {
+            static Cache instance;
+            return instance;
+        }
+    }
+
+    static bool identify(const std::string& isoPath, std::string& key, struct stat& st) {
+        if (stat(isoPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+        key = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+        return true;
+    }
+
+    static uint64_t availableMemory() {
+        std::ifstream meminfo("/proc/meminfo");
+        std::string name;
+        uint64_t kilobytes = 0;
+        while (meminfo >> name >> kilobytes) {
+            if (name == "MemAvailable:") return kilobytes * 1024;
+            meminfo.ignore(64, '\n');
+        }
+        return 0;
+    }
+
+    void enable(uint64_t capacityBytes) {
+        if (capacityBytes == 0) {
+            const char* budget = getenv("MYISO_SOURCE_CACHE_MB");
+            capacityBytes = budget ? strtoull(budget, nullptr, 10) * MB : availableMemory() / 2;
+        }
+
+        Cache& state = cache();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.capacity = capacityBytes;
+        if (capacityBytes > 0) {
+            Logs::info("Source cache: up to " + std::to_string(capacityBytes / MB) + " MB of ISO images in RAM");
+        }
+    }
+
+    bool enabled() {
+        Cache& state = cache();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return state.capacity > 0;
+    }
+
+    // Uses per byte of RAM: a small image burned often beats a big one
+    // burned once
+    static double score(Cache& state, const std::string& key, uint64_t size) {
+        return static_cast<double>(state.requests[key]) / std::max<uint64_t>(size, 1);
+    }
+
+    // Makes room for an image by evicting idle images worth less per byte;
+    // nothing is evicted unless the whole image then fits
+    static bool admit(Cache& state, const std::string& key, uint64_t size) {
+        if (size > state.capacity) return false;
+
+        double candidate = score(state, key, size);
+        std::vector<std::shared_ptr<Entry>> idle;
+        for (const auto& item : state.entries) {
+            // Held by a job or a loader besides the table
+            if (item.second->state == State::LOADING || item.second.use_count() > 1) continue;
+            idle.push_back(item.second);
+        }
+        std::sort(idle.begin(), idle.end(), [&](const std::shared_ptr<Entry>& a, const std::shared_ptr<Entry>& b) {
+            double scoreA = score(state, a->key, a->size);
+            double scoreB = score(state, b->key, b->size);
+            return scoreA != scoreB ? scoreA < scoreB : a->lastUse < b->lastUse;
+        });
+
+        uint64_t free = state.capacity - std::min(state.capacity, state.resident);
+        size_t victims = 0;
+        while (free < size && victims < idle.size() &&
+               score(state, idle[victims]->key, idle[victims]->size) <= candidate) {
+            free += idle[victims]->size;
+            victims++;
+        }
+        if (free < size) return false;
+
+        for (size_t i = 0; i < victims; i++) {
+            Logs::debug("Source cache: evicting ", idle[i]->isoPath);
+            state.entries.erase(idle[i]->key);
+            state.resident -= idle[i]->size;
+            state.counters.evicted++;
+        }
+        return true;
+    }
+
+    static bool allZero(const uint8_t* data, size_t length) {
+        return data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+    }
+
+    // Copies the ISO's data extents into a fresh memfd through a mapping
+    // advised for huge pages; a source on network storage is read through
+    // its staged copy as that arrives
+    static bool load(Cache& state, Entry& entry) {
+        SourceStager::Handle staged = SourceStager::stage(entry.isoPath);
+        int source = staged ? SourceStager::openStaged(entry.isoPath) : -1;
+        if (source < 0) source = open(entry.isoPath.c_str(), O_RDONLY | O_CLOEXEC);
+        if (source < 0) return false;
+
+        std::string name = "myiso:" + entry.isoPath.substr(entry.isoPath.find_last_of('/') + 1);
+        int fd = memfd_create(name.c_str(), MFD_CLOEXEC);
+        if (fd < 0 || ftruncate(fd, entry.size) != 0) {
+            if (fd >= 0) close(fd);
+            close(source);
+            return false;
+        }
+
+        uint8_t* map = nullptr;
+        if (entry.size > 0) {
+            void* mapped = mmap(nullptr, entry.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mapped == MAP_FAILED) {
+                close(fd);
+                close(source);
+                return false;
+            }
+            map = static_cast<uint8_t*>(mapped);
+            madvise(map, entry.size, MADV_HUGEPAGE);
+        }
+
+        std::vector<uint8_t> buffer(CHUNK);
+        bool ok = true;
+        try {
+            for (const auto& extent : BlockTarget::mapData(source, entry.size)) {
+                uint64_t end = extent.offset + extent.length;
+                for (uint64_t offset = extent.offset; ok && offset < end && !state.stopping; ) {
+                    size_t length = std::min<uint64_t>(CHUNK, end - offset);
+                    SourceStager::await(source, offset, length);
+                    ssize_t n = pread(source, buffer.data(), length, offset);
+                    if (n <= 0) {
+                        ok = false;
+                        break;
+                    }
+                    for (ssize_t block = 0; block < n; block += ZERO_BLOCK) {
+                        size_t span = std::min<size_t>(ZERO_BLOCK, n - block);
+                        if (!allZero(buffer.data() + block, span)) {
+                            memcpy(map + offset + block, buffer.data() + block, span);
+                        }
+                    }
+                    offset += n;
+                }
+                if (!ok || state.stopping) break;
+            }
+        } catch (const std::exception& e) {
+            Logs::debug("Source cache: ", e.what());
+            ok = false;
+        }
+
+        if (map) munmap(map, entry.size);
+        close(source);
+        if (!ok || state.stopping) {
+            close(fd);
+            return false;
+        }
+        entry.fd = fd;
+        return true;
+    }
+
+    static void finishLoad(Cache& state, const std::shared_ptr<Entry>& entry) {
+        bool ok = load(state, *entry);
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        entry->state = ok ? State::READY : State::FAILED;
+        if (!ok) {
+            // Give the room back; the next request tries again
+            auto it = state.entries.find(entry->key);
+            if (it != state.entries.end() && it->second == entry) {
+                state.entries.erase(it);
+                state.resident -= entry->size;
+            }
+            if (!state.stopping) {
+                Logs::warning("Source cache: cannot load " + entry->isoPath + ", reading it from disk");
+            }
+        } else {
+            Logs::debug("Source cache: ", entry->isoPath, " resident (", entry->size / MB, " MB)");
+        }
+    }
+
+    // The entry for an ISO, or a new loading entry when it is admitted;
+    // called with the cache locked
+    static std::shared_ptr<Entry> lookup(Cache& state, const std::string& isoPath, const std::string& key,
+                                         const struct stat& st, bool& created) {
+        created = false;
+        auto it = state.entries.find(key);
+        if (it != state.entries.end()) {
+            // A rewritten ISO is a different image; jobs still leasing the
+            // old one finish with it
+            if (it->second->size == static_cast<uint64_t>(st.st_size) && it->second->mtime == st.st_mtime) {
+                it->second->lastUse = ++state.tick;
+                return it->second;
+            }
+            state.resident -= it->second->size;
+            state.entries.erase(it);
+        }
+
+        if (!admit(state, key, st.st_size)) {
+            state.counters.rejected++;
+            return nullptr;
+        }
+
+        auto entry = std::make_shared<Entry>();
+        entry->key = key;
+        entry->isoPath = isoPath;
+        entry->size = st.st_size;
+        entry->mtime = st.st_mtime;
+        entry->lastUse = ++state.tick;
+        state.entries[key] = entry;
+        state.resident += entry->size;
+        created = true;
+        return entry;
+    }
+
+    // Starts a loader for a new entry; called with the cache locked
+    static void startLoad(Cache& state, const std::shared_ptr<Entry>& entry) {
+        // A loader whose image left LOADING has released the lock for good
+        auto done = std::remove_if(state.loaders.begin(), state.loaders.end(), [](auto& loader) {
+            if (loader.second->state == State::LOADING) return false;
+            loader.first.join();
+            return true;
+        });
+        state.loaders.erase(done, state.loaders.end());
+
+        state.loaders.emplace_back(std::thread(finishLoad, std::ref(state), entry), entry);
+    }
+
+    Lease acquire(const std::string& isoPath) {
+        Cache& state = cache();
+        std::string key;
+        struct stat st;
+        if (!enabled() || !identify(isoPath, key, st)) return Lease();
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.requests[key]++;
+
+        bool created = false;
+        std::shared_ptr<Entry> entry = lookup(state, isoPath, key, st, created);
+        if (!entry) {
+            state.counters.misses++;
+            return Lease();
+        }
+
+        // The job never waits for the load: openSource() keeps serving the
+        // file until the memfd is complete
+        if (created) {
+            state.counters.misses++;
+            startLoad(state, entry);
+        } else {
+            state.counters.hits++;
+        }
+        return Lease(entry);
+    }
+
+    void prefetch(const std::string& isoPath, uint64_t expectedJobs) {
+        Cache& state = cache();
+        std::string key;
+        struct stat st;
+        if (!enabled() || !identify(isoPath, key, st)) return;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.requests[key] += expectedJobs;
+
+        bool created = false;
+        std::shared_ptr<Entry> entry = lookup(state, isoPath, key, st, created);
+        if (!created) return;
+
+        state.counters.prefetched++;
+        startLoad(state, entry);
+    }
+
+    int openSource(const std::string& isoPath) {
+        Cache& state = cache();
+        std::string key;
+        struct stat st;
+
+        if (enabled() && identify(isoPath, key, st)) {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            auto it = state.entries.find(key);
+            if (it != state.entries.end() && it->second->state == State::READY &&
+                it->second->size == static_cast<uint64_t>(st.st_size) && it->second->mtime == st.st_mtime) {
+                // A fresh open of the memfd gets its own offset, unlike dup()
+                std::string path = "/proc/self/fd/" + std::to_string(it->second->fd);
+                int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (fd >= 0) return fd;
+            }
+        }
+
+        int staged = SourceStager::openStaged(isoPath);
+        if (staged >= 0) return staged;
+
+        return open(isoPath.c_str(), O_RDONLY);
+    }
+
+    Stats stats() {
+        Cache& state = cache();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        Stats result = state.counters;
+        result.residentBytes = state.resident;
+        result.capacityBytes = state.capacity;
+        result.images = state.entries.size();
+        return result;
+    }
+
+    std::string describe(const Stats& stats) {
+        uint64_t requests = stats.hits + stats.misses;
+        char rate[16];
+        snprintf(rate, sizeof(rate), "%.0f%%", requests ? 100.0 * stats.hits / requests : 0.0);
+
+        return std::to_string(stats.hits) + " hits, " + std::to_string(stats.misses) + " misses (" +
+               rate + " hit rate), " + std::to_string(stats.images) + " images / " +
+               std::to_string(stats.residentBytes / MB) + " MB of " +
+               std::to_string(stats.capacityBytes / MB) + " MB resident, " +
+               std::to_string(stats.prefetched) + " prefetched, " + std::to_string(stats.evicted) +
+               " evicted, " + std::to_string(stats.rejected) + " rejected";
+    }
+}
@@ -0,0 +1,695 @@
+#include "lib/source_stager.hpp"
+#include "lib/block_target.hpp"
+#include "lib/http_source.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include "utils/sha256.hpp"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+#include <algorithm>
+
+namespace SourceStager {
+
+    static const uint64_t MB = 1024 * 1024;
+    static const uint64_t CHUNK = 8 * MB;
+    static const size_t ZERO_BLOCK = 64 * 1024;
+    static const uint64_t HEAD_BYTES = 2 * MB;     // What the ISO type scans read
+    static const int ATTEMPTS = 3;
+    static const unsigned DEFAULT_STREAMS = 4;
+    static const char* DEFAULT_DIR = "/var/tmp/myiso-staging";
+    static const char* PART_SUFFIX = ".part";
+
+    enum class ChunkState : uint8_t {
+        PENDING,
+        CLAIMED,
+        DONE
+    };
+
+    struct Stage {
+        std::string isoPath;
+        std::string sourceKey;          // Identity of the ISO: device, inode, size, mtime,
+                                        // or URL, size and validator
+        std::string fileKey;            // Device and inode of the staged copy
+        std::string path;               // Staged copy; empty for a RAM copy
+        std::string finalPath;          // Name in the staging cache
+        int sourceFd = -1;
+        int fd = -1;
+        uint64_t size = 0;
+        std::vector<Pipeline::Extent> data;
+
+        bool remote = false;
+        HttpSource::Resource resource;
+        uint64_t head = 0;              // Leading bytes present before any chunk
+
+        std::mutex mutex;
+        std::condition_variable arrived;
+        std::vector<ChunkState> chunks;
+        std::deque<uint64_t> urgent;    // Chunks a reader is waiting for
+        uint64_t next = 0;
+        uint64_t remaining = 0;
+        std::string error;
+
+        Hash::SHA256 hasher;            // URL sources, over the arrived prefix
+        uint64_t hashedChunks = 0;
+        bool hashing = false;
+        bool hashed = false;
+
+        std::atomic<bool> cancel{false};
+        std::vector<std::thread> streams;
+        std::chrono::steady_clock::time_point started;
+
+        ~Stage();
+    };
+
+    namespace {
+        struct Registry {
+            std::mutex mutex;
+            std::map<std::string, std::weak_ptr<Stage>> bySource;
+            std::map<std::string, std::weak_ptr<Stage>> byFile;
+            std::atomic<int> live{0};
+        };
+
+        Registry& registry() {
+            static Registry instance;
+            return instance;
+        }
+    }
+
+    static std::string setting(const char* name, const std::string& fallback) {
+        const char* value = getenv(name);
+        return value && *value ? value : fallback;
+    }
+
+    static std::string fileKey(const struct stat& st) {
+        return std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+    }
+
+    bool networkFilesystem(const std::string& path) {
+        static const long NETWORK[] = {
+            0x6969,         // NFS
+            0x517B,         // SMB
+            0xFF534D42,     // CIFS
+            0xFE534D42,     // SMB2
+            0x01021997,     // 9p
+            0x00C36400,     // Ceph
+            0x65735546,     // FUSE (sshfs, ...)
+        };
+
+        struct statfs fs;
+        if (statfs(path.c_str(), &fs) != 0) return false;
+        return std::find(std::begin(NETWORK), std::end(NETWORK),
+                         static_cast<long>(fs.f_type)) != std::end(NETWORK);
+    }
+
+    static bool allZero(const uint8_t* data, size_t length) {
+        return data[0] == 0 && memcmp(data, data + 1, length - 1) == 0;
+    }
+
+    // Removes the least recently used completed copies until the staging
+    // cache fits its budget; copies in use are kept
+    static void trimCache(const std::string& dir, uint64_t budget) {
+        struct Cached {
+            std::string path;
+            uint64_t bytes;
+            int64_t used;
+        };
+        std::vector<Cached> cached;
+        uint64_t total = 0;
+
+        DIR* listing = opendir(dir.c_str());
+        if (!listing) return;
+        while (dirent* entry = readdir(listing)) {
+            std::string name = entry->d_name;
+            if (name[0] == '.' || (name.size() > strlen(PART_SUFFIX) &&
+                name.compare(name.size() - strlen(PART_SUFFIX), std::string::npos, PART_SUFFIX) == 0)) {
+                continue;
+            }
+            std::string path = dir + "/" + name;
+            struct stat st;
+            if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            cached.push_back({path, static_cast<uint64_t>(st.st_blocks) * 512, st.st_mtime});
+            total += cached.back().bytes;
+        }
+        closedir(listing);
+
+        std::sort(cached.begin(), cached.end(), [](const Cached& a, const Cached& b) {
+            return a.used < b.used;
+        });
+
+        Registry& state = registry();
+        for (const auto& copy : cached) {
+            if (total <= budget) break;
+
+            bool inUse = false;
+            {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                for (const auto& item : state.bySource) {
+                    std::shared_ptr<Stage> stage = item.second.lock();
+                    if (stage && stage->finalPath == copy.path) inUse = true;
+                }
+            }
+            if (inUse) continue;
+
+            Logs::debug("Staging cache: evicting ", copy.path);
+            unlink(copy.path.c_str());
+            total -= copy.bytes;
+        }
+    }
+
+    Stage::~Stage() {
+        cancel = true;
+        for (auto& stream : streams) stream.join();
+
+        {
+            Registry& state = registry();
+            std::lock_guard<std::mutex> lock(state.mutex);
+            auto source = state.bySource.find(sourceKey);
+            if (source != state.bySource.end() && source->second.expired()) state.bySource.erase(source);
+            auto file = state.byFile.find(fileKey);
+            if (file != state.byFile.end() && file->second.expired()) state.byFile.erase(file);
+            state.live--;
+        }
+
+        if (sourceFd >= 0) close(sourceFd);
+        if (fd >= 0) close(fd);
+
+        // A complete copy joins the staging cache, anything else goes
+        uint64_t budget = strtoull(setting("MYISO_STAGING_CACHE_MB", "0").c_str(), nullptr, 10) * MB;
+        if (path.empty() || path == finalPath) {
+            if (!path.empty()) utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+        } else if (remaining == 0 && error.empty() && budget > 0 && !finalPath.empty() &&
+                   rename(path.c_str(), finalPath.c_str()) == 0) {
+            Logs::debug("Staging cache: keeping ", finalPath);
+        } else {
+            unlink(path.c_str());
+        }
+
+        if (budget > 0 && !finalPath.empty()) {
+            trimCache(finalPath.substr(0, finalPath.find_last_of('/')), budget);
+        }
+    }
+
+    // Hashes the arrived prefix of a URL source in order. Whichever stream
+    // completes the next chunk carries the digest forward; the last chunk
+    // settles it against the expected one.
+    static void advanceHash(Stage* stage, std::vector<uint8_t>& buffer) {
+        {
+            std::lock_guard<std::mutex> lock(stage->mutex);
+            if (stage->hashing || stage->hashed) return;
+            stage->hashing = true;
+        }
+
+        for (;;) {
+            uint64_t chunk;
+            {
+                std::lock_guard<std::mutex> lock(stage->mutex);
+                chunk = stage->hashedChunks;
+                if (stage->cancel || !stage->error.empty() || chunk == stage->chunks.size() ||
+                    stage->chunks[chunk] != ChunkState::DONE) {
+                    stage->hashing = false;
+                    return;
+                }
+            }
+
+            uint64_t offset = chunk * CHUNK;
+            uint64_t length = std::min(CHUNK, stage->size - offset);
+            for (uint64_t done = 0; done < length;) {
+                ssize_t got = pread(stage->fd, buffer.data() + done, length - done, offset + done);
+                if (got <= 0) {
+                    std::lock_guard<std::mutex> lock(stage->mutex);
+                    stage->error = std::string("cannot read staged copy: ") + strerror(got < 0 ? errno : EIO);
+                    stage->hashing = false;
+                    stage->arrived.notify_all();
+                    return;
+                }
+                done += got;
+            }
+            stage->hasher.update(buffer.data(), length);
+
+            std::lock_guard<std::mutex> lock(stage->mutex);
+            if (++stage->hashedChunks < stage->chunks.size()) continue;
+
+            std::string digest = Hash::toHex(stage->hasher.finish());
+            if (!stage->resource.sha256.empty() && digest != stage->resource.sha256) {
+                stage->error = "SHA-256 mismatch: expected " + stage->resource.sha256 + ", got " + digest;
+            } else {
+                Logs::info("SHA-256 of " + stage->isoPath + ": " + digest +
+                           (stage->resource.sha256.empty() ? "" : " (verified)"));
+                stage->hashed = true;
+            }
+            stage->hashing = false;
+            stage->arrived.notify_all();
+            return;
+        }
+    }
+
+    // Writes a fetched chunk from 'from' on; zero blocks stay holes in the
+    // copy and read back as zeros
+    static std::string storeChunk(Stage* stage, uint64_t chunk, const std::vector<uint8_t>& buffer,
+                                  uint64_t from, uint64_t length) {
+        uint64_t offset = chunk * CHUNK;
+        for (uint64_t block = from; block < length; block += ZERO_BLOCK) {
+            size_t span = std::min<uint64_t>(ZERO_BLOCK, length - block);
+            if (allZero(buffer.data() + block, span)) continue;
+            if (pwrite(stage->fd, buffer.data() + block, span, offset + block) != static_cast<ssize_t>(span)) {
+                return std::string("cannot write staged copy: ") + strerror(errno);
+            }
+        }
+        return "";
+    }
+
+    // Publishes a chunk to waiting readers, or the failure that ends staging
+    static void finishChunk(Stage* stage, uint64_t chunk, const std::string& failure,
+                            std::vector<uint8_t>& buffer) {
+        {
+            std::lock_guard<std::mutex> lock(stage->mutex);
+            if (!failure.empty()) {
+                stage->error = failure;
+                stage->chunks[chunk] = ChunkState::PENDING;
+                stage->arrived.notify_all();
+                return;
+            }
+
+            stage->chunks[chunk] = ChunkState::DONE;
+            if (--stage->remaining == 0) {
+                double seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - stage->started).count();
+                Logs::info("Staged " + stage->isoPath + ": " + std::to_string(stage->size / MB) +
+                           " MB in " + std::to_string(static_cast<int>(seconds + 0.5)) + " s (" +
+                           std::to_string(static_cast<int>(stage->size / MB / std::max(seconds, 0.001))) +
+                           " MB/s)");
+            }
+            stage->arrived.notify_all();
+        }
+
+        if (stage->remote) advanceHash(stage, buffer);
+    }
+
+    // Reads [offset + from, offset + length) of a URL with a few attempts,
+    // reconnecting after each failure
+    static std::string fetchRange(Stage* stage, std::unique_ptr<HttpSource::Connection>& connection,
+                                  uint64_t offset, uint64_t from, uint64_t length, uint8_t* buffer) {
+        for (int attempt = 1;; attempt++) {
+            try {
+                if (!connection) connection.reset(new HttpSource::Connection(stage->resource.url));
+                connection->read(stage->resource, offset + from, length - from, buffer + from);
+                return "";
+            } catch (const std::exception& e) {
+                bool changed = connection && connection->sourceChanged();
+                connection.reset();
+                if (attempt == ATTEMPTS || changed || stage->cancel) return e.what();
+                Logs::warning(std::string(e.what()) + ", retrying");
+                std::this_thread::sleep_for(std::chrono::seconds(attempt));
+            }
+        }
+    }
+
+    // One read stream: claims the chunk a reader waits for, else the next
+    // one in order, until every chunk is claimed
+    static void runStream(Stage* stage) {
+        std::vector<uint8_t> buffer(CHUNK);
+        std::unique_ptr<HttpSource::Connection> connection;
+
+        while (!stage->cancel) {
+            uint64_t chunk;
+            {
+                std::lock_guard<std::mutex> lock(stage->mutex);
+                while (!stage->urgent.empty() &&
+                       stage->chunks[stage->urgent.front()] != ChunkState::PENDING) {
+                    stage->urgent.pop_front();
+                }
+                if (!stage->urgent.empty()) {
+                    chunk = stage->urgent.front();
+                    stage->urgent.pop_front();
+                } else {
+                    while (stage->next < stage->chunks.size() &&
+                           stage->chunks[stage->next] != ChunkState::PENDING) {
+                        stage->next++;
+                    }
+                    if (stage->next == stage->chunks.size() || !stage->error.empty()) return;
+                    chunk = stage->next++;
+                }
+                stage->chunks[chunk] = ChunkState::CLAIMED;
+            }
+
+            uint64_t offset = chunk * CHUNK;
+            uint64_t length = std::min(CHUNK, stage->size - offset);
+            uint64_t from = chunk == 0 ? std::min(stage->head, length) : 0;
+            std::string failure;
+
+            if (stage->remote) {
+                if (from < length) {
+                    failure = fetchRange(stage, connection, offset, from, length, buffer.data());
+                }
+            } else {
+                for (uint64_t done = 0; done < length;) {
+                    ssize_t got = pread(stage->sourceFd, buffer.data() + done, length - done, offset + done);
+                    if (got <= 0) {
+                        failure = got < 0 ? strerror(errno) : "unexpected end of file";
+                        break;
+                    }
+                    done += got;
+                }
+            }
+
+            if (failure.empty()) failure = storeChunk(stage, chunk, buffer, from, length);
+            finishChunk(stage, chunk, failure, buffer);
+            if (!failure.empty()) return;
+        }
+    }
+
+    // Servers without range support send the image once, in order, over a
+    // single connection; waiting readers cannot jump ahead
+    static void runSequential(Stage* stage) {
+        std::vector<uint8_t> buffer(CHUNK);
+        uint64_t chunk = 0;
+        uint64_t filled = 0;
+        std::string failure;
+
+        try {
+            HttpSource::Connection connection(stage->resource.url);
+            connection.readAll(stage->resource, [&](const uint8_t* data, size_t length) {
+                while (length > 0) {
+                    uint64_t chunkLength = std::min(CHUNK, stage->size - chunk * CHUNK);
+                    size_t take = std::min<uint64_t>(length, chunkLength - filled);
+                    memcpy(buffer.data() + filled, data, take);
+                    filled += take;
+                    data += take;
+                    length -= take;
+                    if (filled < chunkLength) continue;
+
+                    uint64_t from = chunk == 0 ? std::min(stage->head, chunkLength) : 0;
+                    failure = storeChunk(stage, chunk, buffer, from, chunkLength);
+                    if (!failure.empty()) return false;
+                    finishChunk(stage, chunk, "", buffer);
+                    chunk++;
+                    filled = 0;
+                }
+                return !stage->cancel;
+            });
+        } catch (const std::exception& e) {
+            failure = e.what();
+        }
+
+        if (!failure.empty()) finishChunk(stage, chunk, failure, buffer);
+    }
+
+    // Digests a URL source taken from the staging cache
+    static void runHash(Stage* stage) {
+        std::vector<uint8_t> buffer(CHUNK);
+        advanceHash(stage, buffer);
+    }
+
+    static std::shared_ptr<Stage> find(std::map<std::string, std::weak_ptr<Stage>>& table, const std::string& key) {
+        auto it = table.find(key);
+        return it == table.end() ? nullptr : it->second.lock();
+    }
+
+    Handle stage(const std::string& isoPath) {
+        Registry& state = registry();
+        bool remote = HttpSource::isUrl(isoPath);
+        HttpSource::Resource resource;
+        std::string head;
+        std::string sourceKey;
+        struct stat st;
+
+        if (remote) {
+            // A URL cannot be read in place, whatever MYISO_STAGING says.
+            // Its head arrives with the probe, before any stream starts.
+            HttpSource::Connection connection(isoPath);
+            resource = connection.probe(HEAD_BYTES, head);
+            sourceKey = resource.url + ":" + std::to_string(resource.size) + ":" +
+                        resource.etag + resource.lastModified;
+        } else {
+            if (stat(isoPath.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return nullptr;
+
+            // The staged copy itself, as handed out by stagedPath()
+            if (state.live > 0) {
+                std::lock_guard<std::mutex> lock(state.mutex);
+                if (std::shared_ptr<Stage> existing = find(state.byFile, fileKey(st))) {
+                    return existing;
+                }
+            }
+
+            std::string mode = setting("MYISO_STAGING", "auto");
+            if (mode == "off" || (mode != "always" && !networkFilesystem(isoPath))) {
+                return nullptr;
+            }
+            sourceKey = fileKey(st) + ":" + std::to_string(st.st_size) + ":" +
+                        std::to_string(st.st_mtime);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (std::shared_ptr<Stage> existing = find(state.bySource, sourceKey)) {
+                return existing;
+            }
+        }
+
+        // Set up without the registry lock: a stage given up on here
+        // deregisters itself in its destructor
+        auto stage = std::make_shared<Stage>();
+        state.live++;
+        stage->isoPath = remote ? resource.url : isoPath;
+        stage->sourceKey = sourceKey;
+        stage->remote = remote;
+        if (remote) {
+            stage->resource = resource;
+            stage->size = resource.size;
+        } else {
+            stage->size = st.st_size;
+            stage->sourceFd = open(isoPath.c_str(), O_RDONLY | O_CLOEXEC);
+            if (stage->sourceFd < 0) {
+                throw FileError(isoPath, "Cannot open ISO file");
+            }
+        }
+
+        // Without a validator two versions of a URL look alike, so their
+        // copies stay out of the staging cache
+        bool cacheable = !remote || !resource.etag.empty() || !resource.lastModified.empty();
+        std::string dir = setting("MYISO_STAGING_DIR", DEFAULT_DIR);
+        std::string name = remote ? resource.name : isoPath.substr(isoPath.find_last_of('/') + 1);
+        bool fromCache = false;
+        if (dir == "ram") {
+            stage->fd = memfd_create(("myiso-stage:" + name).c_str(), MFD_CLOEXEC);
+        } else {
+            mkdir(dir.c_str(), 0700);
+            char identity[32];
+            snprintf(identity, sizeof(identity), "%016zx", std::hash<std::string>()(sourceKey));
+            std::string base = dir + "/" + name + "." + identity;
+            if (cacheable) stage->finalPath = base;
+
+            // A copy from the staging cache needs no streams at all
+            int cached = cacheable ? open(base.c_str(), O_RDONLY | O_CLOEXEC) : -1;
+            struct stat copy;
+            if (cached >= 0 && fstat(cached, &copy) == 0 && static_cast<uint64_t>(copy.st_size) == stage->size) {
+                Logs::info("Using staged copy of " + isoPath + " from the staging cache");
+                stage->fd = cached;
+                stage->path = stage->finalPath;
+                fromCache = true;
+            } else {
+                static std::atomic<unsigned> serial{0};
+                if (cached >= 0) close(cached);
+                stage->path = base + "." + std::to_string(getpid()) + "-" +
+                              std::to_string(serial++) + PART_SUFFIX;
+                stage->fd = open(stage->path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+            }
+        }
+
+        struct stat staged;
+        if (stage->fd < 0 || fstat(stage->fd, &staged) != 0 ||
+            (!fromCache && ftruncate(stage->fd, stage->size) != 0)) {
+            if (remote) {
+                throw FileError(isoPath, "Cannot stage the download in " + dir);
+            }
+            Logs::warning("Cannot stage " + isoPath + " in " + dir + ", reading it in place");
+            return nullptr;
+        }
+        stage->fileKey = fileKey(staged);
+
+        if (remote) {
+            // Served as data throughout; the head is in place before the
+            // analysis reads it
+            stage->data.push_back({0, stage->size});
+            if (!fromCache) {
+                if (pwrite(stage->fd, head.data(), head.size(), 0) != static_cast<ssize_t>(head.size())) {
+                    throw FileError(isoPath, std::string("Cannot write staged copy: ") + strerror(errno));
+                }
+                stage->head = head.size();
+            }
+        } else {
+            stage->data = BlockTarget::mapData(stage->sourceFd, stage->size);
+        }
+
+        uint64_t count = (stage->size + CHUNK - 1) / CHUNK;
+        stage->chunks.assign(count, ChunkState::DONE);
+        if (!fromCache) {
+            // Chunks wholly inside a hole of the source are done already
+            for (const auto& extent : stage->data) {
+                for (uint64_t chunk = extent.offset / CHUNK;
+                     chunk < count && chunk * CHUNK < extent.offset + extent.length; chunk++) {
+                    if (stage->chunks[chunk] == ChunkState::DONE) {
+                        stage->chunks[chunk] = ChunkState::PENDING;
+                        stage->remaining++;
+                    }
+                }
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            if (std::shared_ptr<Stage> existing = find(state.bySource, sourceKey)) {
+                // Another job got there first; ours is dropped unlocked
+                return existing;
+            }
+            state.bySource[sourceKey] = stage;
+            state.byFile[stage->fileKey] = stage;
+        }
+        if (stage->remaining == 0) {
+            if (remote) stage->streams.emplace_back(runHash, stage.get());
+            return stage;
+        }
+
+        unsigned streams = strtoul(setting("MYISO_STAGING_STREAMS", "").c_str(), nullptr, 10);
+        if (streams == 0) streams = DEFAULT_STREAMS;
+        streams = std::min<uint64_t>(streams, stage->remaining);
+        std::string where = dir == "ram" ? "RAM" : dir;
+        stage->started = std::chrono::steady_clock::now();
+
+        if (remote && !resource.ranges) {
+            Logs::info("Streaming " + stage->isoPath + " to " + where +
+                       " over one connection (the server does not take range requests)");
+            stage->streams.emplace_back(runSequential, stage.get());
+            return stage;
+        }
+
+        Logs::info((remote ? "Streaming " : "Staging ") + stage->isoPath + " to " + where + " with " +
+                   std::to_string(streams) + (remote ? " range requests" : " read streams"));
+        for (unsigned i = 0; i < streams; i++) {
+            stage->streams.emplace_back(runStream, stage.get());
+        }
+        return stage;
+    }
+
+    int openStaged(const std::string& isoPath) {
+        Registry& state = registry();
+        if (state.live == 0) return -1;
+
+        struct stat st;
+        if (stat(isoPath.c_str(), &st) != 0) return -1;
+        std::string sourceKey = fileKey(st) + ":" + std::to_string(st.st_size) + ":" +
+                                std::to_string(st.st_mtime);
+
+        std::shared_ptr<Stage> stage;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            stage = find(state.bySource, sourceKey);
+        }
+        if (!stage) return -1;
+
+        return open(stagedPath(stage).c_str(), O_RDONLY | O_CLOEXEC);
+    }
+
+    std::string stagedPath(const Handle& stage) {
+        return stage->path.empty() ? "/proc/self/fd/" + std::to_string(stage->fd) : stage->path;
+    }
+
+    void verify(const Handle& stage) {
+        if (!stage || !stage->remote) return;
+
+        std::unique_lock<std::mutex> lock(stage->mutex);
+        stage->arrived.wait(lock, [&] { return stage->hashed || !stage->error.empty(); });
+        if (!stage->error.empty()) {
+            throw FileError(stage->isoPath, "Staging failed: " + stage->error);
+        }
+    }
+
+    static std::shared_ptr<Stage> stageOf(int fd) {
+        Registry& state = registry();
+        if (state.live == 0) return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0) return nullptr;
+
+        std::lock_guard<std::mutex> lock(state.mutex);
+        return find(state.byFile, fileKey(st));
+    }
+
+    void await(int fd, uint64_t offset, uint64_t length) {
+        std::shared_ptr<Stage> stage = stageOf(fd);
+        if (!stage || length == 0 || offset >= stage->size || offset + length <= stage->head) return;
+
+        uint64_t first = offset / CHUNK;
+        uint64_t last = (std::min(offset + length, stage->size) - 1) / CHUNK;
+
+        std::unique_lock<std::mutex> lock(stage->mutex);
+        auto ready = [&] {
+            for (uint64_t chunk = first; chunk <= last; chunk++) {
+                if (stage->chunks[chunk] != ChunkState::DONE) return false;
+            }
+            return true;
+        };
+        if (ready()) return;
+
+        for (uint64_t chunk = first; chunk <= last; chunk++) {
+            if (stage->chunks[chunk] == ChunkState::PENDING) stage->urgent.push_back(chunk);
+        }
+        stage->arrived.wait(lock, [&] { return ready() || !stage->error.empty(); });
+
+        if (!ready()) {
+            throw FileError(stage->isoPath, "Staging failed: " + stage->error);
+        }
+    }
+
+    void complete(const std::string& path) {
+        Registry& state = registry();
+        if (state.live == 0) return;
+
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) return;
+
+        std::shared_ptr<Stage> stage;
+        {
+            std::lock_guard<std::mutex> lock(state.mutex);
+            stage = find(state.byFile, fileKey(st));
+        }
+        if (!stage) return;
+
+        std::unique_lock<std::mutex> lock(stage->mutex);
+        if (stage->remaining > 0 && stage->error.empty()) {
+            Logs::info("Waiting for " + stage->isoPath + " to finish staging");
+        }
+        stage->arrived.wait(lock, [&] { return stage->remaining == 0 || !stage->error.empty(); });
+        if (!stage->error.empty()) {
+            throw FileError(stage->isoPath, "Staging failed: " + stage->error);
+        }
+    }
+
+    bool sourceExtents(int fd, uint64_t size, std::vector<Pipeline::Extent>& extents) {
+        std::shared_ptr<Stage> stage = stageOf(fd);
+        if (!stage) return false;
+
+        extents.clear();
+        for (const auto& extent : stage->data) {
+            if (extent.offset >= size) break;
+            extents.push_back({extent.offset, std::min(extent.length, size - extent.offset)});
+        }
+        return true;
+    }
+}
@@ -0,0 +1,311 @@
+#include "lib/task_graph.hpp"
+#include "lib/errors.hpp"
+#include "utils/logs.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+
+namespace Pipeline {
+
+    struct TaskGraph::Task {
+        std::string name;
+        std::function<bool()> work;
+        WriteWork writeWork;
+        WriteKind kind = WriteKind::FIXED;
+        ExtentMap footprint;
+        ExtentMap live;             // What is left of footprint after planning
+        std::vector<TaskId> successors;
+        size_t dependencies = 0;
+        std::atomic<size_t> pending{0};
+        double seconds = 0;
+        double finishedAt = 0;      // Longest path ending here, for reporting
+    };
+
+    struct TaskGraph::Worker {
+        std::mutex mutex;
+        std::deque<TaskId> ready;
+    };
+
+    std::string partitionTag(int number) {
+        return "partition:" + std::to_string(number);
+    }
+
+    TaskGraph::TaskGraph(unsigned workers) : workerCount(workers), savedBytes(0) {}
+
+    TaskGraph::~TaskGraph() = default;
+
+    void TaskGraph::setObserver(Observer callback) {
+        observer = std::move(callback);
+    }
+
+    TaskId TaskGraph::add(const std::string& name, std::function<bool()> work,
+                          const std::vector<TaskId>& after,
+                          const std::vector<std::string>& resources) {
+        TaskId id = tasks.size();
+
+        std::unique_ptr<Task> task(new Task());
+        task->name = name;
+        task->work = std::move(work);
+        tasks.push_back(std::move(task));
+
+        std::vector<TaskId> predecessors = after;
+        for (const auto& resource : resources) {
+            auto holder = lastHolder.find(resource);
+            if (holder != lastHolder.end()) predecessors.push_back(holder->second);
+            lastHolder[resource] = id;
+        }
+
+        std::sort(predecessors.begin(), predecessors.end());
+        predecessors.erase(std::unique(predecessors.begin(), predecessors.end()),
+                           predecessors.end());
+
+        for (TaskId predecessor : predecessors) {
+            if (predecessor >= id) {
+                throw MyISOException("Task '" + name + "' depends on a later task");
+            }
+            tasks[predecessor]->successors.push_back(id);
+            tasks[id]->dependencies++;
+        }
+
+        return id;
+    }
+
+    TaskId TaskGraph::addWrites(const std::string& name, WriteKind kind,
+                                const std::vector<Extent>& footprint, WriteWork work,
+                                const std::vector<TaskId>& after,
+                                const std::vector<std::string>& resources) {
+        TaskId id = add(name, nullptr, after, resources);
+
+        Task& task = *tasks[id];
+        task.kind = kind;
+        task.footprint = ExtentMap(footprint);
+        task.writeWork = std::move(work);
+        return id;
+    }
+
+    size_t TaskGraph::size() const {
+        return tasks.size();
+    }
+
+    uint64_t TaskGraph::bytesSaved() const {
+        return savedBytes;
+    }
+
+    void TaskGraph::planWrites() {
+        savedBytes = 0;
+        uint64_t plannedBytes = 0;
+
+        // Successors always have larger ids, so walking backwards means the
+        // live writes of everything ordered after a task are already known
+        for (TaskId id = tasks.size(); id-- > 0;) {
+            Task& task = *tasks[id];
+            task.live = task.footprint;
+            plannedBytes += task.footprint.bytes();
+
+            if (task.kind == WriteKind::FIXED || task.footprint.empty()) continue;
+
+            ExtentMap later;
+            std::vector<bool> seen(tasks.size(), false);
+            std::vector<TaskId> stack(task.successors);
+            while (!stack.empty()) {
+                TaskId next = stack.back();
+                stack.pop_back();
+                if (seen[next]) continue;
+                seen[next] = true;
+
+                later.add(tasks[next]->live);
+                stack.insert(stack.end(), tasks[next]->successors.begin(),
+                             tasks[next]->successors.end());
+            }
+
+            if (task.kind == WriteKind::DROPPABLE) {
+                if (later.covers(task.footprint)) task.live = ExtentMap();
+            } else {
+                task.live.subtract(later);
+            }
+
+            uint64_t saved = task.footprint.bytes() - task.live.bytes();
+            if (saved > 0) {
+                savedBytes += saved;
+                Logs::debug("Write plan: ", task.name, task.live.empty() ? " dropped, " : " trimmed, ",
+                            saved, " bytes are overwritten later");
+            }
+        }
+
+        if (savedBytes > 0) {
+            Logs::info("Write plan: skipping ", savedBytes, " of ", plannedBytes,
+                       " planned bytes (overwritten by later stages)");
+        }
+    }
+
+    bool TaskGraph::run() {
+        if (tasks.empty()) return true;
+
+        planWrites();
+
+        // Tasks mostly wait on the device, so a small core count should not
+        // serialize them
+        unsigned threads = workerCount;
+        if (threads == 0) {
+            threads = std::max(4u, std::thread::hardware_concurrency());
+        }
+        threads = std::min<unsigned>(threads, tasks.size());
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back(new Worker());
+        }
+
+        size_t next = 0;
+        for (TaskId id = 0; id < tasks.size(); id++) {
+            tasks[id]->pending.store(tasks[id]->dependencies);
+            if (tasks[id]->dependencies == 0) {
+                workers[next++ % threads]->ready.push_back(id);
+            }
+        }
+
+        std::atomic<size_t> remaining(tasks.size());
+        std::atomic<size_t> finished(0);
+        std::atomic<size_t> running(0);
+        std::atomic<bool> aborted(false);
+        std::exception_ptr firstError;
+        std::string failedTask;
+        std::mutex stateMutex;
+        std::condition_variable wake;
+
+        auto start = std::chrono::steady_clock::now();
+
+        auto take = [&](unsigned self, TaskId& id) {
+            {
+                std::lock_guard<std::mutex> lock(workers[self]->mutex);
+                if (!workers[self]->ready.empty()) {
+                    id = workers[self]->ready.back();
+                    workers[self]->ready.pop_back();
+                    return true;
+                }
+            }
+            for (unsigned offset = 1; offset < threads; offset++) {
+                Worker& victim = *workers[(self + offset) % threads];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.ready.empty()) {
+                    id = victim.ready.front();
+                    victim.ready.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        };
+
+        auto workerLoop = [&](unsigned self) {
+            while (true) {
+                if (remaining.load() == 0 || (aborted.load() && running.load() == 0)) break;
+
+                TaskId id;
+                running.fetch_add(1);
+                if (aborted.load() || !take(self, id)) {
+                    running.fetch_sub(1);
+                    std::unique_lock<std::mutex> lock(stateMutex);
+                    wake.wait_for(lock, std::chrono::milliseconds(10));
+                    continue;
+                }
+
+                Task& task = *tasks[id];
+                Logs::debug("Task started: ", task.name);
+                auto taskStart = std::chrono::steady_clock::now();
+
+                bool ok = false;
+                try {
+                    if (!task.writeWork) {
+                        ok = task.work();
+                    } else if (task.kind != WriteKind::FIXED && task.live.empty()) {
+                        Logs::debug("Task skipped, all of its writes are overwritten: ", task.name);
+                        ok = true;
+                    } else {
+                        ok = task.writeWork(task.live.extents());
+                    }
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    if (!firstError) firstError = std::current_exception();
+                }
+
+                task.seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - taskStart).count();
+
+                if (!ok) {
+                    {
+                        std::lock_guard<std::mutex> lock(stateMutex);
+                        if (failedTask.empty()) failedTask = task.name;
+                    }
+                    aborted.store(true);
+                } else {
+                    Logs::debug("Task finished: ", task.name, " (",
+                                static_cast<long>(task.seconds * 1000), " ms)");
+
+                    for (TaskId successor : task.successors) {
+                        if (tasks[successor]->pending.fetch_sub(1) == 1) {
+                            std::lock_guard<std::mutex> lock(workers[self]->mutex);
+                            workers[self]->ready.push_back(successor);
+                        }
+                    }
+
+                    if (observer) observer(task.name, finished.fetch_add(1) + 1, tasks.size());
+                }
+
+                remaining.fetch_sub(1);
+                running.fetch_sub(1);
+
+                std::lock_guard<std::mutex> lock(stateMutex);
+                wake.notify_all();
+            }
+        };
+
+        // Records from the pool carry the caller's prefix (job, device)
+        std::string prefix = Logs::currentPrefix();
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < threads; i++) {
+            pool.emplace_back([&workerLoop, &prefix, i]() {
+                Logs::ScopedPrefix scope(prefix);
+                workerLoop(i);
+            });
+        }
+        workerLoop(0);
+        for (auto& thread : pool) thread.join();
+
+        if (firstError) {
+            std::rethrow_exception(firstError);
+        }
+
+        if (aborted.load()) {
+            Logs::error("Pipeline stopped: task '" + failedTask + "' failed");
+            return false;
+        }
+
+        // Tasks are added in topological order, so one pass gives the
+        // longest chain of task durations
+        double serial = 0;
+        double criticalPath = 0;
+        for (TaskId id = 0; id < tasks.size(); id++) {
+            serial += tasks[id]->seconds;
+            tasks[id]->finishedAt += tasks[id]->seconds;
+            criticalPath = std::max(criticalPath, tasks[id]->finishedAt);
+            for (TaskId successor : tasks[id]->successors) {
+                tasks[successor]->finishedAt = std::max(tasks[successor]->finishedAt,
+                                                        tasks[id]->finishedAt);
+            }
+        }
+
+        double wall = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        Logs::debug("Pipeline: ", tasks.size(), " tasks on ", threads, " workers, ",
+                    static_cast<long>(wall * 1000), " ms wall, ",
+                    static_cast<long>(criticalPath * 1000), " ms critical path, ",
+                    static_cast<long>(serial * 1000), " ms serial");
+
+        return true;
+    }
+}
@@ -1,29 +1,311 @@
 #include "utils/logs.hpp"
 #include "utils/colors.hpp"
-#include <iostream>
+#include "utils/mpmc_queue.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <vector>
 
 namespace Logs {
-    void info(const std::string& message) {
-        std::cout << Colors::cyan("[INFO] ") << message << std::endl;
+
+    static const size_t QUEUE_CAPACITY = 8192;
+    static const size_t BATCH_RECORDS = 512;
+
+    struct Record {
+        Level level;
+        std::string prefix;
+        std::string message;
+        std::chrono::system_clock::time_point time;
+    };
+
+    static std::atomic<int> runtimeLevel{static_cast<int>(Level::INFO)};
+    static thread_local std::string threadPrefix;
+
+    static const char* levelName(Level level) {
+        switch (level) {
+            case Level::DEBUG: return "debug";
+            case Level::INFO: return "info";
+            case Level::SUCCESS: return "success";
+            case Level::WARNING: return "warning";
+            case Level::ERROR: return "error";
+            case Level::FATAL: return "fatal";
+        }
+        return "info";
     }
-    
-    void success(const std::string& message) {
-        std::cout << Colors::green("[SUCCESS] ") << message << std::endl;
+
+    static std::string levelTag(Level level) {
+        switch (level) {
+            case Level::DEBUG: return Colors::blue("[DEBUG] ");
+            case Level::INFO: return Colors::cyan("[INFO] ");
+            case Level::SUCCESS: return Colors::green("[SUCCESS] ");
+            case Level::WARNING: return Colors::yellow("[WARNING] ");
+            case Level::ERROR: return Colors::red("[ERROR] ");
+            case Level::FATAL: return Colors::bold(Colors::red("[FATAL] "));
+        }
+        return "";
     }
-    
-    void warning(const std::string& message) {
-        std::cout << Colors::yellow("[WARNING] ") << message << std::endl;
+
+    static void appendJsonString(std::string& out, const std::string& text) {
+        out += '"';
+        for (unsigned char c : text) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char escaped[8];
+                        snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                        out += escaped;
+                    } else {
+                        out += static_cast<char>(c);
+                    }
+            }
+        }
+        out += '"';
     }
-    
-    void error(const std::string& message) {
-        std::cerr << Colors::red("[ERROR] ") << message << std::endl;
+
+    static void appendJson(std::string& out, const Record& record) {
+        auto since = record.time.time_since_epoch();
+        time_t seconds = std::chrono::duration_cast<std::chrono::seconds>(since).count();
+        long millis = std::chrono::duration_cast<std::chrono::milliseconds>(since).count() % 1000;
+
+        struct tm utc;
+        gmtime_r(&seconds, &utc);
+        char stamp[40];
+        strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+        char full[48];
+        snprintf(full, sizeof(full), "%s.%03ldZ", stamp, millis);
+
+        out += "{\"time\":\"";
+        out += full;
+        out += "\",\"level\":\"";
+        out += levelName(record.level);
+        out += "\"";
+        if (!record.prefix.empty()) {
+            out += ",\"prefix\":";
+            appendJsonString(out, record.prefix);
+        }
+        out += ",\"message\":";
+        appendJsonString(out, record.message);
+        out += "}\n";
     }
-    
-    void fatal(const std::string& message) {
-        std::cerr << Colors::bold(Colors::red("[FATAL] ")) << message << std::endl;
+
+    // Owns the ring and the thread that drains it. Created on first use so it
+    // is torn down (and drained) before the Colors constants it relies on.
+    class Writer {
+    private:
+        MPMCQueue<Record> queue;
+        std::atomic<uint64_t> submitted;
+        std::atomic<uint64_t> written;
+        std::atomic<uint64_t> dropped;
+        std::atomic<bool> stopping;
+
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable drained;
+
+        std::mutex sinkMutex;
+        FILE* jsonSink;
+
+        std::thread thread;
+
+        // Records are rendered into per-stream batches; switching streams
+        // writes the pending batch first so stdout/stderr keep their order
+        void writeBatch(std::vector<Record>& batch) {
+            std::string pending;
+            FILE* pendingStream = stdout;
+            std::string json;
+
+            bool wantJson;
+            {
+                std::lock_guard<std::mutex> lock(sinkMutex);
+                wantJson = jsonSink != nullptr;
+            }
+
+            for (const auto& record : batch) {
+                FILE* stream = record.level >= Level::ERROR ? stderr : stdout;
+                if (stream != pendingStream && !pending.empty()) {
+                    fwrite(pending.data(), 1, pending.size(), pendingStream);
+                    fflush(pendingStream);
+                    pending.clear();
+                }
+                pendingStream = stream;
+
+                pending += levelTag(record.level);
+                if (!record.prefix.empty()) {
+                    pending += "[" + record.prefix + "] ";
+                }
+                pending += record.message;
+                pending += '\n';
+
+                if (wantJson) appendJson(json, record);
+            }
+
+            if (!pending.empty()) {
+                fwrite(pending.data(), 1, pending.size(), pendingStream);
+                fflush(pendingStream);
+            }
+
+            if (!json.empty()) {
+                std::lock_guard<std::mutex> lock(sinkMutex);
+                if (jsonSink) {
+                    fwrite(json.data(), 1, json.size(), jsonSink);
+                    fflush(jsonSink);
+                }
+            }
+        }
+
+        void run() {
+            std::vector<Record> batch;
+            batch.reserve(BATCH_RECORDS);
+
+            while (true) {
+                Record record;
+                while (batch.size() < BATCH_RECORDS && queue.tryPop(record)) {
+                    batch.push_back(std::move(record));
+                }
+
+                if (!batch.empty()) {
+                    writeBatch(batch);
+                    written.fetch_add(batch.size(), std::memory_order_release);
+                    batch.clear();
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    drained.notify_all();
+                    continue;
+                }
+
+                if (stopping.load(std::memory_order_acquire)) break;
+
+                // Producers only notify, they never wait for this lock to be
+                // released, so the timeout covers a wakeup lost in between
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait_for(lock, std::chrono::milliseconds(20), [this] {
+                    return stopping.load() || written.load() < submitted.load();
+                });
+            }
+        }
+
+    public:
+        Writer()
+            : queue(QUEUE_CAPACITY), submitted(0), written(0), dropped(0),
+              stopping(false), jsonSink(nullptr) {
+            thread = std::thread(&Writer::run, this);
+        }
+
+        ~Writer() {
+            stopping.store(true, std::memory_order_release);
+            wake.notify_one();
+            thread.join();
+
+            if (dropped.load() > 0) {
+                fprintf(stderr, "%s%llu log records dropped (queue full)\n",
+                        levelTag(Level::WARNING).c_str(),
+                        static_cast<unsigned long long>(dropped.load()));
+            }
+            if (jsonSink) fclose(jsonSink);
+        }
+
+        void push(Record&& record) {
+            Level level = record.level;
+            submitted.fetch_add(1, std::memory_order_acq_rel);
+
+            if (!queue.tryPush(std::move(record))) {
+                submitted.fetch_sub(1, std::memory_order_acq_rel);
+
+                // Errors are never lost; everything else is shed rather than
+                // stalling the caller
+                if (level >= Level::ERROR) {
+                    flush();
+                    std::string line = levelTag(level) +
+                        (record.prefix.empty() ? "" : "[" + record.prefix + "] ") +
+                        record.message + "\n";
+                    fwrite(line.data(), 1, line.size(), stderr);
+                } else {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                }
+                return;
+            }
+
+            wake.notify_one();
+        }
+
+        void flush() {
+            uint64_t target = submitted.load(std::memory_order_acquire);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while (written.load(std::memory_order_acquire) <
+                   std::min(target, submitted.load(std::memory_order_acquire))) {
+                wake.notify_one();
+                drained.wait_for(lock, std::chrono::milliseconds(20));
+            }
+        }
+
+        bool setJsonSink(const std::string& path) {
+            FILE* file = fopen(path.c_str(), "a");
+            if (!file) return false;
+
+            std::lock_guard<std::mutex> lock(sinkMutex);
+            if (jsonSink) fclose(jsonSink);
+            jsonSink = file;
+            return true;
+        }
+    };
+
+    static Writer& writer() {
+        static Writer instance;
+        return instance;
+    }
+
+    void setLevel(Level level) {
+        runtimeLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    bool parseLevel(const std::string& name, Level& level) {
+        for (int i = static_cast<int>(Level::DEBUG); i <= static_cast<int>(Level::FATAL); i++) {
+            if (name == levelName(static_cast<Level>(i))) {
+                level = static_cast<Level>(i);
+                return true;
+            }
+        }
+        return false;
     }
-    
-    void debug(const std::string& message) {
-        std::cout << Colors::blue("[DEBUG] ") << message << std::endl;
+
+    bool isEnabled(Level level) {
+        return static_cast<int>(level) >= runtimeLevel.load(std::memory_order_relaxed);
+    }
+
+    bool setJsonSink(const std::string& path) {
+        return writer().setJsonSink(path);
+    }
+
+    void flush() {
+        writer().flush();
+        fflush(stdout);
+    }
+
+    void submit(Level level, std::string message) {
+        writer().push(Record{level, threadPrefix, std::move(message),
+                             std::chrono::system_clock::now()});
+    }
+
+    std::string currentPrefix() {
+        return threadPrefix;
+    }
+
+    ScopedPrefix::ScopedPrefix(const std::string& prefix) : previous(threadPrefix) {
+        threadPrefix = previous.empty() ? prefix : previous + "/" + prefix;
+    }
+
+    ScopedPrefix::~ScopedPrefix() {
+        threadPrefix = previous;
     }
 }
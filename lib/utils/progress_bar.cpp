@@ -1,5 +1,6 @@
 #include "utils/progress_bar.hpp"
 #include "utils/colors.hpp"
+#include "utils/logs.hpp"
 #include <iostream>
 #include <iomanip>
 #include <sstream>
@@ -7,6 +8,8 @@
 
 ProgressBar::ProgressBar(size_t totalSize, const std::string& taskLabel)
     : total(totalSize), current(0), barWidth(50), label(taskLabel) {
+    // The bar redraws its line in place, queued log lines must land first
+    Logs::flush();
     startTime = std::chrono::steady_clock::now();
 }
 
@@ -0,0 +1,90 @@
+#include "lib/write_plan.hpp"
+#include <algorithm>
+#include <iterator>
+
+namespace Pipeline {
+
+    ExtentMap::ExtentMap(const std::vector<Extent>& extents) {
+        for (const auto& extent : extents) {
+            add(extent.offset, extent.length);
+        }
+    }
+
+    void ExtentMap::add(uint64_t offset, uint64_t length) {
+        if (length == 0) return;
+
+        uint64_t start = offset;
+        uint64_t end = offset + length;
+
+        // Absorb every range that overlaps or touches [start, end)
+        auto it = ranges.upper_bound(start);
+        if (it != ranges.begin()) {
+            auto previous = std::prev(it);
+            if (previous->second >= start) it = previous;
+        }
+
+        while (it != ranges.end() && it->first <= end) {
+            start = std::min(start, it->first);
+            end = std::max(end, it->second);
+            it = ranges.erase(it);
+        }
+
+        ranges[start] = end;
+    }
+
+    void ExtentMap::add(const ExtentMap& other) {
+        for (const auto& range : other.ranges) {
+            add(range.first, range.second - range.first);
+        }
+    }
+
+    void ExtentMap::subtract(const ExtentMap& other) {
+        for (const auto& cut : other.ranges) {
+            auto it = ranges.upper_bound(cut.first);
+            if (it != ranges.begin()) --it;
+
+            while (it != ranges.end() && it->first < cut.second) {
+                uint64_t start = it->first;
+                uint64_t end = it->second;
+
+                if (end <= cut.first) {
+                    ++it;
+                    continue;
+                }
+
+                it = ranges.erase(it);
+                if (start < cut.first) ranges[start] = cut.first;
+                if (end > cut.second) {
+                    ranges[cut.second] = end;
+                    break;
+                }
+            }
+        }
+    }
+
+    bool ExtentMap::covers(const ExtentMap& other) const {
+        ExtentMap rest = other;
+        rest.subtract(*this);
+        return rest.empty();
+    }
+
+    bool ExtentMap::empty() const {
+        return ranges.empty();
+    }
+
+    uint64_t ExtentMap::bytes() const {
+        uint64_t total = 0;
+        for (const auto& range : ranges) {
+            total += range.second - range.first;
+        }
+        return total;
+    }
+
+    std::vector<Extent> ExtentMap::extents() const {
+        std::vector<Extent> result;
+        for (const auto& range : ranges) {
+            result.push_back({range.first, range.second - range.first});
+        }
+        return result;
+    }
+}
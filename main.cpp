@@ -7,6 +7,16 @@
 #include "lib/mbr_gpt.hpp"
 #include "lib/iso_analyzer.hpp"
 #include "lib/smart_burner.hpp"
+#include "lib/block_manifest.hpp"
+#include "lib/iso_index.hpp"
+#include "lib/golden_image.hpp"
+#include "lib/block_target.hpp"
+#include "lib/burn_planner.hpp"
+#include "lib/burn_station.hpp"
+#include "lib/batch_scheduler.hpp"
+#include "lib/source_stager.hpp"
+#include "lib/http_source.hpp"
+#include "lib/partition_sizing.hpp"
 #include "utils/logs.hpp"
 #include "utils/colors.hpp"
 #include "misc/version.hpp"
@@ -27,14 +37,26 @@ struct Options {
     bool dryRun = false;
     bool aggressiveInfo = false;
     bool forceOperation = false;
+    bool bake = false;
+    bool updateISO = false;
+    bool syncFiles = false;
+    bool syncHash = false;
+    uint64_t imageSize = 0;
     BootStructures::TableType tableType = BootStructures::TableType::MBR;
+    std::string verifyDevice;
+    std::string indexPath;
+    std::string logJsonPath;
+    bool daemon = false;
+    std::string daemonSocket = BurnStation::DEFAULT_SOCKET;
+    std::string batchPath;
 };
 
 void printUsage() {
+    Logs::flush();
     std::cout << Colors::bold("Usage:") << " MI [OPTIONS]\n\n";
     std::cout << Colors::cyan("Options:") << "\n";
-    std::cout << "  -i <file>      Input ISO file\n";
-    std::cout << "  -o <device>    Output device (e.g., /dev/sdX)\n";
+    std::cout << "  -i <file>      Input ISO file, or an http:// URL to stream from\n";
+    std::cout << "  -o <device>    Output device (e.g., /dev/sdX) or disk image file\n";
     std::cout << "  -p <size>      Enable persistence with size in MB\n";
     std::cout << "  -f <fs>        Filesystem type for persistence\n";
     std::cout << "                 (ext4, ntfs, exfat, FAT32, FAT64)\n";
@@ -44,14 +66,41 @@ void printUsage() {
     std::cout << "  --dry-run      Show all information without performing operations\n";
     std::cout << "  -asi           Show aggressive system info (quick, non-comprehensive)\n";
     std::cout << "  --force        Force operation, bypass warnings\n";
+    std::cout << "  --verify <dev> Check a burned device against its embedded manifest\n";
+    std::cout << "  --index <file> Build the block/directory index sidecar for an ISO\n";
+    std::cout << "  --bake         Build (once) and reuse a cached golden image of the\n";
+    std::cout << "                 layout; later burns copy only its allocated blocks\n";
+    std::cout << "  --size <size>  Create or resize the -o image file (e.g., 16G)\n";
+    std::cout << "  --update-iso   Replace only the ISO partition of an existing stick with the\n";
+    std::cout << "                 new ISO, keeping the persistence partition\n";
+    std::cout << "  --sync[=hash]  Update an extracted stick file by file: copy only new or\n";
+    std::cout << "                 changed files (size and time, or content), remove stale\n";
+    std::cout << "  --daemon[=<socket>]\n";
+    std::cout << "                 Run as a burn station taking jobs on a Unix socket\n";
+    std::cout << "                 (default " << BurnStation::DEFAULT_SOCKET << ")\n";
+    std::cout << "  --batch <file> Run every job of a TOML or JSON manifest in parallel,\n";
+    std::cout << "                 longest first and capped per USB root hub\n";
+    std::cout << "  --log-level <level>\n";
+    std::cout << "                 Minimum level shown (debug, info, success, warning, error)\n";
+    std::cout << "  --log-json <file>\n";
+    std::cout << "                 Also append every log record as JSON lines to <file>\n";
     std::cout << "  -v             Show version information\n";
     std::cout << "  -h             Show this help message\n\n";
     
     std::cout << Colors::bold("Examples:") << "\n";
     std::cout << "  MI -i ubuntu.iso -o /dev/sdb\n";
+    std::cout << "  MI -i http://mirror/ubuntu.iso -o /dev/sdb\n";
     std::cout << "  MI -i ubuntu.iso -p 4096 -f ext4 -o /dev/sdb --dry-run\n";
     std::cout << "  MI -i linux.iso -p 2048 -o /dev/sdc -m -t gpt --force\n";
-    std::cout << "  MI -i debian.iso -o /dev/sdb -asi\n\n";
+    std::cout << "  MI -i debian.iso -o /dev/sdb -asi\n";
+    std::cout << "  MI --verify /dev/sdb\n";
+    std::cout << "  MI --index ubuntu.iso\n";
+    std::cout << "  MI -i ubuntu.iso -p 4096 -o /dev/sdb --bake\n";
+    std::cout << "  MI -i ubuntu.iso -o disk.img --size 16G\n";
+    std::cout << "  MI -i ubuntu-new.iso -o /dev/sdb --update-iso\n";
+    std::cout << "  MI -i ubuntu-new.iso -o /dev/sdb --sync\n";
+    std::cout << "  MI --daemon\n";
+    std::cout << "  MI --batch jobs.toml --dry-run\n\n";
     
     std::cout << Colors::yellow("Note: ") << "This tool requires root privileges (use sudo)\n";
     std::cout << Colors::yellow("      Device must be whole disk (e.g., /dev/sdb), not partition (e.g., /dev/sdb1)\n");
@@ -63,6 +112,16 @@ bool parseArguments(int argc, char* argv[], Options& opts) {
     static struct option long_options[] = {
         {"dry-run", no_argument, 0, 'd'},
         {"force", no_argument, 0, 'F'},
+        {"verify", required_argument, 0, 'V'},
+        {"index", required_argument, 0, 'I'},
+        {"log-level", required_argument, 0, 'L'},
+        {"log-json", required_argument, 0, 'J'},
+        {"bake", no_argument, 0, 'B'},
+        {"size", required_argument, 0, 'S'},
+        {"update-iso", no_argument, 0, 'U'},
+        {"sync", optional_argument, 0, 'Y'},
+        {"daemon", optional_argument, 0, 'D'},
+        {"batch", required_argument, 0, 'b'},
         {0, 0, 0, 0}
     };
     
@@ -123,6 +182,59 @@ bool parseArguments(int argc, char* argv[], Options& opts) {
             case 'F':
                 opts.forceOperation = true;
                 break;
+            case 'V':
+                opts.verifyDevice = optarg;
+                break;
+            case 'I':
+                opts.indexPath = optarg;
+                break;
+            case 'B':
+                opts.bake = true;
+                break;
+            case 'U':
+                opts.updateISO = true;
+                break;
+            case 'Y':
+                opts.updateISO = true;
+                opts.syncFiles = true;
+                if (optarg) {
+                    if (std::string(optarg) != "hash") {
+                        Logs::error("Unknown --sync mode: " + std::string(optarg) + " (use --sync or --sync=hash)");
+                        return false;
+                    }
+                    opts.syncHash = true;
+                }
+                break;
+            case 'D':
+                opts.daemon = true;
+                if (optarg) opts.daemonSocket = optarg;
+                break;
+            case 'b':
+                opts.batchPath = optarg;
+                break;
+            case 'S':
+                opts.imageSize = BlockTarget::parseSize(optarg);
+                if (opts.imageSize == 0) {
+                    Logs::error("Invalid image size: " + std::string(optarg));
+                    return false;
+                }
+                break;
+            case 'L': {
+                Logs::Level level;
+                if (!Logs::parseLevel(optarg, level)) {
+                    Logs::error("Invalid log level: " + std::string(optarg));
+                    return false;
+                }
+                Logs::setLevel(level);
+                break;
+            }
+            case 'J':
+                opts.logJsonPath = optarg;
+                if (!Logs::setJsonSink(opts.logJsonPath)) {
+                    Logs::error("Cannot open log file: " + opts.logJsonPath);
+                    return false;
+                }
+                break;
             case 'v':
                 Version::printVersion();
                 exit(0);
@@ -135,6 +247,11 @@ bool parseArguments(int argc, char* argv[], Options& opts) {
         }
     }
     
+    if (!opts.verifyDevice.empty() || !opts.indexPath.empty() || opts.daemon ||
+        !opts.batchPath.empty()) {
+        return true;
+    }
+    
     if (opts.isoPath.empty() || opts.device.empty()) {
         Logs::error("Both -i (input ISO) and -o (output device) are required");
         printUsage();
@@ -146,6 +263,11 @@ bool parseArguments(int argc, char* argv[], Options& opts) {
         return false;
     }
     
+    if (opts.updateISO && (opts.usePersistence || opts.bake || opts.imageSize > 0)) {
+        Logs::error("--update-iso and --sync keep the existing layout; they cannot be combined with -p, --bake or --size");
+        return false;
+    }
+    
     return true;
 }
 
@@ -166,7 +288,9 @@ std::string getBaseDevice(const std::string& device) {
 }
 
 void showDryRunInfo(const Options& opts, size_t deviceSizeMB, size_t isoSizeMB, 
-                    const std::string& isoType) {
+                    const std::string& isoType, const ISOAnalyzer::ISOStructure& structure,
+                    const BurnPlanner::Plan& plan) {
+    Logs::flush();
     std::cout << "\n" << Colors::bold(Colors::cyan("=== DRY RUN MODE - NO CHANGES WILL BE MADE ===")) << "\n\n";
     
     std::cout << Colors::bold("Input Information:") << "\n";
@@ -205,15 +329,61 @@ void showDryRunInfo(const Options& opts, size_t deviceSizeMB, size_t isoSizeMB,
     
     std::cout << "  " << (opts.usePersistence ? "7" : "5") << ". Sync and finalize\n";
     
-    size_t totalUsed = isoSizeMB + (opts.usePersistence ? opts.persistenceSize : 0) + 100;
-    size_t remaining = deviceSizeMB - totalUsed;
+    const BurnPlanner::Composition& iso = plan.composition;
+    std::cout << "\n" << Colors::bold("Strategy Estimates:") << "\n";
+    std::cout << "  ISO: " << iso.fileCount << " files (" << iso.smallFiles << " under 64 KB) in "
+              << iso.directoryCount << " directories, " << iso.fileBytes / (1024 * 1024) << " MB of file data, "
+              << (iso.zeroKnown ? std::to_string(iso.zeroBytes * 100 / std::max<uint64_t>(iso.isoBytes, 1)) + "% zeros" :
+                                  "zero ratio unknown (no index)") << "\n";
+    std::cout << "  Target: " << plan.device.kind << ", " << plan.device.sequentialMBps << " MB/s sequential, "
+              << plan.device.smallWriteIOPS << " small writes/s\n";
+    for (const auto& estimate : plan.estimates) {
+        std::string line = "  " + BurnPlanner::strategyName(estimate.strategy) + ": ";
+        if (estimate.valid) {
+            char seconds[32];
+            snprintf(seconds, sizeof(seconds), estimate.seconds < 10 ? "%.1f" : "%.0f", estimate.seconds);
+            line += "~" + std::string(seconds) + " s (" +
+                    std::to_string(estimate.bytesWritten / (1024 * 1024)) + " MB, " +
+                    std::to_string(estimate.smallWrites) + " small writes)";
+        } else {
+            line += "not applicable, " + estimate.reason;
+        }
+        
+        if (estimate.strategy == plan.strategy) {
+            std::cout << Colors::green(line + "  <- selected") << "\n";
+        } else {
+            std::cout << line << "\n";
+        }
+    }
+    
+    // Sized as the selected strategy lays the device out: the image block
+    // for block, or the extracted tree (behind the ESP for multi-partition)
+    using ISOAnalyzer::BurnStrategy;
+    bool extracting = plan.strategy == BurnStrategy::SMART_EXTRACT || plan.strategy == BurnStrategy::MULTIPART;
+    uint64_t layoutBytes;
+    if (extracting) {
+        layoutBytes = PartitionSizing::extracted(opts.isoPath).bytes;
+        if (plan.strategy == BurnStrategy::MULTIPART && structure.hasUEFI) {
+            layoutBytes += static_cast<uint64_t>(SmartBurner::IntelligentBurner::espSectors(structure)) * 512;
+        }
+    } else {
+        layoutBytes = PartitionSizing::rawPartitionBytes(ISOBurner::getISOSize(opts.isoPath));
+    }
+    size_t layoutMB = (layoutBytes + 1024 * 1024 - 1) / (1024 * 1024);
+    
+    // A raw copy brings the ISO's own table and gap along
+    size_t overheadMB = plan.strategy == BurnStrategy::RAW_COPY && !opts.usePersistence ? 0 :
+                        PartitionSizing::TABLE_OVERHEAD_MB;
+    
+    size_t totalUsed = layoutMB + (opts.usePersistence ? opts.persistenceSize : 0) + overheadMB;
+    size_t remaining = totalUsed < deviceSizeMB ? deviceSizeMB - totalUsed : 0;
     
     std::cout << "\n" << Colors::bold("Space Analysis:") << "\n";
-    std::cout << "  ISO: " << isoSizeMB << " MB\n";
+    std::cout << "  ISO: " << layoutMB << " MB (" << (extracting ? "extracted" : "image") << ")\n";
     if (opts.usePersistence) {
         std::cout << "  Persistence: " << opts.persistenceSize << " MB\n";
     }
-    std::cout << "  Overhead: ~100 MB\n";
+    std::cout << "  Overhead: " << overheadMB << " MB\n";
     std::cout << "  Total Used: " << totalUsed << " MB\n";
     std::cout << "  Remaining: " << remaining << " MB\n";
     std::cout << "  Usage: " << ((totalUsed * 100) / deviceSizeMB) << "%\n";
@@ -222,7 +392,112 @@ void showDryRunInfo(const Options& opts, size_t deviceSizeMB, size_t isoSizeMB,
     std::cout << Colors::yellow("Remove --dry-run flag to perform the actual operation.") << "\n\n";
 }
 
+int runVerification(const std::string& device) {
+    if (!DeviceHandler::validateDevice(device)) {
+        throw DeviceError(device, "Invalid block device");
+    }
+    
+    BlockManifest::VerifyReport report = BlockManifest::verifyDevice(device);
+    
+    if (!report.manifestFound) {
+        Logs::error("No valid verification manifest found on " + device);
+        return 1;
+    }
+    
+    if (report.intact) {
+        Logs::success("Device verified: " + std::to_string(report.bytesChecked / (1024 * 1024)) +
+                      " MB intact");
+        return 0;
+    }
+    
+    Logs::error("Device " + device + " is corrupted in " + 
+                std::to_string(report.corrupted.size()) + " region(s):");
+    Logs::flush();
+    for (const auto& region : report.corrupted) {
+        std::cerr << Colors::red("  offset " + std::to_string(region.offset) + 
+                                 " (+" + std::to_string(region.length / 1024) + " KB)") << std::endl;
+    }
+    return 2;
+}
+
+int runUpdate(const Options& opts) {
+    Persistence::UpdatePlan plan = Persistence::planUpdate(opts.isoPath, opts.device, opts.syncFiles);
+    plan.compareHash = opts.syncHash;
+    
+    if (opts.dryRun) {
+        Logs::flush();
+        std::cout << "\n" << Colors::bold(Colors::cyan("=== DRY RUN MODE - NO CHANGES WILL BE MADE ===")) << "\n\n";
+        std::cout << "  Partition " << plan.target.number << ": " << plan.target.length / (1024 * 1024) << " MB at sector "
+                  << plan.target.offset / 512 << "\n";
+        std::cout << "  Update: " << (plan.mode == Persistence::UpdateMode::RAW ? "raw ISO image" :
+                                      plan.differential ? "sync changed files" :
+                                      "reformat and copy ISO contents")
+                  << " (" << plan.required / (1024 * 1024) << " MB)\n";
+        std::cout << "  Partitions kept: " << plan.keptPartitions << "\n";
+        return 0;
+    }
+    
+    Logs::flush();
+    std::cout << Colors::yellow("\nWARNING: Partition " + std::to_string(plan.target.number) + " on " + opts.device +
+                 " will be replaced; other partitions are kept") << std::endl;
+    std::cout << "Continue? (yes/no): ";
+    
+    std::string confirm;
+    std::cin >> confirm;
+    
+    if (confirm != "yes" && !opts.forceOperation) {
+        Logs::info("Operation cancelled by user");
+        return 0;
+    }
+    
+    SourceStager::Handle staged = SourceStager::stage(opts.isoPath);
+    if (!Persistence::updateISO(opts.isoPath, opts.device, plan)) {
+        throw MyISOException("ISO update failed");
+    }
+    SourceStager::verify(staged);
+    
+    Logs::flush();
+    std::cout << "\n" << Colors::green(Colors::bold("✓ SUCCESS!")) << std::endl;
+    return 0;
+}
+
+int runBatch(const Options& opts) {
+    std::vector<BurnStation::JobSpec> specs = BatchScheduler::readManifest(opts.batchPath);
+
+    BurnStation::SourceTable sources;
+    std::vector<BatchScheduler::Job> jobs = BatchScheduler::plan(specs, sources);
+
+    if (opts.dryRun) {
+        Logs::flush();
+        std::cout << "\n" << Colors::bold(Colors::cyan("=== DRY RUN MODE - NO CHANGES WILL BE MADE ===")) << "\n";
+    }
+    BatchScheduler::printPlan(jobs);
+    if (opts.dryRun) {
+        return 0;
+    }
+
+    Logs::flush();
+    std::cout << Colors::yellow("WARNING: All data on the " + std::to_string(jobs.size()) +
+                 " targets above will be destroyed!") << std::endl;
+    std::cout << "Continue? (yes/no): ";
+
+    std::string confirm;
+    std::cin >> confirm;
+
+    if (confirm != "yes" && !opts.forceOperation) {
+        Logs::info("Operation cancelled by user");
+        return 0;
+    }
+
+    if (opts.forceOperation && confirm != "yes") {
+        Logs::warning("Proceeding with --force flag");
+    }
+
+    return BatchScheduler::run(jobs) ? 0 : 1;
+}
+
 void showAggressiveInfo(const Options& opts) {
+    Logs::flush();
     std::cout << Colors::bold(Colors::cyan("\n=== AGGRESSIVE SYSTEM INFO ===\n"));
     std::cout << "ISO: " << opts.isoPath << "\n";
     std::cout << "DEV: " << opts.device << "\n";
@@ -237,6 +512,7 @@ void showAggressiveInfo(const Options& opts) {
 }
 
 BootStructures::TableType promptPartitionTableType() {
+    Logs::flush();
     std::cout << "\n" << Colors::bold(Colors::cyan("╔════════════════════════════════════════════════════════════════╗")) << std::endl;
     std::cout << Colors::bold(Colors::cyan("║        PARTITION TABLE SELECTION                              ║")) << std::endl;
     std::cout << Colors::bold(Colors::cyan("╚════════════════════════════════════════════════════════════════╝")) << std::endl;
@@ -296,8 +572,40 @@ int main(int argc, char* argv[]) {
             return 1;
         }
         
+        // Indexing only reads the ISO and writes next to it, no root needed
+        if (!opts.indexPath.empty()) {
+            if (!ISOBurner::validateISO(opts.indexPath)) {
+                throw FileError(opts.indexPath, "Invalid ISO file");
+            }
+            return ISOIndex::build(opts.indexPath) ? 0 : 1;
+        }
+        
         ErrorHandler::checkPrivileges();
         
+        if (!opts.verifyDevice.empty()) {
+            opts.device = opts.verifyDevice;
+            return runVerification(opts.verifyDevice);
+        }
+        
+        // Jobs come in over the socket from here on
+        if (opts.daemon) {
+            BurnStation::Station station(opts.daemonSocket);
+            return station.run();
+        }
+        
+        if (!opts.batchPath.empty()) {
+            return runBatch(opts);
+        }
+        
+        // A URL streams into a staged copy that every step below reads as
+        // the ISO; its head sectors are there before the analysis starts
+        SourceStager::Handle streamed;
+        if (HttpSource::isUrl(opts.isoPath)) {
+            Logs::info("ISO URL: " + opts.isoPath);
+            streamed = SourceStager::stage(opts.isoPath);
+            opts.isoPath = SourceStager::stagedPath(streamed);
+        }
+        
         // Show aggressive info if requested
         if (opts.aggressiveInfo) {
             showAggressiveInfo(opts);
@@ -309,17 +617,28 @@ int main(int argc, char* argv[]) {
         Logs::info("ISO File: " + opts.isoPath);
         Logs::info("Target Device: " + opts.device);
         
-        // Validate device is not a partition
-        if (isPartitionDevice(opts.device)) {
+        // --size, or an existing regular file, makes the target a disk image;
+        // the image is only created once the burn is confirmed
+        bool imageTarget = opts.imageSize > 0 || BlockTarget::isImageFile(opts.device);
+        if (opts.imageSize > 0 && access(opts.device.c_str(), F_OK) == 0 &&
+            !BlockTarget::isImageFile(opts.device)) {
+            throw DeviceError(opts.device, "--size only applies to image files");
+        }
+        
+        // Validate device is not a partition (images have none)
+        if (imageTarget) {
+            Logs::info("Target is a disk image file");
+        } else if (isPartitionDevice(opts.device)) {
             std::string baseDevice = getBaseDevice(opts.device);
             Logs::fatal("Fatal Error: The target device is incomplete.");
+            Logs::flush();
             std::cerr << Colors::red("  You specified: " + opts.device) << std::endl;
             std::cerr << Colors::green("  Try instead: " + baseDevice) << std::endl;
             std::cerr << Colors::yellow("  Just remove the number at the end.") << std::endl;
             return 1;
         }
         
-        if (!DeviceHandler::validateDevice(opts.device)) {
+        if (!imageTarget && !DeviceHandler::validateDevice(opts.device)) {
             throw DeviceError(opts.device, "Invalid block device");
         }
         
@@ -327,6 +646,10 @@ int main(int argc, char* argv[]) {
             throw FileError(opts.isoPath, "Invalid ISO file");
         }
         
+        if (opts.updateISO) {
+            return runUpdate(opts);
+        }
+        
         std::string isoType = ISOBurner::detectISOType(opts.isoPath);
         Logs::info("ISO Type: " + isoType);
         
@@ -339,7 +662,8 @@ int main(int argc, char* argv[]) {
         Logs::info("Analysis: " + strategy);
         Logs::info("Required Partitions: " + std::to_string(requiredParts));
         
-        size_t deviceSize = DeviceHandler::getDeviceSize(opts.device);
+        size_t deviceSize = opts.imageSize > 0 ? opts.imageSize :
+            DeviceHandler::getDeviceSize(opts.device);
         size_t isoSize = ISOBurner::getISOSize(opts.isoPath);
         
         size_t deviceSizeMB = deviceSize / (1024 * 1024);
@@ -388,12 +712,17 @@ int main(int argc, char* argv[]) {
         opts.tableType = promptPartitionTableType();
         std::cout << "\n";
         
+        // Estimated wall time decides between the strategies the ISO allows
+        BurnPlanner::Plan burnPlan = BurnPlanner::plan(opts.isoPath, opts.device, isoStructure,
+                                                       opts.usePersistence);
+        
         // Show dry-run information and exit if requested
         if (opts.dryRun) {
-            showDryRunInfo(opts, deviceSizeMB, isoSizeMB, isoType);
+            showDryRunInfo(opts, deviceSizeMB, isoSizeMB, isoType, isoStructure, burnPlan);
             return 0;
         }
         
+        Logs::flush();
         std::cout << Colors::yellow("\nWARNING: All data on " + opts.device + 
                      " will be destroyed!") << std::endl;
         std::cout << "Continue? (yes/no): ";
@@ -410,12 +739,19 @@ int main(int argc, char* argv[]) {
             Logs::warning("Proceeding with --force flag");
         }
         
+        if (opts.imageSize > 0 && !BlockTarget::createImage(opts.device, opts.imageSize)) {
+            throw FileError(opts.device, "Cannot create image file");
+        }
+        
+        // An ISO on network storage is copied locally while the burn reads it
+        SourceStager::Handle staged = SourceStager::stage(opts.isoPath);
+        
         // Use intelligent burning system
         SmartBurner::BurnConfig burnConfig;
         burnConfig.isoPath = opts.isoPath;
         burnConfig.device = opts.device;
         burnConfig.isoStructure = isoStructure;
-        burnConfig.strategy = ISOAnalyzer::determineBurnStrategy(isoStructure);
+        burnConfig.strategy = burnPlan.strategy;
         burnConfig.persistence = opts.usePersistence;
         burnConfig.persistenceSizeMB = opts.persistenceSize;
         burnConfig.persistenceFS = FilesystemSupport::getFSName(opts.fsType);
@@ -423,7 +759,13 @@ int main(int argc, char* argv[]) {
         
         Logs::info("Starting intelligent burn operation...");
         
-        bool success = SmartBurner::IntelligentBurner::burnWithStrategy(burnConfig);
+        bool success = opts.bake ? GoldenImage::burn(burnConfig) :
+            SmartBurner::IntelligentBurner::burnWithStrategy(burnConfig);
+        
+        // A streamed ISO must also have arrived whole and hashed right
+        if (success) {
+            SourceStager::verify(staged);
+        }
         
         if (success) {
             std::cout << "\n" << Colors::green(Colors::bold("✓ SUCCESS!")) << std::endl;